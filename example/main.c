@@ -1,63 +1,590 @@
 #include <stdio.h>
+#include <string.h>
 
+#include "hardware/sync.h"
 #include "pico/stdlib.h"
-#include "pico/util/queue.h"
 #include "tusb.h"
 
+#if LIDAR_EXAMPLE_MULTICORE
+#include "pico/multicore.h"
+#endif
+
 #include "lidar.h"
+#include "lidar_bins.h"
+#include "lidar_capture.h"
+#include "lidar_features.h"
+#include "lidar_filter.h"
+#include "lidar_grid.h"
+#include "lidar_match.h"
+#include "lidar_merge.h"
+#include "lidar_scan.h"
+#include "lidar_spsc.h"
+#include "lidar_triple.h"
 #include "usb.h"
 
+#if LIDAR_EXAMPLE_DUAL_SENSOR
+#define NUM_SENSORS 2
+#else
+#define NUM_SENSORS 1
+#endif
+static_assert(NUM_SENSORS <= LIDAR_MERGE_MAX_SENSORS, "too many sensors");
+
+// The first sensor is on uart1, the second on uart0. Each has its own PWM
+// slice, so they can be controlled independently.
+static const struct {
+	uint rx_pin;
+	int pwm_pin;
+} sensor_pins[] = {
+	{ .rx_pin = 5, .pwm_pin = 2 },
+	{ .rx_pin = 17, .pwm_pin = 16 },
+};
+
+// Scan rate to hold, in centi-Hz. Can be changed over USB, see
+// tools/usb_scan_rate.py
+#define SCAN_RATE_CENTI_HZ 1000
+
+// Filtered output (CDC_CMD_FILTERED): drop weak returns and anything outside
+// the sensor's rated range, and remove single-sample spikes. Everything else
+// gets the frames as they came from the sensor.
+static const struct lidar_filter_cfg filter_cfg = {
+	.min_intensity = 10,
+	.min_distance_mm = 20,
+	.max_distance_mm = 12000,
+	.median = 3,
+};
+
+// Binned output (CDC_CMD_BINS): the nearest return in each 1 degree bin
+#define BIN_WIDTH 100
+#define BIN_MODE LIDAR_BINS_MIN
+
+// Occupancy grid (CDC_CMD_GRID), only with LIDAR_EXAMPLE_GRID: 6.4 m square,
+// in 5 cm cells, with the sensor fixed in the middle. A cell goes from
+// unknown to occupied or free after a few samples, and saturates after a few
+// more, after which it stops being sent.
+static const struct lidar_grid_cfg grid_cfg = {
+	.cell_mm = 50,
+	.width = 128,
+	.height = 128,
+	.hit = 16,
+	.miss = -4,
+	.min = -64,
+	.max = 64,
+	.max_range_mm = 8000,
+	.min_intensity = 10,
+};
+
+// Scan matching odometry, only with LIDAR_EXAMPLE_ODOMETRY: the lightweight
+// configuration, using a quarter of the points, which takes a few ms of the
+// processing stage per revolution. bench_match checks the same
+// configuration on the host.
+static const struct lidar_match_cfg match_cfg = {
+	.cell_mm = 250,
+	.min_distance_mm = 100,
+	.max_distance_mm = 12000,
+	.decimate = 4,
+	.max_iterations = 8,
+	.min_pairs = 20,
+};
+
+// Line features (CDC_CMD_FEATURES), only with LIDAR_EXAMPLE_FEATURES. Walls
+// need to be within 4 cm of straight, and at least 10 cm and 5 samples long.
+// bench_features checks the same configuration on the host.
+static const struct lidar_features_cfg features_cfg = {
+	.min_distance_mm = 100,
+	.max_distance_mm = 12000,
+	.break_mm = 100,
+	.split_mm = 40,
+	.merge_angle = 300,
+	.corner_angle = 3000,
+	.corner_mm = 200,
+	.min_points = 5,
+	.min_length_mm = 100,
+	.max_segments = 48,
+};
+
+// Most tiles sent per sensor each time round the main loop, so that sending
+// the whole grid doesn't hold everything else up
+#define GRID_TILES_PER_POLL 2
+
+// Filtered frames go from the lidar stage to the transport stage through a
+// ring. Must be a power of two.
+#define FILTERED_RING_SIZE 8
+
+struct filtered_frame {
+	uint8_t sensor_id;
+	struct lidar_frame frame;
+};
+
+// Raw capture (CDC_CMD_CAPTURE): each DMA transfer is copied into a ring
+// from the IRQ, and sent from the transport stage. Must be a power of two.
+#define CAPTURE_RING_SIZE 16
+
+struct capture_chunk {
+	struct lidar_capture_record rec;
+	uint8_t data[LIDAR_CAPTURE_MAX_LEN];
+};
+
+// How often to print the timing counters, in frames (~1 s per sensor)
+#define STATS_INTERVAL (360 * NUM_SENSORS)
+
+// Time spent in one stage of the pipeline. Each is only written by one
+// core, and only printed by core0, so a torn read just gives a slightly
+// wrong number in the printout.
+struct stage_timing {
+	uint32_t count;
+	uint32_t total_us;
+	uint32_t max_us;
+};
+
+struct sensor {
+	struct lidar_hw lidar;
+
+	// Owned by the lidar stage, read by the transport stage
+	struct lidar_scan_assembler scans;
+	struct lidar_bins_reducer bins;
+#if LIDAR_EXAMPLE_GRID
+	// Dirty tiles are taken by the transport stage
+	struct lidar_grid grid;
+#endif
+
+	// Only used while the host wants filtered frames, and restarted each
+	// time it starts asking
+	struct lidar_filter filter;
+	bool filtering;
+
+	// Lidar stage: frame callback (assembly, binning, filtering and the
+	// grid)
+	struct stage_timing rx_timing;
+
+	// Owned by the processing stage, which takes the revolutions. The
+	// results are handed to the transport stage through the triple
+	// buffers.
+#if LIDAR_EXAMPLE_ODOMETRY
+	// Where the sensor is, relative to where it started
+	struct lidar_match match;
+	struct lidar_match_transform pose;
+	struct stage_timing match_timing;
+	uint32_t match_failed;
+	struct lidar_triple poses_idx;
+	struct lidar_match_transform poses[LIDAR_TRIPLE_NUM_BUFS];
+#endif
+#if LIDAR_EXAMPLE_FEATURES
+	struct lidar_features_extractor features;
+	struct stage_timing features_timing;
+	struct lidar_triple features_idx;
+	struct lidar_features features_out[LIDAR_TRIPLE_NUM_BUFS];
+#endif
+
+	// Owned by the transport stage: the latest results it's taken
+#if LIDAR_EXAMPLE_ODOMETRY
+	struct lidar_match_transform pose_latest;
+#endif
+#if LIDAR_EXAMPLE_FEATURES
+	const struct lidar_features *features_latest;
+#endif
+};
+
+// Everything which is shared between the stages (and possibly the cores)
+struct pipeline {
+	struct sensor sensors[NUM_SENSORS];
+
+	// Frames from all the sensors go from the lidar stage to the
+	// transport stage through this, in the order they arrived.
+	struct lidar_merge merge;
+
+	// Filtered frames from all the sensors, from the lidar stage to the
+	// transport stage
+	struct lidar_spsc filtered;
+	struct filtered_frame filtered_storage[FILTERED_RING_SIZE];
+
+	// Transport stage: handling each frame
+	struct stage_timing tx_timing;
+	// Whether the grid was being sent last time round
+	bool grid_sending;
+
+	// Raw capture, from the lidar stage to the transport stage. The
+	// sequence number is only touched by the lidar stage.
+	struct lidar_spsc capture;
+	struct capture_chunk capture_storage[CAPTURE_RING_SIZE];
+	uint8_t capture_seq;
+};
+
+static struct pipeline pipeline;
+
+static void stage_timing_add(struct stage_timing *timing, uint32_t start_us)
+{
+	const uint32_t elapsed = time_us_32() - start_us;
+
+	timing->count++;
+	timing->total_us += elapsed;
+	if (elapsed > timing->max_us) {
+		timing->max_us = elapsed;
+	}
+}
+
+static void stage_timing_print(const char *name, struct stage_timing *timing)
+{
+	const uint32_t count = timing->count;
+	const uint32_t avg = count ? timing->total_us / count : 0;
+
+	printf("%s: %lu frames, avg %lu us, max %lu us\n", name,
+	       (unsigned long)count, (unsigned long)avg, (unsigned long)timing->max_us);
+}
+
+// Filter the frame, if the host wants filtered frames. The filter keeps the
+// state for the median, so it has to see every frame while it's in use.
+static void filter_frame(struct sensor *sensor, const struct lidar_frame *frame)
+{
+	struct pipeline *p = &pipeline;
+
+	if (!usb_filtered_enabled()) {
+		sensor->filtering = false;
+		return;
+	}
+
+	if (!sensor->filtering) {
+		lidar_filter_init(&sensor->filter, &filter_cfg);
+		sensor->filtering = true;
+	}
+
+	// If the ring is full, the output is lost, but the filter still
+	// needs the frame.
+	struct filtered_frame scratch;
+	struct filtered_frame *out = lidar_spsc_reserve(&p->filtered);
+	if (!out) {
+		out = &scratch;
+	}
+
+	if (lidar_filter_frame(&sensor->filter, frame, &out->frame) && out != &scratch) {
+		out->sensor_id = sensor - p->sensors;
+		lidar_spsc_commit(&p->filtered);
+	}
+}
+
+// The driver passes each frame on to the merger after this
 void frame_cb(void *cb_data, struct lidar_frame *frame)
 {
-	queue_t *queue = (queue_t *)cb_data;
+	struct sensor *sensor = (struct sensor *)cb_data;
+	const uint32_t start = time_us_32();
 
-	if (!queue_try_add(queue, frame)) {
-		printf("Frame dropped! Handle frames more quickly.");
+	filter_frame(sensor, frame);
+
+	lidar_scan_add_frame(&sensor->scans, frame);
+	lidar_bins_add_frame(&sensor->bins, frame);
+#if LIDAR_EXAMPLE_GRID
+	lidar_grid_add_frame(&sensor->grid, frame);
+#endif
+
+	stage_timing_add(&sensor->rx_timing, start);
+}
+
+// Called from the DMA IRQ with the raw data, before it's parsed
+static void capture_rx_cb(void *cb_data, const uint8_t *data, uint32_t len, uint64_t time_us)
+{
+	struct sensor *sensor = (struct sensor *)cb_data;
+	struct pipeline *p = &pipeline;
+
+	if (!usb_capture_enabled()) {
+		return;
+	}
+
+	// If the ring is full, the record is lost, but its sequence number
+	// is still used so the host can tell.
+	const uint8_t seq = p->capture_seq++;
+	struct capture_chunk *chunk = lidar_spsc_reserve(&p->capture);
+	if (!chunk) {
+		return;
 	}
+
+	chunk->rec = (struct lidar_capture_record){
+		.sync = LIDAR_CAPTURE_SYNC,
+		.seq = seq,
+		.sensor_id = sensor - p->sensors,
+		.len = len,
+		.time_us = (uint32_t)time_us,
+	};
+	memcpy(chunk->data, data, len);
+
+	lidar_spsc_commit(&p->capture);
 }
 
-#define PWM_PIN 2
-#define RX_PIN 5
+// The lidar stage: the DMA IRQ, parsing, and revolution assembly.
+// Whichever core calls lidar_init() gets the interrupts, for all the sensors.
+static void lidar_stage_init(struct pipeline *p)
+{
+	for (int i = 0; i < NUM_SENSORS; i++) {
+		struct sensor *sensor = &p->sensors[i];
+		struct lidar_cfg lidar_cfg = {
+			.uart_pin = sensor_pins[i].rx_pin,
+			.pwm_pin = sensor_pins[i].pwm_pin,
+			.scan_rate_centi_hz = SCAN_RATE_CENTI_HZ,
+			.frame_cb = frame_cb,
+			.frame_cb_data = sensor,
+			.sensor_id = i,
+			.merge = &p->merge,
+			.rx_cb = capture_rx_cb,
+			.rx_cb_data = sensor,
+		};
+
+		lidar_init(&sensor->lidar, &lidar_cfg);
+	}
+}
+
+#if LIDAR_EXAMPLE_ODOMETRY || LIDAR_EXAMPLE_FEATURES
+// The processing stage: the heavier work on each complete revolution, which
+// is too slow for the interrupt. Runs on the same core as the lidar stage.
+// Returns the number of revolutions handled.
+static uint32_t process_stage_poll(struct pipeline *p)
+{
+	uint32_t n = 0;
+
+	for (int i = 0; i < NUM_SENSORS; i++) {
+		struct sensor *sensor = &p->sensors[i];
+		const struct lidar_scan *scan = lidar_scan_acquire(&sensor->scans);
+
+		if (!scan) {
+			continue;
+		}
+		n++;
+
+#if LIDAR_EXAMPLE_ODOMETRY
+		// Match each new revolution against the one before, and add
+		// the motion to the pose. The first revolution only becomes
+		// the reference, so it's not a failure.
+		struct lidar_match_result res;
+		const uint32_t match_start = time_us_32();
+		if (lidar_match_add_scan(&sensor->match, scan, &res)) {
+			lidar_match_compose(&sensor->pose, &res.transform, &sensor->pose);
+		} else if (res.iterations) {
+			sensor->match_failed++;
+		}
+		stage_timing_add(&sensor->match_timing, match_start);
+
+		sensor->poses[lidar_triple_fill(&sensor->poses_idx)] = sensor->pose;
+		lidar_triple_publish(&sensor->poses_idx);
+#endif
+
+#if LIDAR_EXAMPLE_FEATURES
+		// Only worth the time if the host wants them
+		if (usb_features_enabled()) {
+			struct lidar_features *out = &sensor->features_out[lidar_triple_fill(&sensor->features_idx)];
+			const uint32_t features_start = time_us_32();
+
+			lidar_features_extract(&sensor->features, scan, out);
+			stage_timing_add(&sensor->features_timing, features_start);
+			lidar_triple_publish(&sensor->features_idx);
+		}
+#endif
+	}
+
+	return n;
+}
+#endif
+
+#if LIDAR_EXAMPLE_MULTICORE
+static void core1_entry(void)
+{
+	lidar_stage_init(&pipeline);
+
+	// Everything else happens in the interrupts. New revolutions are
+	// published from them too, so there's nothing to process until the
+	// next one.
+	for ( ;; ) {
+#if LIDAR_EXAMPLE_ODOMETRY || LIDAR_EXAMPLE_FEATURES
+		if (process_stage_poll(&pipeline)) {
+			continue;
+		}
+#endif
+		__wfi();
+	}
+}
+#endif
+
+static void print_stats(struct pipeline *p)
+{
+	for (int i = 0; i < NUM_SENSORS; i++) {
+		struct sensor *sensor = &p->sensors[i];
+
+#if LIDAR_EXAMPLE_ODOMETRY
+		// The odometry takes the revolutions, so print where it's got to
+		printf("Sensor %d pose: %ld, %ld mm, %ld cdeg, %lu failed\n", i,
+		       (long)sensor->pose_latest.x_mm, (long)sensor->pose_latest.y_mm,
+		       (long)sensor->pose_latest.theta, (unsigned long)sensor->match_failed);
+		stage_timing_print("match", &sensor->match_timing);
+#endif
+#if LIDAR_EXAMPLE_FEATURES
+		// Feature extraction takes the revolutions too, so print the
+		// last one that was sent
+		const struct lidar_features *features = sensor->features_latest;
+		if (features) {
+			printf("Sensor %d features: %u segments, %u corners, %u points\n", i,
+			       features->nsegments, features->ncorners, features->npoints);
+		}
+		stage_timing_print("features", &sensor->features_timing);
+#endif
+#if !LIDAR_EXAMPLE_ODOMETRY && !LIDAR_EXAMPLE_FEATURES
+		const struct lidar_scan *scan = lidar_scan_acquire(&sensor->scans);
+		if (scan) {
+			printf("Sensor %d revolution %lu: %u samples, %u deg/s\n", i,
+			       (unsigned long)scan->seq, scan->nsamples, scan->speed);
+		}
+#endif
+		stage_timing_print("lidar", &sensor->rx_timing);
+
+		struct lidar_stats stats;
+		lidar_get_stats(&sensor->lidar, &stats);
+		printf("irq: max %lu cycles, %lu crc errors, %lu dropped\n",
+		       (unsigned long)stats.irq_cycles.max,
+		       (unsigned long)stats.parser.crc_errors,
+		       (unsigned long)stats.parser.frames_dropped);
+	}
+	stage_timing_print("transport", &p->tx_timing);
+}
+
+// The transport stage: send everything which has arrived over USB.
+// Returns the number of frames handled.
+static uint32_t transport_stage_poll(struct pipeline *p)
+{
+	static uint32_t nframes = 0;
+	struct lidar_frame_ref ref;
+	uint32_t n = 0;
+
+	// Handle everything that's arrived in one go
+	while (lidar_merge_pop(&p->merge, &ref)) {
+		const uint32_t start = time_us_32();
+
+		usb_handle_frame(ref.frame, ref.sensor_id);
+		lidar_release_frame(&p->sensors[ref.sensor_id].lidar, ref.frame);
+
+		stage_timing_add(&p->tx_timing, start);
+		n++;
+
+		if (++nframes % STATS_INTERVAL == 0) {
+			print_stats(p);
+		}
+	}
+
+	struct filtered_frame *filtered;
+	while (lidar_spsc_peek(&p->filtered, (void **)&filtered)) {
+		usb_handle_filtered_frame(&filtered->frame, filtered->sensor_id);
+		lidar_spsc_release(&p->filtered, 1);
+	}
+
+	struct capture_chunk *chunk;
+	while (lidar_spsc_peek(&p->capture, (void **)&chunk)) {
+		usb_handle_capture(&chunk->rec, chunk->data);
+		lidar_spsc_release(&p->capture, 1);
+	}
+
+	for (int i = 0; i < NUM_SENSORS; i++) {
+		const struct lidar_bins *bins = lidar_bins_acquire(&p->sensors[i].bins);
+		if (bins) {
+			usb_handle_bins(bins, i);
+		}
+	}
+
+#if LIDAR_EXAMPLE_ODOMETRY || LIDAR_EXAMPLE_FEATURES
+	// Whatever the processing stage has finished
+	for (int i = 0; i < NUM_SENSORS; i++) {
+		struct sensor *sensor = &p->sensors[i];
+		uint32_t idx;
+
+#if LIDAR_EXAMPLE_ODOMETRY
+		idx = lidar_triple_acquire(&sensor->poses_idx);
+		if (idx != LIDAR_TRIPLE_NONE) {
+			sensor->pose_latest = sensor->poses[idx];
+		}
+#endif
+
+#if LIDAR_EXAMPLE_FEATURES
+		idx = lidar_triple_acquire(&sensor->features_idx);
+		if (idx != LIDAR_TRIPLE_NONE) {
+			sensor->features_latest = &sensor->features_out[idx];
+			usb_handle_features(sensor->features_latest, i);
+		}
+#endif
+	}
+#endif
+
+#if LIDAR_EXAMPLE_GRID
+	// A new host needs the whole grid, after that just what changes
+	const bool grid_sending = usb_grid_enabled();
+	for (int i = 0; grid_sending && i < NUM_SENSORS; i++) {
+		struct lidar_grid *grid = &p->sensors[i].grid;
+		struct lidar_grid_tile tile;
+
+		if (!p->grid_sending) {
+			lidar_grid_mark_all_dirty(grid);
+		}
+
+		for (int t = 0; t < GRID_TILES_PER_POLL && lidar_grid_take_dirty(grid, &tile); t++) {
+			usb_handle_grid_tile(&tile, i);
+		}
+	}
+	p->grid_sending = grid_sending;
+#endif
+
+	return n;
+}
 
 void main(void) {
+	struct pipeline *p = &pipeline;
+
 	stdio_init_all();
 
 	gpio_init(PICO_DEFAULT_LED_PIN);
 	gpio_set_dir(PICO_DEFAULT_LED_PIN, GPIO_OUT);
 
-	queue_t frame_queue;
-	queue_init(&frame_queue, sizeof(struct lidar_frame), 8);
+	static struct lidar_hw *lidars[NUM_SENSORS];
 
-	usb_init();
-
-	struct lidar_hw lidar;
-	struct lidar_cfg lidar_cfg = {
-		.uart_pin = RX_PIN,
-		.pwm_pin = PWM_PIN,
-		.frame_cb = frame_cb,
-		.frame_cb_data = &frame_queue,
+	const struct lidar_bins_cfg bins_cfg = {
+		.bin_width = BIN_WIDTH,
+		.mode = BIN_MODE,
 	};
 
-	lidar_init(&lidar, &lidar_cfg);
+	lidar_merge_init(&p->merge, NUM_SENSORS);
+	lidar_spsc_init(&p->filtered, p->filtered_storage, sizeof(p->filtered_storage[0]), FILTERED_RING_SIZE);
+	lidar_spsc_init(&p->capture, p->capture_storage, sizeof(p->capture_storage[0]), CAPTURE_RING_SIZE);
+	for (int i = 0; i < NUM_SENSORS; i++) {
+		lidar_scan_init(&p->sensors[i].scans, NULL, NULL);
+		lidar_bins_init(&p->sensors[i].bins, &bins_cfg);
+#if LIDAR_EXAMPLE_GRID
+		lidar_grid_init(&p->sensors[i].grid, &grid_cfg);
+#endif
+#if LIDAR_EXAMPLE_ODOMETRY
+		lidar_match_init(&p->sensors[i].match, &match_cfg);
+		lidar_triple_init(&p->sensors[i].poses_idx);
+#endif
+#if LIDAR_EXAMPLE_FEATURES
+		lidar_features_init(&p->sensors[i].features, &features_cfg);
+		lidar_triple_init(&p->sensors[i].features_idx);
+#endif
+		lidars[i] = &p->sensors[i].lidar;
+	}
+
+	usb_init(lidars, NUM_SENSORS);
 
-	int i = 0;
+#if LIDAR_EXAMPLE_MULTICORE
+	// core1 owns the lidar and the processing of each revolution, and
+	// core0 does nothing but USB
+	multicore_launch_core1(core1_entry);
+#else
+	lidar_stage_init(p);
+#endif
 
 	for ( ;; ) {
-		struct lidar_frame frame;
 		gpio_put(PICO_DEFAULT_LED_PIN, 0);
-		if (queue_try_remove(&frame_queue, &frame)) {
-			gpio_put(PICO_DEFAULT_LED_PIN, 1);
-			//printf("Frame: %d\n", frame.timestamp);
-			usb_handle_frame(&frame);
 
-			if (i % 320 == 0) {
-				printf("Speed: %d\n", frame.speed);
-				printf("Angle: %.3f\n", (frame.end_angle - frame.start_angle) * 0.01);
-			}
-			i++;
+#if !LIDAR_EXAMPLE_MULTICORE && (LIDAR_EXAMPLE_ODOMETRY || LIDAR_EXAMPLE_FEATURES)
+		process_stage_poll(p);
+#endif
+		if (transport_stage_poll(p)) {
+			gpio_put(PICO_DEFAULT_LED_PIN, 1);
 		}
 
+#if !LIDAR_EXAMPLE_MULTICORE
 		sleep_ms(1);
+#endif
 		tud_task();
 	}
 }
@@ -1,12 +1,15 @@
 #include <string.h>
 
+#include "hardware/clocks.h"
 #include "pico/unique_id.h"
-#include "pico/util/queue.h"
 
 #include "tusb.h"
 #include "device/usbd_pvt.h"
 
 #include "lidar.h"
+#include "lidar_points.h"
+#include "lidar_spsc.h"
+#include "usb.h"
 #include "usb_descriptors.h"
 
 #ifdef DEBUG
@@ -21,12 +24,51 @@ enum usb_ctx_state {
 	CTX_STATE_OPENED,
 };
 
+#if LIDAR_EXAMPLE_RAW_BULK
+struct __attribute__((packed)) raw_xfer {
+	struct raw_xfer_header hdr;
+	struct lidar_frame frames[RAW_XFER_MAX_FRAMES];
+	uint8_t pad;
+};
+#endif
+
 struct usb_ctx {
 	enum usb_ctx_state state;
 	uint8_t rhport;
 	uint8_t ep_in;
-	queue_t tx_queue;
+#if LIDAR_EXAMPLE_RAW_BULK
+	// Double-buffered: one is being sent while the other fills
+	struct raw_xfer raw_bufs[2];
+	uint8_t raw_fill;
+	uint32_t raw_seq;
+	uint32_t raw_dropped;
+#else
+	struct lidar_spsc tx_queue;
+	// At worst, we should only need to buffer 2 frames
+	// for the interrupt endpoint
+	struct lidar_frame tx_queue_storage[2];
 	bool overflowed;
+#endif
+
+	enum {
+		CDC_MODE_TEXT,
+		CDC_MODE_BINARY,
+		CDC_MODE_FILTERED,
+		CDC_MODE_BINS,
+		CDC_MODE_CAPTURE,
+		CDC_MODE_GRID,
+		CDC_MODE_FEATURES,
+	} cdc_mode;
+	uint8_t cdc_seq;
+
+	struct lidar_hw *const *lidars;
+	uint8_t nsensors;
+	struct usb_stats stats;
+	// Per sensor, reset with the driver's stats
+	uint32_t raw_dropped_sensor[LIDAR_MERGE_MAX_SENSORS];
+	uint32_t cdc_dropped_sensor[LIDAR_MERGE_MAX_SENSORS];
+	struct usb_scan_rate scan_rate;
+	uint32_t scan_rate_req;
 };
 
 static void lidar_usb_driver_init(void);
@@ -123,13 +165,32 @@ usbd_class_driver_t const* usbd_app_driver_get_cb(uint8_t* driver_count)
 
 struct usb_ctx ctx;
 
+static void raw_reset(void)
+{
+#if LIDAR_EXAMPLE_RAW_BULK
+	ctx.raw_bufs[0].hdr.nframes = 0;
+	ctx.raw_bufs[0].hdr.sensor_ids = 0;
+	ctx.raw_bufs[1].hdr.nframes = 0;
+	ctx.raw_bufs[1].hdr.sensor_ids = 0;
+	ctx.raw_fill = 0;
+	ctx.raw_seq = 0;
+	ctx.raw_dropped = 0;
+#else
+	ctx.overflowed = false;
+
+	// Clear the queue
+	lidar_spsc_release(&ctx.tx_queue, lidar_spsc_count(&ctx.tx_queue));
+#endif
+}
+
 static void lidar_usb_driver_init(void)
 {
 	DBG_PRINTF("%s\n", __func__);
 
-	// At worst, we should only need to buffer 2 frames
-	// for the interrupt endpoint
-	queue_init(&ctx.tx_queue, sizeof(struct lidar_frame), 2);
+#if !LIDAR_EXAMPLE_RAW_BULK
+	lidar_spsc_init(&ctx.tx_queue, ctx.tx_queue_storage,
+	                sizeof(ctx.tx_queue_storage[0]), 2);
+#endif
 
 	ctx.state = CTX_STATE_CLOSED;
 }
@@ -139,12 +200,7 @@ static void lidar_usb_driver_reset(uint8_t rhport)
 	DBG_PRINTF("%s\n", __func__);
 
 	ctx.state = CTX_STATE_CLOSED;
-	ctx.overflowed = false;
-
-	struct lidar_frame frame;
-
-	// Clear the queue
-	while (queue_try_remove(&ctx.tx_queue, &frame));
+	raw_reset();
 }
 
 static uint16_t lidar_usb_driver_open(uint8_t rhport, tusb_desc_interface_t const *desc_intf, uint16_t max_len)
@@ -162,18 +218,101 @@ static uint16_t lidar_usb_driver_open(uint8_t rhport, tusb_desc_interface_t cons
 
 	usbd_edpt_open(rhport, ep_desc);
 
+	raw_reset();
 	ctx.state = CTX_STATE_OPENED;
 	ctx.rhport = rhport;
-	ctx.overflowed = false;
 	ctx.ep_in = ep_desc->bEndpointAddress;
 
 	return sizeof(tusb_desc_interface_t) + sizeof(tusb_desc_endpoint_t);
 }
 
+static void fill_usb_stats(uint8_t sensor_id, struct usb_stats *out)
+{
+	struct lidar_hw *lidar = ctx.lidars[sensor_id];
+	struct lidar_stats stats;
+
+	lidar_get_stats(lidar, &stats);
+
+	*out = (struct usb_stats){
+		.sys_clk_hz = clock_get_hz(clk_sys),
+
+		.bytes_rx = stats.parser.bytes_rx,
+		.frames = stats.parser.frames,
+		.crc_errors = stats.parser.crc_errors,
+		.bytes_skipped = stats.parser.bytes_skipped,
+		.requests = stats.parser.requests,
+		.short_requests = stats.parser.short_requests,
+		.frames_dropped = stats.parser.frames_dropped,
+
+		.irq_count = stats.irq_cycles.count,
+		.irq_min = stats.irq_cycles.min,
+		.irq_max = stats.irq_cycles.max,
+		.irq_total = stats.irq_cycles.total,
+
+		.frame_cb_count = stats.frame_cb_cycles.count,
+		.frame_cb_min = stats.frame_cb_cycles.min,
+		.frame_cb_max = stats.frame_cb_cycles.max,
+		.frame_cb_total = stats.frame_cb_cycles.total,
+
+		.raw_dropped = ctx.raw_dropped_sensor[sensor_id],
+		.cdc_dropped = ctx.cdc_dropped_sensor[sensor_id],
+	};
+}
+
 static bool lidar_usb_driver_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const * request)
 {
 	DBG_PRINTF("%s\n", __func__);
-	return true;
+
+	if (request->bmRequestType_bit.type != TUSB_REQ_TYPE_VENDOR ||
+	    request->wValue >= ctx.nsensors) {
+		return false;
+	}
+
+	struct lidar_hw *lidar = ctx.lidars[request->wValue];
+
+	// The new rate arrives in the data stage
+	if (stage == CONTROL_STAGE_DATA && request->bRequest == LIDAR_REQ_SET_SCAN_RATE) {
+		lidar_set_scan_rate(lidar, ctx.scan_rate_req);
+		return true;
+	}
+
+	if (stage != CONTROL_STAGE_SETUP) {
+		return true;
+	}
+
+	switch (request->bRequest) {
+	case LIDAR_REQ_GET_STATS:
+		// Static, as it has to outlive this call
+		fill_usb_stats(request->wValue, &ctx.stats);
+		return tud_control_xfer(rhport, request, &ctx.stats, sizeof(ctx.stats));
+	case LIDAR_REQ_RESET_STATS:
+		lidar_reset_stats(lidar);
+		ctx.raw_dropped_sensor[request->wValue] = 0;
+		ctx.cdc_dropped_sensor[request->wValue] = 0;
+		return tud_control_status(rhport, request);
+	case LIDAR_REQ_SET_SCAN_RATE:
+		if (request->wLength != sizeof(ctx.scan_rate_req)) {
+			return false;
+		}
+		return tud_control_xfer(rhport, request, &ctx.scan_rate_req, sizeof(ctx.scan_rate_req));
+	case LIDAR_REQ_GET_SCAN_RATE:
+	{
+		struct lidar_speed_status status;
+
+		lidar_get_scan_rate_status(lidar, &status);
+		ctx.scan_rate = (struct usb_scan_rate){
+			.target_centi_hz = status.target_centi_hz,
+			.measured_centi_hz = status.measured_centi_hz,
+			.settle_time_us = status.settle_time_us,
+			.duty = status.duty,
+			.locked = status.locked,
+		};
+		return tud_control_xfer(rhport, request, &ctx.scan_rate, sizeof(ctx.scan_rate));
+	}
+	}
+
+	// Stall anything else
+	return false;
 }
 
 void __write_string(char *str, int len)
@@ -199,37 +338,203 @@ void __write_string(char *str, int len)
 	}
 }
 
+// Binary packets are written whole or not at all, so a slow host never
+// stalls the caller. Skipped packets show up as gaps in 'seq'.
+void __write_frame_cdc_binary(struct lidar_frame *frame, uint8_t sensor_id)
+{
+	struct cdc_packet pkt = {
+		.sync = CDC_PACKET_SYNC,
+		.seq = ctx.cdc_seq++,
+		.count = LIDAR_SAMPLES_PER_FRAME,
+		.sensor_id = sensor_id,
+		.start_angle = frame->start_angle,
+		.end_angle = frame->end_angle,
+	};
+
+	if (tud_cdc_write_available() < sizeof(pkt)) {
+		ctx.cdc_dropped_sensor[sensor_id]++;
+		tud_cdc_write_flush();
+		return;
+	}
+
+	memcpy(pkt.samples, frame->samples, sizeof(pkt.samples));
+
+	tud_cdc_write(&pkt, sizeof(pkt));
+	tud_cdc_write_flush();
+}
+
 void __write_frame_cdc(struct lidar_frame *frame)
 {
 	char buf[32];
-	int start_angle = frame->start_angle;
-	int end_angle = frame->end_angle;
-	if (end_angle < start_angle) {
-		end_angle += 36000;
-	}
+	struct lidar_point points[LIDAR_SAMPLES_PER_FRAME];
+
+	lidar_frame_to_points(frame, points);
 
-	float angle_per_sample = ((end_angle - start_angle) / LIDAR_SAMPLES_PER_FRAME) * 0.01;
-	float angle = start_angle * 0.01;
 	for (int i = 0; i < LIDAR_SAMPLES_PER_FRAME; i++) {
-		int len = snprintf(buf, 32, "%3.2f, %d\r\n", angle, frame->samples[i].distance_mm);
+		// Integer formatting, no need for floats
+		int len = snprintf(buf, 32, "%d.%02d, %d\r\n",
+		                   points[i].angle / 100, points[i].angle % 100,
+		                   points[i].distance_mm);
 		if (len >= sizeof(buf)) {
 			len = sizeof(buf);
 		}
 
 		__write_string(buf, len);
+	}
+	tud_cdc_write_flush();
+}
 
-		angle += angle_per_sample;
-		if (angle > 360.0) {
-			angle -= 360.0;
-		}
+#if LIDAR_EXAMPLE_RAW_BULK
+// Send the buffer that's been filling, and start filling the other one.
+// The endpoint must be claimed and idle.
+static void raw_xfer_submit(void)
+{
+	struct raw_xfer *xfer = &ctx.raw_bufs[ctx.raw_fill];
+
+	xfer->hdr.seq = ctx.raw_seq++;
+	xfer->hdr.dropped = ctx.raw_dropped;
+	xfer->hdr.frame_size = sizeof(struct lidar_frame);
+
+	uint16_t len = sizeof(xfer->hdr) + xfer->hdr.nframes * sizeof(struct lidar_frame);
+	if (len % 64 == 0) {
+		// Make sure the host sees the end of the transfer (the
+		// struct has room for this, even when it's full)
+		((uint8_t *)xfer)[len++] = 0;
 	}
+
+	usbd_edpt_xfer(ctx.rhport, ctx.ep_in, (uint8_t *)xfer, len);
+
+	ctx.raw_fill ^= 1;
+	ctx.raw_bufs[ctx.raw_fill].hdr.nframes = 0;
+	ctx.raw_bufs[ctx.raw_fill].hdr.sensor_ids = 0;
+}
+#endif
+
+void usb_handle_bins(const struct lidar_bins *bins, uint8_t sensor_id)
+{
+	if (!tud_cdc_connected() || ctx.cdc_mode != CDC_MODE_BINS) {
+		return;
+	}
+
+	struct cdc_bins_header hdr = {
+		.sync = CDC_BINS_SYNC,
+		.seq = ctx.cdc_seq++,
+		.sensor_id = sensor_id,
+		.mode = bins->mode,
+		.bin_width = bins->bin_width,
+		.nbins = bins->nbins,
+		.speed = bins->speed,
+	};
+
+	// Only a few of these a second, and bigger than the CDC buffer, so
+	// wait for space rather than dropping them.
+	__write_string((char *)&hdr, sizeof(hdr));
+	__write_string((char *)bins->distance_mm, bins->nbins * sizeof(bins->distance_mm[0]));
+	tud_cdc_write_flush();
+}
+
+bool usb_grid_enabled(void)
+{
+	return tud_cdc_connected() && ctx.cdc_mode == CDC_MODE_GRID;
+}
+
+void usb_handle_grid_tile(const struct lidar_grid_tile *tile, uint8_t sensor_id)
+{
+	if (!usb_grid_enabled()) {
+		return;
+	}
+
+	struct cdc_grid_header hdr = {
+		.sync = CDC_GRID_SYNC,
+		.seq = ctx.cdc_seq++,
+		.sensor_id = sensor_id,
+		.cell_mm = tile->cell_mm,
+		.tile_dim = LIDAR_GRID_TILE_DIM,
+		.tiles_w = tile->tiles_w,
+		.tiles_h = tile->tiles_h,
+		.tile_x = tile->tile_x,
+		.tile_y = tile->tile_y,
+	};
+
+	// The caller limits how many are sent at once, so wait for space
+	// rather than losing a tile, which wouldn't be sent again until it
+	// next changes.
+	__write_string((char *)&hdr, sizeof(hdr));
+	__write_string((char *)tile->cells, sizeof(tile->cells));
+	tud_cdc_write_flush();
+}
+
+bool usb_features_enabled(void)
+{
+	return tud_cdc_connected() && ctx.cdc_mode == CDC_MODE_FEATURES;
+}
+
+void usb_handle_features(const struct lidar_features *features, uint8_t sensor_id)
+{
+	if (!usb_features_enabled()) {
+		return;
+	}
+
+	struct cdc_features_header hdr = {
+		.sync = CDC_FEATURES_SYNC,
+		.seq = ctx.cdc_seq++,
+		.sensor_id = sensor_id,
+		.timestamp = features->timestamp,
+		.speed = features->speed,
+		.nsegments = features->nsegments,
+		.ncorners = features->ncorners,
+		.npoints = features->npoints,
+	};
+
+	// One small packet per revolution, so wait for space like the bins
+	__write_string((char *)&hdr, sizeof(hdr));
+	__write_string((char *)features->segments, features->nsegments * sizeof(features->segments[0]));
+	__write_string((char *)features->corners, features->ncorners * sizeof(features->corners[0]));
+	__write_string((char *)features->points, features->npoints * sizeof(features->points[0]));
+	tud_cdc_write_flush();
+}
+
+bool usb_filtered_enabled(void)
+{
+	return ctx.cdc_mode == CDC_MODE_FILTERED;
+}
+
+void usb_handle_filtered_frame(struct lidar_frame *frame, uint8_t sensor_id)
+{
+	if (!tud_cdc_connected() || ctx.cdc_mode != CDC_MODE_FILTERED) {
+		return;
+	}
+
+	__write_frame_cdc_binary(frame, sensor_id);
+}
+
+bool usb_capture_enabled(void)
+{
+	return ctx.cdc_mode == CDC_MODE_CAPTURE;
+}
+
+void usb_handle_capture(const struct lidar_capture_record *rec, const uint8_t *data)
+{
+	if (!tud_cdc_connected() || ctx.cdc_mode != CDC_MODE_CAPTURE) {
+		return;
+	}
+
+	// The whole point is to get everything, so wait for space. The
+	// device's ring absorbs short stalls, and anything lost beyond that
+	// shows up in the record sequence numbers.
+	__write_string((char *)rec, sizeof(*rec));
+	__write_string((char *)data, rec->len);
 	tud_cdc_write_flush();
 }
 
-void usb_handle_frame(struct lidar_frame *frame)
+void usb_handle_frame(struct lidar_frame *frame, uint8_t sensor_id)
 {
 	if (tud_cdc_connected()) {
-		__write_frame_cdc(frame);
+		if (ctx.cdc_mode == CDC_MODE_BINARY) {
+			__write_frame_cdc_binary(frame, sensor_id);
+		} else if (ctx.cdc_mode == CDC_MODE_TEXT && sensor_id == 0) {
+			__write_frame_cdc(frame);
+		}
 	}
 
 	if (ctx.state != CTX_STATE_OPENED) {
@@ -240,15 +545,34 @@ void usb_handle_frame(struct lidar_frame *frame)
 		lidar_usb_driver_reset(ctx.rhport);
 	}
 
+#if LIDAR_EXAMPLE_RAW_BULK
+	struct raw_xfer *xfer = &ctx.raw_bufs[ctx.raw_fill];
+	if (xfer->hdr.nframes < RAW_XFER_MAX_FRAMES) {
+		xfer->hdr.sensor_ids |= (sensor_id & 1) << xfer->hdr.nframes;
+		xfer->frames[xfer->hdr.nframes++] = *frame;
+	} else {
+		ctx.raw_dropped++;
+		ctx.raw_dropped_sensor[sensor_id]++;
+	}
+
+	if (!usbd_edpt_busy(ctx.rhport, ctx.ep_in)) {
+		usbd_edpt_claim(ctx.rhport, ctx.ep_in);
+		raw_xfer_submit();
+	}
+#else
 	if (usbd_edpt_busy(ctx.rhport, ctx.ep_in)) {
-		if (!queue_try_add(&ctx.tx_queue, frame) && !ctx.overflowed) {
-			DBG_PRINTF("USB queue full!\n");
-			ctx.overflowed = true;
+		if (!lidar_spsc_push(&ctx.tx_queue, frame)) {
+			ctx.raw_dropped_sensor[sensor_id]++;
+			if (!ctx.overflowed) {
+				DBG_PRINTF("USB queue full!\n");
+				ctx.overflowed = true;
+			}
 		}
 	} else {
 		usbd_edpt_claim(ctx.rhport, ctx.ep_in);
 		usbd_edpt_xfer(ctx.rhport, ctx.ep_in, (uint8_t *)frame, sizeof(*frame));
 	}
+#endif
 }
 
 static bool lidar_usb_driver_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes)
@@ -256,18 +580,58 @@ static bool lidar_usb_driver_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_resul
 	DBG_PRINTF("%s %d\n", __func__, xferred_bytes);
 
 	if (ep_addr == ctx.ep_in) {
-		struct lidar_frame frame;
-		if (queue_try_remove(&ctx.tx_queue, &frame)) {
-			usbd_edpt_xfer(ctx.rhport, ctx.ep_in, (uint8_t *)&frame, sizeof(frame));
+#if LIDAR_EXAMPLE_RAW_BULK
+		// Whatever built up while the last transfer was in flight
+		if (ctx.raw_bufs[ctx.raw_fill].hdr.nframes) {
+			raw_xfer_submit();
+		} else {
+			usbd_edpt_release(ctx.rhport, ctx.ep_in);
+		}
+#else
+		struct lidar_frame *frame;
+		if (lidar_spsc_peek(&ctx.tx_queue, (void **)&frame)) {
+			// The transfer is a single packet, which is copied to the
+			// USB buffer straight away, so it can be released already
+			usbd_edpt_xfer(ctx.rhport, ctx.ep_in, (uint8_t *)frame, sizeof(*frame));
+			lidar_spsc_release(&ctx.tx_queue, 1);
 		} else {
 			usbd_edpt_release(ctx.rhport, ctx.ep_in);
 		}
+#endif
 	}
 
 	return true;
 }
 
-void usb_init()
+void tud_cdc_rx_cb(uint8_t itf)
 {
+	uint8_t buf[CFG_TUD_CDC_RX_BUFSIZE];
+	uint32_t n = tud_cdc_n_read(itf, buf, sizeof(buf));
+
+	// Last command wins, anything else is ignored
+	for (uint32_t i = 0; i < n; i++) {
+		if (buf[i] == CDC_CMD_BINARY) {
+			ctx.cdc_mode = CDC_MODE_BINARY;
+		} else if (buf[i] == CDC_CMD_FILTERED) {
+			ctx.cdc_mode = CDC_MODE_FILTERED;
+		} else if (buf[i] == CDC_CMD_BINS) {
+			ctx.cdc_mode = CDC_MODE_BINS;
+		} else if (buf[i] == CDC_CMD_CAPTURE) {
+			ctx.cdc_mode = CDC_MODE_CAPTURE;
+		} else if (buf[i] == CDC_CMD_GRID) {
+			ctx.cdc_mode = CDC_MODE_GRID;
+		} else if (buf[i] == CDC_CMD_FEATURES) {
+			ctx.cdc_mode = CDC_MODE_FEATURES;
+		} else if (buf[i] == CDC_CMD_TEXT) {
+			ctx.cdc_mode = CDC_MODE_TEXT;
+		}
+	}
+}
+
+void usb_init(struct lidar_hw *const *lidars, uint8_t nsensors)
+{
+	ctx.lidars = lidars;
+	ctx.nsensors = nsensors;
+
 	tusb_init();
 }
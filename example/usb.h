@@ -2,9 +2,218 @@
 #define __LIDAR_USB_H__
 
 #include "lidar.h"
+#include "lidar_bins.h"
+#include "lidar_capture.h"
+#include "lidar_features.h"
+#include "lidar_grid.h"
 
-void usb_init();
+// Binary CDC output. Send CDC_CMD_BINARY on the serial port to switch to it,
+// CDC_CMD_FILTERED for the same packets but with the frames filtered first,
+// CDC_CMD_BINS for one packet of binned distances per revolution,
+// CDC_CMD_CAPTURE for the raw byte stream (see lidar_capture.h),
+// CDC_CMD_GRID for occupancy grid tiles (LIDAR_EXAMPLE_GRID),
+// CDC_CMD_FEATURES for line features (LIDAR_EXAMPLE_FEATURES), and
+// CDC_CMD_TEXT to switch back to "angle, distance" text lines.
+#define CDC_CMD_TEXT     't'
+#define CDC_CMD_BINARY   'b'
+#define CDC_CMD_FILTERED 'F'
+#define CDC_CMD_BINS     'r'
+#define CDC_CMD_CAPTURE  'c'
+#define CDC_CMD_GRID     'g'
+#define CDC_CMD_FEATURES 'f'
 
-void usb_handle_frame(struct lidar_frame *frame);
+#define CDC_PACKET_SYNC 0xa55a
+
+// One packet per frame, in CDC_CMD_BINARY and CDC_CMD_FILTERED modes, all
+// fields little-endian. The angle of sample i is
+// start_angle + i * (end_angle - start_angle) / (count - 1), wrapping at
+// 36000, the same as lidar_frame_to_points(). 45 bytes for 12 samples.
+struct __attribute__((packed)) cdc_packet {
+	uint16_t sync;
+	// Increments by one for each packet, so the host can spot drops
+	uint8_t seq;
+	// Number of samples
+	uint8_t count;
+	// Which sensor the samples are from
+	uint8_t sensor_id;
+	// Centi-degrees
+	uint16_t start_angle;
+	uint16_t end_angle;
+	struct lidar_sample samples[LIDAR_SAMPLES_PER_FRAME];
+};
+
+#define CDC_BINS_SYNC 0xa55b
+
+// One packet per revolution in CDC_CMD_BINS mode, all fields little-endian,
+// followed by 'nbins' distances (uint16_t, mm, 0 for no return). Bin i
+// covers angles from i * bin_width.
+struct __attribute__((packed)) cdc_bins_header {
+	uint16_t sync;
+	// Increments by one for each packet
+	uint8_t seq;
+	uint8_t sensor_id;
+	// enum lidar_bins_mode
+	uint8_t mode;
+	// Centi-degrees
+	uint16_t bin_width;
+	uint16_t nbins;
+	// Degrees/s
+	uint16_t speed;
+};
+
+#define CDC_GRID_SYNC 0xa55d
+
+// One packet per changed tile of the occupancy grid in CDC_CMD_GRID mode,
+// followed by tile_dim * tile_dim cells (int8_t log-odds, row by row:
+// positive is occupied, negative free, 0 unknown). The whole grid is sent
+// when the mode is selected, and after that only the tiles which change.
+struct __attribute__((packed)) cdc_grid_header {
+	uint16_t sync;
+	// Increments by one for each packet
+	uint8_t seq;
+	uint8_t sensor_id;
+	uint16_t cell_mm;
+	// Cells along each side of a tile
+	uint8_t tile_dim;
+	// Size of the whole grid, in tiles
+	uint8_t tiles_w;
+	uint8_t tiles_h;
+	// Which tile this is, covering cells from (tile_x, tile_y) * tile_dim
+	uint8_t tile_x;
+	uint8_t tile_y;
+};
+static_assert(LIDAR_GRID_MAX_DIM / LIDAR_GRID_TILE_DIM <= 255, "too many tiles for cdc_grid_header");
+
+#define CDC_FEATURES_SYNC 0xa55e
+
+// One packet per revolution in CDC_CMD_FEATURES mode, all fields
+// little-endian, followed by 'nsegments' segments (x0, y0, x1, y1),
+// 'ncorners' corners (x, y) and 'npoints' left over points (x, y), all
+// int16_t mm. See lidar_features.h.
+struct __attribute__((packed)) cdc_features_header {
+	uint16_t sync;
+	// Increments by one for each packet
+	uint8_t seq;
+	uint8_t sensor_id;
+	// Sensor timestamp (ms) of the first frame in the revolution
+	uint16_t timestamp;
+	// Degrees/s
+	uint16_t speed;
+	uint8_t nsegments;
+	uint8_t ncorners;
+	uint16_t npoints;
+};
+static_assert(LIDAR_FEATURES_MAX_SEGMENTS <= 255, "too many segments for cdc_features_header");
+
+// Bulk raw endpoint (LIDAR_EXAMPLE_RAW_BULK). Frames are packed into
+// transfers of up to RAW_XFER_MAX_FRAMES, each starting with this header
+// (little-endian), followed by 'nframes' raw struct lidar_frames.
+// A transfer which would be a multiple of the packet size has one byte of
+// padding, so that it always ends with a short packet.
+// host/lidar_reader.h has a copy of this, which must be kept the same.
+#define RAW_XFER_MAX_FRAMES 16
+
+struct __attribute__((packed)) raw_xfer_header {
+	// Increments by one for each transfer
+	uint32_t seq;
+	// Total frames dropped since the interface was opened, because the
+	// host wasn't reading fast enough
+	uint32_t dropped;
+	uint16_t nframes;
+	// sizeof(struct lidar_frame)
+	uint16_t frame_size;
+	// Bit i is the sensor ID of frame i (so up to two sensors)
+	uint16_t sensor_ids;
+};
+
+// Vendor control requests on the raw interface (wIndex = interface number,
+// wValue = sensor ID)
+// LIDAR_REQ_GET_STATS: device-to-host, returns a struct usb_stats.
+// LIDAR_REQ_RESET_STATS: host-to-device, no data.
+// LIDAR_REQ_SET_SCAN_RATE: host-to-device, a uint32_t target in centi-Hz.
+// LIDAR_REQ_GET_SCAN_RATE: device-to-host, returns a struct usb_scan_rate.
+#define LIDAR_REQ_GET_STATS     0x01
+#define LIDAR_REQ_RESET_STATS   0x02
+#define LIDAR_REQ_SET_SCAN_RATE 0x03
+#define LIDAR_REQ_GET_SCAN_RATE 0x04
+
+// struct lidar_stats, flattened so that the layout doesn't depend on the
+// compiler, plus the frames from that sensor which were dropped on the way
+// out over USB. Little-endian. Timings are in CPU cycles.
+struct __attribute__((packed)) usb_stats {
+	uint32_t sys_clk_hz;
+
+	uint32_t bytes_rx;
+	uint32_t frames;
+	uint32_t crc_errors;
+	uint32_t bytes_skipped;
+	uint32_t requests;
+	uint32_t short_requests;
+	uint32_t frames_dropped;
+
+	uint32_t irq_count;
+	uint32_t irq_min;
+	uint32_t irq_max;
+	uint64_t irq_total;
+
+	uint32_t frame_cb_count;
+	uint32_t frame_cb_min;
+	uint32_t frame_cb_max;
+	uint64_t frame_cb_total;
+
+	// Frames the raw endpoint had no room for, because the host wasn't
+	// reading fast enough (only while the interface is open)
+	uint32_t raw_dropped;
+	// Packets skipped in binary CDC mode, because the CDC buffer was full
+	uint32_t cdc_dropped;
+};
+
+// struct lidar_speed_status, flattened. Little-endian.
+struct __attribute__((packed)) usb_scan_rate {
+	uint32_t target_centi_hz;
+	uint32_t measured_centi_hz;
+	uint32_t settle_time_us;
+	uint16_t duty;
+	uint8_t locked;
+};
+
+// 'lidars' are used for the stats requests, indexed by sensor ID. They don't
+// need to have been initialised yet.
+void usb_init(struct lidar_hw *const *lidars, uint8_t nsensors);
+
+// Send a frame, as it came from the sensor, to the host: on the raw
+// endpoint, and in text or binary CDC mode. In text mode, only sensor 0 is
+// sent, as the text format has no sensor ID.
+void usb_handle_frame(struct lidar_frame *frame, uint8_t sensor_id);
+
+// Whether the host has asked for filtered frames. Safe to call from the DMA
+// IRQ, to avoid filtering when nobody wants it.
+bool usb_filtered_enabled(void);
+
+// Send a filtered frame to the host, if it has asked for them
+void usb_handle_filtered_frame(struct lidar_frame *frame, uint8_t sensor_id);
+
+// Send a binned revolution to the host, if it has asked for them
+void usb_handle_bins(const struct lidar_bins *bins, uint8_t sensor_id);
+
+// Whether the host has asked for the raw capture. Safe to call from the
+// DMA IRQ, to avoid copying the data when nobody wants it.
+bool usb_capture_enabled(void);
+
+// Whether the host has asked for the occupancy grid
+bool usb_grid_enabled(void);
+
+// Send a tile of an occupancy grid to the host, if it has asked for them
+void usb_handle_grid_tile(const struct lidar_grid_tile *tile, uint8_t sensor_id);
+
+// Whether the host has asked for line features. Safe to call from the other
+// core, to avoid extracting them when nobody wants them.
+bool usb_features_enabled(void);
+
+// Send a revolution's line features to the host, if it has asked for them
+void usb_handle_features(const struct lidar_features *features, uint8_t sensor_id);
+
+// Send a capture record and its data to the host, if it has asked for them
+void usb_handle_capture(const struct lidar_capture_record *rec, const uint8_t *data);
 
 #endif /* __LIDAR_USB_H__ */
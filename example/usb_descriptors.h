@@ -82,9 +82,15 @@ struct lidar_config_descriptor lidar_config_descriptor = {
 		.bLength =		sizeof(tusb_desc_endpoint_t),
 		.bDescriptorType =	TUSB_DESC_ENDPOINT,
 		.bEndpointAddress =	EP_LIDAR_IN,
+#if LIDAR_EXAMPLE_RAW_BULK
+		.bmAttributes =		TUSB_XFER_BULK,
+		.wMaxPacketSize =	64,
+		.bInterval =		0,
+#else
 		.bmAttributes =		TUSB_XFER_INTERRUPT,
 		.wMaxPacketSize =	57,
 		.bInterval =		2,
+#endif
 	},
 	/*
 	.reset_interface = {
@@ -0,0 +1,22 @@
+// Helpers for the host benchmarks
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include "bench.h"
+
+int bench_cmp_u32(const void *a, const void *b)
+{
+	const uint32_t x = *(const uint32_t *)a;
+	const uint32_t y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+uint32_t bench_percentile(const uint32_t *vals, uint32_t n, double p)
+{
+	if (!n) {
+		return 0;
+	}
+
+	return vals[(uint32_t)(p * (n - 1) + 0.5)];
+}
@@ -0,0 +1,61 @@
+// Helpers for the host benchmarks
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#include "lidar_profile.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_CYCLES 1
+#else
+#define BENCH_HAVE_CYCLES 0
+#endif
+
+// The sensor sends 8N1, so 10 bits on the wire per byte.
+#define BENCH_SENSOR_BYTES_PER_SEC (LIDAR_BAUD_RATE / 10)
+
+static inline uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// A cheap timestamp counter. On x86 this is the TSC (which counts at a fixed
+// reference rate, close to but not exactly the core clock). Elsewhere it
+// falls back to nanoseconds, and BENCH_CYCLES_UNIT says so.
+static inline uint64_t bench_cycles(void)
+{
+#if BENCH_HAVE_CYCLES
+	return __rdtsc();
+#else
+	return bench_now_ns();
+#endif
+}
+
+#if BENCH_HAVE_CYCLES
+#define BENCH_CYCLES_UNIT "cycles"
+#else
+#define BENCH_CYCLES_UNIT "ns"
+#endif
+
+// Stop the compiler from optimising away a result
+static inline void bench_sink(const void *p)
+{
+	__asm__ volatile("" : : "r"(p) : "memory");
+}
+
+// qsort() comparison for uint32_t
+int bench_cmp_u32(const void *a, const void *b);
+
+// The 'p'th (0 to 1) percentile of 'n' values. 'vals' must be sorted, e.g.
+// with qsort() and bench_cmp_u32(). Returns 0 if there are none.
+uint32_t bench_percentile(const uint32_t *vals, uint32_t n, double p);
+
+#endif /* __BENCH_H__ */
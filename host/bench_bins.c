@@ -0,0 +1,241 @@
+// Angular binning benchmark
+//
+// Feeds synthetic frames through the binning in each mode, checks every bin
+// of every revolution against a simple reference, and reports the cost per
+// frame and how much smaller the output is than the full-rate stream.
+// Exits non-zero if the checks fail.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lidar_bins.h"
+#include "lidar_parser.h"
+#include "lidar_points.h"
+
+#include "bench.h"
+#include "synth.h"
+
+// The reference keeps every sample for the revolution in progress
+struct ref_bin {
+	uint16_t samples[64];
+	uint32_t count;
+};
+
+struct reference {
+	struct lidar_bins_cfg cfg;
+	uint32_t nbins;
+	uint32_t last_angle;
+	bool started;
+	struct ref_bin bins[LIDAR_BINS_MAX];
+
+	// Results for each completed revolution
+	uint16_t *results;
+	uint32_t nresults;
+};
+
+static int cmp_u16(const void *a, const void *b)
+{
+	return (int)*(const uint16_t *)a - (int)*(const uint16_t *)b;
+}
+
+static uint16_t ref_result(struct reference *ref, struct ref_bin *bin)
+{
+	if (!bin->count) {
+		return 0;
+	}
+
+	uint32_t sum = 0, min = UINT32_MAX;
+	for (uint32_t i = 0; i < bin->count; i++) {
+		sum += bin->samples[i];
+		if (bin->samples[i] < min) {
+			min = bin->samples[i];
+		}
+	}
+
+	switch (ref->cfg.mode) {
+	case LIDAR_BINS_MIN:
+		return min;
+	case LIDAR_BINS_MEAN:
+		return (sum + bin->count / 2) / bin->count;
+	case LIDAR_BINS_MEDIAN:
+	{
+		// Only the first few samples count
+		uint16_t sorted[64];
+		const uint32_t n = bin->count < LIDAR_BINS_MEDIAN_MAX ? bin->count : LIDAR_BINS_MEDIAN_MAX;
+		memcpy(sorted, bin->samples, n * sizeof(sorted[0]));
+		qsort(sorted, n, sizeof(sorted[0]), cmp_u16);
+		return sorted[(n - 1) / 2];
+	}
+	}
+
+	return 0;
+}
+
+static void ref_add_frame(struct reference *ref, const struct lidar_frame *frame)
+{
+	struct lidar_point points[LIDAR_SAMPLES_PER_FRAME];
+
+	lidar_frame_to_points(frame, points);
+
+	for (int i = 0; i < LIDAR_SAMPLES_PER_FRAME; i++) {
+		const uint32_t angle = points[i].angle;
+
+		if (angle < ref->last_angle && (ref->last_angle - angle) > LIDAR_ANGLE_MAX / 2) {
+			if (ref->started) {
+				for (uint32_t b = 0; b < ref->nbins; b++) {
+					ref->results[ref->nresults * LIDAR_BINS_MAX + b] = ref_result(ref, &ref->bins[b]);
+				}
+				ref->nresults++;
+			}
+			ref->started = true;
+			memset(ref->bins, 0, sizeof(ref->bins));
+		}
+		ref->last_angle = angle;
+
+		struct ref_bin *bin = &ref->bins[angle / ref->cfg.bin_width];
+		if (ref->started && points[i].distance_mm && bin->count < 64) {
+			bin->samples[bin->count++] = points[i].distance_mm;
+		}
+	}
+}
+
+static const char *mode_names[] = {
+	[LIDAR_BINS_MIN] = "min",
+	[LIDAR_BINS_MEDIAN] = "median",
+	[LIDAR_BINS_MEAN] = "mean",
+};
+
+static int run_mode(const struct lidar_frame *frames, uint32_t nframes, const struct lidar_bins_cfg *cfg)
+{
+	static struct lidar_bins_reducer br;
+	static struct reference ref;
+	int errors = 0;
+
+	lidar_bins_init(&br, cfg);
+
+	memset(&ref, 0, sizeof(ref));
+	ref.cfg = *cfg;
+	ref.nbins = (LIDAR_ANGLE_MAX + cfg->bin_width - 1) / cfg->bin_width;
+	ref.results = calloc(nframes * LIDAR_SAMPLES_PER_FRAME / 100 + 1, LIDAR_BINS_MAX * sizeof(uint16_t));
+
+	for (uint32_t i = 0; i < nframes; i++) {
+		ref_add_frame(&ref, &frames[i]);
+	}
+
+	uint32_t revolutions = 0;
+	uint64_t bytes = 0;
+
+	const uint64_t c0 = bench_cycles();
+	for (uint32_t i = 0; i < nframes; i++) {
+		lidar_bins_add_frame(&br, &frames[i]);
+
+		// Revolutions take ~37 frames at 10 Hz, so this sees all of them
+		const struct lidar_bins *bins = lidar_bins_acquire(&br);
+		if (!bins) {
+			continue;
+		}
+
+		if (bins->seq != revolutions || bins->seq >= ref.nresults || bins->nbins != ref.nbins) {
+			fprintf(stderr, "%s: unexpected revolution %u (%u bins)\n",
+			        mode_names[cfg->mode], bins->seq, bins->nbins);
+			errors++;
+			break;
+		}
+
+		const uint16_t *expected = &ref.results[bins->seq * LIDAR_BINS_MAX];
+		for (uint32_t b = 0; b < bins->nbins; b++) {
+			if (bins->distance_mm[b] != expected[b]) {
+				fprintf(stderr, "%s: revolution %u bin %u: %u, expected %u\n",
+				        mode_names[cfg->mode], bins->seq, b, bins->distance_mm[b], expected[b]);
+				errors++;
+			}
+		}
+
+		revolutions++;
+		bytes += bins->nbins * sizeof(bins->distance_mm[0]);
+	}
+	const uint64_t c1 = bench_cycles();
+
+	if (revolutions + 1 < ref.nresults) {
+		fprintf(stderr, "%s: only got %u of %u revolutions\n",
+		        mode_names[cfg->mode], revolutions, ref.nresults);
+		errors++;
+	}
+
+	// The full-rate path sends every sample (3 bytes each)
+	const double full_bytes = (double)nframes * LIDAR_SAMPLES_PER_FRAME * sizeof(struct lidar_sample);
+
+	printf("mode: %s bin_width: %u revolutions: %u " BENCH_CYCLES_UNIT "_per_frame: %.1f reduction: %.1fx errors: %d\n",
+	       mode_names[cfg->mode], cfg->bin_width, revolutions, (double)(c1 - c0) / nframes,
+	       bytes ? full_bytes / bytes : 0, errors);
+
+	free(ref.results);
+
+	return errors;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t nframes = 100000;
+	uint32_t scan_hz = 10;
+	uint32_t bin_width = 100;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:s:w:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nframes = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			scan_hz = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			bin_width = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n nframes] [-s scan_hz] [-w bin width (centi-degrees)]\n", argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (bin_width < (LIDAR_ANGLE_MAX + LIDAR_BINS_MAX - 1) / LIDAR_BINS_MAX || bin_width > LIDAR_ANGLE_MAX) {
+		fprintf(stderr, "bin width must be %u-%u\n",
+		        (LIDAR_ANGLE_MAX + LIDAR_BINS_MAX - 1) / LIDAR_BINS_MAX, LIDAR_ANGLE_MAX);
+		return 1;
+	}
+
+	struct synth_state st;
+	synth_init(&st, 1, scan_hz);
+
+	struct lidar_frame *frames = malloc(nframes * sizeof(*frames));
+	for (uint32_t i = 0; i < nframes; i++) {
+		synth_frame(&st, &frames[i]);
+
+		// Some samples with no return
+		for (int j = 0; j < LIDAR_SAMPLES_PER_FRAME; j++) {
+			if (synth_rand(&st) % 10 == 0) {
+				frames[i].samples[j].distance_mm = 0;
+			}
+		}
+	}
+
+	int errors = 0;
+	for (int mode = LIDAR_BINS_MIN; mode <= LIDAR_BINS_MEAN; mode++) {
+		const struct lidar_bins_cfg cfg = {
+			.bin_width = bin_width,
+			.mode = mode,
+		};
+
+		errors += run_mode(frames, nframes, &cfg);
+	}
+
+	printf("errors: %d\n", errors);
+
+	free(frames);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,408 @@
+// Raw capture round-trip benchmark
+//
+// Simulates the device capturing two sensors: their byte streams (with some
+// junk) go through a parser in DMA-sized chunks, and each chunk becomes a
+// capture record. The records are written to a capture file, mapped and
+// replayed, and the replayed parsers must produce exactly the same frames
+// and counters as the "device" ones did. The same records are also sent
+// through the CDC stream decoder, with some lost, in random chunks, and a
+// cut-off file must still replay up to the last whole record.
+// Reports the replay cost per frame, and exits non-zero if the checks fail.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lidar_parser.h"
+
+#include "bench.h"
+#include "lidar_capture_file.h"
+#include "synth.h"
+
+#define NSENSORS 2
+
+// What a parser delivered: a hash of every frame, and its counters
+struct result {
+	uint64_t hash;
+	struct lidar_parser_stats stats;
+};
+
+static void hash_frame(void *cb_data, struct lidar_frame *frame)
+{
+	uint64_t *hash = cb_data;
+	const uint8_t *p = (const uint8_t *)frame;
+
+	// FNV-1a
+	for (uint32_t i = 0; i < LIDAR_FRAME_SIZE; i++) {
+		*hash = (*hash ^ p[i]) * 0x100000001b3ull;
+	}
+}
+
+struct device_sensor {
+	uint8_t *stream;
+	uint32_t len;
+	uint32_t offs;
+	uint64_t time_ns;
+	uint64_t byte_ns;
+	struct lidar_parser parser;
+	struct result result;
+};
+
+// Everything the device sent, back to back, as it would go over the CDC
+struct records {
+	uint8_t *buf;
+	size_t len;
+	uint32_t count;
+};
+
+static void gen_stream(struct synth_state *st, struct device_sensor *s, uint32_t nframes)
+{
+	s->stream = malloc(nframes * (LIDAR_FRAME_SIZE + 64));
+	s->len = 0;
+
+	for (uint32_t i = 0; i < nframes; i++) {
+		if (synth_rand(st) % 50 == 0) {
+			const uint32_t junk = 1 + synth_rand(st) % 64;
+			synth_junk(st, s->stream + s->len, junk);
+			s->len += junk;
+		}
+		synth_stream(st, s->stream + s->len, 1);
+		s->len += LIDAR_FRAME_SIZE;
+	}
+}
+
+// Run the device side, producing records in the order the DMA transfers
+// would have completed.
+static void run_device(struct device_sensor *sensors, uint32_t batch, struct records *recs)
+{
+	uint8_t seq = 0;
+
+	recs->buf = malloc((size_t)(sensors[0].len + sensors[1].len) * 2 + 1024);
+	recs->len = 0;
+	recs->count = 0;
+
+	for (int i = 0; i < NSENSORS; i++) {
+		struct lidar_parser_cfg cfg = {
+			.frame_cb = hash_frame,
+			.frame_cb_data = &sensors[i].result.hash,
+			.batch_frames = batch,
+		};
+		lidar_parser_init(&sensors[i].parser, &cfg);
+	}
+
+	for (;;) {
+		struct device_sensor *s = NULL;
+
+		// The sensor whose transfer completes first
+		for (int i = 0; i < NSENSORS; i++) {
+			struct device_sensor *c = &sensors[i];
+			const uint32_t want = lidar_parser_rx_len(&c->parser);
+
+			if (c->len - c->offs < want) {
+				continue;
+			}
+			if (!s || c->time_ns + want * c->byte_ns < s->time_ns + lidar_parser_rx_len(&s->parser) * s->byte_ns) {
+				s = c;
+			}
+		}
+		if (!s) {
+			break;
+		}
+
+		const uint32_t len = lidar_parser_rx_len(&s->parser);
+		uint8_t *buf = lidar_parser_rx_buf(&s->parser);
+
+		memcpy(buf, s->stream + s->offs, len);
+		s->offs += len;
+		s->time_ns += len * s->byte_ns;
+
+		const struct lidar_capture_record rec = {
+			.sync = LIDAR_CAPTURE_SYNC,
+			.seq = seq++,
+			.sensor_id = s - sensors,
+			.len = len,
+			.time_us = s->time_ns / 1000,
+		};
+		memcpy(recs->buf + recs->len, &rec, sizeof(rec));
+		memcpy(recs->buf + recs->len + sizeof(rec), buf, len);
+		recs->len += sizeof(rec) + len;
+		recs->count++;
+
+		lidar_parser_rx_done(&s->parser);
+	}
+
+	for (int i = 0; i < NSENSORS; i++) {
+		lidar_parser_get_stats(&sensors[i].parser, &sensors[i].result.stats);
+	}
+}
+
+static int write_capture(const char *path, const struct records *recs, size_t len)
+{
+	struct lidar_capture_file_header hdr;
+	lidar_capture_file_header_init(&hdr);
+
+	FILE *fp = fopen(path, "wb");
+	if (!fp) {
+		perror(path);
+		return -1;
+	}
+
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	fwrite(recs->buf, 1, len, fp);
+
+	return fclose(fp);
+}
+
+// Replay a capture file, returning the number of records
+static uint32_t replay(struct lidar_capture_map *map, struct result *results, uint64_t *cycles)
+{
+	struct lidar_parser parsers[NSENSORS];
+	struct lidar_capture_record rec;
+	const uint8_t *data;
+	uint32_t n = 0;
+
+	for (int i = 0; i < NSENSORS; i++) {
+		struct lidar_parser_cfg cfg = {
+			.frame_cb = hash_frame,
+			.frame_cb_data = &results[i].hash,
+		};
+		results[i].hash = 0;
+		lidar_parser_init(&parsers[i], &cfg);
+	}
+
+	lidar_capture_map_rewind(map);
+
+	const uint64_t c0 = bench_cycles();
+	while (lidar_capture_map_next(map, &rec, &data)) {
+		lidar_parser_feed(&parsers[rec.sensor_id], data, rec.len);
+		n++;
+	}
+	*cycles = bench_cycles() - c0;
+
+	for (int i = 0; i < NSENSORS; i++) {
+		lidar_parser_get_stats(&parsers[i], &results[i].stats);
+	}
+
+	return n;
+}
+
+static int compare(const char *name, const struct result *got, const struct result *want)
+{
+	int errors = 0;
+
+	for (int i = 0; i < NSENSORS; i++) {
+		if (got[i].hash != want[i].hash || got[i].stats.frames != want[i].stats.frames ||
+		    got[i].stats.crc_errors != want[i].stats.crc_errors ||
+		    got[i].stats.bytes_skipped != want[i].stats.bytes_skipped) {
+			fprintf(stderr, "%s: sensor %d: %u frames, %u crc errors, %u skipped, "
+			        "expected %u, %u, %u%s\n", name, i,
+			        got[i].stats.frames, got[i].stats.crc_errors, got[i].stats.bytes_skipped,
+			        want[i].stats.frames, want[i].stats.crc_errors, want[i].stats.bytes_skipped,
+			        got[i].hash != want[i].hash ? " (frames differ)" : "");
+			errors++;
+		}
+	}
+
+	return errors;
+}
+
+struct stream_check {
+	const struct records *recs;
+	size_t offs;
+	uint32_t matched;
+	uint32_t mismatched;
+};
+
+static void stream_record_cb(void *cb_data, const struct lidar_capture_record *rec, const uint8_t *data)
+{
+	struct stream_check *c = cb_data;
+	struct lidar_capture_record want;
+
+	// Find the original, skipping the ones which weren't sent
+	for (;;) {
+		memcpy(&want, c->recs->buf + c->offs, sizeof(want));
+		c->offs += sizeof(want) + want.len;
+		if (want.seq == rec->seq) {
+			break;
+		}
+	}
+
+	if (!memcmp(&want, rec, sizeof(want)) &&
+	    !memcmp(c->recs->buf + c->offs - want.len, data, want.len)) {
+		c->matched++;
+	} else {
+		c->mismatched++;
+	}
+}
+
+static int check_stream(struct synth_state *st, const struct records *recs)
+{
+	uint8_t *buf = malloc(recs->len + 256);
+	size_t len = 0;
+	uint32_t sent = 0;
+	uint32_t lost = 0;
+
+	// Start part-way through a record, with a false sync word
+	synth_junk(st, buf, 37);
+	buf[37] = LIDAR_CAPTURE_SYNC & 0xff;
+	buf[38] = LIDAR_CAPTURE_SYNC >> 8;
+	len = 39;
+
+	for (size_t offs = 0; offs < recs->len; ) {
+		struct lidar_capture_record rec;
+		memcpy(&rec, recs->buf + offs, sizeof(rec));
+
+		const size_t n = sizeof(rec) + rec.len;
+		// Lost on the device, but never the first or last
+		if (offs && offs + n < recs->len && synth_rand(st) % 300 == 0) {
+			lost++;
+		} else {
+			memcpy(buf + len, recs->buf + offs, n);
+			len += n;
+			sent++;
+		}
+		offs += n;
+	}
+
+	struct stream_check c = { .recs = recs };
+	struct lidar_capture_stream s;
+	lidar_capture_stream_init(&s, stream_record_cb, &c);
+
+	for (size_t offs = 0; offs < len; ) {
+		size_t n = 1 + synth_rand(st) % 512;
+		if (n > len - offs) {
+			n = len - offs;
+		}
+		lidar_capture_stream_feed(&s, buf + offs, n);
+		offs += n;
+	}
+
+	struct lidar_capture_stream_stats stats;
+	lidar_capture_stream_get_stats(&s, &stats);
+
+	int errors = 0;
+	if (stats.records != sent || c.matched != sent || c.mismatched ||
+	    stats.records_lost != lost || stats.bytes_skipped < 39) {
+		fprintf(stderr, "stream: %u records (%u match, %u don't), %u lost, %u skipped, "
+		        "expected %u, %u lost\n", stats.records, c.matched, c.mismatched,
+		        stats.records_lost, stats.bytes_skipped, sent, lost);
+		errors++;
+	}
+
+	printf("stream: records: %u lost: %u bytes_skipped: %u errors: %d\n",
+	       stats.records, stats.records_lost, stats.bytes_skipped, errors);
+
+	free(buf);
+
+	return errors;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t nframes = 50000;
+	uint32_t batch = 4;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:b:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nframes = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			batch = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n nframes] [-b batch]\n", argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	struct synth_state st;
+	synth_init(&st, 1, 10);
+
+	static struct device_sensor sensors[NSENSORS];
+	for (int i = 0; i < NSENSORS; i++) {
+		gen_stream(&st, &sensors[i], nframes);
+		sensors[i].byte_ns = LIDAR_BYTE_TIME_NS + i * 97;
+	}
+
+	struct records recs;
+	run_device(sensors, batch, &recs);
+
+	const struct result want[NSENSORS] = { sensors[0].result, sensors[1].result };
+
+	char path[] = "/tmp/bench_capture_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+
+	int errors = 0;
+
+	// Whole file
+	struct lidar_capture_map map;
+	struct result got[NSENSORS];
+	uint64_t cycles;
+
+	if (write_capture(path, &recs, recs.len) || lidar_capture_map_open(&map, path)) {
+		perror(path);
+		unlink(path);
+		return 1;
+	}
+
+	const uint32_t nrecs = replay(&map, got, &cycles);
+	if (nrecs != recs.count || map.offs != map.len) {
+		fprintf(stderr, "replay: %u records, expected %u\n", nrecs, recs.count);
+		errors++;
+	}
+	errors += compare("replay", got, want);
+
+	const uint32_t frames = got[0].stats.frames + got[1].stats.frames;
+	const size_t file_len = map.len;
+	lidar_capture_map_close(&map);
+
+	// Cut off part-way through the last record
+	struct lidar_capture_record last;
+	size_t last_offs = 0;
+	for (size_t offs = 0; offs < recs.len; offs += sizeof(last) + last.len) {
+		memcpy(&last, recs.buf + offs, sizeof(last));
+		last_offs = offs;
+	}
+
+	if (write_capture(path, &recs, recs.len - 5) || lidar_capture_map_open(&map, path)) {
+		perror(path);
+		unlink(path);
+		return 1;
+	}
+
+	uint64_t cut_cycles;
+	const uint32_t ncut = replay(&map, got, &cut_cycles);
+	if (ncut != recs.count - 1 || map.offs != sizeof(struct lidar_capture_file_header) + last_offs) {
+		fprintf(stderr, "cut-off: %u records, expected %u\n", ncut, recs.count - 1);
+		errors++;
+	}
+	lidar_capture_map_close(&map);
+	unlink(path);
+
+	printf("capture: frames: %u records: %u bytes: %zu overhead_pct: %.1f "
+	       BENCH_CYCLES_UNIT "_per_frame: %.1f errors: %d\n",
+	       frames, nrecs, file_len,
+	       100.0 * (file_len - sensors[0].len - sensors[1].len) / (sensors[0].len + sensors[1].len),
+	       (double)cycles / frames, errors);
+
+	errors += check_stream(&st, &recs);
+
+	printf("errors: %d\n", errors);
+
+	free(recs.buf);
+	for (int i = 0; i < NSENSORS; i++) {
+		free(sensors[i].stream);
+	}
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,128 @@
+// CRC8 benchmark
+//
+// Compares the reference byte-at-a-time CalCRC8() against the sliced
+// lidar_crc8_update(), and checks that they agree bit for bit before timing
+// anything. CalCRC8() uses the table from the manual, so this also checks
+// the tables generated from LIDAR_CRC8_POLY. Exits non-zero on any mismatch.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "crc8.h"
+#include "lidar_parser.h"
+
+#include "bench.h"
+#include "synth.h"
+
+#define CHECK_BUF_SIZE 256
+
+static int check_agreement(struct synth_state *st, int iterations)
+{
+	uint8_t buf[CHECK_BUF_SIZE];
+	int failures = 0;
+
+	for (int i = 0; i < iterations; i++) {
+		for (int j = 0; j < CHECK_BUF_SIZE; j++) {
+			buf[j] = synth_rand(st);
+		}
+
+		// Every length and alignment CalCRC8 can handle
+		const uint32_t offs = i % 8;
+		for (uint32_t len = 0; len < CHECK_BUF_SIZE - 8; len++) {
+			uint8_t ref = CalCRC8(buf + offs, len);
+			uint8_t crc = lidar_crc8_update(0, buf + offs, len);
+
+			// And split into two pieces, like across a ring wrap
+			uint32_t split = len ? synth_rand(st) % len : 0;
+			uint8_t crc_split = lidar_crc8_update(0, buf + offs, split);
+			crc_split = lidar_crc8_update(crc_split, buf + offs + split, len - split);
+
+			if (crc != ref || crc_split != ref) {
+				if (failures++ < 10) {
+					fprintf(stderr, "mismatch: len %u offs %u split %u: ref %02x sliced %02x split %02x\n",
+						len, offs, split, ref, crc, crc_split);
+				}
+			}
+		}
+	}
+
+	// Real frames must validate
+	for (int i = 0; i < iterations; i++) {
+		struct lidar_frame frame;
+		synth_frame(st, &frame);
+
+		if (lidar_crc8_update(0, (uint8_t *)&frame, LIDAR_FRAME_SIZE - 1) != frame.crc8) {
+			if (failures++ < 10) {
+				fprintf(stderr, "frame %d: CRC mismatch\n", i);
+			}
+		}
+	}
+
+	return failures;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t nframes = 10000;
+	int repeats = 100;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:r:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nframes = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n nframes] [-r repeats]\n", argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	struct synth_state st;
+	synth_init(&st, 1, 10);
+	lidar_crc8_init();
+
+	int failures = check_agreement(&st, 1000);
+	printf("agreement_failures: %d\n", failures);
+	if (failures) {
+		return 1;
+	}
+
+	uint8_t *stream = malloc(nframes * LIDAR_FRAME_SIZE);
+	synth_stream(&st, stream, nframes);
+
+	const uint64_t total = (uint64_t)nframes * repeats;
+	volatile uint8_t result = 0;
+
+	uint64_t c0 = bench_cycles();
+	for (int r = 0; r < repeats; r++) {
+		for (uint32_t i = 0; i < nframes; i++) {
+			result ^= CalCRC8(stream + i * LIDAR_FRAME_SIZE, LIDAR_FRAME_SIZE - 1);
+		}
+	}
+	uint64_t c1 = bench_cycles();
+
+	for (int r = 0; r < repeats; r++) {
+		for (uint32_t i = 0; i < nframes; i++) {
+			result ^= lidar_crc8_update(0, stream + i * LIDAR_FRAME_SIZE, LIDAR_FRAME_SIZE - 1);
+		}
+	}
+	uint64_t c2 = bench_cycles();
+
+	const double ref = (double)(c1 - c0) / total;
+	const double sliced = (double)(c2 - c1) / total;
+
+	printf("CalCRC8_" BENCH_CYCLES_UNIT "_per_frame: %.1f\n", ref);
+	printf("lidar_crc8_update_" BENCH_CYCLES_UNIT "_per_frame: %.1f\n", sliced);
+	printf("speedup: %.2f\n", ref / sliced);
+
+	free(stream);
+
+	return 0;
+}
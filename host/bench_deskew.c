@@ -0,0 +1,429 @@
+// Motion de-skew benchmark
+//
+// Simulates the sensor moving and turning in a room, with the samples of
+// each revolution taken from where the sensor was at the time, like the real
+// thing. Each revolution is de-skewed to its first sample with
+// lidar_deskew_frame(), given the true velocity, and compared against where
+// the points really are relative to the sensor at that time. The same is
+// done without any correction, and with the same maths in double precision,
+// to show what de-skewing gains and what the fixed-point maths loses.
+// It also checks lidar_deskew_motion_from_delta(), and measures the speed
+// against plain lidar_frame_to_points()/lidar_points_to_xy().
+// Exits non-zero if the results are out of tolerance.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "lidar_deskew.h"
+#include "lidar_parser.h"
+#include "lidar_points.h"
+#include "lidar_time.h"
+
+#include "bench.h"
+
+#define SCAN_HZ 10
+#define REVOLUTIONS 5
+// Start just before the sensor's ms counter wraps, to check that's handled
+#define START_MS (LIDAR_TIME_SENSOR_WRAP_MS - 120)
+
+// The remaining error is from the sensor itself rounding the angles to 0.01
+// degrees and distances to whole mm, plus rounding the results to whole mm.
+#define DESKEW_TOLERANCE_MM 4.0
+#define FIXED_TOLERANCE_MM 3.0
+// Velocities recovered from a revolution's motion. The motion is given in
+// whole mm, which alone is up to 7 mm/s over 100 ms.
+#define VELOCITY_TOLERANCE_MM_S 10.0
+#define OMEGA_TOLERANCE_CDEG_S 5.0
+
+struct pose {
+	double x, y, theta;
+};
+
+struct motion_case {
+	const char *name;
+	double vx, vy;   // mm/s, in the sensor's frame
+	double omega;    // degrees/s
+};
+
+static const struct motion_case cases[] = {
+	{ "still",    0,    0,    0 },
+	{ "straight", 1000, 0,    0 },
+	{ "turning",  500,  300,  90 },
+	{ "spinning", 0,    0,    180 },
+	{ "reverse",  -800, 0,    -120 },
+};
+
+// An 8 x 6 m room with a pillar in it, centred on the origin
+struct segment {
+	double x0, y0, x1, y1;
+};
+
+static const struct segment walls[] = {
+	{ -4000, -3000,  4000, -3000 },
+	{  4000, -3000,  4000,  3000 },
+	{  4000,  3000, -4000,  3000 },
+	{ -4000,  3000, -4000, -3000 },
+	{  1500,   800,  2100,   800 },
+	{  2100,   800,  2100,  1400 },
+	{  2100,  1400,  1500,  1400 },
+	{  1500,  1400,  1500,   800 },
+};
+
+static double raycast(double x, double y, double angle)
+{
+	const double dx = cos(angle), dy = sin(angle);
+	double best = INFINITY;
+
+	for (unsigned i = 0; i < sizeof(walls) / sizeof(walls[0]); i++) {
+		const struct segment *w = &walls[i];
+		const double ex = w->x1 - w->x0, ey = w->y1 - w->y0;
+		const double den = dx * ey - dy * ex;
+		if (fabs(den) < 1e-12) {
+			continue;
+		}
+
+		const double t = ((w->x0 - x) * ey - (w->y0 - y) * ex) / den;
+		const double u = ((w->x0 - x) * dy - (w->y0 - y) * dx) / den;
+		if (t > 0 && u >= 0 && u <= 1 && t < best) {
+			best = t;
+		}
+	}
+
+	return best;
+}
+
+// Where a sensor starting at 'start' is after 't' seconds of constant motion
+static struct pose pose_at(const struct pose *start, const struct motion_case *mc, double t)
+{
+	const double w = mc->omega * M_PI / 180.0;
+	double lx, ly;
+
+	if (fabs(w) < 1e-12) {
+		lx = mc->vx * t;
+		ly = mc->vy * t;
+	} else {
+		const double s = sin(w * t) / w, c = (1 - cos(w * t)) / w;
+		lx = s * mc->vx - c * mc->vy;
+		ly = c * mc->vx + s * mc->vy;
+	}
+
+	struct pose p = {
+		.x = start->x + cos(start->theta) * lx - sin(start->theta) * ly,
+		.y = start->y + sin(start->theta) * lx + cos(start->theta) * ly,
+		.theta = start->theta + w * t,
+	};
+
+	return p;
+}
+
+// A world point, relative to pose 'p'
+static void to_local(const struct pose *p, double wx, double wy, double *x, double *y)
+{
+	const double dx = wx - p->x, dy = wy - p->y;
+
+	*x = cos(p->theta) * dx + sin(p->theta) * dy;
+	*y = -sin(p->theta) * dx + cos(p->theta) * dy;
+}
+
+struct sim {
+	struct lidar_frame *frames;
+	// World position of each sample's hit, NAN for no return
+	double *wx, *wy;
+	// Index of the frame which starts each revolution
+	uint32_t rev_start[REVOLUTIONS + 2];
+	struct pose rev_pose[REVOLUTIONS + 2];
+	uint32_t nrevs;
+	uint32_t nframes;
+};
+
+static void simulate(struct sim *sim, const struct motion_case *mc)
+{
+	const double period = 1.0 / LIDAR_SAMPLE_RATE_HZ;
+	const double deg_per_s = 360.0 * SCAN_HZ;
+	const struct pose start = { 0, -500, 0.3 };
+	// Start a little way before 0 degrees, so the first revolution starts a
+	// few frames in
+	const double start_angle = 350.0;
+
+	sim->nframes = (REVOLUTIONS + 1) * LIDAR_SAMPLE_RATE_HZ / SCAN_HZ / LIDAR_SAMPLES_PER_FRAME;
+	sim->frames = calloc(sim->nframes, sizeof(*sim->frames));
+	sim->wx = malloc(sim->nframes * LIDAR_SAMPLES_PER_FRAME * sizeof(double));
+	sim->wy = malloc(sim->nframes * LIDAR_SAMPLES_PER_FRAME * sizeof(double));
+	sim->nrevs = 0;
+
+	uint32_t prev_start = LIDAR_ANGLE_MAX;
+	for (uint32_t f = 0; f < sim->nframes; f++) {
+		struct lidar_frame *frame = &sim->frames[f];
+
+		for (int i = 0; i < LIDAR_SAMPLES_PER_FRAME; i++) {
+			const uint32_t k = f * LIDAR_SAMPLES_PER_FRAME + i;
+			const double t = k * period;
+			const double angle = fmod(start_angle + deg_per_s * t, 360.0);
+			const uint16_t cdeg = (uint32_t)lround(angle * 100) % LIDAR_ANGLE_MAX;
+
+			if (i == 0) {
+				frame->start_angle = cdeg;
+				frame->timestamp = (uint32_t)floor(START_MS + t * 1000) % LIDAR_TIME_SENSOR_WRAP_MS;
+			} else if (i == LIDAR_SAMPLES_PER_FRAME - 1) {
+				frame->end_angle = cdeg;
+			}
+
+			const struct pose p = pose_at(&start, mc, t);
+			// The sample angle the sensor reports is rounded, and
+			// that's where it's really pointing
+			const double d = raycast(p.x, p.y, p.theta + cdeg * M_PI / 18000.0);
+			if (d > 12000) {
+				frame->samples[i].distance_mm = 0;
+				sim->wx[k] = sim->wy[k] = NAN;
+			} else {
+				frame->samples[i].distance_mm = lround(d);
+				frame->samples[i].intensity = 200;
+				const double ray = p.theta + cdeg * M_PI / 18000.0;
+				sim->wx[k] = p.x + frame->samples[i].distance_mm * cos(ray);
+				sim->wy[k] = p.y + frame->samples[i].distance_mm * sin(ray);
+			}
+
+			if (i == 0 && cdeg < prev_start && sim->nrevs < REVOLUTIONS + 1) {
+				sim->rev_start[sim->nrevs] = f;
+				sim->rev_pose[sim->nrevs] = p;
+				sim->nrevs++;
+			}
+			if (i == 0) {
+				prev_start = cdeg;
+			}
+		}
+
+		frame->speed = deg_per_s;
+	}
+	sim->rev_start[sim->nrevs] = sim->nframes;
+}
+
+static void sim_free(struct sim *sim)
+{
+	free(sim->frames);
+	free(sim->wx);
+	free(sim->wy);
+}
+
+// The same as lidar_deskew_frame(), in double precision and with the exact
+// arc rather than the chord, as it would be written without worrying about
+// cost.
+static void float_deskew(const struct lidar_frame *frame, const struct motion_case *mc,
+                         uint16_t ref_timestamp, uint16_t ref_angle, double *x, double *y)
+{
+	double start = frame->start_angle * 0.01;
+	double end = frame->end_angle * 0.01;
+	if (end < start) {
+		end += 360.0;
+	}
+
+	double dt = (double)frame->timestamp - ref_timestamp;
+	if (dt >= LIDAR_TIME_SENSOR_WRAP_MS / 2) {
+		dt -= LIDAR_TIME_SENSOR_WRAP_MS;
+	} else if (dt < -LIDAR_TIME_SENSOR_WRAP_MS / 2) {
+		dt += LIDAR_TIME_SENSOR_WRAP_MS;
+	}
+
+	const double turned = frame->speed * dt / 1000.0;
+	double error = fmod(start - ref_angle * 0.01 - turned, 360.0);
+	if (error < -180.0) {
+		error += 360.0;
+	} else if (error >= 180.0) {
+		error -= 360.0;
+	}
+	const double t0 = (turned + error) / frame->speed;
+	const double step = (end - start) / (LIDAR_SAMPLES_PER_FRAME - 1);
+	const struct pose origin = { 0, 0, 0 };
+
+	for (int i = 0; i < LIDAR_SAMPLES_PER_FRAME; i++) {
+		const double d = frame->samples[i].distance_mm;
+		const double angle = (start + step * i) * M_PI / 180.0;
+		const struct pose p = pose_at(&origin, mc, t0 + step * i / frame->speed);
+
+		x[i] = p.x + d * cos(p.theta + angle);
+		y[i] = p.y + d * sin(p.theta + angle);
+	}
+}
+
+struct errors {
+	double raw_max, raw_sum;
+	double deskew_max, deskew_sum;
+	double float_max;
+	double fixed_max;
+	uint32_t n;
+};
+
+static void update(double *max, double err)
+{
+	if (err > *max) {
+		*max = err;
+	}
+}
+
+static void run_case(const struct motion_case *mc, struct errors *e)
+{
+	struct sim sim;
+	simulate(&sim, mc);
+
+	struct lidar_deskew_motion motion = {
+		.vx_mm_s = lround(mc->vx),
+		.vy_mm_s = lround(mc->vy),
+		.omega_cdeg_s = lround(mc->omega * 100),
+	};
+	struct lidar_deskew d;
+	lidar_deskew_init(&d);
+	lidar_deskew_set_motion(&d, &motion);
+
+	for (uint32_t r = 0; r + 1 < sim.nrevs; r++) {
+		const struct lidar_frame *first = &sim.frames[sim.rev_start[r]];
+		lidar_deskew_set_reference(&d, first->timestamp, first->start_angle);
+
+		for (uint32_t f = sim.rev_start[r]; f < sim.rev_start[r + 1]; f++) {
+			const struct lidar_frame *frame = &sim.frames[f];
+			struct lidar_point points[LIDAR_SAMPLES_PER_FRAME];
+			struct lidar_point_xy raw[LIDAR_SAMPLES_PER_FRAME];
+			struct lidar_point_xy xy[LIDAR_SAMPLES_PER_FRAME];
+			double fx[LIDAR_SAMPLES_PER_FRAME], fy[LIDAR_SAMPLES_PER_FRAME];
+
+			lidar_frame_to_points(frame, points);
+			lidar_points_to_xy(points, raw, LIDAR_SAMPLES_PER_FRAME);
+			lidar_deskew_frame(&d, frame, xy);
+			float_deskew(frame, mc, first->timestamp, first->start_angle, fx, fy);
+
+			for (int i = 0; i < LIDAR_SAMPLES_PER_FRAME; i++) {
+				const uint32_t k = f * LIDAR_SAMPLES_PER_FRAME + i;
+				if (isnan(sim.wx[k])) {
+					continue;
+				}
+
+				double tx, ty;
+				to_local(&sim.rev_pose[r], sim.wx[k], sim.wy[k], &tx, &ty);
+
+				const double raw_err = hypot(raw[i].x_mm - tx, raw[i].y_mm - ty);
+				const double err = hypot(xy[i].x_mm - tx, xy[i].y_mm - ty);
+				update(&e->raw_max, raw_err);
+				update(&e->deskew_max, err);
+				update(&e->float_max, hypot(fx[i] - tx, fy[i] - ty));
+				update(&e->fixed_max, hypot(xy[i].x_mm - fx[i], xy[i].y_mm - fy[i]));
+				e->raw_sum += raw_err;
+				e->deskew_sum += err;
+				e->n++;
+			}
+		}
+	}
+
+	sim_free(&sim);
+}
+
+// Recover the velocity from one revolution's worth of motion
+static void check_from_delta(const struct motion_case *mc, double *v_err, double *w_err)
+{
+	const double t = 1.0 / SCAN_HZ;
+	const struct pose origin = { 0, 0, 0 };
+	const struct pose p = pose_at(&origin, mc, t);
+	struct lidar_deskew_motion motion;
+
+	lidar_deskew_motion_from_delta(&motion, lround(p.x), lround(p.y),
+	                               lround(p.theta * 18000.0 / M_PI), lround(t * 1e6));
+
+	update(v_err, hypot(motion.vx_mm_s - mc->vx, motion.vy_mm_s - mc->vy));
+	update(w_err, fabs(motion.omega_cdeg_s - mc->omega * 100));
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t nframes = 100000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nframes = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n nframes]\n", argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	int ret = 0;
+	double v_err = 0, w_err = 0;
+	for (unsigned c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+		const struct motion_case *mc = &cases[c];
+		struct errors e = { 0 };
+
+		run_case(mc, &e);
+		check_from_delta(mc, &v_err, &w_err);
+
+		printf("%s_raw_mean_error_mm: %.2f\n", mc->name, e.raw_sum / e.n);
+		printf("%s_raw_max_error_mm: %.2f\n", mc->name, e.raw_max);
+		printf("%s_deskew_mean_error_mm: %.2f\n", mc->name, e.deskew_sum / e.n);
+		printf("%s_deskew_max_error_mm: %.2f\n", mc->name, e.deskew_max);
+		printf("%s_float_max_error_mm: %.2f\n", mc->name, e.float_max);
+		printf("%s_fixed_vs_float_max_mm: %.2f\n", mc->name, e.fixed_max);
+
+		if (e.deskew_max > DESKEW_TOLERANCE_MM || e.fixed_max > FIXED_TOLERANCE_MM) {
+			fprintf(stderr, "%s: de-skewed points out of tolerance\n", mc->name);
+			ret = 1;
+		}
+	}
+
+	printf("from_delta_max_velocity_error_mm_s: %.2f\n", v_err);
+	printf("from_delta_max_omega_error_cdeg_s: %.2f\n", w_err);
+	if (v_err > VELOCITY_TOLERANCE_MM_S || w_err > OMEGA_TOLERANCE_CDEG_S) {
+		fprintf(stderr, "velocity from delta out of tolerance\n");
+		ret = 1;
+	}
+
+	// Speed, on a long run of the turning case, which is the worst for
+	// the wrapping and rounding
+	struct sim sim;
+	simulate(&sim, &cases[2]);
+	struct lidar_frame *frames = malloc(nframes * sizeof(*frames));
+	for (uint32_t i = 0; i < nframes; i++) {
+		frames[i] = sim.frames[i % sim.nframes];
+	}
+
+	struct lidar_deskew_motion motion = { 500, 300, 9000 };
+	struct lidar_deskew d;
+	lidar_deskew_init(&d);
+	lidar_deskew_set_motion(&d, &motion);
+	lidar_deskew_set_reference(&d, sim.frames[0].timestamp, sim.frames[0].start_angle);
+
+	const uint64_t nsamples = (uint64_t)nframes * LIDAR_SAMPLES_PER_FRAME;
+	struct lidar_point points[LIDAR_SAMPLES_PER_FRAME];
+	struct lidar_point_xy xy[LIDAR_SAMPLES_PER_FRAME];
+	double fx[LIDAR_SAMPLES_PER_FRAME], fy[LIDAR_SAMPLES_PER_FRAME];
+
+	uint64_t c0 = bench_cycles();
+	for (uint32_t i = 0; i < nframes; i++) {
+		lidar_frame_to_points(&frames[i], points);
+		lidar_points_to_xy(points, xy, LIDAR_SAMPLES_PER_FRAME);
+		bench_sink(xy);
+	}
+	uint64_t c1 = bench_cycles();
+	for (uint32_t i = 0; i < nframes; i++) {
+		lidar_deskew_frame(&d, &frames[i], xy);
+		bench_sink(xy);
+	}
+	uint64_t c2 = bench_cycles();
+	for (uint32_t i = 0; i < nframes; i++) {
+		float_deskew(&frames[i], &cases[2], sim.frames[0].timestamp, sim.frames[0].start_angle, fx, fy);
+		bench_sink(fx);
+		bench_sink(fy);
+	}
+	uint64_t c3 = bench_cycles();
+
+	printf("plain_xy_" BENCH_CYCLES_UNIT "_per_sample: %.2f\n", (double)(c1 - c0) / nsamples);
+	printf("deskew_" BENCH_CYCLES_UNIT "_per_sample: %.2f\n", (double)(c2 - c1) / nsamples);
+	printf("float_deskew_" BENCH_CYCLES_UNIT "_per_sample: %.2f\n", (double)(c3 - c2) / nsamples);
+
+	free(frames);
+	sim_free(&sim);
+
+	return ret;
+}
@@ -0,0 +1,493 @@
+// Line feature extraction benchmark
+//
+// Ray casts revolutions from random poses in a few scenes (a room with some
+// furniture, a corridor with doorways, and a cluttered office), with seeded
+// noise and dropouts and the sensor's real number of samples per revolution,
+// and runs lidar_features_extract() on each.
+//
+// Checks that the segments lie on the scene's walls, that the corners are at
+// real corners, that most points end up in segments, that the work stays
+// within the documented bound, and, for the structured scenes (the room and
+// the corridor), that the features are at least 10 times smaller over USB
+// than sending the samples in CDC_CMD_BINARY mode. Also checks that a
+// revolution with more runs than max_segments is truncated, rather than
+// overflowing. Exits non-zero if any are out of tolerance.
+//
+// With -f, extracts the features from a raw capture (see lidar_capture.h)
+// instead, and only reports the sizes and cost.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lidar_features.h"
+#include "lidar_scan.h"
+
+#include "bench.h"
+#include "lidar_capture_file.h"
+#include "synth.h"
+
+#define NOISE_MM 10
+// Percent of samples with no return
+#define DROPOUT_PCT 3
+#define MAX_RANGE_MM 12000
+#define SCAN_HZ 10
+#define POSES 100
+
+// Bytes sent over USB for a revolution: the header in example/usb.h, plus
+// the features. CDC_CMD_BINARY sends a 45 byte packet for each frame.
+#define FEATURES_HEADER_BYTES 12
+#define BINARY_PACKET_BYTES 45
+
+// Segment ends within this of a wall, and corners within this of a real
+// corner. Some segments on short, distant surfaces can be worse, so only
+// most of them need to be.
+#define SEGMENT_TOLERANCE_MM 30
+#define CORNER_TOLERANCE_MM 50
+#define MIN_GOOD_SEGMENTS 0.95
+#define MIN_GOOD_CORNERS 0.95
+// Fraction of the points which should be in segments, in the structured
+// scenes
+#define MIN_COVERAGE 0.9
+#define MIN_REDUCTION 10.0
+
+struct scene {
+	const char *name;
+	bool structured;
+	// Where the sensor can be
+	double min_x, min_y, max_x, max_y;
+	struct synth_scene world;
+};
+
+static void build_scenes(struct scene *scenes)
+{
+	struct scene *s = &scenes[0];
+
+	// 7 x 5 m, with a cupboard, a table at an angle and a column
+	*s = (struct scene){ .name = "room", .structured = true, 300, 300, 6700, 4700 };
+	synth_add_box(&s->world, 3500, 2500, 7000, 5000, 0);
+	synth_add_box(&s->world, 6500, 1000, 600, 1600, 0);
+	synth_add_box(&s->world, 2500, 3300, 1400, 800, 0.4);
+	synth_add_box(&s->world, 4500, 1500, 300, 300, 0);
+
+	// 2.4 m wide and 30 m long, longer than the sensor's range, with
+	// recessed doorways
+	s = &scenes[1];
+	*s = (struct scene){ .name = "corridor", .structured = true, 1000, 400, 29000, 2000 };
+	const double corridor[][2] = {
+		{ 0, 0 }, { 6000, 0 }, { 6000, -300 }, { 7000, -300 }, { 7000, 0 },
+		{ 15000, 0 }, { 15000, -300 }, { 16000, -300 }, { 16000, 0 }, { 30000, 0 },
+		{ 30000, 2400 }, { 22000, 2400 }, { 22000, 2700 }, { 21000, 2700 }, { 21000, 2400 },
+		{ 11000, 2400 }, { 11000, 2700 }, { 10000, 2700 }, { 10000, 2400 }, { 0, 2400 },
+	};
+	synth_add_polygon(&s->world, corridor, sizeof(corridor) / sizeof(corridor[0]));
+
+	// 9 x 7 m, with desks, chairs and cabinets everywhere
+	s = &scenes[2];
+	*s = (struct scene){ .name = "office", .structured = false, 300, 300, 8700, 6700 };
+	synth_add_box(&s->world, 4500, 3500, 9000, 7000, 0);
+	for (int row = 0; row < 2; row++) {
+		for (int col = 0; col < 3; col++) {
+			const double x = 1800 + col * 2700, y = 1800 + row * 3400;
+			synth_add_box(&s->world, x, y, 1600, 800, 0);
+			synth_add_box(&s->world, x + 200, y + (row ? -800 : 800), 500, 500, 0.3 * (col + 1));
+		}
+	}
+	synth_add_box(&s->world, 8700, 3500, 500, 1200, 0);
+	synth_add_box(&s->world, 300, 3500, 500, 900, 0);
+}
+
+#define NUM_SCENES 3
+
+static bool pose_clear(const struct scene *s, const struct synth_pose *p)
+{
+	if (!synth_pose_clear(&s->world, p)) {
+		return false;
+	}
+
+	// Not inside anything: a ray out should hit a wall facing it, so
+	// count crossings
+	uint32_t crossings = 0;
+	for (uint32_t i = 0; i < s->world.nsegs; i++) {
+		const struct synth_segment *w = &s->world.segs[i];
+		if ((w->y0 > p->y) != (w->y1 > p->y) &&
+		    p->x < w->x0 + (p->y - w->y0) * (w->x1 - w->x0) / (w->y1 - w->y0)) {
+			crossings++;
+		}
+	}
+
+	// Inside the outer wall, and nothing else
+	return crossings == 1;
+}
+
+static double rand_unit(struct synth_state *st)
+{
+	return (synth_rand(st) & 0xffffff) / (double)0x1000000;
+}
+
+static void simulate_scan(const struct scene *s, const struct synth_pose *p, struct synth_state *st,
+                          uint32_t seq, struct lidar_scan *scan)
+{
+	const uint32_t nsamples = LIDAR_SAMPLE_RATE_HZ / SCAN_HZ;
+	const double phase = rand_unit(st);
+
+	memset(scan, 0, sizeof(*scan));
+	scan->seq = seq;
+	scan->speed = 360 * SCAN_HZ;
+
+	for (uint32_t i = 0; i < nsamples; i++) {
+		const double a = (i + phase) * 2 * M_PI / nsamples;
+		const double d = synth_raycast(&s->world, p->x, p->y, p->theta + a);
+		const int noise = (int)(synth_rand(st) % (2 * NOISE_MM + 1)) - NOISE_MM;
+
+		scan->nsamples++;
+		if (synth_rand(st) % 100 < DROPOUT_PCT || d > MAX_RANGE_MM) {
+			continue;
+		}
+
+		const uint32_t bin = (uint32_t)(a / (2 * M_PI) * LIDAR_SCAN_BINS) % LIDAR_SCAN_BINS;
+		scan->bins[bin].distance_mm = lround(d) + noise;
+		scan->bins[bin].intensity = 200;
+	}
+}
+
+static void to_world(const struct synth_pose *p, double x, double y, double *wx, double *wy)
+{
+	*wx = p->x + x * cos(p->theta) - y * sin(p->theta);
+	*wy = p->y + x * sin(p->theta) + y * cos(p->theta);
+}
+
+// How far the segment is from the wall it's closest to
+static double segment_error(const struct scene *s, const struct synth_pose *p, const struct lidar_feature_segment *seg)
+{
+	double x0, y0, x1, y1;
+	double best = INFINITY;
+
+	to_world(p, seg->x0_mm, seg->y0_mm, &x0, &y0);
+	to_world(p, seg->x1_mm, seg->y1_mm, &x1, &y1);
+
+	for (uint32_t i = 0; i < s->world.nsegs; i++) {
+		const double err = fmax(synth_dist_to_segment(&s->world.segs[i], x0, y0),
+		                        synth_dist_to_segment(&s->world.segs[i], x1, y1));
+		best = fmin(best, err);
+	}
+
+	return best;
+}
+
+static double corner_error(const struct scene *s, const struct synth_pose *p, const struct lidar_feature_corner *c)
+{
+	double x, y;
+	double best = INFINITY;
+
+	to_world(p, c->x_mm, c->y_mm, &x, &y);
+	for (uint32_t i = 0; i < s->world.nsegs; i++) {
+		best = fmin(best, hypot(s->world.segs[i].x0 - x, s->world.segs[i].y0 - y));
+	}
+
+	return best;
+}
+
+struct stats {
+	uint32_t revolutions;
+	uint64_t samples;
+	uint64_t points;
+	uint64_t outliers;
+	uint64_t segments;
+	uint64_t corners;
+	uint64_t bytes;
+	uint64_t binary_bytes;
+	uint32_t truncated;
+	uint32_t dropped;
+	uint64_t cycles;
+	uint64_t max_cycles;
+	double max_work_ratio;
+	bool work_exceeded;
+};
+
+static void time_extract(struct lidar_features_extractor *ex, const struct lidar_scan *scan,
+                         struct lidar_features *out, struct stats *stats)
+{
+	const uint64_t c0 = bench_cycles();
+	lidar_features_extract(ex, scan, out);
+	const uint64_t c = bench_cycles() - c0;
+
+	uint32_t npoints = 0;
+	for (uint32_t i = 0; i < LIDAR_SCAN_BINS; i++) {
+		npoints += scan->bins[i].distance_mm != 0;
+	}
+
+	const uint32_t max_segments = ex->cfg.max_segments && ex->cfg.max_segments < LIDAR_FEATURES_MAX_SEGMENTS ?
+	                              ex->cfg.max_segments : LIDAR_FEATURES_MAX_SEGMENTS;
+	const double bound = (double)(max_segments + 4) * npoints;
+	if (npoints) {
+		stats->max_work_ratio = fmax(stats->max_work_ratio, out->work / bound);
+	}
+	if (out->work > bound) {
+		stats->work_exceeded = true;
+	}
+
+	stats->revolutions++;
+	stats->samples += scan->nsamples;
+	stats->points += npoints;
+	stats->outliers += out->npoints + out->dropped;
+	stats->segments += out->nsegments;
+	stats->corners += out->ncorners;
+	stats->bytes += FEATURES_HEADER_BYTES + out->nsegments * sizeof(out->segments[0]) +
+	                out->ncorners * sizeof(out->corners[0]) + out->npoints * sizeof(out->points[0]);
+	stats->binary_bytes += (scan->nsamples + LIDAR_SAMPLES_PER_FRAME - 1) / LIDAR_SAMPLES_PER_FRAME *
+	                       BINARY_PACKET_BYTES;
+	stats->truncated += out->truncated;
+	stats->dropped += out->dropped;
+	stats->cycles += c;
+	if (c > stats->max_cycles) {
+		stats->max_cycles = c;
+	}
+}
+
+static void print_stats(const char *prefix, const struct stats *stats)
+{
+	const double revs = stats->revolutions ? stats->revolutions : 1;
+
+	printf("%ssegments_per_revolution: %.1f\n", prefix, stats->segments / revs);
+	printf("%scorners_per_revolution: %.1f\n", prefix, stats->corners / revs);
+	printf("%soutliers_per_revolution: %.1f\n", prefix, stats->outliers / revs);
+	printf("%scoverage: %.3f\n", prefix,
+	       stats->points ? 1.0 - (double)stats->outliers / stats->points : 0);
+	printf("%susb_bytes_per_revolution: %.0f\n", prefix, stats->bytes / revs);
+	printf("%sbinary_bytes_per_revolution: %.0f\n", prefix, stats->binary_bytes / revs);
+	printf("%sreduction: %.1fx\n", prefix, stats->bytes ? (double)stats->binary_bytes / stats->bytes : 0);
+	printf("%sitems_reduction: %.1fx\n", prefix,
+	       (double)stats->samples / fmax(1, stats->segments + stats->corners + stats->outliers));
+	printf("%struncated: %u\n", prefix, stats->truncated);
+	printf("%sdropped: %u\n", prefix, stats->dropped);
+	printf("%smax_work_vs_bound: %.3f\n", prefix, stats->max_work_ratio);
+	printf("%s" BENCH_CYCLES_UNIT "_per_revolution: %.0f\n", prefix, stats->cycles / revs);
+	printf("%smax_" BENCH_CYCLES_UNIT "_per_revolution: %llu\n", prefix,
+	       (unsigned long long)stats->max_cycles);
+}
+
+static int run_scene(const struct scene *s, const struct lidar_features_cfg *cfg)
+{
+	static struct lidar_features_extractor ex;
+	static struct lidar_features out;
+	static struct lidar_scan scan;
+	static double seg_errors[POSES * LIDAR_FEATURES_MAX_SEGMENTS];
+	struct synth_state st;
+	struct stats stats = { 0 };
+	uint32_t nseg_errors = 0, good_segs = 0, ncorners = 0, good_corners = 0;
+	int errors = 0;
+
+	synth_init(&st, 1, SCAN_HZ);
+	lidar_features_init(&ex, cfg);
+
+	for (uint32_t i = 0; i < POSES; i++) {
+		struct synth_pose p;
+		do {
+			p.x = s->min_x + rand_unit(&st) * (s->max_x - s->min_x);
+			p.y = s->min_y + rand_unit(&st) * (s->max_y - s->min_y);
+			p.theta = rand_unit(&st) * 2 * M_PI;
+		} while (!pose_clear(s, &p));
+
+		simulate_scan(s, &p, &st, i, &scan);
+		time_extract(&ex, &scan, &out, &stats);
+
+		for (uint32_t j = 0; j < out.nsegments; j++) {
+			const double err = segment_error(s, &p, &out.segments[j]);
+			seg_errors[nseg_errors++] = err;
+			good_segs += err <= SEGMENT_TOLERANCE_MM;
+		}
+		for (uint32_t j = 0; j < out.ncorners; j++) {
+			ncorners++;
+			good_corners += corner_error(s, &p, &out.corners[j]) <= CORNER_TOLERANCE_MM;
+		}
+	}
+
+	uint32_t *sorted = malloc(nseg_errors * sizeof(*sorted));
+	for (uint32_t i = 0; i < nseg_errors; i++) {
+		sorted[i] = lround(seg_errors[i]);
+	}
+	qsort(sorted, nseg_errors, sizeof(*sorted), bench_cmp_u32);
+
+	char prefix[32];
+	snprintf(prefix, sizeof(prefix), "%s_", s->name);
+	print_stats(prefix, &stats);
+
+	const double seg_frac = nseg_errors ? (double)good_segs / nseg_errors : 0;
+	const double corner_frac = ncorners ? (double)good_corners / ncorners : 1;
+	const double coverage = 1.0 - (double)stats.outliers / stats.points;
+	const double reduction = (double)stats.binary_bytes / stats.bytes;
+	printf("%ssegment_error_p50_mm: %u\n", prefix, nseg_errors ? sorted[nseg_errors / 2] : 0);
+	printf("%ssegment_error_p95_mm: %u\n", prefix, nseg_errors ? sorted[nseg_errors * 95 / 100] : 0);
+	printf("%sgood_segments: %.3f\n", prefix, seg_frac);
+	printf("%sgood_corners: %.3f\n", prefix, corner_frac);
+	free(sorted);
+
+	if (seg_frac < MIN_GOOD_SEGMENTS || corner_frac < MIN_GOOD_CORNERS) {
+		fprintf(stderr, "%s: features out of tolerance\n", s->name);
+		errors++;
+	}
+	if (stats.work_exceeded) {
+		fprintf(stderr, "%s: work exceeded the bound\n", s->name);
+		errors++;
+	}
+	if (s->structured && (coverage < MIN_COVERAGE || reduction < MIN_REDUCTION)) {
+		fprintf(stderr, "%s: not enough reduction\n", s->name);
+		errors++;
+	}
+
+	return errors;
+}
+
+// More short runs than there's room for segments, like a cluttered room, or
+// the furniture legs under a table. The extra runs must come out as points.
+#define MANY_RUNS 80
+
+static int run_many_runs(const struct lidar_features_cfg *cfg)
+{
+	static struct lidar_features_extractor ex;
+	static struct lidar_scan scan;
+	static struct lidar_features out;
+	const uint32_t max_segments = cfg->max_segments && cfg->max_segments < LIDAR_FEATURES_MAX_SEGMENTS ?
+	                              cfg->max_segments : LIDAR_FEATURES_MAX_SEGMENTS;
+
+	memset(&scan, 0, sizeof(scan));
+	scan.speed = 360 * SCAN_HZ;
+	scan.nsamples = LIDAR_SCAN_BINS;
+	for (uint32_t i = 0; i < LIDAR_SCAN_BINS; i++) {
+		const uint32_t run = i * MANY_RUNS / LIDAR_SCAN_BINS;
+		scan.bins[i].distance_mm = run % 2 ? 1500 : 3000;
+		scan.bins[i].intensity = 200;
+	}
+
+	lidar_features_init(&ex, cfg);
+	lidar_features_extract(&ex, &scan, &out);
+
+	printf("many_runs_segments: %u\n", out.nsegments);
+	printf("many_runs_points: %u\n", out.npoints);
+	printf("many_runs_truncated: %u\n", out.truncated);
+
+	if (out.nsegments > max_segments || (max_segments < MANY_RUNS && !out.truncated)) {
+		fprintf(stderr, "many_runs: %u segments, with room for %u\n", out.nsegments, max_segments);
+		return 1;
+	}
+
+	return 0;
+}
+
+struct capture_state {
+	struct lidar_scan_assembler as;
+	struct lidar_features_extractor ex;
+	struct lidar_features out;
+	struct stats stats;
+};
+
+static void capture_scan_cb(void *cb_data, const struct lidar_scan *scan)
+{
+	struct capture_state *cs = cb_data;
+
+	time_extract(&cs->ex, scan, &cs->out, &cs->stats);
+}
+
+static void capture_frame_cb(void *cb_data, struct lidar_frame *frame)
+{
+	struct capture_state *cs = cb_data;
+
+	lidar_scan_add_frame(&cs->as, frame);
+}
+
+static int run_capture(const char *path, const struct lidar_features_cfg *cfg)
+{
+	static struct capture_state cs;
+	struct lidar_capture_map map;
+
+	if (lidar_capture_map_open(&map, path)) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	lidar_scan_init(&cs.as, capture_scan_cb, &cs);
+	lidar_features_init(&cs.ex, cfg);
+
+	struct lidar_parser parser;
+	const struct lidar_parser_cfg parser_cfg = {
+		.frame_cb = capture_frame_cb,
+		.frame_cb_data = &cs,
+	};
+	lidar_parser_init(&parser, &parser_cfg);
+
+	struct lidar_capture_record rec;
+	const uint8_t *data;
+	while (lidar_capture_map_next(&map, &rec, &data)) {
+		// Only the first sensor
+		if (rec.sensor_id == 0) {
+			lidar_parser_feed(&parser, data, rec.len);
+		}
+	}
+
+	lidar_capture_map_close(&map);
+
+	printf("revolutions: %u\n", cs.stats.revolutions);
+	print_stats("", &cs.stats);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = NULL;
+	// The same as the example uses on the device
+	struct lidar_features_cfg cfg = {
+		.min_distance_mm = 100,
+		.max_distance_mm = MAX_RANGE_MM,
+		.break_mm = 100,
+		.split_mm = 40,
+		.merge_angle = 300,
+		.corner_angle = 3000,
+		.corner_mm = 200,
+		.min_points = 5,
+		.min_length_mm = 100,
+		.max_segments = 48,
+	};
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:s:m:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			path = optarg;
+			break;
+		case 's':
+			cfg.split_mm = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			cfg.max_segments = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [-f capture] [-s split_mm] [-m max_segments]\n"
+				"  -f  Run over a raw capture, instead of the simulated scenes\n",
+				argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (path) {
+		return run_capture(path, &cfg) ? 1 : 0;
+	}
+
+	static struct scene scenes[NUM_SCENES];
+	build_scenes(scenes);
+
+	int errors = 0;
+	for (int i = 0; i < NUM_SCENES; i++) {
+		errors += run_scene(&scenes[i], &cfg);
+	}
+	errors += run_many_runs(&cfg);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,262 @@
+// Sample filter benchmark
+//
+// Feeds synthetic frames, with spikes, weak returns, out-of-range returns
+// and the occasional missing frame, through the filter. The output is
+// checked against a simple reference which works on the whole stream at
+// once, and the cost per sample is reported for each configuration.
+// The frames are then fed again with each one starting a sample before the
+// last one ended, like the sensor does at some speeds, which must still
+// count as contiguous. Exits non-zero if the checks fail.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "crc8.h"
+#include "lidar_filter.h"
+#include "lidar_parser.h"
+
+#include "bench.h"
+#include "synth.h"
+
+// Reference: gate every sample, then take the median over the flattened
+// stream, not looking across missing frames.
+static void ref_filter(const struct lidar_filter_cfg *cfg, const struct lidar_frame *frames,
+                       const uint32_t *segment, uint32_t nframes, uint16_t *out)
+{
+	const uint32_t n = nframes * LIDAR_SAMPLES_PER_FRAME;
+	uint16_t *gated = malloc(n * sizeof(*gated));
+
+	for (uint32_t i = 0; i < n; i++) {
+		const struct lidar_sample *s = &frames[i / LIDAR_SAMPLES_PER_FRAME].samples[i % LIDAR_SAMPLES_PER_FRAME];
+		const bool keep = s->intensity >= cfg->min_intensity &&
+		                  s->distance_mm >= cfg->min_distance_mm &&
+		                  (!cfg->max_distance_mm || s->distance_mm <= cfg->max_distance_mm);
+
+		gated[i] = keep ? s->distance_mm : 0;
+	}
+
+	const int radius = cfg->median == 3 || cfg->median == 5 ? cfg->median / 2 : 0;
+
+	for (int64_t i = 0; i < n; i++) {
+		if (!gated[i]) {
+			out[i] = 0;
+			continue;
+		}
+
+		uint16_t w[LIDAR_FILTER_MEDIAN_MAX];
+		int count = 0;
+		for (int64_t j = i - radius; j <= i + radius; j++) {
+			if (j < 0 || j >= n || !gated[j] ||
+			    segment[j / LIDAR_SAMPLES_PER_FRAME] != segment[i / LIDAR_SAMPLES_PER_FRAME]) {
+				continue;
+			}
+			w[count++] = gated[j];
+		}
+
+		// Bubble sort, to be different to the real thing
+		for (int a = 0; a < count; a++) {
+			for (int b = 0; b + 1 < count - a; b++) {
+				if (w[b] > w[b + 1]) {
+					const uint16_t tmp = w[b];
+					w[b] = w[b + 1];
+					w[b + 1] = tmp;
+				}
+			}
+		}
+
+		out[i] = w[(count - 1) / 2];
+	}
+
+	free(gated);
+}
+
+// Move each frame back to overlap the one before by a sample, keeping the
+// gaps where a frame was lost
+static void overlap_frames(struct lidar_frame *frames, const uint32_t *segment, uint32_t nframes)
+{
+	for (uint32_t i = 1; i < nframes; i++) {
+		const struct lidar_frame *prev = &frames[i - 1];
+		struct lidar_frame *frame = &frames[i];
+		const uint32_t span = (frame->end_angle + LIDAR_ANGLE_MAX - frame->start_angle) % LIDAR_ANGLE_MAX;
+		const uint32_t step = span / (LIDAR_SAMPLES_PER_FRAME - 1);
+		uint32_t start = prev->end_angle + LIDAR_ANGLE_MAX - step;
+
+		if (segment[i] != segment[i - 1]) {
+			start += span + 2 * step;
+		}
+
+		frame->start_angle = start % LIDAR_ANGLE_MAX;
+		frame->end_angle = (start + span) % LIDAR_ANGLE_MAX;
+		frame->crc8 = lidar_crc8_update(0, (const uint8_t *)frame, LIDAR_FRAME_SIZE - 1);
+	}
+}
+
+struct spike {
+	uint32_t index;
+	uint16_t true_distance;
+};
+
+static int run_cfg(const char *name, const struct lidar_filter_cfg *cfg,
+                   const struct lidar_frame *frames, const uint32_t *segment, uint32_t nframes,
+                   const struct spike *spikes, uint32_t nspikes)
+{
+	const uint32_t nsamples = nframes * LIDAR_SAMPLES_PER_FRAME;
+	uint16_t *expected = malloc(nsamples * sizeof(*expected));
+	struct lidar_frame *out = malloc((nframes + 1) * sizeof(*out));
+	struct lidar_filter f;
+	uint32_t nout = 0;
+	int errors = 0;
+
+	ref_filter(cfg, frames, segment, nframes, expected);
+
+	lidar_filter_init(&f, cfg);
+
+	const uint64_t c0 = bench_cycles();
+	for (uint32_t i = 0; i < nframes; i++) {
+		if (lidar_filter_frame(&f, &frames[i], &out[nout])) {
+			nout++;
+		}
+	}
+	if (lidar_filter_flush(&f, &out[nout])) {
+		nout++;
+	}
+	const uint64_t c1 = bench_cycles();
+
+	if (nout != nframes) {
+		fprintf(stderr, "%s: %u frames out, expected %u\n", name, nout, nframes);
+		errors++;
+		nout = nout < nframes ? nout : nframes;
+	}
+
+	uint32_t removed = 0;
+	for (uint32_t i = 0; i < nout; i++) {
+		const struct lidar_frame *frame = &out[i];
+
+		if (frame->start_angle != frames[i].start_angle ||
+		    lidar_crc8_update(0, (const uint8_t *)frame, LIDAR_FRAME_SIZE - 1) != frame->crc8) {
+			fprintf(stderr, "%s: frame %u mangled\n", name, i);
+			errors++;
+			continue;
+		}
+
+		for (int j = 0; j < LIDAR_SAMPLES_PER_FRAME; j++) {
+			const uint16_t want = expected[i * LIDAR_SAMPLES_PER_FRAME + j];
+			const uint16_t got = frame->samples[j].distance_mm;
+
+			if (got != want && errors++ < 10) {
+				fprintf(stderr, "%s: frame %u sample %d: %u, expected %u\n", name, i, j, got, want);
+			}
+			if (!got) {
+				removed++;
+			}
+		}
+	}
+
+	// How many of the spikes were put back close to the true distance
+	uint32_t fixed = 0;
+	for (uint32_t i = 0; i < nspikes && spikes[i].index < nout * LIDAR_SAMPLES_PER_FRAME; i++) {
+		const uint32_t idx = spikes[i].index;
+		const int diff = (int)out[idx / LIDAR_SAMPLES_PER_FRAME].samples[idx % LIDAR_SAMPLES_PER_FRAME].distance_mm -
+		                 spikes[i].true_distance;
+
+		if (diff > -100 && diff < 100) {
+			fixed++;
+		}
+	}
+
+	printf("filter: %s " BENCH_CYCLES_UNIT "_per_sample: %.2f removed_pct: %.1f spikes_fixed_pct: %.1f errors: %d\n",
+	       name, (double)(c1 - c0) / nsamples, 100.0 * removed / nsamples,
+	       nspikes ? 100.0 * fixed / nspikes : 0, errors);
+
+	free(out);
+	free(expected);
+
+	return errors;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t nframes = 100000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nframes = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n nframes]\n", argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	struct synth_state st;
+	synth_init(&st, 1, 10);
+
+	struct lidar_frame *frames = malloc(nframes * sizeof(*frames));
+	uint32_t *segment = malloc(nframes * sizeof(*segment));
+	struct spike *spikes = malloc(nframes * LIDAR_SAMPLES_PER_FRAME * sizeof(*spikes));
+	uint32_t nspikes = 0;
+	uint32_t seg = 0;
+
+	for (uint32_t i = 0; i < nframes; i++) {
+		synth_frame(&st, &frames[i]);
+
+		// A lost frame: the ones either side aren't neighbours
+		if (synth_rand(&st) % 200 == 0) {
+			synth_frame(&st, &frames[i]);
+			seg++;
+		}
+		segment[i] = seg;
+
+		for (int j = 0; j < LIDAR_SAMPLES_PER_FRAME; j++) {
+			struct lidar_sample *s = &frames[i].samples[j];
+			const uint32_t r = synth_rand(&st) % 100;
+
+			if (r < 3) {
+				// A spike, but never two in a row
+				const uint32_t idx = i * LIDAR_SAMPLES_PER_FRAME + j;
+				if (!nspikes || spikes[nspikes - 1].index + 1 < idx) {
+					spikes[nspikes++] = (struct spike){ idx, s->distance_mm };
+					s->distance_mm = 20 + synth_rand(&st) % 11000;
+				}
+			} else if (r < 5) {
+				s->intensity = synth_rand(&st) % 10;
+			} else if (r < 6) {
+				s->distance_mm = synth_rand(&st) % 2 ? 5 : 15000;
+			}
+		}
+	}
+
+	static const struct {
+		const char *name;
+		struct lidar_filter_cfg cfg;
+	} cfgs[] = {
+		{ "none", { 0 } },
+		{ "gate", { .min_intensity = 10, .min_distance_mm = 20, .max_distance_mm = 12000 } },
+		{ "median3", { .median = 3 } },
+		{ "gate+median3", { .min_intensity = 10, .min_distance_mm = 20, .max_distance_mm = 12000, .median = 3 } },
+		{ "gate+median5", { .min_intensity = 10, .min_distance_mm = 20, .max_distance_mm = 12000, .median = 5 } },
+	};
+
+	int errors = 0;
+	for (uint32_t i = 0; i < sizeof(cfgs) / sizeof(cfgs[0]); i++) {
+		errors += run_cfg(cfgs[i].name, &cfgs[i].cfg, frames, segment, nframes, spikes, nspikes);
+	}
+
+	overlap_frames(frames, segment, nframes);
+	errors += run_cfg("overlap+median3", &cfgs[3].cfg, frames, segment, nframes, spikes, nspikes);
+	errors += run_cfg("overlap+median5", &cfgs[4].cfg, frames, segment, nframes, spikes, nspikes);
+
+	printf("errors: %d\n", errors);
+
+	free(spikes);
+	free(segment);
+	free(frames);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,389 @@
+// Occupancy grid benchmark
+//
+// Simulates the sensor in a rectangular room with a pillar in it, and builds
+// a grid from the frames. Checks that the walls come out occupied, that the
+// open space comes out free, and that nothing beyond the walls is touched.
+// The dirty tiles are taken after every revolution and copied into a second
+// grid, which must end up identical to the real one.
+//
+// With -f, builds the grid from a raw capture (see lidar_capture.h) instead,
+// with no checks.
+//
+// Reports the cost per frame (with percentiles, to show the cost is spread
+// evenly) and per revolution, and how many tiles changed per revolution.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lidar_grid.h"
+#include "lidar_points.h"
+
+#include "bench.h"
+#include "lidar_capture_file.h"
+#include "synth.h"
+
+// Bytes sent over USB for each tile: the header in example/usb.h plus the cells
+#define TILE_BYTES (11 + LIDAR_GRID_TILE_CELLS)
+
+// The room, in mm on the grid. The walls are on cell centres (for 50 mm
+// cells), so wall hits land in the wall's cells.
+static const double room_x0 = 1225, room_x1 = 5175;
+static const double room_y0 = 1725, room_y1 = 4675;
+static const double pillar_x = 4000, pillar_y = 3800, pillar_r = 150;
+static const double sensor_x = 2900, sensor_y = 3100;
+
+#define NOISE_MM 10
+
+struct bench {
+	struct lidar_grid grid;
+	// Rebuilt from the dirty tiles, row by row
+	int8_t copy[LIDAR_GRID_MAX_DIM][LIDAR_GRID_MAX_DIM];
+
+	uint32_t *frame_cycles;
+	uint32_t nframes;
+	uint32_t max_frames;
+	uint64_t cycles;
+};
+
+static void bench_add_frame(struct bench *b, const struct lidar_frame *frame)
+{
+	const uint64_t c0 = bench_cycles();
+	lidar_grid_add_frame(&b->grid, frame);
+	const uint64_t c = bench_cycles() - c0;
+
+	if (b->nframes < b->max_frames) {
+		b->frame_cycles[b->nframes++] = c;
+	}
+	b->cycles += c;
+}
+
+// Take every dirty tile, and apply it to the copy. Returns the number taken.
+static uint32_t bench_take_tiles(struct bench *b)
+{
+	struct lidar_grid_tile tile;
+	uint32_t n = 0;
+
+	while (lidar_grid_take_dirty(&b->grid, &tile)) {
+		for (int y = 0; y < LIDAR_GRID_TILE_DIM; y++) {
+			memcpy(&b->copy[tile.tile_y * LIDAR_GRID_TILE_DIM + y][tile.tile_x * LIDAR_GRID_TILE_DIM],
+			       &tile.cells[y * LIDAR_GRID_TILE_DIM], LIDAR_GRID_TILE_DIM);
+		}
+		n++;
+	}
+
+	return n;
+}
+
+// Distance from the sensor to whatever the ray at 'angle' hits
+static double raycast(uint32_t angle)
+{
+	const double a = angle / 100.0 * M_PI / 180.0;
+	const double dx = cos(a), dy = sin(a);
+	double t = INFINITY;
+
+	if (dx > 1e-9) {
+		t = fmin(t, (room_x1 - sensor_x) / dx);
+	} else if (dx < -1e-9) {
+		t = fmin(t, (room_x0 - sensor_x) / dx);
+	}
+	if (dy > 1e-9) {
+		t = fmin(t, (room_y1 - sensor_y) / dy);
+	} else if (dy < -1e-9) {
+		t = fmin(t, (room_y0 - sensor_y) / dy);
+	}
+
+	// Slab test for the pillar
+	double tmin = -INFINITY, tmax = INFINITY;
+	const double lo[2] = { pillar_x - pillar_r, pillar_y - pillar_r };
+	const double hi[2] = { pillar_x + pillar_r, pillar_y + pillar_r };
+	const double o[2] = { sensor_x, sensor_y };
+	const double d[2] = { dx, dy };
+
+	for (int i = 0; i < 2; i++) {
+		if (fabs(d[i]) < 1e-9) {
+			if (o[i] < lo[i] || o[i] > hi[i]) {
+				tmin = INFINITY;
+			}
+			continue;
+		}
+
+		double t0 = (lo[i] - o[i]) / d[i];
+		double t1 = (hi[i] - o[i]) / d[i];
+		if (t0 > t1) {
+			const double tmp = t0;
+			t0 = t1;
+			t1 = tmp;
+		}
+		tmin = fmax(tmin, t0);
+		tmax = fmin(tmax, t1);
+	}
+
+	if (tmin <= tmax && tmin > 0) {
+		t = fmin(t, tmin);
+	}
+
+	return t;
+}
+
+static void room_frame(struct synth_state *st, struct lidar_frame *frame)
+{
+	struct lidar_point points[LIDAR_SAMPLES_PER_FRAME];
+
+	synth_frame(st, frame);
+	lidar_frame_to_points(frame, points);
+
+	for (int i = 0; i < LIDAR_SAMPLES_PER_FRAME; i++) {
+		const int noise = (int)(synth_rand(st) % (2 * NOISE_MM + 1)) - NOISE_MM;
+		frame->samples[i].distance_mm = lround(raycast(points[i].angle)) + noise;
+	}
+}
+
+static double dist_to_box(double x, double y, double x0, double y0, double x1, double y1)
+{
+	const double dx = fmax(fmax(x0 - x, 0), x - x1);
+	const double dy = fmax(fmax(y0 - y, 0), y - y1);
+
+	return hypot(dx, dy);
+}
+
+// Check the grid against the room. Returns the number of errors.
+static int check_room(const struct lidar_grid *grid, uint32_t cell_mm, uint32_t dim)
+{
+	uint32_t interior = 0, interior_free = 0, interior_occupied = 0;
+	uint32_t wall = 0, wall_occupied = 0;
+	uint32_t outside = 0, outside_touched = 0;
+	int errors = 0;
+
+	for (uint32_t cy = 0; cy < dim; cy++) {
+		for (uint32_t cx = 0; cx < dim; cx++) {
+			const double x = (cx + 0.5) * cell_mm;
+			const double y = (cy + 0.5) * cell_mm;
+			const int8_t v = lidar_grid_get(grid, cx, cy);
+
+			const bool in_room = x > room_x0 && x < room_x1 && y > room_y0 && y < room_y1;
+			const double to_walls = fmin(fmin(x - room_x0, room_x1 - x),
+			                             fmin(y - room_y0, room_y1 - y));
+			const double to_pillar = dist_to_box(x, y, pillar_x - pillar_r, pillar_y - pillar_r,
+			                                     pillar_x + pillar_r, pillar_y + pillar_r);
+			const bool in_pillar = to_pillar == 0;
+
+			if (!in_room && fabs(to_walls) < cell_mm / 2.0 &&
+			    x > room_x0 - cell_mm && x < room_x1 + cell_mm &&
+			    y > room_y0 - cell_mm && y < room_y1 + cell_mm) {
+				// On a wall
+				wall++;
+				wall_occupied += v > 0;
+			} else if ((!in_room && -to_walls > 1.5 * cell_mm) ||
+			           (in_pillar && dist_to_box(x, y, pillar_x - pillar_r + 1.5 * cell_mm,
+			                                     pillar_y - pillar_r + 1.5 * cell_mm,
+			                                     pillar_x + pillar_r - 1.5 * cell_mm,
+			                                     pillar_y + pillar_r - 1.5 * cell_mm) == 0)) {
+				// Well beyond a wall, or inside the pillar
+				outside++;
+				outside_touched += v != 0;
+			} else if (in_room && to_walls > 1.5 * cell_mm && to_pillar > 1.5 * cell_mm) {
+				interior++;
+				interior_free += v < 0;
+				interior_occupied += v > 0;
+			}
+		}
+	}
+
+	printf("wall_cells: %u\n", wall);
+	printf("wall_occupied_pct: %.1f\n", 100.0 * wall_occupied / wall);
+	printf("interior_cells: %u\n", interior);
+	printf("interior_free_pct: %.1f\n", 100.0 * interior_free / interior);
+	printf("interior_occupied: %u\n", interior_occupied);
+	printf("outside_touched: %u\n", outside_touched);
+
+	if (wall_occupied < wall * 0.8) {
+		fprintf(stderr, "only %u of %u wall cells occupied\n", wall_occupied, wall);
+		errors++;
+	}
+	if (interior_free < interior * 0.9 || interior_occupied) {
+		fprintf(stderr, "interior: %u free, %u occupied, of %u\n",
+		        interior_free, interior_occupied, interior);
+		errors++;
+	}
+	if (outside_touched) {
+		fprintf(stderr, "%u of %u cells beyond the walls were touched\n",
+		        outside_touched, outside);
+		errors++;
+	}
+
+	return errors;
+}
+
+static void grid_frame_cb(void *cb_data, struct lidar_frame *frame)
+{
+	bench_add_frame(cb_data, frame);
+}
+
+static int run_capture(struct bench *b, const char *path)
+{
+	struct lidar_capture_map map;
+	if (lidar_capture_map_open(&map, path)) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	struct lidar_parser parser;
+	const struct lidar_parser_cfg cfg = {
+		.frame_cb = grid_frame_cb,
+		.frame_cb_data = b,
+	};
+	lidar_parser_init(&parser, &cfg);
+
+	struct lidar_capture_record rec;
+	const uint8_t *data;
+	while (lidar_capture_map_next(&map, &rec, &data)) {
+		// Only the first sensor, there's only one pose
+		if (rec.sensor_id == 0) {
+			lidar_parser_feed(&parser, data, rec.len);
+		}
+	}
+
+	lidar_capture_map_close(&map);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = NULL;
+	uint32_t revolutions = 20;
+	struct lidar_grid_cfg cfg = {
+		.cell_mm = 50,
+		.width = LIDAR_GRID_MAX_DIM,
+		.height = LIDAR_GRID_MAX_DIM,
+		.hit = 16,
+		.miss = -4,
+		.min = -64,
+		.max = 64,
+		.max_range_mm = 8000,
+	};
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:r:c:m:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			path = optarg;
+			break;
+		case 'r':
+			revolutions = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			cfg.cell_mm = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			cfg.max_range_mm = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [-f capture] [-r revolutions] [-c cell_mm] [-m max_range_mm]\n"
+				"  -f  Build the grid from a raw capture, instead of the simulated room\n"
+				"  -r  Simulated revolutions (default 20)\n"
+				"  -c  Cell size (default 50 mm). The room checks assume 50.\n"
+				"  -m  Maximum range (default 8000 mm)\n",
+				argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	static struct bench b;
+	// A generous upper bound on the frames in a capture or the simulation
+	b.max_frames = 1 << 22;
+	b.frame_cycles = malloc(b.max_frames * sizeof(*b.frame_cycles));
+
+	lidar_grid_init(&b.grid, &cfg);
+
+	int errors = 0;
+	uint32_t tiles_first = 0, tiles_last = 0, tiles_total = 0;
+
+	if (path) {
+		if (run_capture(&b, path)) {
+			return 1;
+		}
+		tiles_total = bench_take_tiles(&b);
+	} else {
+		const struct lidar_grid_pose pose = {
+			.x_mm = sensor_x,
+			.y_mm = sensor_y,
+		};
+		lidar_grid_set_pose(&b.grid, &pose);
+
+		struct synth_state st;
+		synth_init(&st, 1, 10);
+
+		const uint32_t frames_per_rev = LIDAR_SAMPLE_RATE_HZ / 10 / LIDAR_SAMPLES_PER_FRAME;
+
+		for (uint32_t r = 0; r < revolutions; r++) {
+			for (uint32_t i = 0; i < frames_per_rev; i++) {
+				struct lidar_frame frame;
+				room_frame(&st, &frame);
+				bench_add_frame(&b, &frame);
+			}
+
+			const uint32_t tiles = bench_take_tiles(&b);
+			if (r == 0) {
+				tiles_first = tiles;
+			}
+			tiles_last = tiles;
+			tiles_total += tiles;
+		}
+
+		if (cfg.cell_mm == 50) {
+			errors += check_room(&b.grid, cfg.cell_mm, LIDAR_GRID_MAX_DIM);
+		}
+	}
+
+	uint32_t mismatched = 0;
+	for (int y = 0; y < LIDAR_GRID_MAX_DIM; y++) {
+		for (int x = 0; x < LIDAR_GRID_MAX_DIM; x++) {
+			mismatched += b.copy[y][x] != lidar_grid_get(&b.grid, x, y);
+		}
+	}
+	if (mismatched) {
+		fprintf(stderr, "%u cells rebuilt from the dirty tiles don't match\n", mismatched);
+		errors++;
+	}
+
+	struct lidar_grid_stats stats;
+	lidar_grid_get_stats(&b.grid, &stats);
+
+	qsort(b.frame_cycles, b.nframes, sizeof(*b.frame_cycles), bench_cmp_u32);
+
+	printf("frames: %u\n", stats.frames);
+	printf("rays: %u\n", stats.rays);
+	printf("cell_updates: %u\n", stats.cells);
+	if (stats.frames) {
+		const double per_frame = (double)b.cycles / stats.frames;
+		const double frames_per_rev = (double)LIDAR_SAMPLE_RATE_HZ / 10 / LIDAR_SAMPLES_PER_FRAME;
+
+		printf("cells_per_frame: %.1f\n", (double)stats.cells / stats.frames);
+		printf(BENCH_CYCLES_UNIT "_per_frame: %.0f\n", per_frame);
+		printf(BENCH_CYCLES_UNIT "_per_cell: %.2f\n", stats.cells ? (double)b.cycles / stats.cells : 0);
+		printf("frame_" BENCH_CYCLES_UNIT "_p50: %u\n", bench_percentile(b.frame_cycles, b.nframes, 0.5));
+		printf("frame_" BENCH_CYCLES_UNIT "_p99: %u\n", bench_percentile(b.frame_cycles, b.nframes, 0.99));
+		printf("frame_" BENCH_CYCLES_UNIT "_max: %u\n", b.nframes ? b.frame_cycles[b.nframes - 1] : 0);
+		// At 10 Hz
+		printf(BENCH_CYCLES_UNIT "_per_revolution: %.0f\n", per_frame * frames_per_rev);
+	}
+	if (!path) {
+		printf("tiles_first_revolution: %u\n", tiles_first);
+		printf("tiles_last_revolution: %u\n", tiles_last);
+		printf("usb_bytes_per_revolution: %.0f\n", (double)tiles_total * TILE_BYTES / revolutions);
+	}
+	printf("tiles_total: %u\n", tiles_total);
+	printf("errors: %d\n", errors);
+
+	free(b.frame_cycles);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,451 @@
+// Scan matching benchmark
+//
+// Moves a simulated sensor along a known path through a few scenes (a room
+// with some furniture, an L-shaped room, and a cluttered hall), and runs
+// lidar_match_add_scan() on each revolution. Each revolution is ray cast
+// from its pose with seeded noise and dropouts, so every run is identical.
+// Checks each revolution's transform against the true motion, and the pose
+// integrated from them against the true final pose. Exits non-zero if any
+// are out of tolerance.
+//
+// Each scene is run twice: with the host configuration, and with the
+// lightweight one used by the example on the RP2040.
+//
+// With -f, runs the odometry over a raw capture (see lidar_capture.h)
+// instead, with no checks.
+//
+// Reports the cost per match, against the 100 ms between revolutions at
+// 10 Hz.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lidar_match.h"
+#include "lidar_points.h"
+#include "lidar_scan.h"
+
+#include "bench.h"
+#include "lidar_capture_file.h"
+#include "synth.h"
+
+#define NOISE_MM 10
+// Percent of samples with no return
+#define DROPOUT_PCT 3
+#define MAX_RANGE_MM 12000
+
+// Per revolution
+#define TOLERANCE_MM 10
+#define TOLERANCE_CDEG 25
+// Over the whole path: of the distance travelled, and absolute heading
+#define DRIFT_TOLERANCE_PCT 2.0
+#define DRIFT_TOLERANCE_CDEG 150
+
+// 10 Hz
+#define BUDGET_NS 100000000
+
+struct scene {
+	const char *name;
+	struct synth_scene world;
+	struct synth_pose start;
+	uint32_t revolutions;
+	// The motion during revolution 'rev', relative to the sensor
+	void (*motion)(uint32_t rev, struct synth_pose *m);
+};
+
+struct stats {
+	uint32_t matches;
+	uint32_t failed;
+	uint32_t out_of_tolerance;
+	double max_err_mm;
+	double max_err_cdeg;
+	double sum_err_mm;
+	uint64_t iterations;
+	uint32_t not_converged;
+	uint64_t cycles;
+	uint64_t ns;
+	uint64_t max_ns;
+};
+
+// Drives round in a circle, with some sideways wobble
+static void room_motion(uint32_t rev, struct synth_pose *m)
+{
+	m->x = 60;
+	m->y = 10 * sin(rev * 0.3);
+	m->theta = 3.0 * M_PI / 180;
+}
+
+// Along the bottom of the L, round the corner, and up the side
+static void l_motion(uint32_t rev, struct synth_pose *m)
+{
+	if (rev < 40 || rev >= 55) {
+		*m = (struct synth_pose){ 100, 0, 0 };
+	} else {
+		*m = (struct synth_pose){ 40, 0, -6.0 * M_PI / 180 };
+	}
+}
+
+// Speeding up and slowing down, while turning back and forth
+static void clutter_motion(uint32_t rev, struct synth_pose *m)
+{
+	m->x = 70 + 50 * sin(rev * 0.1);
+	m->y = 0;
+	m->theta = 2.0 * M_PI / 180 * sin(rev * 0.15);
+}
+
+static void build_scenes(struct scene *scenes)
+{
+	struct scene *s = &scenes[0];
+	*s = (struct scene){
+		.name = "room",
+		.start = { 3500, 1200, 0 },
+		.revolutions = 80,
+		.motion = room_motion,
+	};
+	synth_add_box(&s->world, 3500, 2500, 7000, 5000, 0);
+	synth_add_box(&s->world, 1300, 4100, 600, 600, 0);
+	synth_add_box(&s->world, 5850, 850, 700, 500, 0);
+	synth_add_box(&s->world, 3500, 2350, 200, 200, 0);
+
+	s = &scenes[1];
+	*s = (struct scene){
+		.name = "l_room",
+		.start = { 7000, 1500, M_PI },
+		.revolutions = 80,
+		.motion = l_motion,
+	};
+	const double l_room[][2] = {
+		{ 0, 0 }, { 8000, 0 }, { 8000, 3000 }, { 3000, 3000 }, { 3000, 7000 }, { 0, 7000 },
+	};
+	synth_add_polygon(&s->world, l_room, 6);
+	synth_add_box(&s->world, 900, 5400, 600, 400, 0);
+
+	s = &scenes[2];
+	*s = (struct scene){
+		.name = "clutter",
+		.start = { 2000, 1500, M_PI / 4 },
+		.revolutions = 80,
+		.motion = clutter_motion,
+	};
+	synth_add_box(&s->world, 4500, 4500, 9000, 9000, 0);
+	for (int y = 0; y < 4; y++) {
+		for (int x = 0; x < 4; x++) {
+			const double cx = 1125 + x * 2200 + (y % 2) * 500;
+			const double cy = 825 + y * 2300;
+			synth_add_box(&s->world, cx, cy, 250, 250, 0);
+		}
+	}
+}
+
+static void simulate_scan(const struct scene *s, const struct synth_pose *p, struct synth_state *st,
+                          uint32_t seq, struct lidar_scan *scan)
+{
+	memset(scan, 0, sizeof(*scan));
+	scan->seq = seq;
+	scan->speed = 3600;
+
+	for (uint32_t i = 0; i < LIDAR_SCAN_BINS; i++) {
+		// The middle of the bin, like lidar_match uses
+		const double a = (i + 0.5) * 2 * M_PI / LIDAR_SCAN_BINS;
+		const double d = synth_raycast(&s->world, p->x, p->y, p->theta + a);
+		const int noise = (int)(synth_rand(st) % (2 * NOISE_MM + 1)) - NOISE_MM;
+
+		if (synth_rand(st) % 100 < DROPOUT_PCT || d > MAX_RANGE_MM) {
+			continue;
+		}
+
+		scan->bins[i].distance_mm = lround(d) + noise;
+		scan->bins[i].intensity = 200;
+		scan->nsamples++;
+	}
+}
+
+// a = a * b
+static void pose_compose(struct synth_pose *a, const struct synth_pose *b)
+{
+	a->x += b->x * cos(a->theta) - b->y * sin(a->theta);
+	a->y += b->x * sin(a->theta) + b->y * cos(a->theta);
+	a->theta += b->theta;
+}
+
+static double wrap_cdeg(double cdeg)
+{
+	return remainder(cdeg, LIDAR_ANGLE_MAX);
+}
+
+static void time_match(struct lidar_match *m, const struct lidar_scan *scan,
+                       struct lidar_match_result *res, struct stats *stats, bool *ok)
+{
+	const uint64_t t0 = bench_now_ns();
+	const uint64_t c0 = bench_cycles();
+	*ok = lidar_match_add_scan(m, scan, res);
+	const uint64_t c = bench_cycles() - c0;
+	const uint64_t ns = bench_now_ns() - t0;
+
+	stats->cycles += c;
+	stats->ns += ns;
+	if (ns > stats->max_ns) {
+		stats->max_ns = ns;
+	}
+}
+
+static void print_timing(const char *prefix, const struct stats *stats)
+{
+	if (!stats->matches) {
+		return;
+	}
+
+	const double mean_ns = (double)stats->ns / stats->matches;
+
+	printf("%s" BENCH_CYCLES_UNIT "_per_match: %.0f\n", prefix, (double)stats->cycles / stats->matches);
+	printf("%sus_per_match: %.1f\n", prefix, mean_ns / 1000);
+	printf("%smax_us_per_match: %.1f\n", prefix, stats->max_ns / 1000.0);
+	printf("%sbudget_pct: %.3f\n", prefix, 100.0 * mean_ns / BUDGET_NS);
+	printf("%smean_iterations: %.1f\n", prefix, (double)stats->iterations / stats->matches);
+}
+
+// Returns the number of errors
+static int run_scene(const struct scene *s, const struct lidar_match_cfg *cfg, const char *cfg_name)
+{
+	static struct lidar_match m;
+	struct lidar_scan scan;
+	struct synth_state st;
+	struct stats stats = { 0 };
+	struct synth_pose truth = s->start;
+	struct lidar_match_transform est = { 0 };
+	double travelled = 0;
+	char prefix[64];
+	int errors = 0;
+
+	snprintf(prefix, sizeof(prefix), "%s_%s_", s->name, cfg_name);
+	synth_init(&st, 1, 10);
+	lidar_match_init(&m, cfg);
+
+	for (uint32_t rev = 0; rev < s->revolutions; rev++) {
+		struct synth_pose motion = { 0 };
+		if (rev) {
+			s->motion(rev, &motion);
+			pose_compose(&truth, &motion);
+			travelled += hypot(motion.x, motion.y);
+		}
+
+		if (!synth_pose_clear(&s->world, &truth)) {
+			fprintf(stderr, "%s: the path hits something at revolution %u\n", s->name, rev);
+			return errors + 1;
+		}
+
+		simulate_scan(s, &truth, &st, rev, &scan);
+
+		struct lidar_match_result res;
+		bool ok;
+		time_match(&m, &scan, &res, &stats, &ok);
+
+		if (!rev) {
+			continue;
+		}
+
+		stats.matches++;
+		stats.iterations += res.iterations;
+		stats.not_converged += !res.converged;
+		if (!ok) {
+			stats.failed++;
+			continue;
+		}
+
+		lidar_match_compose(&est, &res.transform, &est);
+
+		const double err_mm = hypot(res.transform.x_mm - motion.x, res.transform.y_mm - motion.y);
+		const double err_cdeg = fabs(wrap_cdeg(res.transform.theta - motion.theta * 18000 / M_PI));
+
+		stats.sum_err_mm += err_mm;
+		stats.max_err_mm = fmax(stats.max_err_mm, err_mm);
+		stats.max_err_cdeg = fmax(stats.max_err_cdeg, err_cdeg);
+		if (err_mm > TOLERANCE_MM || err_cdeg > TOLERANCE_CDEG) {
+			stats.out_of_tolerance++;
+		}
+	}
+
+	// Where the odometry thinks the sensor is, in the scene
+	const double c = cos(s->start.theta), sn = sin(s->start.theta);
+	const double est_x = s->start.x + est.x_mm * c - est.y_mm * sn;
+	const double est_y = s->start.y + est.x_mm * sn + est.y_mm * c;
+	const double drift_mm = hypot(est_x - truth.x, est_y - truth.y);
+	const double drift_cdeg = fabs(wrap_cdeg(est.theta - (truth.theta - s->start.theta) * 18000 / M_PI));
+	const double drift_pct = travelled ? 100 * drift_mm / travelled : 0;
+
+	printf("%smatches: %u\n", prefix, stats.matches);
+	printf("%sfailed: %u\n", prefix, stats.failed);
+	printf("%sout_of_tolerance: %u\n", prefix, stats.out_of_tolerance);
+	printf("%snot_converged: %u\n", prefix, stats.not_converged);
+	printf("%smean_err_mm: %.2f\n", prefix, stats.sum_err_mm / (stats.matches - stats.failed));
+	printf("%smax_err_mm: %.2f\n", prefix, stats.max_err_mm);
+	printf("%smax_err_cdeg: %.1f\n", prefix, stats.max_err_cdeg);
+	printf("%stravelled_mm: %.0f\n", prefix, travelled);
+	printf("%sdrift_mm: %.1f\n", prefix, drift_mm);
+	printf("%sdrift_pct: %.2f\n", prefix, drift_pct);
+	printf("%sdrift_cdeg: %.1f\n", prefix, drift_cdeg);
+	print_timing(prefix, &stats);
+
+	if (stats.failed || stats.out_of_tolerance) {
+		fprintf(stderr, "%s (%s): %u failed, %u out of tolerance, of %u\n", s->name, cfg_name,
+		        stats.failed, stats.out_of_tolerance, stats.matches);
+		errors++;
+	}
+	if (drift_pct > DRIFT_TOLERANCE_PCT || drift_cdeg > DRIFT_TOLERANCE_CDEG) {
+		fprintf(stderr, "%s (%s): drifted %.0f mm (%.2f%%) and %.0f cdeg\n", s->name, cfg_name,
+		        drift_mm, drift_pct, drift_cdeg);
+		errors++;
+	}
+
+	return errors;
+}
+
+struct capture_state {
+	struct lidar_scan_assembler as;
+	struct lidar_match m;
+	struct lidar_match_transform pose;
+	struct stats stats;
+};
+
+static void capture_scan_cb(void *cb_data, const struct lidar_scan *scan)
+{
+	struct capture_state *cs = cb_data;
+	struct lidar_match_result res;
+	bool ok;
+
+	time_match(&cs->m, scan, &res, &cs->stats, &ok);
+	if (ok) {
+		lidar_match_compose(&cs->pose, &res.transform, &cs->pose);
+		cs->stats.matches++;
+		cs->stats.iterations += res.iterations;
+		cs->stats.not_converged += !res.converged;
+	} else {
+		cs->stats.failed++;
+	}
+}
+
+static void capture_frame_cb(void *cb_data, struct lidar_frame *frame)
+{
+	struct capture_state *cs = cb_data;
+
+	lidar_scan_add_frame(&cs->as, frame);
+}
+
+static int run_capture(const char *path, const struct lidar_match_cfg *cfg)
+{
+	static struct capture_state cs;
+	struct lidar_capture_map map;
+
+	if (lidar_capture_map_open(&map, path)) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	lidar_scan_init(&cs.as, capture_scan_cb, &cs);
+	lidar_match_init(&cs.m, cfg);
+
+	struct lidar_parser parser;
+	const struct lidar_parser_cfg parser_cfg = {
+		.frame_cb = capture_frame_cb,
+		.frame_cb_data = &cs,
+	};
+	lidar_parser_init(&parser, &parser_cfg);
+
+	struct lidar_capture_record rec;
+	const uint8_t *data;
+	while (lidar_capture_map_next(&map, &rec, &data)) {
+		// Only the first sensor, there's only one pose
+		if (rec.sensor_id == 0) {
+			lidar_parser_feed(&parser, data, rec.len);
+		}
+	}
+
+	lidar_capture_map_close(&map);
+
+	printf("matches: %u\n", cs.stats.matches);
+	// Includes the first revolution, which has nothing to match against
+	printf("failed: %u\n", cs.stats.failed);
+	printf("not_converged: %u\n", cs.stats.not_converged);
+	printf("final_x_mm: %d\n", cs.pose.x_mm);
+	printf("final_y_mm: %d\n", cs.pose.y_mm);
+	printf("final_theta_cdeg: %d\n", cs.pose.theta);
+	cs.stats.matches += cs.stats.failed;
+	print_timing("", &cs.stats);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = NULL;
+	bool light_only = false;
+	struct lidar_match_cfg cfg = {
+		.cell_mm = 250,
+		.min_distance_mm = 100,
+		.max_iterations = 30,
+		.min_pairs = 40,
+	};
+	// Like the example's on-device configuration
+	const struct lidar_match_cfg light_cfg = {
+		.cell_mm = 250,
+		.min_distance_mm = 100,
+		.decimate = 4,
+		.max_iterations = 8,
+		.min_pairs = 20,
+	};
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:c:i:d:lh")) != -1) {
+		switch (opt) {
+		case 'f':
+			path = optarg;
+			break;
+		case 'c':
+			cfg.cell_mm = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			cfg.max_iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			cfg.decimate = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			light_only = true;
+			break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [-f capture] [-c cell_mm] [-i iterations] [-d decimate] [-l]\n"
+				"  -f  Run over a raw capture, instead of the simulated scenes\n"
+				"  -c  Cell size (default 250 mm)\n"
+				"  -i  Maximum iterations (default 30)\n"
+				"  -d  Use every n'th point (default 1)\n"
+				"  -l  Only use the lightweight configuration\n",
+				argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (path) {
+		return run_capture(path, light_only ? &light_cfg : &cfg) ? 1 : 0;
+	}
+
+	static struct scene scenes[3];
+	build_scenes(scenes);
+
+	int errors = 0;
+	for (int i = 0; i < 3; i++) {
+		if (!light_only) {
+			errors += run_scene(&scenes[i], &cfg, "host");
+		}
+		errors += run_scene(&scenes[i], &light_cfg, "light");
+	}
+
+	printf("match_state_bytes: %zu\n", sizeof(struct lidar_match));
+
+	return errors ? 1 : 0;
+}
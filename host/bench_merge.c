@@ -0,0 +1,226 @@
+// Multi-sensor merge benchmark
+//
+// Simulates several sensors, each with its own parser, receiving synthetic
+// data at slightly different rates. Their DMA requests complete in time
+// order, as they would on the Pico, and every frame is pushed to a merger
+// tagged with the simulated receive time. The consumer drains the merger
+// every few requests, and checks that the merged stream is in time order,
+// that each sensor's frames are in order and intact, and that nothing is
+// lost. Exits non-zero if any check fails.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "crc8.h"
+#include "lidar_merge.h"
+#include "lidar_parser.h"
+
+#include "bench.h"
+#include "synth.h"
+
+struct sensor {
+	uint8_t id;
+	struct lidar_parser parser;
+	struct lidar_merge *merge;
+
+	uint8_t *stream;
+	uint32_t len;
+	uint32_t done;
+
+	// Simulated time, in ns so that the byte period can be fractional
+	uint64_t byte_ns;
+	uint64_t now_ns;
+
+	// Checks on the consumer side
+	uint16_t last_timestamp;
+	uint32_t popped;
+};
+
+static uint64_t sim_now_ns;
+
+static void push_frame(void *cb_data, struct lidar_frame *frame)
+{
+	struct sensor *s = cb_data;
+	const struct lidar_frame_ref ref = {
+		.frame = frame,
+		.rx_time = sim_now_ns / 1000,
+		.sensor_id = s->id,
+	};
+
+	lidar_merge_push(s->merge, &ref);
+}
+
+// Complete the sensor's current request, like the DMA would
+static void sensor_rx(struct sensor *s)
+{
+	const uint32_t nbytes = lidar_parser_rx_len(&s->parser);
+
+	memcpy(lidar_parser_rx_buf(&s->parser), s->stream + s->done, nbytes);
+	s->done += nbytes;
+
+	lidar_parser_rx_done(&s->parser);
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t nframes = 100000;
+	uint32_t nsensors = LIDAR_MERGE_MAX_SENSORS;
+	uint32_t batch = 1;
+	uint32_t drain_every = 2;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:b:d:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nframes = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			batch = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			drain_every = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n frames per sensor] [-b batch] [-d drain every N requests]\n",
+				argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!drain_every) {
+		drain_every = 1;
+	}
+
+	static struct lidar_merge merge;
+	static struct sensor sensors[LIDAR_MERGE_MAX_SENSORS];
+
+	lidar_crc8_init();
+	lidar_merge_init(&merge, nsensors);
+
+	for (uint32_t i = 0; i < nsensors; i++) {
+		struct sensor *s = &sensors[i];
+		struct synth_state st;
+
+		synth_init(&st, i + 1, 10);
+
+		s->id = i;
+		s->merge = &merge;
+		s->len = nframes * LIDAR_FRAME_SIZE;
+		s->stream = malloc(s->len);
+		synth_stream(&st, s->stream, nframes);
+
+		// ~43.4 us per byte at 230400 baud. Skew the sensors a bit, and
+		// start them out of phase.
+		s->byte_ns = LIDAR_BYTE_TIME_NS + i * 97;
+		s->now_ns = i * 12345;
+
+		struct lidar_parser_cfg cfg = {
+			.frame_cb = push_frame,
+			.frame_cb_data = s,
+			.hold_frames = true,
+			.batch_frames = batch,
+		};
+		lidar_parser_init(&s->parser, &cfg);
+	}
+
+	uint64_t requests = 0, popped = 0;
+	uint64_t pop_cycles = 0;
+	uint32_t last_rx_time = 0;
+	int errors = 0;
+
+	for (;;) {
+		// The next request to complete, across all the sensors
+		struct sensor *next = NULL;
+		uint64_t next_ns = 0;
+		for (uint32_t i = 0; i < nsensors; i++) {
+			struct sensor *s = &sensors[i];
+			const uint32_t nbytes = lidar_parser_rx_len(&s->parser);
+			const uint64_t t = s->now_ns + nbytes * s->byte_ns;
+
+			if (s->len - s->done >= nbytes && (!next || t < next_ns)) {
+				next = s;
+				next_ns = t;
+			}
+		}
+
+		if (next) {
+			next->now_ns = sim_now_ns = next_ns;
+			sensor_rx(next);
+			requests++;
+
+			if (requests % drain_every) {
+				continue;
+			}
+		}
+
+		struct lidar_frame_ref ref;
+		for (;;) {
+			const uint64_t c0 = bench_cycles();
+			const bool got = lidar_merge_pop(&merge, &ref);
+			pop_cycles += bench_cycles() - c0;
+
+			if (!got) {
+				break;
+			}
+
+			struct sensor *s = &sensors[ref.sensor_id];
+			const struct lidar_frame *frame = ref.frame;
+
+			if ((int32_t)(ref.rx_time - last_rx_time) < 0) {
+				fprintf(stderr, "out of order: %u after %u\n", ref.rx_time, last_rx_time);
+				errors++;
+			}
+			last_rx_time = ref.rx_time;
+
+			if (frame->header != LIDAR_FRAME_HEADER ||
+			    lidar_crc8_update(0, (const uint8_t *)frame, LIDAR_FRAME_SIZE - 1) != frame->crc8) {
+				fprintf(stderr, "sensor %u: corrupt frame\n", ref.sensor_id);
+				errors++;
+			}
+
+			// The sensor timestamp wraps at 30000 ms
+			if (s->popped && (frame->timestamp + 30000 - s->last_timestamp) % 30000 > 15000) {
+				fprintf(stderr, "sensor %u: frame out of order\n", ref.sensor_id);
+				errors++;
+			}
+			s->last_timestamp = frame->timestamp;
+			s->popped++;
+			popped++;
+
+			lidar_parser_release(&s->parser, ref.frame);
+		}
+
+		if (!next) {
+			break;
+		}
+	}
+
+	for (uint32_t i = 0; i < nsensors; i++) {
+		struct lidar_parser_stats stats;
+		lidar_parser_get_stats(&sensors[i].parser, &stats);
+
+		printf("sensor%u_frames: %u\n", i, sensors[i].popped);
+		printf("sensor%u_dropped: %u\n", i, stats.frames_dropped);
+
+		if (sensors[i].popped != stats.frames) {
+			fprintf(stderr, "sensor %u: %u frames delivered, %u merged\n",
+				i, stats.frames, sensors[i].popped);
+			errors++;
+		}
+
+		free(sensors[i].stream);
+	}
+
+	printf("requests: %lu\n", (unsigned long)requests);
+	printf("merged_frames: %lu\n", (unsigned long)popped);
+	if (popped) {
+		printf(BENCH_CYCLES_UNIT "_per_pop: %.1f\n", (double)pop_cycles / popped);
+	}
+	printf("errors: %d\n", errors);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,205 @@
+// Parser throughput benchmark
+//
+// Replays a byte stream through the parser, fed in exactly the same chunks as
+// the DMA would deliver them, and reports throughput and the parser's
+// counters. Exits non-zero if the counters don't add up.
+//
+// The stream is either synthetic, or a raw capture of the sensor's UART output
+// (e.g. from a USB-serial adapter: `cat /dev/ttyUSB0 > capture.bin`).
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lidar_parser.h"
+
+#include "bench.h"
+#include "synth.h"
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-f capture.bin] [-n nframes] [-r repeats] [-b batch] [-j junk]\n"
+		"  -f  Replay a raw UART capture instead of synthetic data\n"
+		"  -b  Frames per request (batch_frames, default 1)\n"
+		"  -j  Bytes of junk (full of false headers) between synthetic frames\n"
+		"  -n  Number of synthetic frames to generate (default 100000)\n"
+		"  -r  Number of times to replay the stream (default 10)\n",
+		prog);
+}
+
+static uint8_t *load_file(const char *path, uint32_t *len)
+{
+	FILE *fp = fopen(path, "rb");
+	if (!fp) {
+		perror(path);
+		return NULL;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	uint8_t *buf = malloc(size);
+	if (!buf || fread(buf, 1, size, fp) != (size_t)size) {
+		fprintf(stderr, "%s: read failed\n", path);
+		free(buf);
+		fclose(fp);
+		return NULL;
+	}
+
+	fclose(fp);
+	*len = size;
+
+	return buf;
+}
+
+// Same as lidar_parser_feed(), but counting the requests, which is the
+// number of DMA interrupts there would be.
+static uint64_t replay(struct lidar_parser *parser, const uint8_t *data, uint32_t len)
+{
+	uint64_t requests = 0;
+	uint32_t done = 0;
+
+	while (len - done >= lidar_parser_rx_len(parser)) {
+		const uint32_t nbytes = lidar_parser_rx_len(parser);
+
+		memcpy(lidar_parser_rx_buf(parser), data + done, nbytes);
+		done += nbytes;
+
+		lidar_parser_rx_done(parser);
+		requests++;
+	}
+
+	return requests;
+}
+
+static void count_frame(void *cb_data, struct lidar_frame *frame)
+{
+	uint64_t *nframes = cb_data;
+
+	(*nframes)++;
+	bench_sink(frame);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = NULL;
+	uint32_t nframes = 100000;
+	int repeats = 10;
+	uint32_t batch = 1;
+	uint32_t junk = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:n:r:b:j:h")) != -1) {
+		switch (opt) {
+		case 'j':
+			junk = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			batch = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			path = optarg;
+			break;
+		case 'n':
+			nframes = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	uint8_t *stream;
+	uint32_t len;
+
+	if (path) {
+		stream = load_file(path, &len);
+		if (!stream) {
+			return 1;
+		}
+	} else {
+		struct synth_state st;
+		synth_init(&st, 1, 10);
+
+		len = nframes * (LIDAR_FRAME_SIZE + junk);
+		stream = malloc(len);
+		for (uint32_t i = 0; i < nframes; i++) {
+			uint8_t *p = stream + i * (LIDAR_FRAME_SIZE + junk);
+			synth_junk(&st, p, junk);
+			synth_stream(&st, p + junk, 1);
+		}
+	}
+
+	struct lidar_parser parser;
+	uint64_t frames = 0;
+	struct lidar_parser_cfg cfg = {
+		.frame_cb = count_frame,
+		.frame_cb_data = &frames,
+		.batch_frames = batch,
+	};
+
+	// Warm-up pass, which also counts how many frames a pass produces
+	lidar_parser_init(&parser, &cfg);
+	const uint64_t requests_per_pass = replay(&parser, stream, len);
+	const uint64_t frames_per_pass = frames;
+
+	struct lidar_parser_stats stats;
+	lidar_parser_get_stats(&parser, &stats);
+
+	int errors = 0;
+	if (stats.frames != frames_per_pass || stats.requests != requests_per_pass ||
+	    stats.bytes_rx > len || len - stats.bytes_rx >= LIDAR_HW_BUF_SIZE) {
+		fprintf(stderr, "stats don't match the replay\n");
+		errors++;
+	}
+
+	frames = 0;
+	const uint64_t t0 = bench_now_ns();
+	const uint64_t c0 = bench_cycles();
+
+	for (int i = 0; i < repeats; i++) {
+		lidar_parser_init(&parser, &cfg);
+		replay(&parser, stream, len);
+	}
+
+	const uint64_t c1 = bench_cycles();
+	const uint64_t t1 = bench_now_ns();
+
+	const double secs = (t1 - t0) / 1e9;
+	const double bytes = (double)len * repeats;
+	const double bytes_per_sec = bytes / secs;
+
+	printf("stream_bytes: %u\n", len);
+	printf("frames_per_pass: %lu\n", (unsigned long)frames_per_pass);
+	printf("requests_per_pass: %lu\n", (unsigned long)requests_per_pass);
+	if (frames_per_pass) {
+		printf("requests_per_frame: %.3f\n", (double)requests_per_pass / frames_per_pass);
+	}
+	printf("crc_errors_per_pass: %u\n", stats.crc_errors);
+	printf("bytes_skipped_per_pass: %u\n", stats.bytes_skipped);
+	printf("short_requests_per_pass: %u\n", stats.short_requests);
+	printf("frames: %lu\n", (unsigned long)frames);
+	printf("elapsed_s: %.6f\n", secs);
+	printf("frames_per_s: %.0f\n", frames / secs);
+	printf("bytes_per_s: %.0f\n", bytes_per_sec);
+	if (frames) {
+		printf(BENCH_CYCLES_UNIT "_per_frame: %.1f\n", (double)(c1 - c0) / frames);
+	}
+	printf(BENCH_CYCLES_UNIT "_per_byte: %.2f\n", (double)(c1 - c0) / bytes);
+	// How many sensors' worth of data one core could parse
+	printf("sensors_per_core: %.0f\n", bytes_per_sec / BENCH_SENSOR_BYTES_PER_SEC);
+
+	printf("errors: %d\n", errors);
+
+	free(stream);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,215 @@
+// Point generation benchmark
+//
+// Compares the fixed-point lidar_frame_to_points()/lidar_points_to_xy()
+// against the equivalent float maths, for both accuracy and speed, and checks
+// lidar_atan2() against atan2() over the whole int32 range. Also checks that
+// frames with corrupt angles, which can still pass the CRC, are treated as
+// if the angles had wrapped.
+// Exits non-zero if the fixed-point results are out of tolerance.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "lidar_parser.h"
+#include "lidar_points.h"
+
+#include "bench.h"
+#include "synth.h"
+
+// Angles within one centi-degree (rounding). Positions within 3 mm at up to
+// 12 m, most of which comes from rounding the angle to 0.01 degrees (~1 mm
+// at 12 m) and the result to whole mm.
+#define ANGLE_TOLERANCE 1.0
+#define XY_TOLERANCE 3.0
+// Rounding to the nearest centi-degree, plus the CORDIC's own error
+#define ATAN2_TOLERANCE 0.6
+
+struct float_point {
+	float angle;
+	float x;
+	float y;
+};
+
+// The float version, as it would be written without worrying about cost.
+static void float_points(const struct lidar_frame *frame, struct float_point *points)
+{
+	float start = frame->start_angle * 0.01f;
+	float end = frame->end_angle * 0.01f;
+	if (end < start) {
+		end += 360.0f;
+	}
+
+	const float step = (end - start) / (LIDAR_SAMPLES_PER_FRAME - 1);
+
+	for (int i = 0; i < LIDAR_SAMPLES_PER_FRAME; i++) {
+		float angle = start + step * i;
+		if (angle >= 360.0f) {
+			angle -= 360.0f;
+		}
+
+		const float rads = angle * (float)M_PI / 180.0f;
+		const float d = frame->samples[i].distance_mm;
+
+		points[i].angle = angle;
+		points[i].x = d * cosf(rads);
+		points[i].y = d * sinf(rads);
+	}
+}
+
+static double angle_diff(double a, double b)
+{
+	double d = fabs(a - b);
+
+	return d > 18000 ? 36000 - d : d;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t nframes = 100000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nframes = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n nframes]\n", argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	struct synth_state st;
+	synth_init(&st, 1, 10);
+
+	struct lidar_frame *frames = malloc(nframes * sizeof(*frames));
+	for (uint32_t i = 0; i < nframes; i++) {
+		synth_frame(&st, &frames[i]);
+
+		// Use arbitrary angle spans, including ones which wrap past
+		// 0, and spread the distances over the full range, to check
+		// the worst case for the Cartesian conversion.
+		frames[i].start_angle = synth_rand(&st) % LIDAR_ANGLE_MAX;
+		frames[i].end_angle = (frames[i].start_angle + synth_rand(&st) % 2000) % LIDAR_ANGLE_MAX;
+		for (int j = 0; j < LIDAR_SAMPLES_PER_FRAME; j++) {
+			frames[i].samples[j].distance_mm = synth_rand(&st) % 12000;
+		}
+	}
+
+	// Accuracy
+	double max_angle_err = 0, max_xy_err = 0;
+	for (uint32_t i = 0; i < nframes; i++) {
+		struct lidar_point points[LIDAR_SAMPLES_PER_FRAME];
+		struct lidar_point_xy xy[LIDAR_SAMPLES_PER_FRAME];
+		struct float_point ref[LIDAR_SAMPLES_PER_FRAME];
+
+		lidar_frame_to_points(&frames[i], points);
+		lidar_points_to_xy(points, xy, LIDAR_SAMPLES_PER_FRAME);
+		float_points(&frames[i], ref);
+
+		for (int j = 0; j < LIDAR_SAMPLES_PER_FRAME; j++) {
+			double err = angle_diff(points[j].angle, ref[j].angle * 100.0);
+			if (err > max_angle_err) {
+				max_angle_err = err;
+			}
+
+			err = hypot(xy[j].x_mm - ref[j].x, xy[j].y_mm - ref[j].y);
+			if (err > max_xy_err) {
+				max_xy_err = err;
+			}
+		}
+	}
+
+	// The inverse, over the whole range including the extremes
+	double max_atan2_err = 0;
+	for (uint32_t i = 0; i < nframes; i++) {
+		int32_t x = synth_rand(&st);
+		int32_t y = synth_rand(&st);
+
+		// Small vectors too, which have the least precision
+		const uint32_t shift = i % 32;
+		x >>= shift;
+		y >>= shift;
+		if (!x && !y) {
+			continue;
+		}
+
+		double ref = atan2(y, x) * 18000.0 / M_PI;
+		if (ref < 0) {
+			ref += 36000;
+		}
+
+		const double err = angle_diff(lidar_atan2(y, x), ref);
+		if (err > max_atan2_err) {
+			max_atan2_err = err;
+		}
+	}
+
+	// Any 16-bit angles, as a corrupt frame might have
+	uint32_t bad_angles = 0;
+	for (uint32_t i = 0; i < nframes; i++) {
+		struct lidar_frame frame = frames[i], wrapped;
+		struct lidar_point points[LIDAR_SAMPLES_PER_FRAME];
+		struct float_point ref[LIDAR_SAMPLES_PER_FRAME];
+
+		frame.start_angle = synth_rand(&st);
+		frame.end_angle = synth_rand(&st);
+		wrapped = frame;
+		wrapped.start_angle %= LIDAR_ANGLE_MAX;
+		wrapped.end_angle %= LIDAR_ANGLE_MAX;
+
+		lidar_frame_to_points(&frame, points);
+		float_points(&wrapped, ref);
+
+		for (int j = 0; j < LIDAR_SAMPLES_PER_FRAME; j++) {
+			bad_angles += points[j].angle >= LIDAR_ANGLE_MAX ||
+			              angle_diff(points[j].angle, ref[j].angle * 100.0) > ANGLE_TOLERANCE;
+		}
+	}
+
+	// Speed
+	const uint64_t nsamples = (uint64_t)nframes * LIDAR_SAMPLES_PER_FRAME;
+	struct lidar_point points[LIDAR_SAMPLES_PER_FRAME];
+	struct lidar_point_xy xy[LIDAR_SAMPLES_PER_FRAME];
+	struct float_point ref[LIDAR_SAMPLES_PER_FRAME];
+
+	uint64_t c0 = bench_cycles();
+	for (uint32_t i = 0; i < nframes; i++) {
+		lidar_frame_to_points(&frames[i], points);
+		bench_sink(points);
+	}
+	uint64_t c1 = bench_cycles();
+	for (uint32_t i = 0; i < nframes; i++) {
+		lidar_frame_to_points(&frames[i], points);
+		lidar_points_to_xy(points, xy, LIDAR_SAMPLES_PER_FRAME);
+		bench_sink(xy);
+	}
+	uint64_t c2 = bench_cycles();
+	for (uint32_t i = 0; i < nframes; i++) {
+		float_points(&frames[i], ref);
+		bench_sink(ref);
+	}
+	uint64_t c3 = bench_cycles();
+
+	printf("max_angle_error_centideg: %.3f\n", max_angle_err);
+	printf("max_xy_error_mm: %.3f\n", max_xy_err);
+	printf("max_atan2_error_centideg: %.3f\n", max_atan2_err);
+	printf("corrupt_frame_bad_angles: %u\n", bad_angles);
+	printf("fixed_points_" BENCH_CYCLES_UNIT "_per_sample: %.2f\n", (double)(c1 - c0) / nsamples);
+	printf("fixed_xy_" BENCH_CYCLES_UNIT "_per_sample: %.2f\n", (double)(c2 - c1) / nsamples);
+	printf("float_xy_" BENCH_CYCLES_UNIT "_per_sample: %.2f\n", (double)(c3 - c2) / nsamples);
+
+	free(frames);
+
+	if (max_angle_err > ANGLE_TOLERANCE || max_xy_err > XY_TOLERANCE ||
+	    max_atan2_err > ATAN2_TOLERANCE || bad_angles) {
+		fprintf(stderr, "fixed-point results out of tolerance\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,306 @@
+// Host reader benchmark
+//
+// Packs synthetic frames from two sensors into raw endpoint transfers, the
+// same way the device does, with corrupted frames, lost transfers and
+// device-side drops mixed in, and decodes them with lidar_reader. The
+// counters and revolutions are checked against what was generated. Then the
+// same frames are fed as a byte stream, split into random chunks.
+// Reports the cost per frame, and exits non-zero if the checks fail.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lidar_reader.h"
+#include "lidar_scan.h"
+
+#include "bench.h"
+#include "synth.h"
+
+#define NSENSORS 2
+
+struct counts {
+	uint32_t scans[NSENSORS];
+	uint32_t samples[NSENSORS];
+};
+
+static void reader_scan_cb(void *cb_data, uint8_t sensor_id, const struct lidar_scan *scan)
+{
+	struct counts *c = cb_data;
+
+	c->scans[sensor_id]++;
+	c->samples[sensor_id] += scan->nsamples;
+}
+
+static void ref_scan_cb(void *cb_data, const struct lidar_scan *scan)
+{
+	uint32_t *c = cb_data;
+
+	c[0]++;
+	c[1] += scan->nsamples;
+}
+
+struct xfer_stream {
+	uint8_t *buf;
+	uint32_t *offs;
+	uint32_t *lens;
+	uint32_t nxfers;
+	uint32_t len;
+
+	// What the reader should see
+	uint32_t frames[NSENSORS];
+	uint32_t corrupt;
+	uint32_t missed;
+	uint32_t dropped;
+	struct counts expected;
+};
+
+static void gen_xfers(struct xfer_stream *xs, uint32_t nframes)
+{
+	struct synth_state st[NSENSORS];
+	struct lidar_scan_assembler ref[NSENSORS];
+	uint32_t ref_counts[NSENSORS][2] = { 0 };
+	uint32_t seq = 0;
+	uint32_t dropped = 0;
+
+	for (int i = 0; i < NSENSORS; i++) {
+		synth_init(&st[i], i + 1, 10 + i);
+		lidar_scan_init(&ref[i], ref_scan_cb, ref_counts[i]);
+	}
+
+	memset(xs, 0, sizeof(*xs));
+	const uint32_t max_xfers = nframes;
+	xs->buf = malloc((size_t)max_xfers * LIDAR_READER_XFER_READ_SIZE);
+	xs->offs = malloc(max_xfers * sizeof(*xs->offs));
+	xs->lens = malloc(max_xfers * sizeof(*xs->lens));
+
+	uint32_t generated = 0;
+	while (generated < nframes && xs->nxfers < max_xfers) {
+		uint8_t *p = xs->buf + xs->len;
+		struct lidar_reader_xfer_header hdr = { 0 };
+		const bool lost = synth_rand(&st[0]) % 300 == 0;
+
+		hdr.seq = seq++;
+		hdr.frame_size = LIDAR_FRAME_SIZE;
+		hdr.nframes = 1 + synth_rand(&st[0]) % LIDAR_READER_XFER_MAX_FRAMES;
+		if (hdr.nframes > nframes - generated) {
+			hdr.nframes = nframes - generated;
+		}
+
+		// Frames which didn't fit on the device
+		if (synth_rand(&st[0]) % 100 == 0) {
+			dropped += 1 + synth_rand(&st[0]) % 4;
+		}
+		hdr.dropped = dropped;
+
+		struct lidar_frame *frames = (struct lidar_frame *)(p + sizeof(hdr));
+		for (uint32_t i = 0; i < hdr.nframes; i++) {
+			const uint8_t sensor_id = synth_rand(&st[0]) % NSENSORS;
+
+			hdr.sensor_ids |= sensor_id << i;
+			synth_frame(&st[sensor_id], &frames[i]);
+
+			if (lost) {
+				continue;
+			}
+
+			if (synth_rand(&st[0]) % 500 == 0) {
+				frames[i].samples[synth_rand(&st[0]) % LIDAR_SAMPLES_PER_FRAME].distance_mm ^= 0x10;
+				xs->corrupt++;
+				continue;
+			}
+
+			xs->frames[sensor_id]++;
+			lidar_scan_add_frame(&ref[sensor_id], &frames[i]);
+		}
+		generated += hdr.nframes;
+
+		memcpy(p, &hdr, sizeof(hdr));
+
+		if (lost) {
+			xs->missed++;
+			continue;
+		}
+
+		// The reader only knows about the drops it's been told about
+		xs->dropped = dropped;
+
+		uint32_t len = sizeof(hdr) + hdr.nframes * LIDAR_FRAME_SIZE;
+		// Padding, so it ends with a short packet
+		if (len % 64 == 0) {
+			p[len++] = 0;
+		}
+
+		xs->offs[xs->nxfers] = xs->len;
+		xs->lens[xs->nxfers] = len;
+		xs->nxfers++;
+		xs->len += LIDAR_READER_XFER_READ_SIZE;
+	}
+
+	for (int i = 0; i < NSENSORS; i++) {
+		xs->expected.scans[i] = ref_counts[i][0];
+		xs->expected.samples[i] = ref_counts[i][1];
+	}
+}
+
+static int check_stats(const char *name, const struct lidar_reader_stats *stats, const struct counts *got,
+                       const uint32_t *frames, const struct counts *expected,
+                       uint32_t corrupt, uint32_t missed, uint32_t dropped)
+{
+	int errors = 0;
+
+	for (int i = 0; i < NSENSORS; i++) {
+		if (stats->frames[i] != frames[i]) {
+			fprintf(stderr, "%s: sensor %d: %u frames, expected %u\n", name, i, stats->frames[i], frames[i]);
+			errors++;
+		}
+		if (got->scans[i] != expected->scans[i] || got->samples[i] != expected->samples[i]) {
+			fprintf(stderr, "%s: sensor %d: %u revolutions (%u samples), expected %u (%u)\n", name, i,
+			        got->scans[i], got->samples[i], expected->scans[i], expected->samples[i]);
+			errors++;
+		}
+	}
+
+	if (stats->crc_errors != corrupt || stats->xfers_missed != missed || stats->device_dropped != dropped) {
+		fprintf(stderr, "%s: %u crc errors, %u missed, %u dropped, expected %u, %u, %u\n", name,
+		        stats->crc_errors, stats->xfers_missed, stats->device_dropped, corrupt, missed, dropped);
+		errors++;
+	}
+
+	return errors;
+}
+
+static int run_xfers(uint32_t nframes)
+{
+	struct xfer_stream xs;
+	gen_xfers(&xs, nframes);
+
+	static struct lidar_reader reader;
+	struct counts got = { 0 };
+	struct lidar_reader_cfg cfg = {
+		.scan_cb = reader_scan_cb,
+		.cb_data = &got,
+	};
+	lidar_reader_init(&reader, &cfg);
+
+	const uint64_t c0 = bench_cycles();
+	const uint64_t t0 = bench_now_ns();
+	for (uint32_t i = 0; i < xs.nxfers; i++) {
+		lidar_reader_xfer(&reader, xs.buf + xs.offs[i], xs.lens[i]);
+	}
+	const uint64_t t1 = bench_now_ns();
+	const uint64_t c1 = bench_cycles();
+
+	struct lidar_reader_stats stats;
+	lidar_reader_get_stats(&reader, &stats);
+
+	int errors = check_stats("xfer", &stats, &got, xs.frames, &xs.expected, xs.corrupt, xs.missed, xs.dropped);
+
+	// Malformed transfers are rejected without touching anything
+	struct lidar_reader_xfer_header bad = { .nframes = 2, .frame_size = LIDAR_FRAME_SIZE };
+	if (lidar_reader_xfer(&reader, (const uint8_t *)&bad, sizeof(bad) + LIDAR_FRAME_SIZE) ||
+	    lidar_reader_xfer(&reader, (const uint8_t *)&bad, sizeof(bad) - 1)) {
+		fprintf(stderr, "xfer: malformed transfer accepted\n");
+		errors++;
+	}
+
+	const uint32_t total = stats.frames[0] + stats.frames[1];
+	const double secs = (t1 - t0) / 1e9;
+
+	printf("xfer: transfers: %u frames: %u revolutions: %u " BENCH_CYCLES_UNIT "_per_frame: %.1f "
+	       "frames_per_s: %.0f sensors_per_core: %.0f errors: %d\n",
+	       xs.nxfers, total, got.scans[0] + got.scans[1], (double)(c1 - c0) / total,
+	       total / secs, total / secs / (LIDAR_SAMPLE_RATE_HZ / LIDAR_SAMPLES_PER_FRAME), errors);
+
+	free(xs.lens);
+	free(xs.offs);
+	free(xs.buf);
+
+	return errors;
+}
+
+static int run_stream(uint32_t nframes)
+{
+	struct synth_state st;
+	struct lidar_scan_assembler ref;
+	uint32_t ref_counts[2] = { 0 };
+
+	synth_init(&st, 3, 10);
+	lidar_scan_init(&ref, ref_scan_cb, ref_counts);
+
+	uint8_t *stream = malloc(nframes * LIDAR_FRAME_SIZE);
+	synth_stream(&st, stream, nframes);
+	for (uint32_t i = 0; i < nframes; i++) {
+		lidar_scan_add_frame(&ref, (struct lidar_frame *)(stream + i * LIDAR_FRAME_SIZE));
+	}
+
+	static struct lidar_reader reader;
+	struct counts got = { 0 };
+	struct lidar_reader_cfg cfg = {
+		.scan_cb = reader_scan_cb,
+		.cb_data = &got,
+	};
+	lidar_reader_init(&reader, &cfg);
+
+	// Random chunks, like reads from a pty
+	const uint32_t len = nframes * LIDAR_FRAME_SIZE;
+	uint32_t *chunks = malloc(len * sizeof(*chunks));
+	uint32_t nchunks = 0;
+	for (uint32_t offs = 0; offs < len; nchunks++) {
+		chunks[nchunks] = 1 + synth_rand(&st) % 4096;
+		if (chunks[nchunks] > len - offs) {
+			chunks[nchunks] = len - offs;
+		}
+		offs += chunks[nchunks];
+	}
+
+	const uint64_t c0 = bench_cycles();
+	for (uint32_t i = 0, offs = 0; i < nchunks; i++) {
+		lidar_reader_feed(&reader, stream + offs, chunks[i]);
+		offs += chunks[i];
+	}
+	const uint64_t c1 = bench_cycles();
+
+	struct lidar_reader_stats stats;
+	lidar_reader_get_stats(&reader, &stats);
+
+	const uint32_t frames[NSENSORS] = { nframes, 0 };
+	const struct counts expected = { { ref_counts[0], 0 }, { ref_counts[1], 0 } };
+
+	int errors = check_stats("stream", &stats, &got, frames, &expected, 0, 0, 0);
+
+	printf("stream: frames: %u revolutions: %u " BENCH_CYCLES_UNIT "_per_frame: %.1f errors: %d\n",
+	       stats.frames[0], got.scans[0], (double)(c1 - c0) / nframes, errors);
+
+	free(chunks);
+	free(stream);
+
+	return errors;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t nframes = 200000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nframes = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n nframes]\n", argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	int errors = run_xfers(nframes);
+	errors += run_stream(nframes);
+
+	printf("errors: %d\n", errors);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,543 @@
+// Parser robustness benchmark
+//
+// Generates streams with different kinds of damage - bit errors, dropped
+// bytes, junk full of false headers, and frames cut short - and replays each
+// one through the parser in the same sized chunks as the DMA would deliver
+// them, with every batch size. Each generated frame carries a sequence number
+// in its sample data, so every frame the parser delivers can be matched to
+// the one which was sent.
+//
+// For each class of stream it reports the frames recovered and lost, false
+// frames (damaged ones which still passed the CRC), how many bytes after each
+// corruption it took to deliver an intact frame again, and the cost per byte,
+// with percentiles of the cost of a single request (i.e. the time spent in
+// the DMA interrupt). The output is one "key: value" per line, with keys
+// prefixed by the class, so runs can be diffed.
+//
+// Exits non-zero if any frame is delivered twice or out of order, if an intact
+// frame is lost without a false frame to account for it, if the parser never
+// gets back in sync, or if anything at all goes wrong with a clean stream.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "crc8.h"
+#include "lidar_parser.h"
+
+#include "bench.h"
+#include "synth.h"
+
+// Most junk inserted in one go by the false header class
+#define MAX_JUNK 64
+// Most bytes removed in one go by the drop class
+#define MAX_DROP 3
+// Undamaged frames on the end of every stream, so that whatever the batch
+// size, the parser has a chance to deliver everything before the data ends.
+#define TAIL_FRAMES (2 * LIDAR_HW_NUM_SLOTS)
+
+#define NOT_DELIVERED UINT32_MAX
+
+enum stream_class {
+	CLASS_CLEAN,
+	CLASS_BITFLIP,
+	CLASS_DROP,
+	CLASS_FALSE_HEADER,
+	CLASS_PARTIAL,
+	CLASS_MIXED,
+	NUM_CLASSES,
+};
+
+static const char *const class_names[NUM_CLASSES] = {
+	[CLASS_CLEAN] = "clean",
+	[CLASS_BITFLIP] = "bitflip",
+	[CLASS_DROP] = "drop",
+	[CLASS_FALSE_HEADER] = "false_header",
+	[CLASS_PARTIAL] = "partial",
+	[CLASS_MIXED] = "mixed",
+};
+
+struct stream {
+	uint8_t *data;
+	uint32_t len;
+
+	// Frames as generated, including the tail
+	struct lidar_frame *frames;
+	uint32_t nframes;
+	uint32_t total_frames;
+	// Whether each frame was sent undamaged, and where it starts
+	bool *intact;
+	uint32_t *start;
+
+	// Stream offset of each corruption, in order
+	uint32_t *events;
+	uint32_t nevents;
+};
+
+struct delivered {
+	struct lidar_frame frame;
+	// Bytes of the stream received when it was delivered
+	uint32_t pos;
+};
+
+struct run {
+	struct delivered *out;
+	uint32_t max_out;
+	uint32_t nout;
+	uint32_t pos;
+};
+
+struct result {
+	uint32_t intact;
+	uint32_t recovered;
+	uint32_t lost;
+	uint32_t false_frames;
+	uint32_t duplicates;
+	uint32_t unresolved;
+	struct lidar_parser_stats stats;
+
+	uint32_t resync_p50;
+	uint32_t resync_p99;
+	uint32_t resync_max;
+
+	// Timings, in BENCH_CYCLES_UNIT
+	uint64_t cycles;
+	uint32_t req_p50;
+	uint32_t req_p99;
+	uint32_t req_p999;
+	uint32_t req_max;
+};
+
+static bool chance(struct synth_state *st, double rate)
+{
+	return (synth_rand(st) >> 8) < rate * (1 << 24);
+}
+
+static void make_frame(struct synth_state *st, struct lidar_frame *frame, uint32_t seq)
+{
+	synth_frame(st, frame);
+
+	frame->samples[0].distance_mm = seq & 0xffff;
+	frame->samples[1].distance_mm = seq >> 16;
+	frame->crc8 = CalCRC8((uint8_t *)frame, LIDAR_FRAME_SIZE - 1);
+}
+
+static uint32_t frame_seq(const struct lidar_frame *frame)
+{
+	return frame->samples[0].distance_mm | ((uint32_t)frame->samples[1].distance_mm << 16);
+}
+
+// Junk full of false headers. Half of them are followed by the start of a
+// real frame, so they pass the structural checks and cost a CRC (or, at the
+// end of the data, make the parser wait for the rest).
+static void false_headers(struct synth_state *st, uint8_t *buf, uint32_t len,
+                          const struct lidar_frame *like)
+{
+	synth_junk(st, buf, len);
+
+	for (uint32_t i = 0; i < len; i++) {
+		if (buf[i] == LIDAR_FRAME_HEADER && (synth_rand(st) & 1)) {
+			uint32_t n = offsetof(struct lidar_frame, samples);
+			if (n > len - i) {
+				n = len - i;
+			}
+			memcpy(&buf[i], like, n);
+			i += n - 1;
+		}
+	}
+}
+
+enum damage {
+	DAMAGE_NONE,
+	DAMAGE_BITFLIP,
+	DAMAGE_DROP,
+	DAMAGE_JUNK,
+	DAMAGE_CUT,
+};
+
+static enum damage pick_damage(struct synth_state *st, enum stream_class cls, double rate)
+{
+	if (cls == CLASS_CLEAN || !chance(st, rate)) {
+		return DAMAGE_NONE;
+	}
+
+	switch (cls) {
+	case CLASS_BITFLIP:
+		return DAMAGE_BITFLIP;
+	case CLASS_DROP:
+		return DAMAGE_DROP;
+	case CLASS_FALSE_HEADER:
+		return DAMAGE_JUNK;
+	case CLASS_PARTIAL:
+		return DAMAGE_CUT;
+	default:
+		return DAMAGE_BITFLIP + synth_rand(st) % 4;
+	}
+}
+
+static void stream_generate(struct stream *s, enum stream_class cls, double rate, uint32_t seed)
+{
+	struct synth_state st;
+	synth_init(&st, seed, 10);
+
+	s->len = 0;
+	s->nevents = 0;
+
+	for (uint32_t i = 0; i < s->total_frames; i++) {
+		struct lidar_frame *frame = &s->frames[i];
+		make_frame(&st, frame, i);
+
+		const enum damage damage = i < s->nframes ? pick_damage(&st, cls, rate) : DAMAGE_NONE;
+		uint8_t *p = s->data + s->len;
+		uint32_t n;
+
+		if (damage == DAMAGE_JUNK) {
+			n = 1 + synth_rand(&st) % MAX_JUNK;
+			false_headers(&st, p, n, frame);
+			s->events[s->nevents++] = s->len;
+			s->len += n;
+			p += n;
+		}
+
+		memcpy(p, frame, LIDAR_FRAME_SIZE);
+		s->start[i] = s->len;
+		s->intact[i] = false;
+
+		switch (damage) {
+		case DAMAGE_BITFLIP:
+			n = synth_rand(&st) % LIDAR_FRAME_SIZE;
+			p[n] ^= 1 << (synth_rand(&st) % 8);
+			s->events[s->nevents++] = s->len + n;
+			s->len += LIDAR_FRAME_SIZE;
+			break;
+		case DAMAGE_DROP: {
+			const uint32_t ndrop = 1 + synth_rand(&st) % MAX_DROP;
+			n = synth_rand(&st) % (LIDAR_FRAME_SIZE - ndrop + 1);
+			memmove(p + n, p + n + ndrop, LIDAR_FRAME_SIZE - n - ndrop);
+			s->events[s->nevents++] = s->len + n;
+			s->len += LIDAR_FRAME_SIZE - ndrop;
+			break;
+		}
+		case DAMAGE_CUT:
+			n = 1 + synth_rand(&st) % (LIDAR_FRAME_SIZE - 1);
+			s->events[s->nevents++] = s->len + n;
+			s->len += n;
+			break;
+		default:
+			s->intact[i] = true;
+			s->len += LIDAR_FRAME_SIZE;
+			break;
+		}
+	}
+}
+
+static void record_frame(void *cb_data, struct lidar_frame *frame)
+{
+	struct run *run = cb_data;
+
+	if (run->nout < run->max_out) {
+		run->out[run->nout].frame = *frame;
+		run->out[run->nout].pos = run->pos;
+	}
+	run->nout++;
+}
+
+// Same as lidar_parser_feed(), but timing each request. Returns the number of
+// requests, and adds up their total cost in 'total_cycles'.
+static uint32_t replay(struct lidar_parser *parser, struct run *run, const struct stream *s,
+                       uint32_t *req_cycles, uint64_t *total_cycles)
+{
+	uint32_t nreq = 0;
+	uint32_t done = 0;
+
+	run->nout = 0;
+
+	while (s->len - done >= lidar_parser_rx_len(parser)) {
+		const uint32_t nbytes = lidar_parser_rx_len(parser);
+
+		memcpy(lidar_parser_rx_buf(parser), s->data + done, nbytes);
+		done += nbytes;
+		run->pos = done;
+
+		const uint64_t c0 = bench_cycles();
+		lidar_parser_rx_done(parser);
+		const uint64_t c = bench_cycles() - c0;
+
+		req_cycles[nreq++] = c;
+		*total_cycles += c;
+	}
+
+	return nreq;
+}
+
+static void analyse(const struct stream *s, const struct run *run, uint32_t *delivered_at,
+                    uint32_t *resync, struct result *res)
+{
+	bool have_last = false;
+	uint32_t last = 0;
+
+	for (uint32_t i = 0; i < s->total_frames; i++) {
+		delivered_at[i] = NOT_DELIVERED;
+	}
+
+	for (uint32_t i = 0; i < run->nout && i < run->max_out; i++) {
+		const struct delivered *d = &run->out[i];
+		const uint32_t seq = frame_seq(&d->frame);
+
+		if (seq >= s->total_frames || !s->intact[seq] ||
+		    memcmp(&d->frame, &s->frames[seq], LIDAR_FRAME_SIZE)) {
+			res->false_frames++;
+			continue;
+		}
+
+		if (have_last && seq <= last) {
+			res->duplicates++;
+			continue;
+		}
+		have_last = true;
+		last = seq;
+
+		delivered_at[seq] = d->pos;
+	}
+
+	for (uint32_t i = 0; i < s->nframes; i++) {
+		if (!s->intact[i]) {
+			continue;
+		}
+
+		res->intact++;
+		if (delivered_at[i] == NOT_DELIVERED) {
+			res->lost++;
+		} else {
+			res->recovered++;
+		}
+	}
+
+	// For each corruption, the first intact frame which starts after it,
+	// and then the first frame from there on which was delivered.
+	uint32_t nresync = 0;
+	uint32_t j = 0;
+	for (uint32_t e = 0; e < s->nevents; e++) {
+		const uint32_t offs = s->events[e];
+
+		while (j < s->total_frames && (!s->intact[j] || s->start[j] < offs)) {
+			j++;
+		}
+
+		uint32_t k = j;
+		while (k < s->total_frames && delivered_at[k] == NOT_DELIVERED) {
+			k++;
+		}
+
+		if (k == s->total_frames) {
+			res->unresolved++;
+			continue;
+		}
+
+		resync[nresync++] = delivered_at[k] - offs;
+	}
+
+	qsort(resync, nresync, sizeof(*resync), bench_cmp_u32);
+	res->resync_p50 = bench_percentile(resync, nresync, 0.5);
+	res->resync_p99 = bench_percentile(resync, nresync, 0.99);
+	res->resync_max = nresync ? resync[nresync - 1] : 0;
+}
+
+static int check(enum stream_class cls, uint32_t batch, const struct result *res)
+{
+	const char *name = class_names[cls];
+	int errors = 0;
+
+	if (res->duplicates) {
+		fprintf(stderr, "%s, batch %u: %u frames delivered twice or out of order\n",
+		        name, batch, res->duplicates);
+		errors++;
+	}
+
+	// A false frame can swallow the start of at most two real ones
+	if (res->lost > 2 * res->false_frames) {
+		fprintf(stderr, "%s, batch %u: %u intact frames lost, but only %u false frames\n",
+		        name, batch, res->lost, res->false_frames);
+		errors++;
+	}
+
+	if (res->unresolved) {
+		fprintf(stderr, "%s, batch %u: never back in sync after %u corruptions\n",
+		        name, batch, res->unresolved);
+		errors++;
+	}
+
+	if (cls == CLASS_CLEAN &&
+	    (res->lost || res->false_frames || res->stats.crc_errors || res->stats.bytes_skipped)) {
+		fprintf(stderr, "%s, batch %u: lost: %u false: %u crc_errors: %u bytes_skipped: %u\n",
+		        name, batch, res->lost, res->false_frames, res->stats.crc_errors,
+		        res->stats.bytes_skipped);
+		errors++;
+	}
+
+	return errors;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-n nframes] [-p rate] [-b batch] [-r repeats] [-s seed]\n"
+		"  -n  Frames per stream (default 20000)\n"
+		"  -p  Chance of each frame being damaged (default 0.05)\n"
+		"  -b  batch_frames to report on (default 1). Every batch size is\n"
+		"      checked regardless.\n"
+		"  -r  Number of timed replays (default 5)\n"
+		"  -s  Random seed (default 1)\n",
+		prog);
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t nframes = 20000;
+	double rate = 0.05;
+	uint32_t report_batch = 1;
+	int repeats = 5;
+	uint32_t seed = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:p:b:r:s:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nframes = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			rate = atof(optarg);
+			break;
+		case 'b':
+			report_batch = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (report_batch < 1 || report_batch > LIDAR_HW_NUM_SLOTS - 1) {
+		fprintf(stderr, "batch must be from 1 to %d\n", LIDAR_HW_NUM_SLOTS - 1);
+		return 1;
+	}
+	if (repeats < 1) {
+		repeats = 1;
+	}
+
+	struct stream s = {
+		.nframes = nframes,
+		.total_frames = nframes + TAIL_FRAMES,
+	};
+	const uint32_t max_len = s.total_frames * (LIDAR_FRAME_SIZE + MAX_JUNK);
+
+	s.data = malloc(max_len);
+	s.frames = malloc(s.total_frames * sizeof(*s.frames));
+	s.intact = malloc(s.total_frames * sizeof(*s.intact));
+	s.start = malloc(s.total_frames * sizeof(*s.start));
+	s.events = malloc(s.total_frames * sizeof(*s.events));
+
+	// Every request is at least one byte
+	uint32_t *req_cycles = malloc((max_len + 1) * sizeof(*req_cycles));
+	uint32_t *delivered_at = malloc(s.total_frames * sizeof(*delivered_at));
+	uint32_t *resync = malloc(s.total_frames * sizeof(*resync));
+
+	struct run run = {
+		.max_out = max_len / LIDAR_FRAME_SIZE + 1,
+	};
+	run.out = malloc(run.max_out * sizeof(*run.out));
+
+	struct lidar_parser parser;
+	int errors = 0;
+
+	printf("sensor: %s\n", LIDAR_SENSOR_NAME);
+	printf("frames: %u\n", nframes);
+	printf("rate: %g\n", rate);
+	printf("batch: %u\n", report_batch);
+
+	for (int cls = 0; cls < NUM_CLASSES; cls++) {
+		const char *name = class_names[cls];
+		struct result report = { 0 };
+
+		stream_generate(&s, cls, rate, seed + cls);
+
+		for (uint32_t batch = 1; batch < LIDAR_HW_NUM_SLOTS; batch++) {
+			const struct lidar_parser_cfg cfg = {
+				.frame_cb = record_frame,
+				.frame_cb_data = &run,
+				.batch_frames = batch,
+			};
+			const int passes = batch == report_batch ? repeats : 1;
+			struct result res = { 0 };
+
+			// Keep the timings from the fastest pass, which is the
+			// one least disturbed by anything else on the machine
+			res.cycles = UINT64_MAX;
+			for (int i = 0; i < passes; i++) {
+				uint64_t cycles = 0;
+
+				lidar_parser_init(&parser, &cfg);
+				const uint32_t nreq = replay(&parser, &run, &s, req_cycles, &cycles);
+				if (cycles >= res.cycles) {
+					continue;
+				}
+
+				qsort(req_cycles, nreq, sizeof(*req_cycles), bench_cmp_u32);
+				res.cycles = cycles;
+				res.req_p50 = bench_percentile(req_cycles, nreq, 0.5);
+				res.req_p99 = bench_percentile(req_cycles, nreq, 0.99);
+				res.req_p999 = bench_percentile(req_cycles, nreq, 0.999);
+				res.req_max = nreq ? req_cycles[nreq - 1] : 0;
+			}
+
+			lidar_parser_get_stats(&parser, &res.stats);
+			analyse(&s, &run, delivered_at, resync, &res);
+			errors += check(cls, batch, &res);
+
+			if (batch == report_batch) {
+				report = res;
+			}
+		}
+
+		printf("%s_stream_bytes: %u\n", name, s.len);
+		printf("%s_corruptions: %u\n", name, s.nevents);
+		printf("%s_frames_intact: %u\n", name, report.intact);
+		printf("%s_frames_recovered: %u\n", name, report.recovered);
+		printf("%s_frames_lost: %u\n", name, report.lost);
+		printf("%s_false_frames: %u\n", name, report.false_frames);
+		printf("%s_crc_errors: %u\n", name, report.stats.crc_errors);
+		printf("%s_bytes_skipped: %u\n", name, report.stats.bytes_skipped);
+		printf("%s_resync_bytes_p50: %u\n", name, report.resync_p50);
+		printf("%s_resync_bytes_p99: %u\n", name, report.resync_p99);
+		printf("%s_resync_bytes_max: %u\n", name, report.resync_max);
+		printf("%s_" BENCH_CYCLES_UNIT "_per_byte: %.2f\n", name, (double)report.cycles / s.len);
+		printf("%s_request_" BENCH_CYCLES_UNIT "_p50: %u\n", name, report.req_p50);
+		printf("%s_request_" BENCH_CYCLES_UNIT "_p99: %u\n", name, report.req_p99);
+		printf("%s_request_" BENCH_CYCLES_UNIT "_p999: %u\n", name, report.req_p999);
+		printf("%s_request_" BENCH_CYCLES_UNIT "_max: %u\n", name, report.req_max);
+	}
+
+	printf("errors: %d\n", errors);
+
+	free(run.out);
+	free(resync);
+	free(delivered_at);
+	free(req_cycles);
+	free(s.events);
+	free(s.start);
+	free(s.intact);
+	free(s.frames);
+	free(s.data);
+
+	return errors ? 1 : 0;
+}
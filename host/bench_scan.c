@@ -0,0 +1,185 @@
+// Scan assembler benchmark
+//
+// Feeds frames (synthetic, or parsed from a raw UART capture) through the
+// scan assembler, checks that the revolutions make sense, and reports the
+// cost per frame. Exits non-zero if the checks fail.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lidar_parser.h"
+#include "lidar_scan.h"
+
+#include "bench.h"
+#include "synth.h"
+
+struct frame_list {
+	struct lidar_frame *frames;
+	uint32_t count;
+	uint32_t cap;
+};
+
+static void collect_frame(void *cb_data, struct lidar_frame *frame)
+{
+	struct frame_list *list = cb_data;
+
+	if (list->count == list->cap) {
+		list->cap = list->cap ? list->cap * 2 : 1024;
+		list->frames = realloc(list->frames, list->cap * sizeof(*frame));
+	}
+
+	list->frames[list->count++] = *frame;
+}
+
+static int load_capture(const char *path, struct frame_list *list)
+{
+	FILE *fp = fopen(path, "rb");
+	if (!fp) {
+		perror(path);
+		return -1;
+	}
+
+	struct lidar_parser parser;
+	struct lidar_parser_cfg cfg = {
+		.frame_cb = collect_frame,
+		.frame_cb_data = list,
+	};
+	lidar_parser_init(&parser, &cfg);
+
+	uint8_t buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		lidar_parser_feed(&parser, buf, n);
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+struct check_state {
+	uint32_t revolutions;
+	uint32_t next_seq;
+	uint32_t min_samples;
+	uint32_t max_samples;
+	int errors;
+};
+
+static void check_scan(void *cb_data, const struct lidar_scan *scan)
+{
+	struct check_state *check = cb_data;
+
+	if (scan->seq != check->next_seq) {
+		fprintf(stderr, "seq %u, expected %u\n", scan->seq, check->next_seq);
+		check->errors++;
+	}
+	check->next_seq = scan->seq + 1;
+
+	if (scan->nsamples < check->min_samples) {
+		check->min_samples = scan->nsamples;
+	}
+	if (scan->nsamples > check->max_samples) {
+		check->max_samples = scan->nsamples;
+	}
+
+	check->revolutions++;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = NULL;
+	uint32_t nframes = 100000;
+	uint32_t scan_hz = 10;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:n:s:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			path = optarg;
+			break;
+		case 'n':
+			nframes = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			scan_hz = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-f capture.bin] [-n nframes] [-s scan_hz]\n", argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	struct frame_list list = { 0 };
+
+	if (path) {
+		if (load_capture(path, &list)) {
+			return 1;
+		}
+	} else {
+		struct synth_state st;
+		synth_init(&st, 1, scan_hz);
+
+		list.cap = list.count = nframes;
+		list.frames = malloc(nframes * sizeof(*list.frames));
+		for (uint32_t i = 0; i < nframes; i++) {
+			synth_frame(&st, &list.frames[i]);
+		}
+	}
+
+	static struct lidar_scan_assembler as;
+	struct check_state check = { .min_samples = UINT32_MAX };
+	uint32_t acquired = 0;
+	int errors = 0;
+
+	lidar_scan_init(&as, check_scan, &check);
+
+	const uint64_t c0 = bench_cycles();
+	for (uint32_t i = 0; i < list.count; i++) {
+		lidar_scan_add_frame(&as, &list.frames[i]);
+
+		// Poll like a consumer would, every few frames
+		if (i % 16 == 0) {
+			const struct lidar_scan *scan = lidar_scan_acquire(&as);
+			if (scan) {
+				if (scan->seq >= check.next_seq) {
+					fprintf(stderr, "acquired unpublished scan %u\n", scan->seq);
+					errors++;
+				}
+				acquired++;
+			}
+		}
+	}
+	const uint64_t c1 = bench_cycles();
+
+	errors += check.errors;
+
+	if (!path && check.revolutions) {
+		// Synthetic data is steady, so every revolution should have
+		// close to the nominal number of samples.
+		const uint32_t nominal = LIDAR_SAMPLE_RATE_HZ / scan_hz;
+		if (check.min_samples < nominal - LIDAR_SAMPLES_PER_FRAME ||
+		    check.max_samples > nominal + LIDAR_SAMPLES_PER_FRAME) {
+			fprintf(stderr, "samples per revolution %u-%u, expected ~%u\n",
+				check.min_samples, check.max_samples, nominal);
+			errors++;
+		}
+	}
+
+	printf("frames: %u\n", list.count);
+	printf("revolutions: %u\n", check.revolutions);
+	printf("acquired: %u\n", acquired);
+	printf("samples_per_revolution: %u-%u\n", check.revolutions ? check.min_samples : 0,
+	       check.max_samples);
+	if (list.count) {
+		printf(BENCH_CYCLES_UNIT "_per_frame: %.1f\n", (double)(c1 - c0) / list.count);
+	}
+	printf("errors: %d\n", errors);
+
+	free(list.frames);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,132 @@
+// Scan rate controller test, against a simulated motor
+//
+// The motor is modelled as first order: its speed heads towards a steady
+// state set by the PWM duty, with time constant 'tau'. The reported speed in
+// each frame has some noise on it. The controller is stepped through a
+// series of target rates, and must lock onto each one within a time limit,
+// and then stay locked. Exits non-zero if it doesn't.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "lidar_parser.h"
+#include "lidar_speed.h"
+
+#include "synth.h"
+
+// The sensor samples at a fixed rate whatever the speed
+#define FRAME_US (LIDAR_SAMPLES_PER_FRAME * 1000000 / LIDAR_SAMPLE_RATE_HZ)
+
+#define STEP_US 5000000
+#define SETTLE_LIMIT_US 3000000
+
+struct motor {
+	// Degrees/s per duty unit above the dead zone
+	double gain;
+	uint32_t dead_zone;
+	double tau_s;
+	double speed;
+};
+
+static void motor_step(struct motor *m, uint16_t duty, double dt_s)
+{
+	const double target = duty > m->dead_zone ? m->gain * (duty - m->dead_zone) : 0;
+
+	m->speed += (target - m->speed) * (1 - exp(-dt_s / m->tau_s));
+}
+
+int main(int argc, char *argv[])
+{
+	struct motor motor = {
+		.gain = 12,
+		.dead_zone = 100,
+		.tau_s = 0.3,
+	};
+	// Noise on the reported speed, as a fraction
+	double noise = 0.005;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "g:t:n:h")) != -1) {
+		switch (opt) {
+		case 'g':
+			motor.gain = atof(optarg);
+			break;
+		case 't':
+			motor.tau_s = atof(optarg);
+			break;
+		case 'n':
+			noise = atof(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-g motor gain] [-t motor tau (s)] [-n speed noise]\n", argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	// Centi-Hz, across the sensor's range
+	static const uint32_t targets[] = { 1000, 600, 1300, 800, 1000 };
+
+	struct lidar_speed_ctl ctl;
+	struct synth_state st;
+	uint32_t now_us = 0;
+	int errors = 0;
+
+	synth_init(&st, 1, 10);
+	lidar_speed_init(&ctl);
+
+	// Start from rest, at the default duty
+	for (uint32_t i = 0; i < sizeof(targets) / sizeof(targets[0]); i++) {
+		lidar_speed_set_target(&ctl, targets[i], now_us);
+
+		const uint32_t step_start = now_us;
+		double max_err_locked = 0;
+		bool was_locked = false;
+		bool lost_lock = false;
+
+		while (now_us - step_start < STEP_US) {
+			motor_step(&motor, lidar_speed_duty(&ctl), FRAME_US / 1e6);
+			now_us += FRAME_US;
+
+			const double r = (synth_rand(&st) % 2001) / 1000.0 - 1.0;
+			const double reported = motor.speed * (1 + noise * r);
+			lidar_speed_add_frame(&ctl, reported > 0 ? (uint16_t)reported : 0, now_us);
+
+			struct lidar_speed_status status;
+			lidar_speed_get_status(&ctl, &status);
+
+			if (status.locked) {
+				const double err = fabs(motor.speed / 3.6 - targets[i]) / targets[i];
+				if (err > max_err_locked) {
+					max_err_locked = err;
+				}
+				was_locked = true;
+			} else if (was_locked) {
+				lost_lock = true;
+			}
+		}
+
+		struct lidar_speed_status status;
+		lidar_speed_get_status(&ctl, &status);
+
+		printf("target_centi_hz: %u measured_centi_hz: %u duty: %u settle_ms: %u max_err_locked_pct: %.2f\n",
+		       status.target_centi_hz, status.measured_centi_hz, status.duty,
+		       status.settle_time_us / 1000, max_err_locked * 100);
+
+		if (!status.locked || !status.settle_time_us || status.settle_time_us > SETTLE_LIMIT_US) {
+			fprintf(stderr, "didn't lock to %u centi-Hz in time\n", targets[i]);
+			errors++;
+		}
+		if (lost_lock) {
+			fprintf(stderr, "lost lock at %u centi-Hz\n", targets[i]);
+			errors++;
+		}
+	}
+
+	printf("errors: %d\n", errors);
+
+	return errors ? 1 : 0;
+}
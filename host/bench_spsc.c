@@ -0,0 +1,145 @@
+// SPSC ring stress test and benchmark
+//
+// Runs a producer and a consumer thread flat out on the ring, with the
+// consumer draining in batches, and checks that every element arrives
+// exactly once, in order and intact. Exits non-zero on any error.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "lidar_parser.h"
+#include "lidar_spsc.h"
+
+#include "bench.h"
+
+#define CAPACITY 64
+
+// Frame-sized, so the copies are realistic. The sequence number is spread
+// over the payload so torn reads show up.
+struct elem {
+	uint32_t seq;
+	uint8_t payload[LIDAR_FRAME_SIZE - 2 * sizeof(uint32_t)];
+	uint32_t check;
+};
+
+struct stress {
+	struct lidar_spsc q;
+	struct elem storage[CAPACITY];
+	uint64_t count;
+	int batch;
+	uint64_t errors;
+};
+
+static uint32_t elem_check(const struct elem *e)
+{
+	return e->seq * 2654435761u;
+}
+
+static void *producer(void *arg)
+{
+	struct stress *s = arg;
+
+	for (uint64_t i = 0; i < s->count; i++) {
+		struct elem *e;
+
+		while (!(e = lidar_spsc_reserve(&s->q))) {
+			// Full. Yield, in case we're sharing a CPU with the
+			// consumer.
+			sched_yield();
+		}
+
+		e->seq = i;
+		for (unsigned j = 0; j < sizeof(e->payload); j++) {
+			e->payload[j] = i + j;
+		}
+		e->check = elem_check(e);
+
+		lidar_spsc_commit(&s->q);
+	}
+
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	struct stress *s = arg;
+	uint64_t next = 0;
+
+	while (next < s->count) {
+		void *elems;
+		uint32_t n = lidar_spsc_peek(&s->q, &elems);
+		if (!n) {
+			sched_yield();
+			continue;
+		}
+		if (n > (uint32_t)s->batch) {
+			n = s->batch;
+		}
+
+		const struct elem *e = elems;
+		for (uint32_t i = 0; i < n; i++, next++) {
+			int bad = e[i].seq != (uint32_t)next || e[i].check != elem_check(&e[i]);
+			for (unsigned j = 0; j < sizeof(e[i].payload); j++) {
+				bad |= e[i].payload[j] != (uint8_t)(next + j);
+			}
+
+			if (bad && s->errors++ < 10) {
+				fprintf(stderr, "bad element: got seq %u, expected %lu\n",
+					e[i].seq, (unsigned long)next);
+			}
+		}
+
+		lidar_spsc_release(&s->q, n);
+	}
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct stress s;
+	uint64_t count = 10000000;
+	int batch = 8;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:b:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			count = strtoull(optarg, NULL, 0);
+			break;
+		case 'b':
+			batch = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n elements] [-b batch]\n", argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	lidar_spsc_init(&s.q, s.storage, sizeof(s.storage[0]), CAPACITY);
+	s.count = count;
+	s.batch = batch > 0 ? batch : 1;
+
+	pthread_t prod, cons;
+	const uint64_t t0 = bench_now_ns();
+
+	pthread_create(&cons, NULL, consumer, &s);
+	pthread_create(&prod, NULL, producer, &s);
+	pthread_join(prod, NULL);
+	pthread_join(cons, NULL);
+
+	const uint64_t t1 = bench_now_ns();
+	const double secs = (t1 - t0) / 1e9;
+
+	printf("elements: %lu\n", (unsigned long)count);
+	printf("elements_per_s: %.0f\n", count / secs);
+	printf("ns_per_element: %.1f\n", (t1 - t0) / (double)count);
+	printf("errors: %lu\n", (unsigned long)s.errors);
+
+	return s.errors ? 1 : 0;
+}
@@ -0,0 +1,215 @@
+// Timestamp reconstruction test, against a simulated sensor clock
+//
+// The sensor's clock runs at a slightly different rate to the Pico's, and
+// each frame's DMA completion is delayed by a fixed latency plus random
+// interrupt latency (with occasional long stalls). Frames are randomly lost,
+// the sensor goes quiet for longer than its timestamp wrap at one point, and
+// resets its clock at another. The reconstructed sample times are compared
+// with the true ones. Exits non-zero if they're off by too much.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "lidar_parser.h"
+#include "lidar_time.h"
+
+#include "synth.h"
+
+#define SAMPLE_PERIOD_US (LIDAR_TIME_SAMPLE_PERIOD_NS / 1000.0)
+#define FRAME_PERIOD_US (SAMPLE_PERIOD_US * LIDAR_SAMPLES_PER_FRAME)
+
+// Skip this long after starting, or the sensor resetting, before checking
+#define WARMUP_US 10e6
+
+// Sensor goes quiet for GAP_LEN_US at GAP_AT_US, and resets at RESET_AT_US
+#define GAP_AT_US 100e6
+#define GAP_LEN_US 70e6
+#define RESET_AT_US 250e6
+
+#define MAX_ERR_US 1000
+#define MAX_DRIFT_ERR_PPB 20000
+
+struct sim {
+	struct synth_state rng;
+	// Parts per million that the Pico clock runs faster than the sensor
+	double drift_ppm;
+	uint32_t batch;
+	// Percent of frames with a long interrupt stall
+	uint32_t stall_pct;
+
+	// Sensor time (us) at Pico time 0
+	double sensor_epoch_us;
+};
+
+static double sim_uniform(struct sim *sim, double max)
+{
+	return (synth_rand(&sim->rng) % 1000000) * max / 1000000;
+}
+
+static double sensor_time(struct sim *sim, double pico_us)
+{
+	return sim->sensor_epoch_us + pico_us / (1 + sim->drift_ppm * 1e-6);
+}
+
+static double pico_time(struct sim *sim, double sensor_us)
+{
+	return (sensor_us - sim->sensor_epoch_us) * (1 + sim->drift_ppm * 1e-6);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sim sim = {
+		.drift_ppm = 120,
+		.batch = 1,
+		.stall_pct = 2,
+		.sensor_epoch_us = 12345678,
+	};
+	double duration_s = 330;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:b:p:s:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			sim.drift_ppm = atof(optarg);
+			break;
+		case 'b':
+			sim.batch = atoi(optarg);
+			if (sim.batch < 1 || sim.batch > LIDAR_HW_NUM_SLOTS - 1) {
+				fprintf(stderr, "batch must be 1-%d\n", LIDAR_HW_NUM_SLOTS - 1);
+				return 1;
+			}
+			break;
+		case 'p':
+			sim.stall_pct = atoi(optarg);
+			break;
+		case 's':
+			duration_s = atof(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-d drift ppm] [-b batch frames] [-p stall %%] [-s seconds]\n", argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	synth_init(&sim.rng, 1, 10);
+
+	struct lidar_time_sync sync;
+	lidar_time_init(&sync);
+
+	// Frames in the current batch, waiting for the DMA to complete
+	struct {
+		uint16_t timestamp;
+		double first_sample_us;
+	} pending[LIDAR_HW_NUM_SLOTS];
+	uint32_t npending = 0;
+
+	double sensor_us = sensor_time(&sim, 1e6);
+	double checks_from_us = WARMUP_US;
+	bool reset_done = false;
+	uint64_t last_rx_us = 0;
+	uint64_t nchecked = 0;
+	double total_err = 0, max_err = 0;
+	int errors = 0;
+
+	for ( ;; ) {
+		double t = pico_time(&sim, sensor_us);
+		if (t > duration_s * 1e6) {
+			break;
+		}
+
+		if (t >= GAP_AT_US && t < GAP_AT_US + GAP_LEN_US) {
+			sensor_us = sensor_time(&sim, GAP_AT_US + GAP_LEN_US);
+			npending = 0;
+			continue;
+		}
+
+		if (!reset_done && t >= RESET_AT_US) {
+			// Sensor clock starts again from zero
+			sim.sensor_epoch_us -= sensor_us;
+			sensor_us = 0;
+			t = pico_time(&sim, sensor_us);
+			checks_from_us = t + WARMUP_US;
+			reset_done = true;
+		}
+
+		const double frame_sensor_us = sensor_us;
+		sensor_us += FRAME_PERIOD_US;
+
+		// Lost to a CRC error
+		if (synth_rand(&sim.rng) % 100 == 0) {
+			continue;
+		}
+
+		pending[npending].timestamp = (uint64_t)(frame_sensor_us / 1000) % LIDAR_TIME_SENSOR_WRAP_MS;
+		pending[npending].first_sample_us = t;
+		npending++;
+
+		if (npending < sim.batch) {
+			continue;
+		}
+
+		double latency = 5 + sim_uniform(&sim, 35);
+		if (synth_rand(&sim.rng) % 100 < sim.stall_pct) {
+			latency += sim_uniform(&sim, 3000);
+		}
+		// A stall holds up the frames behind it too
+		uint64_t rx_us = t + LIDAR_TIME_FRAME_LATENCY_US + latency;
+		if (rx_us < last_rx_us) {
+			rx_us = last_rx_us;
+		}
+		last_rx_us = rx_us;
+
+		for (uint32_t i = 0; i < npending; i++) {
+			struct lidar_frame_time ft;
+
+			lidar_time_add_frame(&sync, pending[i].timestamp, rx_us, &ft);
+
+			if (pending[i].first_sample_us < checks_from_us) {
+				continue;
+			}
+
+			for (int j = 0; j < LIDAR_SAMPLES_PER_FRAME; j++) {
+				const double expected = pending[i].first_sample_us +
+					j * SAMPLE_PERIOD_US * (1 + sim.drift_ppm * 1e-6);
+				const double err = fabs((double)lidar_frame_time_sample_us(&ft, j) - expected);
+
+				total_err += err;
+				nchecked++;
+				if (err > max_err) {
+					max_err = err;
+				}
+			}
+		}
+		npending = 0;
+	}
+
+	struct lidar_time_status status;
+	lidar_time_get_status(&sync, &status);
+
+	const double drift_err = fabs(status.drift_ppb - sim.drift_ppm * 1000);
+
+	printf("samples: %llu mean_err_us: %.1f max_err_us: %.1f drift_ppb: %ld (actual %.0f) resyncs: %u\n",
+	       (unsigned long long)nchecked, nchecked ? total_err / nchecked : 0, max_err,
+	       (long)status.drift_ppb, sim.drift_ppm * 1000, status.resyncs);
+
+	if (!nchecked || max_err > MAX_ERR_US) {
+		fprintf(stderr, "sample times off by up to %.1f us\n", max_err);
+		errors++;
+	}
+	if (drift_err > MAX_DRIFT_ERR_PPB) {
+		fprintf(stderr, "drift estimate off by %.0f ppb\n", drift_err);
+		errors++;
+	}
+	if (status.resyncs != (reset_done ? 1 : 0)) {
+		fprintf(stderr, "expected %d resyncs\n", reset_done ? 1 : 0);
+		errors++;
+	}
+
+	printf("errors: %d\n", errors);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,203 @@
+// Host-side reading and writing of raw captures
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lidar_capture_file.h"
+
+#define RECORD_SIZE sizeof(struct lidar_capture_record)
+
+void lidar_capture_file_header_init(struct lidar_capture_file_header *hdr)
+{
+	memset(hdr, 0, sizeof(*hdr));
+
+	memcpy(hdr->magic, LIDAR_CAPTURE_MAGIC, sizeof(hdr->magic));
+	hdr->version = LIDAR_CAPTURE_VERSION;
+	hdr->header_size = sizeof(*hdr);
+	hdr->sensor = LIDAR_SENSOR;
+	hdr->baud_rate = LIDAR_BAUD_RATE;
+}
+
+uint32_t lidar_capture_file_header_check(const uint8_t *data, size_t len)
+{
+	struct lidar_capture_file_header hdr;
+
+	if (len < sizeof(hdr)) {
+		return 0;
+	}
+
+	memcpy(&hdr, data, sizeof(hdr));
+
+	if (memcmp(hdr.magic, LIDAR_CAPTURE_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.version != LIDAR_CAPTURE_VERSION ||
+	    hdr.header_size < sizeof(hdr) || hdr.header_size > len) {
+		return 0;
+	}
+
+	return hdr.header_size;
+}
+
+int lidar_capture_map_open(struct lidar_capture_map *m, const char *path)
+{
+	struct stat st;
+
+	memset(m, 0, sizeof(*m));
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(struct lidar_capture_file_header)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return -1;
+	}
+
+	m->data = data;
+	m->len = st.st_size;
+	m->start = lidar_capture_file_header_check(m->data, m->len);
+	if (!m->start) {
+		lidar_capture_map_close(m);
+		errno = EINVAL;
+		return -1;
+	}
+
+	m->hdr = (const struct lidar_capture_file_header *)m->data;
+	m->offs = m->start;
+
+	return 0;
+}
+
+void lidar_capture_map_close(struct lidar_capture_map *m)
+{
+	if (m->data) {
+		munmap((void *)m->data, m->len);
+	}
+
+	memset(m, 0, sizeof(*m));
+}
+
+bool lidar_capture_map_next(struct lidar_capture_map *m, struct lidar_capture_record *rec,
+                            const uint8_t **data)
+{
+	if (m->len - m->offs < RECORD_SIZE) {
+		return false;
+	}
+
+	memcpy(rec, m->data + m->offs, RECORD_SIZE);
+
+	if (rec->sync != LIDAR_CAPTURE_SYNC || rec->len > LIDAR_CAPTURE_MAX_LEN ||
+	    m->len - m->offs - RECORD_SIZE < rec->len) {
+		return false;
+	}
+
+	*data = m->data + m->offs + RECORD_SIZE;
+	m->offs += RECORD_SIZE + rec->len;
+
+	return true;
+}
+
+void lidar_capture_map_rewind(struct lidar_capture_map *m)
+{
+	m->offs = m->start;
+}
+
+void lidar_capture_stream_init(struct lidar_capture_stream *s, lidar_capture_record_cb_t record_cb,
+                               void *cb_data)
+{
+	memset(s, 0, sizeof(*s));
+
+	s->record_cb = record_cb;
+	s->cb_data = cb_data;
+}
+
+static void lidar_capture_stream_skip(struct lidar_capture_stream *s, uint32_t n)
+{
+	s->fill -= n;
+	memmove(s->buf, s->buf + n, s->fill);
+}
+
+// Handle as many records as are complete in the buffer
+static void lidar_capture_stream_process(struct lidar_capture_stream *s)
+{
+	struct lidar_capture_record rec;
+
+	while (s->fill >= RECORD_SIZE) {
+		memcpy(&rec, s->buf, RECORD_SIZE);
+
+		if (rec.sync != LIDAR_CAPTURE_SYNC || rec.len > LIDAR_CAPTURE_MAX_LEN) {
+			// Not a record, try again from the next byte
+			lidar_capture_stream_skip(s, 1);
+			s->stats.bytes_skipped++;
+			s->locked = false;
+			continue;
+		}
+
+		// The sync word could just be in the data, so until the
+		// stream has been followed from one record to the next, wait
+		// for the next one's sync word too.
+		const uint32_t len = RECORD_SIZE + rec.len;
+		const uint32_t need = s->locked ? len : len + sizeof(rec.sync);
+		if (s->fill < need) {
+			break;
+		}
+
+		if (!s->locked) {
+			const uint16_t next = s->buf[len] | (s->buf[len + 1] << 8);
+			if (next != LIDAR_CAPTURE_SYNC) {
+				lidar_capture_stream_skip(s, 1);
+				s->stats.bytes_skipped++;
+				continue;
+			}
+			s->locked = true;
+		}
+
+		if (s->have_seq) {
+			s->stats.records_lost += (uint8_t)(rec.seq - s->next_seq);
+		}
+		s->have_seq = true;
+		s->next_seq = rec.seq + 1;
+		s->stats.records++;
+
+		s->record_cb(s->cb_data, &rec, s->buf + RECORD_SIZE);
+
+		lidar_capture_stream_skip(s, len);
+	}
+}
+
+void lidar_capture_stream_feed(struct lidar_capture_stream *s, const uint8_t *data, size_t len)
+{
+	while (len) {
+		// Processing always leaves less than a record (plus the next
+		// sync word) in the buffer, so there's always room.
+		uint32_t n = sizeof(s->buf) - s->fill;
+		if (n > len) {
+			n = len;
+		}
+
+		memcpy(s->buf + s->fill, data, n);
+		s->fill += n;
+		data += n;
+		len -= n;
+
+		lidar_capture_stream_process(s);
+	}
+}
+
+void lidar_capture_stream_get_stats(struct lidar_capture_stream *s, struct lidar_capture_stream_stats *stats)
+{
+	*stats = s->stats;
+}
@@ -0,0 +1,84 @@
+// Host-side reading and writing of raw captures (see lidar_capture.h)
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+#ifndef __LIDAR_CAPTURE_FILE_H__
+#define __LIDAR_CAPTURE_FILE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lidar_capture.h"
+
+// Fill in a file header for this build's sensor profile
+void lidar_capture_file_header_init(struct lidar_capture_file_header *hdr);
+
+// Check that 'data' starts with a valid file header. Returns the offset of
+// the first record, or 0 if it isn't a capture.
+uint32_t lidar_capture_file_header_check(const uint8_t *data, size_t len);
+
+// A capture file, memory-mapped read-only
+struct lidar_capture_map {
+	const uint8_t *data;
+	size_t len;
+	const struct lidar_capture_file_header *hdr;
+	// Offset of the first record, and of the next one to read
+	size_t start;
+	size_t offs;
+};
+
+// Returns 0 on success, or -1 with errno set (EINVAL if it isn't a capture)
+int lidar_capture_map_open(struct lidar_capture_map *m, const char *path);
+
+void lidar_capture_map_close(struct lidar_capture_map *m);
+
+// Get the next record, and a pointer to its data in the mapping. Returns
+// false at the end of the file, or at a record which was cut off or
+// corrupted.
+bool lidar_capture_map_next(struct lidar_capture_map *m, struct lidar_capture_record *rec,
+                            const uint8_t **data);
+
+// Go back to the first record
+void lidar_capture_map_rewind(struct lidar_capture_map *m);
+
+// Called for each complete record found by lidar_capture_stream_feed().
+// 'data' is only valid during the callback.
+typedef void (*lidar_capture_record_cb_t)(void *cb_data, const struct lidar_capture_record *rec,
+                                          const uint8_t *data);
+
+// Counters, which start at zero and wrap
+struct lidar_capture_stream_stats {
+	uint32_t records;
+	// From gaps in the sequence numbers
+	uint32_t records_lost;
+	// Bytes thrown away looking for a record
+	uint32_t bytes_skipped;
+};
+
+// Finds records in the device's CDC output, which may start part-way
+// through a record.
+// You should NOT directly access anything in this structure!
+struct lidar_capture_stream {
+	// A whole record, plus the next one's sync word
+	uint8_t buf[sizeof(struct lidar_capture_record) + LIDAR_CAPTURE_MAX_LEN + 2];
+	uint32_t fill;
+	// Set once one record has been seen to follow on from another
+	bool locked;
+
+	bool have_seq;
+	uint8_t next_seq;
+	struct lidar_capture_stream_stats stats;
+
+	lidar_capture_record_cb_t record_cb;
+	void *cb_data;
+};
+
+void lidar_capture_stream_init(struct lidar_capture_stream *s, lidar_capture_record_cb_t record_cb,
+                               void *cb_data);
+
+// Feed bytes, split up any way at all
+void lidar_capture_stream_feed(struct lidar_capture_stream *s, const uint8_t *data, size_t len);
+
+void lidar_capture_stream_get_stats(struct lidar_capture_stream *s, struct lidar_capture_stream_stats *stats);
+
+#endif /* __LIDAR_CAPTURE_FILE_H__ */
@@ -0,0 +1,291 @@
+// Command-line reader for the example's raw USB endpoint
+//
+// Reads from the device (if built with libusb), or the sensor's byte stream
+// from files, ptys or serial ports, and prints the frame rate, errors and
+// (with -s) each revolution. Several sources can be read at once, each with
+// its own reader.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#if LIDAR_READ_HAVE_LIBUSB
+#include <libusb.h>
+#endif
+
+#include "lidar_reader.h"
+
+#include "bench.h"
+
+#define MAX_SOURCES 8
+
+// See example/usb_descriptors.h
+#define USB_VID 0x1209
+#define USB_PID 0x0001
+#define USB_RAW_INTERFACE 2
+
+struct source {
+	const char *name;
+	int fd;
+	bool eof;
+	struct lidar_reader reader;
+	struct lidar_reader_stats last;
+};
+
+static bool print_scans;
+
+static void scan_cb(void *cb_data, uint8_t sensor_id, const struct lidar_scan *scan)
+{
+	struct source *src = cb_data;
+
+	if (!print_scans) {
+		return;
+	}
+
+	printf("%s: sensor %u revolution %u: %u samples, %u deg/s, timestamp %u\n",
+	       src->name, sensor_id, scan->seq, scan->nsamples, scan->speed, scan->timestamp);
+}
+
+static void print_stats(struct source *src, double secs)
+{
+	struct lidar_reader_stats stats;
+
+	lidar_reader_get_stats(&src->reader, &stats);
+
+	printf("%s: %.0f + %.0f frames/s, %u crc errors, %u bytes skipped, "
+	       "%u transfers missed, %u dropped by device\n",
+	       src->name,
+	       (stats.frames[0] - src->last.frames[0]) / secs,
+	       (stats.frames[1] - src->last.frames[1]) / secs,
+	       stats.crc_errors, stats.bytes_skipped,
+	       stats.xfers_missed, stats.device_dropped);
+
+	src->last = stats;
+}
+
+static speed_t baud_to_speed(uint32_t baud)
+{
+	switch (baud) {
+	case 230400:
+		return B230400;
+#ifdef B921600
+	case 921600:
+		return B921600;
+#endif
+	default:
+		return B0;
+	}
+}
+
+static int open_source(struct source *src, const char *path)
+{
+	src->name = path;
+	src->fd = strcmp(path, "-") ? open(path, O_RDONLY | O_NOCTTY) : STDIN_FILENO;
+	if (src->fd < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	// A serial port or pty: raw, at the sensor's baud rate
+	struct termios tio;
+	if (isatty(src->fd) && !tcgetattr(src->fd, &tio)) {
+		cfmakeraw(&tio);
+		if (baud_to_speed(LIDAR_BAUD_RATE) != B0) {
+			cfsetspeed(&tio, baud_to_speed(LIDAR_BAUD_RATE));
+		}
+		tcsetattr(src->fd, TCSANOW, &tio);
+	}
+
+	return 0;
+}
+
+static int read_files(struct source *srcs, int nsources)
+{
+	struct pollfd pfds[MAX_SOURCES];
+	uint8_t buf[4096];
+	int nopen = nsources;
+	uint64_t last_print = bench_now_ns();
+
+	for (int i = 0; i < nsources; i++) {
+		pfds[i] = (struct pollfd){ .fd = srcs[i].fd, .events = POLLIN };
+	}
+
+	while (nopen) {
+		if (poll(pfds, nsources, 100) < 0 && errno != EINTR) {
+			perror("poll");
+			return 1;
+		}
+
+		for (int i = 0; i < nsources; i++) {
+			struct source *src = &srcs[i];
+
+			if (src->eof || !(pfds[i].revents & (POLLIN | POLLHUP))) {
+				continue;
+			}
+
+			const ssize_t n = read(src->fd, buf, sizeof(buf));
+			if (n <= 0) {
+				src->eof = true;
+				pfds[i].fd = -1;
+				nopen--;
+				continue;
+			}
+
+			lidar_reader_feed(&src->reader, buf, n);
+		}
+
+		const uint64_t now = bench_now_ns();
+		if (now - last_print >= 1000000000ull || !nopen) {
+			for (int i = 0; i < nsources; i++) {
+				print_stats(&srcs[i], (now - last_print) / 1e9);
+			}
+			last_print = now;
+		}
+	}
+
+	return 0;
+}
+
+#if LIDAR_READ_HAVE_LIBUSB
+static int read_usb(struct source *src)
+{
+	libusb_context *ctx;
+	int ret = 1;
+
+	if (libusb_init(&ctx)) {
+		fprintf(stderr, "libusb_init failed\n");
+		return 1;
+	}
+
+	libusb_device_handle *dev = libusb_open_device_with_vid_pid(ctx, USB_VID, USB_PID);
+	if (!dev) {
+		fprintf(stderr, "device not found\n");
+		goto out_exit;
+	}
+
+	libusb_set_auto_detach_kernel_driver(dev, 1);
+	if (libusb_claim_interface(dev, USB_RAW_INTERFACE)) {
+		fprintf(stderr, "couldn't claim the raw interface\n");
+		goto out_close;
+	}
+
+	// Find the IN endpoint, and whether it's bulk or interrupt
+	struct libusb_config_descriptor *config;
+	if (libusb_get_active_config_descriptor(libusb_get_device(dev), &config)) {
+		fprintf(stderr, "couldn't get the config descriptor\n");
+		goto out_release;
+	}
+
+	const struct libusb_interface_descriptor *intf =
+		&config->interface[USB_RAW_INTERFACE].altsetting[0];
+	const uint8_t ep = intf->endpoint[0].bEndpointAddress;
+	const bool bulk = (intf->endpoint[0].bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) ==
+	                  LIBUSB_TRANSFER_TYPE_BULK;
+	libusb_free_config_descriptor(config);
+
+	uint8_t buf[LIDAR_READER_XFER_READ_SIZE];
+	uint64_t last_print = bench_now_ns();
+
+	for (;;) {
+		int len = 0;
+		int err;
+
+		if (bulk) {
+			err = libusb_bulk_transfer(dev, ep, buf, sizeof(buf), &len, 100);
+		} else {
+			err = libusb_interrupt_transfer(dev, ep, buf, sizeof(buf), &len, 100);
+		}
+
+		if (err && err != LIBUSB_ERROR_TIMEOUT) {
+			fprintf(stderr, "transfer failed: %s\n", libusb_error_name(err));
+			break;
+		}
+
+		if (len) {
+			if (bulk) {
+				lidar_reader_xfer(&src->reader, buf, len);
+			} else {
+				lidar_reader_frame(&src->reader, 0, buf, len);
+			}
+		}
+
+		const uint64_t now = bench_now_ns();
+		if (now - last_print >= 1000000000ull) {
+			print_stats(src, (now - last_print) / 1e9);
+			last_print = now;
+		}
+	}
+
+out_release:
+	libusb_release_interface(dev, USB_RAW_INTERFACE);
+out_close:
+	libusb_close(dev);
+out_exit:
+	libusb_exit(ctx);
+
+	return ret;
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+	static struct source srcs[MAX_SOURCES];
+	const char *paths[MAX_SOURCES];
+	int nsources = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:sh")) != -1) {
+		switch (opt) {
+		case 'f':
+			if (nsources == MAX_SOURCES) {
+				fprintf(stderr, "Too many sources, max %d\n", MAX_SOURCES);
+				return 1;
+			}
+			paths[nsources++] = optarg;
+			break;
+		case 's':
+			print_scans = true;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s] [-f path]...\n", argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	// Output is often piped somewhere, and never ends by itself
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	for (int i = 0; i < (nsources ? nsources : 1); i++) {
+		struct lidar_reader_cfg cfg = {
+			.scan_cb = scan_cb,
+			.cb_data = &srcs[i],
+		};
+		lidar_reader_init(&srcs[i].reader, &cfg);
+	}
+
+	if (!nsources) {
+#if LIDAR_READ_HAVE_LIBUSB
+		srcs[0].name = "usb";
+		return read_usb(&srcs[0]);
+#else
+		fprintf(stderr, "Built without libusb, so only -f is supported\n");
+		return 1;
+#endif
+	}
+
+	for (int i = 0; i < nsources; i++) {
+		if (open_source(&srcs[i], paths[i])) {
+			return 1;
+		}
+	}
+
+	return read_files(srcs, nsources);
+}
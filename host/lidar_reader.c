@@ -0,0 +1,156 @@
+// Host-side reader for the example's raw USB endpoint
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <string.h>
+
+#include "crc8.h"
+#include "lidar_reader.h"
+
+static void lidar_reader_scan_cb(void *cb_data, const struct lidar_scan *scan)
+{
+	struct lidar_reader_sensor *sensor = cb_data;
+	struct lidar_reader *r = sensor->reader;
+
+	r->cfg.scan_cb(r->cfg.cb_data, sensor->id, scan);
+}
+
+// Validate and pass on one frame, which may be unaligned
+static bool lidar_reader_deliver(struct lidar_reader *r, uint8_t sensor_id, const struct lidar_frame *frame)
+{
+	const uint8_t *p = (const uint8_t *)frame;
+
+	if (p[0] != LIDAR_FRAME_HEADER || p[1] != LIDAR_FRAME_VER_LEN ||
+	    lidar_crc8_update(0, p, LIDAR_FRAME_SIZE - 1) != p[LIDAR_FRAME_SIZE - 1]) {
+		r->stats.crc_errors++;
+		return false;
+	}
+
+	r->stats.frames[sensor_id]++;
+
+	if (r->cfg.frame_cb) {
+		r->cfg.frame_cb(r->cfg.cb_data, sensor_id, frame);
+	}
+
+	lidar_scan_add_frame(&r->sensors[sensor_id].scan, frame);
+
+	return true;
+}
+
+static void lidar_reader_parser_cb(void *cb_data, struct lidar_frame *frame)
+{
+	struct lidar_reader *r = cb_data;
+
+	// Already checked by the parser
+	r->stats.frames[0]++;
+
+	if (r->cfg.frame_cb) {
+		r->cfg.frame_cb(r->cfg.cb_data, 0, frame);
+	}
+
+	lidar_scan_add_frame(&r->sensors[0].scan, frame);
+}
+
+void lidar_reader_init(struct lidar_reader *r, const struct lidar_reader_cfg *cfg)
+{
+	memset(r, 0, sizeof(*r));
+
+	r->cfg = *cfg;
+
+	for (int i = 0; i < LIDAR_READER_MAX_SENSORS; i++) {
+		struct lidar_reader_sensor *sensor = &r->sensors[i];
+
+		sensor->reader = r;
+		sensor->id = i;
+		lidar_scan_init(&sensor->scan, cfg->scan_cb ? lidar_reader_scan_cb : NULL, sensor);
+	}
+
+	struct lidar_parser_cfg parser_cfg = {
+		.frame_cb = lidar_reader_parser_cb,
+		.frame_cb_data = r,
+	};
+	lidar_parser_init(&r->parser, &parser_cfg);
+
+	lidar_crc8_init();
+}
+
+bool lidar_reader_xfer(struct lidar_reader *r, const uint8_t *data, uint32_t len)
+{
+	struct lidar_reader_xfer_header hdr;
+
+	if (len < sizeof(hdr)) {
+		r->stats.xfers_bad++;
+		return false;
+	}
+
+	memcpy(&hdr, data, sizeof(hdr));
+
+	if (hdr.frame_size != LIDAR_FRAME_SIZE || hdr.nframes > LIDAR_READER_XFER_MAX_FRAMES ||
+	    len < sizeof(hdr) + hdr.nframes * LIDAR_FRAME_SIZE) {
+		r->stats.xfers_bad++;
+		return false;
+	}
+
+	// The device starts again from 0 when the interface is re-opened,
+	// which isn't a gap.
+	if (r->have_seq && hdr.seq != r->next_seq && hdr.seq != 0) {
+		r->stats.xfers_missed += hdr.seq - r->next_seq;
+	}
+	if (!r->have_seq || hdr.seq == 0) {
+		r->dropped = 0;
+	}
+	r->have_seq = true;
+	r->next_seq = hdr.seq + 1;
+
+	r->stats.device_dropped += hdr.dropped - r->dropped;
+	r->dropped = hdr.dropped;
+
+	r->stats.xfers++;
+
+	const uint8_t *p = data + sizeof(hdr);
+	for (uint32_t i = 0; i < hdr.nframes; i++) {
+		const uint8_t sensor_id = (hdr.sensor_ids >> i) & 1;
+
+		lidar_reader_deliver(r, sensor_id, (const struct lidar_frame *)p);
+		p += LIDAR_FRAME_SIZE;
+	}
+
+	return true;
+}
+
+bool lidar_reader_frame(struct lidar_reader *r, uint8_t sensor_id, const uint8_t *data, uint32_t len)
+{
+	if (len < LIDAR_FRAME_SIZE || sensor_id >= LIDAR_READER_MAX_SENSORS) {
+		r->stats.xfers_bad++;
+		return false;
+	}
+
+	r->stats.xfers++;
+
+	return lidar_reader_deliver(r, sensor_id, (const struct lidar_frame *)data);
+}
+
+void lidar_reader_feed(struct lidar_reader *r, const uint8_t *data, uint32_t len)
+{
+	lidar_parser_feed(&r->parser, data, len);
+}
+
+const struct lidar_scan *lidar_reader_acquire_scan(struct lidar_reader *r, uint8_t sensor_id)
+{
+	if (sensor_id >= LIDAR_READER_MAX_SENSORS) {
+		return NULL;
+	}
+
+	return lidar_scan_acquire(&r->sensors[sensor_id].scan);
+}
+
+void lidar_reader_get_stats(struct lidar_reader *r, struct lidar_reader_stats *stats)
+{
+	struct lidar_parser_stats parser_stats;
+
+	lidar_parser_get_stats(&r->parser, &parser_stats);
+
+	*stats = r->stats;
+	stats->crc_errors += parser_stats.crc_errors;
+	stats->bytes_skipped = parser_stats.bytes_skipped;
+}
@@ -0,0 +1,132 @@
+// Host-side reader for the example's raw USB endpoint
+//
+// Decodes the frames sent by the raw endpoint (see "Custom raw endpoint" in
+// the README, and example/usb.h), checks their CRCs and the transfer
+// sequence numbers, and assembles them into revolutions, per sensor.
+//
+// Frames are passed to the callback in place, pointing into the caller's
+// buffer, and revolutions point into the reader's own assembler buffers, so
+// nothing is copied on the way. A reader has no global state, so use one per
+// device to read several at once.
+//
+// The same reader can also take the sensor's own byte stream (e.g. from a
+// file, a pty or a USB-UART adapter), which goes through the same parser as
+// on the Pico, so it can be tested without a device.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+#ifndef __LIDAR_READER_H__
+#define __LIDAR_READER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lidar_parser.h"
+#include "lidar_scan.h"
+
+// The raw_xfer_header from example/usb.h, which can't be included here
+// because it depends on the Pico SDK. Must be kept the same.
+// Frames are packed into transfers of up to LIDAR_READER_XFER_MAX_FRAMES,
+// each starting with this header (little-endian), followed by 'nframes' raw
+// struct lidar_frames, and possibly one byte of padding.
+#define LIDAR_READER_XFER_MAX_FRAMES 16
+
+struct __attribute__((packed)) lidar_reader_xfer_header {
+	uint32_t seq;
+	// Total frames dropped by the device since the interface was opened
+	uint32_t dropped;
+	uint16_t nframes;
+	uint16_t frame_size;
+	// Bit i is the sensor ID of frame i
+	uint16_t sensor_ids;
+};
+
+// The largest transfer the device sends, rounded up to a whole number of
+// 64-byte packets, so a read of this size never splits a transfer.
+#define LIDAR_READER_XFER_READ_SIZE 1024
+static_assert(sizeof(struct lidar_reader_xfer_header) +
+              LIDAR_READER_XFER_MAX_FRAMES * LIDAR_FRAME_SIZE + 1 <= LIDAR_READER_XFER_READ_SIZE,
+              "transfer doesn't fit in a read");
+
+// One bit per frame in sensor_ids
+#define LIDAR_READER_MAX_SENSORS 2
+
+// 'frame' points into the buffer passed to the reader, and is only valid
+// during the callback.
+typedef void (*lidar_reader_frame_cb_t)(void *cb_data, uint8_t sensor_id, const struct lidar_frame *frame);
+
+// 'scan' stays valid until the next revolution from the same sensor
+// completes.
+typedef void (*lidar_reader_scan_cb_t)(void *cb_data, uint8_t sensor_id, const struct lidar_scan *scan);
+
+struct lidar_reader_cfg {
+	// Either may be NULL. Both get cb_data.
+	lidar_reader_frame_cb_t frame_cb;
+	lidar_reader_scan_cb_t scan_cb;
+	void *cb_data;
+};
+
+// Counters, which start at zero and wrap.
+struct lidar_reader_stats {
+	// Transfers decoded, and those which were too short or malformed to
+	// use at all
+	uint32_t xfers;
+	uint32_t xfers_bad;
+	// Transfers which never arrived, from gaps in the sequence number
+	uint32_t xfers_missed;
+	// Valid frames passed on, per sensor
+	uint32_t frames[LIDAR_READER_MAX_SENSORS];
+	// Frames which failed the header or CRC checks
+	uint32_t crc_errors;
+	// Frames the device reported dropping, because the host was too slow
+	uint32_t device_dropped;
+	// Bytes thrown away resynchronising, for byte streams
+	uint32_t bytes_skipped;
+};
+
+struct lidar_reader_sensor {
+	struct lidar_reader *reader;
+	uint8_t id;
+	struct lidar_scan_assembler scan;
+};
+
+// This structure stores the internal state of the reader.
+// You should NOT directly access anything in this structure!
+// The definition is only provided so that the library can be used with zero
+// dynamic allocations.
+struct lidar_reader {
+	struct lidar_reader_cfg cfg;
+
+	bool have_seq;
+	uint32_t next_seq;
+	uint32_t dropped;
+
+	struct lidar_reader_stats stats;
+
+	struct lidar_reader_sensor sensors[LIDAR_READER_MAX_SENSORS];
+
+	// Only used for byte streams, which are always sensor 0
+	struct lidar_parser parser;
+};
+
+void lidar_reader_init(struct lidar_reader *r, const struct lidar_reader_cfg *cfg);
+
+// Decode one complete transfer from the bulk endpoint, as returned by a
+// single read. Returns false if the transfer was malformed.
+bool lidar_reader_xfer(struct lidar_reader *r, const uint8_t *data, uint32_t len);
+
+// Decode one bare frame from the interrupt endpoint (built with
+// LIDAR_EXAMPLE_RAW_BULK=OFF). Returns false if it wasn't a valid frame.
+bool lidar_reader_frame(struct lidar_reader *r, uint8_t sensor_id, const uint8_t *data, uint32_t len);
+
+// Feed the sensor's own byte stream, split up any way at all. The frames are
+// treated as sensor 0.
+void lidar_reader_feed(struct lidar_reader *r, const uint8_t *data, uint32_t len);
+
+// Get the most recently completed revolution from a sensor, if there has been
+// a new one since the last call, otherwise NULL. An alternative to scan_cb,
+// with the same rules as lidar_scan_acquire().
+const struct lidar_scan *lidar_reader_acquire_scan(struct lidar_reader *r, uint8_t sensor_id);
+
+void lidar_reader_get_stats(struct lidar_reader *r, struct lidar_reader_stats *stats);
+
+#endif /* __LIDAR_READER_H__ */
@@ -0,0 +1,199 @@
+// Record a raw capture from the example's CDC serial port
+//
+// Switches the device to capture mode, and appends every record it sends to
+// a capture file (see lidar_capture.h), until interrupted or for -d seconds.
+// If the file already exists, the new records are added to the end of it.
+// Replay it with lidar_replay.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "lidar_capture_file.h"
+
+// Only the CDC commands are needed from example/usb.h
+#define CDC_CMD_TEXT    't'
+#define CDC_CMD_CAPTURE 'c'
+
+struct recorder {
+	int fd;
+	int error;
+	uint64_t bytes;
+};
+
+static volatile sig_atomic_t stop;
+
+static void handle_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static void record_cb(void *cb_data, const struct lidar_capture_record *rec, const uint8_t *data)
+{
+	struct recorder *r = cb_data;
+	struct iovec iov[] = {
+		{ .iov_base = (void *)rec, .iov_len = sizeof(*rec) },
+		{ .iov_base = (void *)data, .iov_len = rec->len },
+	};
+
+	if (r->error) {
+		return;
+	}
+
+	// One write per record, so the file only ever ends part-way through
+	// a record if the disk fills up.
+	const ssize_t len = sizeof(*rec) + rec->len;
+	if (writev(r->fd, iov, 2) != len) {
+		r->error = errno ? errno : EIO;
+		return;
+	}
+
+	r->bytes += len;
+}
+
+static int open_output(const char *path)
+{
+	int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (fd < 0) {
+		return -1;
+	}
+
+	struct lidar_capture_file_header hdr;
+	const ssize_t n = read(fd, &hdr, sizeof(hdr));
+
+	if (n == 0) {
+		lidar_capture_file_header_init(&hdr);
+		if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+			close(fd);
+			return -1;
+		}
+	} else if (n != sizeof(hdr) || !lidar_capture_file_header_check((uint8_t *)&hdr, n)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return fd;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *port = NULL;
+	const char *out = NULL;
+	double duration = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:o:d:h")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = optarg;
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		case 'd':
+			duration = atof(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s -p port -o capture [-d seconds]\n", argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!port || !out) {
+		fprintf(stderr, "Need a port (-p) and an output file (-o)\n");
+		return 1;
+	}
+
+	int tty = open(port, O_RDWR | O_NOCTTY);
+	if (tty < 0) {
+		fprintf(stderr, "%s: %s\n", port, strerror(errno));
+		return 1;
+	}
+
+	struct termios tio;
+	if (!tcgetattr(tty, &tio)) {
+		cfmakeraw(&tio);
+		// Don't block forever, so signals and -d are noticed
+		tio.c_cc[VMIN] = 0;
+		tio.c_cc[VTIME] = 1;
+		tcsetattr(tty, TCSANOW, &tio);
+	}
+
+	struct recorder r = { 0 };
+	r.fd = open_output(out);
+	if (r.fd < 0) {
+		fprintf(stderr, "%s: %s\n", out, strerror(errno));
+		return 1;
+	}
+
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	struct lidar_capture_stream stream;
+	lidar_capture_stream_init(&stream, record_cb, &r);
+
+	const uint8_t cmd = CDC_CMD_CAPTURE;
+	if (write(tty, &cmd, 1) != 1) {
+		fprintf(stderr, "%s: %s\n", port, strerror(errno));
+		return 1;
+	}
+
+	const uint64_t start = bench_now_ns();
+	uint64_t last_print = start;
+	uint64_t last_bytes = 0;
+	uint8_t buf[4096];
+
+	while (!stop && !r.error) {
+		const ssize_t n = read(tty, buf, sizeof(buf));
+		if (n < 0 && errno != EINTR) {
+			fprintf(stderr, "%s: %s\n", port, strerror(errno));
+			break;
+		}
+		if (n > 0) {
+			lidar_capture_stream_feed(&stream, buf, n);
+		}
+
+		const uint64_t now = bench_now_ns();
+		if (now - last_print >= 1000000000ull) {
+			struct lidar_capture_stream_stats stats;
+			lidar_capture_stream_get_stats(&stream, &stats);
+
+			printf("%.0f bytes/s, %u records, %u lost, %u bytes skipped\n",
+			       (r.bytes - last_bytes) / ((now - last_print) / 1e9),
+			       stats.records, stats.records_lost, stats.bytes_skipped);
+			last_print = now;
+			last_bytes = r.bytes;
+		}
+
+		if (duration > 0 && now - start >= duration * 1e9) {
+			break;
+		}
+	}
+
+	if (r.error) {
+		fprintf(stderr, "%s: %s\n", out, strerror(r.error));
+	}
+
+	// Put the device back to normal
+	const uint8_t text = CDC_CMD_TEXT;
+	if (write(tty, &text, 1) != 1) {
+		fprintf(stderr, "%s: couldn't leave capture mode\n", port);
+	}
+
+	close(r.fd);
+	close(tty);
+
+	return r.error ? 1 : 0;
+}
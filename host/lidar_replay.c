@@ -0,0 +1,276 @@
+// Replay a raw capture through the parser and processing stages
+//
+// Each record is fed to the parser for its sensor, in the same chunks the
+// DMA delivered, and the frames go through the same stages as in the
+// example: revolution assembly, binning and filtering. By default records
+// are replayed with their original timing (-x sets the speed, and -x 0 goes
+// as fast as possible), so this can also stand in for a live sensor.
+//
+// Reports the frame and error counts, the processing cost per frame, and
+// (when timed) how far behind the original timing the replay fell.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lidar_bins.h"
+#include "lidar_filter.h"
+#include "lidar_parser.h"
+#include "lidar_scan.h"
+
+#include "bench.h"
+#include "lidar_capture_file.h"
+
+#define MAX_SENSORS 4
+
+// Longer gaps than this (e.g. between two recordings appended to the same
+// file) are skipped instead of waited for.
+#define MAX_GAP_US 1000000
+
+// The same as example/main.c
+static const struct lidar_filter_cfg filter_cfg = {
+	.min_intensity = 10,
+	.min_distance_mm = 20,
+	.max_distance_mm = 12000,
+	.median = 3,
+};
+
+static const struct lidar_bins_cfg bins_cfg = {
+	.bin_width = 100,
+	.mode = LIDAR_BINS_MIN,
+};
+
+struct sensor {
+	int id;
+	struct lidar_parser parser;
+	struct lidar_scan_assembler scans;
+	struct lidar_bins_reducer bins;
+	struct lidar_filter filter;
+
+	uint32_t records;
+	uint32_t bytes;
+	uint32_t revolutions;
+	uint32_t filtered;
+};
+
+static bool print_scans;
+
+static void scan_cb(void *cb_data, const struct lidar_scan *scan)
+{
+	struct sensor *sensor = cb_data;
+
+	sensor->revolutions++;
+
+	if (print_scans) {
+		printf("sensor %d revolution %u: %u samples, %u deg/s, timestamp %u\n",
+		       sensor->id, scan->seq, scan->nsamples, scan->speed, scan->timestamp);
+	}
+}
+
+static void frame_cb(void *cb_data, struct lidar_frame *frame)
+{
+	struct sensor *sensor = cb_data;
+	struct lidar_frame filtered;
+
+	lidar_scan_add_frame(&sensor->scans, frame);
+	lidar_bins_add_frame(&sensor->bins, frame);
+	if (lidar_filter_frame(&sensor->filter, frame, &filtered)) {
+		sensor->filtered++;
+	}
+}
+
+static void sensors_init(struct sensor *sensors)
+{
+	for (int i = 0; i < MAX_SENSORS; i++) {
+		struct sensor *sensor = &sensors[i];
+		struct lidar_parser_cfg cfg = {
+			.frame_cb = frame_cb,
+			.frame_cb_data = sensor,
+		};
+
+		memset(sensor, 0, sizeof(*sensor));
+		sensor->id = i;
+		lidar_parser_init(&sensor->parser, &cfg);
+		lidar_scan_init(&sensor->scans, scan_cb, sensor);
+		lidar_bins_init(&sensor->bins, &bins_cfg);
+		lidar_filter_init(&sensor->filter, &filter_cfg);
+	}
+}
+
+static void sleep_until_ns(uint64_t t)
+{
+	const struct timespec ts = {
+		.tv_sec = t / 1000000000ull,
+		.tv_nsec = t % 1000000000ull,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	double speed = 1.0;
+	int repeats = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "x:n:sh")) != -1) {
+		switch (opt) {
+		case 'x':
+			speed = atof(optarg);
+			break;
+		case 'n':
+			repeats = atoi(optarg);
+			break;
+		case 's':
+			print_scans = true;
+			break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [-x speed] [-n repeats] [-s] capture\n"
+				"  -x  Replay speed, relative to the original (default 1).\n"
+				"      0 goes as fast as possible.\n"
+				"  -n  Replay this many times (as fast as possible only)\n"
+				"  -s  Print each revolution\n",
+				argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		fprintf(stderr, "Need a capture file\n");
+		return 1;
+	}
+
+	if (speed > 0) {
+		repeats = 1;
+	}
+
+	struct lidar_capture_map map;
+	if (lidar_capture_map_open(&map, argv[optind])) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+		return 1;
+	}
+
+	if (map.hdr->sensor != LIDAR_SENSOR || map.hdr->baud_rate != LIDAR_BAUD_RATE) {
+		fprintf(stderr, "Warning: captured from sensor %u at %u baud, but built for %s\n",
+		        map.hdr->sensor, map.hdr->baud_rate, LIDAR_SENSOR_NAME);
+	}
+
+	static struct sensor sensors[MAX_SENSORS];
+	struct lidar_capture_record rec;
+	const uint8_t *data;
+	uint32_t records_lost = 0;
+	uint32_t records_skipped = 0;
+	uint64_t cycles = 0;
+	uint64_t max_lag_ns = 0;
+	uint64_t duration_us = 0;
+
+	const uint64_t t0 = bench_now_ns();
+
+	for (int r = 0; r < repeats; r++) {
+		sensors_init(sensors);
+		lidar_capture_map_rewind(&map);
+		records_lost = 0;
+		records_skipped = 0;
+
+		bool first = true;
+		uint8_t next_seq = 0;
+		uint32_t last_time_us = 0;
+		uint64_t rec_us = 0;
+		const uint64_t start_ns = bench_now_ns();
+
+		while (lidar_capture_map_next(&map, &rec, &data)) {
+			if (!first) {
+				records_lost += (uint8_t)(rec.seq - next_seq);
+
+				// 32-bit time, which wraps after ~71 minutes
+				const uint32_t gap_us = rec.time_us - last_time_us;
+				if (gap_us <= MAX_GAP_US) {
+					rec_us += gap_us;
+				}
+			}
+			first = false;
+			next_seq = rec.seq + 1;
+			last_time_us = rec.time_us;
+
+			if (speed > 0) {
+				const uint64_t target = start_ns + (uint64_t)(rec_us * 1000 / speed);
+				const uint64_t now = bench_now_ns();
+
+				if (now < target) {
+					sleep_until_ns(target);
+				} else if (now - target > max_lag_ns) {
+					max_lag_ns = now - target;
+				}
+			}
+
+			if (rec.sensor_id >= MAX_SENSORS) {
+				records_skipped++;
+				continue;
+			}
+
+			struct sensor *sensor = &sensors[rec.sensor_id];
+			sensor->records++;
+			sensor->bytes += rec.len;
+
+			const uint64_t c0 = bench_cycles();
+			lidar_parser_feed(&sensor->parser, data, rec.len);
+			cycles += bench_cycles() - c0;
+		}
+
+		duration_us = rec_us;
+	}
+
+	const double secs = (bench_now_ns() - t0) / 1e9;
+
+	if (map.offs != map.len) {
+		fprintf(stderr, "Stopped at a bad or cut-off record, %zu bytes from the end\n",
+		        map.len - map.offs);
+	}
+
+	uint64_t frames = 0;
+	for (int i = 0; i < MAX_SENSORS; i++) {
+		struct sensor *sensor = &sensors[i];
+		struct lidar_parser_stats stats;
+
+		if (!sensor->records) {
+			continue;
+		}
+
+		lidar_parser_get_stats(&sensor->parser, &stats);
+		frames += stats.frames;
+
+		printf("sensor %d: records: %u bytes: %u frames: %u crc_errors: %u bytes_skipped: %u "
+		       "revolutions: %u filtered: %u\n",
+		       i, sensor->records, sensor->bytes, stats.frames, stats.crc_errors,
+		       stats.bytes_skipped, sensor->revolutions, sensor->filtered);
+	}
+
+	frames *= repeats;
+
+	printf("capture_s: %.3f\n", duration_us / 1e6);
+	printf("records_lost: %u\n", records_lost);
+	if (records_skipped) {
+		printf("records_skipped: %u\n", records_skipped);
+	}
+	printf("elapsed_s: %.3f\n", secs);
+	if (frames) {
+		printf(BENCH_CYCLES_UNIT "_per_frame: %.1f\n", (double)cycles / frames);
+	}
+	if (speed > 0) {
+		printf("max_lag_us: %.0f\n", max_lag_ns / 1e3);
+	} else if (secs > 0) {
+		printf("frames_per_s: %.0f\n", frames / secs);
+		printf("speedup: %.0f\n", duration_us / 1e6 * repeats / secs);
+	}
+
+	lidar_capture_map_close(&map);
+
+	return 0;
+}
@@ -0,0 +1,163 @@
+// Synthetic LD06 data generation for the host benchmarks, and simple 2D
+// scenes to ray cast revolutions from
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc8.h"
+#include "synth.h"
+
+// The sensor samples at a fixed rate regardless of rotation rate
+#define FRAME_PERIOD_US (1000000 * LIDAR_SAMPLES_PER_FRAME / LIDAR_SAMPLE_RATE_HZ)
+
+void synth_init(struct synth_state *st, uint32_t seed, uint32_t scan_hz)
+{
+	memset(st, 0, sizeof(*st));
+	st->rng = seed ? seed : 1;
+	st->speed = scan_hz * 360;
+	st->distance = 1000;
+}
+
+uint32_t synth_rand(struct synth_state *st)
+{
+	// xorshift32
+	uint32_t x = st->rng;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	st->rng = x;
+
+	return x;
+}
+
+void synth_frame(struct synth_state *st, struct lidar_frame *frame)
+{
+	// Angle covered by one frame, in centi-degrees
+	const uint32_t frame_span = (uint32_t)st->speed * FRAME_PERIOD_US / 10000;
+	const uint32_t sample_step = frame_span / LIDAR_SAMPLES_PER_FRAME;
+
+	frame->header = LIDAR_FRAME_HEADER;
+	frame->ver_len = LIDAR_FRAME_VER_LEN;
+	frame->speed = st->speed;
+	frame->start_angle = st->angle;
+	frame->end_angle = (st->angle + sample_step * (LIDAR_SAMPLES_PER_FRAME - 1)) % 36000;
+	frame->timestamp = (st->time_us / 1000) % 30000;
+
+	for (int i = 0; i < LIDAR_SAMPLES_PER_FRAME; i++) {
+		uint32_t r = synth_rand(st);
+		int step = (int)(r % 41) - 20;
+		int dist = st->distance + step;
+		if (dist < 20 || dist > 12000) {
+			dist = 1000;
+		}
+		st->distance = dist;
+
+		frame->samples[i].distance_mm = dist;
+		frame->samples[i].intensity = 150 + ((r >> 8) % 100);
+	}
+
+	frame->crc8 = CalCRC8((uint8_t *)frame, LIDAR_FRAME_SIZE - 1);
+
+	st->angle = (st->angle + frame_span) % 36000;
+	st->time_us += FRAME_PERIOD_US;
+}
+
+void synth_stream(struct synth_state *st, uint8_t *buf, uint32_t nframes)
+{
+	for (uint32_t i = 0; i < nframes; i++) {
+		struct lidar_frame frame;
+		synth_frame(st, &frame);
+		memcpy(buf + i * LIDAR_FRAME_SIZE, &frame, LIDAR_FRAME_SIZE);
+	}
+}
+
+void synth_junk(struct synth_state *st, uint8_t *buf, uint32_t len)
+{
+	for (uint32_t i = 0; i < len; i++) {
+		uint32_t r = synth_rand(st);
+		buf[i] = (r % 3) ? (r >> 8) : LIDAR_FRAME_HEADER;
+	}
+}
+
+void synth_add_segment(struct synth_scene *s, double x0, double y0, double x1, double y1)
+{
+	if (s->nsegs >= SYNTH_MAX_SEGMENTS) {
+		fprintf(stderr, "too many segments in the scene\n");
+		exit(1);
+	}
+
+	s->segs[s->nsegs++] = (struct synth_segment){ x0, y0, x1, y1 };
+}
+
+void synth_add_polygon(struct synth_scene *s, const double (*pts)[2], uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++) {
+		const uint32_t j = (i + 1) % n;
+		synth_add_segment(s, pts[i][0], pts[i][1], pts[j][0], pts[j][1]);
+	}
+}
+
+void synth_add_box(struct synth_scene *s, double cx, double cy, double w, double h, double angle)
+{
+	const double c = cos(angle), sn = sin(angle);
+	double pts[4][2];
+
+	for (int i = 0; i < 4; i++) {
+		const double dx = (i == 1 || i == 2 ? 0.5 : -0.5) * w;
+		const double dy = (i >= 2 ? 0.5 : -0.5) * h;
+		pts[i][0] = cx + dx * c - dy * sn;
+		pts[i][1] = cy + dx * sn + dy * c;
+	}
+
+	synth_add_polygon(s, pts, 4);
+}
+
+double synth_raycast(const struct synth_scene *s, double x, double y, double angle)
+{
+	const double dx = cos(angle), dy = sin(angle);
+	double best = INFINITY;
+
+	for (uint32_t i = 0; i < s->nsegs; i++) {
+		const struct synth_segment *seg = &s->segs[i];
+		const double ex = seg->x1 - seg->x0, ey = seg->y1 - seg->y0;
+		const double den = dx * ey - dy * ex;
+
+		if (fabs(den) < 1e-12) {
+			continue;
+		}
+
+		const double wx = seg->x0 - x, wy = seg->y0 - y;
+		const double t = (wx * ey - wy * ex) / den;
+		const double u = (wx * dy - wy * dx) / den;
+
+		if (t > 0 && u >= 0 && u <= 1 && t < best) {
+			best = t;
+		}
+	}
+
+	return best;
+}
+
+double synth_dist_to_segment(const struct synth_segment *seg, double x, double y)
+{
+	const double ex = seg->x1 - seg->x0, ey = seg->y1 - seg->y0;
+	double u = ((x - seg->x0) * ex + (y - seg->y0) * ey) / (ex * ex + ey * ey);
+	u = fmin(fmax(u, 0), 1);
+
+	return hypot(seg->x0 + u * ex - x, seg->y0 + u * ey - y);
+}
+
+bool synth_pose_clear(const struct synth_scene *s, const struct synth_pose *p)
+{
+	for (uint32_t i = 0; i < s->nsegs; i++) {
+		if (synth_dist_to_segment(&s->segs[i], p->x, p->y) < 300) {
+			return false;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,74 @@
+// Synthetic LD06 data generation for the host benchmarks, and simple 2D
+// scenes to ray cast revolutions from
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+#ifndef __SYNTH_H__
+#define __SYNTH_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lidar_parser.h"
+
+struct synth_state {
+	uint32_t rng;
+	uint32_t angle;     // centi-degrees
+	uint32_t time_us;
+	uint16_t speed;     // degrees/s
+	uint16_t distance;  // mm, random-walks between frames
+};
+
+// 'scan_hz' sets the simulated rotation rate, 10 Hz is the sensor default.
+void synth_init(struct synth_state *st, uint32_t seed, uint32_t scan_hz);
+
+uint32_t synth_rand(struct synth_state *st);
+
+// Generate the next frame, with a valid CRC.
+void synth_frame(struct synth_state *st, struct lidar_frame *frame);
+
+// Fill 'buf' with 'nframes' back-to-back frames, as the sensor sends them.
+// 'buf' must be at least nframes * LIDAR_FRAME_SIZE bytes.
+void synth_stream(struct synth_state *st, uint8_t *buf, uint32_t nframes);
+
+// Fill 'buf' with 'len' bytes of junk which is full of false frame headers,
+// like the sensor's sample data can be.
+void synth_junk(struct synth_state *st, uint8_t *buf, uint32_t len);
+
+// Scenes are made of straight walls, in mm
+struct synth_segment {
+	double x0, y0, x1, y1;
+};
+
+#define SYNTH_MAX_SEGMENTS 96
+
+struct synth_scene {
+	struct synth_segment segs[SYNTH_MAX_SEGMENTS];
+	uint32_t nsegs;
+};
+
+struct synth_pose {
+	double x, y;
+	// Radians
+	double theta;
+};
+
+// Exits if the scene is full
+void synth_add_segment(struct synth_scene *s, double x0, double y0, double x1, double y1);
+
+// A closed polygon
+void synth_add_polygon(struct synth_scene *s, const double (*pts)[2], uint32_t n);
+
+// A w x h box centred on (cx, cy), rotated by 'angle' radians
+void synth_add_box(struct synth_scene *s, double cx, double cy, double w, double h, double angle);
+
+// Distance from (x, y) along the ray at 'angle' to the nearest segment, or
+// INFINITY
+double synth_raycast(const struct synth_scene *s, double x, double y, double angle);
+
+double synth_dist_to_segment(const struct synth_segment *seg, double x, double y);
+
+// Whether the sensor is at least 300 mm from every wall. Any closer and the
+// scene is wrong.
+bool synth_pose_clear(const struct synth_scene *s, const struct synth_pose *p);
+
+#endif /* __SYNTH_H__ */
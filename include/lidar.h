@@ -7,39 +7,30 @@
 #include <stdint.h>
 
 #include "hardware/dma.h"
+#include "pico/time.h"
+
+#include "lidar_merge.h"
+#include "lidar_parser.h"
+#include "lidar_speed.h"
+#include "lidar_time.h"
 
 // By default, this library takes exclusive control of DMA IRQ1.
 // If you don't want that, you can set this to zero, but you _MUST_ register
 // and enable a handler for DMA_IRQ_1 yourself, and call lidar_dma_irq_handler()
-// from that handler!
+// from that handler! It only touches the lidar DMA channels, so the IRQ can be
+// shared with other users.
+//
+// One handler serves every lidar instance, and services all of their pending
+// channels on each entry, so all instances must be initialised on the same
+// core.
 #define LIDAR_EXCLUSIVE_DMA_IRQ_1 1
 
 void lidar_dma_irq_handler(void);
 
-// Structure definitions based on:
-// https://www.elecrow.com/download/product/SLD06360F/LD19_Development%20Manual_V2.3.pdf
-// No copyright attribution mentioned.
-
-#define LIDAR_SAMPLES_PER_FRAME 12
-#define LIDAR_FRAME_HEADER 0x54
-
-struct __attribute__((packed)) lidar_sample {
-	uint16_t distance_mm;
-	uint8_t intensity;
-};
-
-struct __attribute__((packed)) lidar_frame {
-	uint8_t header;
-	uint8_t ver_len;
-	uint16_t speed;
-	uint16_t start_angle;
-	struct lidar_sample samples[LIDAR_SAMPLES_PER_FRAME];
-	uint16_t end_angle;
-	uint16_t timestamp;
-	uint8_t crc8;
-};
-
-typedef void (*frame_cb_t)(void *cb_data, struct lidar_frame *frame);
+// Called with each chunk of the sensor's byte stream exactly as the DMA
+// wrote it, and the time_us_64() when the transfer completed, before the
+// parser sees it. 'data' is only valid during the callback.
+typedef void (*lidar_rx_cb_t)(void *cb_data, const uint8_t *data, uint32_t len, uint64_t time_us);
 
 // Populate this structure with your desired values and pass it to lidar_init.
 struct lidar_cfg {
@@ -48,8 +39,12 @@ struct lidar_cfg {
 	uint uart_pin;
 	// The PWM pin connected to the LIDAR. lidar_init will claim the
 	// corresponding DMA slice. If PWM control is not used or desired,
-	// set to -1.
+	// set to -1. Ignored if the sensor has no PWM input (LIDAR_PWM_HZ is
+	// 0).
 	int pwm_pin;
+	// Scan rate to hold, in centi-Hz (see lidar_set_scan_rate()).
+	// 0 runs the motor open-loop at LIDAR_SPEED_DUTY_DEFAULT (~10 Hz).
+	uint32_t scan_rate_centi_hz;
 
 	// Callback function which will be called for each received valid frame.
 	// It will receive frame_cb_data as its cb_data argument.
@@ -57,33 +52,109 @@ struct lidar_cfg {
 	// interrupt context.
 	frame_cb_t frame_cb;
 	void *frame_cb_data;
+
+	// The frame passed to frame_cb points directly into the DMA buffer.
+	// If hold_frames is set, it stays valid after the callback returns,
+	// until it is passed to lidar_release_frame(), so it can be queued
+	// up and processed elsewhere without copying it.
+	// See lidar_parser_cfg for the details.
+	bool hold_frames;
+
+	// Receive up to this many frames per DMA transfer, to reduce the
+	// interrupt rate (by default there's one interrupt per frame, ~357/s).
+	// 0 or 1 disables batching. At most LIDAR_HW_NUM_SLOTS - 1.
+	uint32_t batch_frames;
+	// When batching, the longest time (in microseconds) that a complete
+	// frame may wait in the buffer before it is delivered. Frames which
+	// have arrived are flushed out by a repeating timer with this period.
+	// 0 means no timer: frames are only delivered when a batch completes.
+	//
+	// The timer runs on the core calling lidar_init(), like DMA_IRQ_1: on
+	// the default alarm pool if that's on the same core, or else on a pool
+	// which takes an unused hardware alarm. The timer IRQ must have the
+	// same priority as DMA_IRQ_1 (both are the default).
+	uint32_t max_latency_us;
+
+	// Identifies this sensor when there's more than one (e.g. one on each
+	// UART). Copied into each lidar_frame_ref pushed to 'merge'.
+	uint8_t sensor_id;
+	// If set, every frame is also pushed to this merger (after calling
+	// frame_cb, which may then be NULL), tagged with sensor_id, its
+	// timestamps, and time_us_32() when its DMA transfer completed.
+	// This implies hold_frames: release
+	// the frames with lidar_release_frame() on the matching lidar_hw.
+	// All sensors sharing a merger get their timestamps from the same
+	// IRQ, so lidar_merge_pop() gives a properly time-ordered stream.
+	struct lidar_merge *merge;
+
+	// Optional, for capturing the raw data (see lidar_capture.h). Called
+	// from the DMA IRQ, like frame_cb, so it should just copy the data
+	// somewhere. It will receive rx_cb_data as its cb_data argument.
+	lidar_rx_cb_t rx_cb;
+	void *rx_cb_data;
 };
 
-// A lidar_frame is 57 bytes.
-// We need a well-aligned power-of-two buffer so we can use the DMA's ring-buffer mode.
-//
-// We process frames serially, so we only need to store one - so 64 bytes
-// should be OK.
-#define LIDAR_FRAME_SIZE sizeof(struct lidar_frame)
-#define LIDAR_HW_BUF_BITS 6
-#define LIDAR_HW_BUF_SIZE (1 << LIDAR_HW_BUF_BITS)
-static_assert(LIDAR_HW_BUF_SIZE >= LIDAR_FRAME_SIZE);
+// CPU cycle counts for one piece of code.
+// The average is total / count.
+struct lidar_timing {
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t total;
+};
+
+struct lidar_stats {
+	struct lidar_parser_stats parser;
+
+	// Time spent in the driver's interrupt handlers (the DMA IRQ, and the
+	// flush timer when batching), including the frame callbacks.
+	struct lidar_timing irq_cycles;
+	// Time spent in the frame callback alone
+	struct lidar_timing frame_cb_cycles;
+};
 
 // This structure stores the internal state of the lidar driver.
 // You should NOT directly access anything in this structure!
 // The definition is only provided so that the library can be used with zero
 // dynamic allocations.
 struct lidar_hw {
-	uint8_t __attribute__((aligned(LIDAR_HW_BUF_SIZE))) buf[LIDAR_HW_BUF_SIZE];
+	struct lidar_parser parser;
 
-	uint64_t insert;
-	uint64_t extract;
 	int dma_chan;
 	dma_channel_config dma_cfg;
-	uint32_t last_nbytes;
 	uint8_t *dma_read_addr;
+	repeating_timer_t flush_timer;
+
+	// The user's callback, which the driver wraps to time it
 	frame_cb_t frame_cb;
 	void *frame_cb_data;
+	uint8_t sensor_id;
+	struct lidar_merge *merge;
+	struct lidar_timing irq_cycles;
+	struct lidar_timing frame_cb_cycles;
+
+	// time_us_64() when the current DMA transfer completed (or the flush
+	// timer ran), and the timestamps of the frame being delivered
+	uint64_t rx_time_us;
+	// Where the current DMA transfer is writing to, for rx_cb
+	uint8_t *rx_req_buf;
+	uint32_t rx_req_len;
+	lidar_rx_cb_t rx_cb;
+	void *rx_cb_data;
+	struct lidar_time_sync time_sync;
+	struct lidar_frame_time frame_time;
+
+	// Scan rate control, run from the frame callback. Only used if
+	// pwm_pin >= 0. New targets are passed in through scan_rate_req, and
+	// picked up when scan_rate_req_seq changes, so they can come from
+	// either core.
+	int pwm_pin;
+	uint pwm_slice;
+	uint pwm_chan;
+	struct lidar_speed_ctl speed;
+	volatile uint32_t scan_rate_req;
+	volatile uint32_t scan_rate_req_seq;
+	uint32_t scan_rate_seq;
 };
 
 // Initialise and start handling data from the lidar.
@@ -96,6 +167,51 @@ struct lidar_hw {
 // lidar_init. This structure MUST NOT be freed or go out of scope.
 void lidar_init(struct lidar_hw *hw, struct lidar_cfg *cfg);
 
+// Release a frame which was received with hold_frames set, so that its
+// buffer space can be re-used. Frames must be released in the order they
+// were received.
+void lidar_release_frame(struct lidar_hw *hw, struct lidar_frame *frame);
+
+// Get the driver's counters and timings.
+//
+// The timings are measured with SysTick, on whichever core called
+// lidar_init(). lidar_init() starts SysTick counting CPU cycles if it isn't
+// already running. If something else runs it with a shorter reload period,
+// the timings will be wrong.
+//
+// Interrupts are disabled while copying, so the result is consistent if this
+// is called on the same core as the interrupts. From the other core, each
+// value is correct but they may be from slightly different times.
+void lidar_get_stats(struct lidar_hw *hw, struct lidar_stats *stats);
+
+// Zero the counters and timings. The same caveats apply as for
+// lidar_get_stats(): from the other core, an update may be lost.
+void lidar_reset_stats(struct lidar_hw *hw);
+
+// Get the timestamps of the frame currently being delivered. Only valid
+// when called from frame_cb. The sensor's timestamp is mapped on to the
+// Pico's clock (time_us_64()), see lidar_time.h. Use
+// lidar_frame_time_sample_us() for the time of each sample.
+const struct lidar_frame_time *lidar_frame_time(struct lidar_hw *hw);
+
+// Get the current estimate of the offset and drift between the sensor's
+// clock and the Pico's. Has the same caveats as lidar_get_stats().
+void lidar_get_time_status(struct lidar_hw *hw, struct lidar_time_status *status);
+
+// Set the scan rate to hold, in centi-Hz (e.g. 1000 for 10 Hz). The sensor
+// is rated for 5-13 Hz. The motor's PWM duty is adjusted from the speed
+// reported in each frame, a few times a second, so it takes a second or two
+// to settle on a new rate. 0 stops adjusting, leaving the duty where it is.
+//
+// Does nothing if the driver isn't controlling the PWM (pwm_pin < 0).
+// Can be called from either core, but only from one place at a time.
+void lidar_set_scan_rate(struct lidar_hw *hw, uint32_t centi_hz);
+
+// Get the scan rate controller's state: the target and measured rates, the
+// current duty, and whether it has locked on to the target.
+// Has the same caveats as lidar_get_stats().
+void lidar_get_scan_rate_status(struct lidar_hw *hw, struct lidar_speed_status *status);
+
 // Print a textual representation of a lidar frame to stdout.
 void dump_frame(struct lidar_frame *frame);
 
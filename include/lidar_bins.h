@@ -0,0 +1,107 @@
+// Angular binning for the OKDO LIDAR_LD06
+//
+// Reduces each revolution to one distance per angular bin (e.g. the nearest
+// return in each degree), for consumers which don't need every sample.
+// Samples are accumulated as frames arrive, and completed revolutions are
+// triple-buffered in the same way as lidar_scan.h (see lidar_triple.h).
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+#ifndef __LIDAR_BINS_H__
+#define __LIDAR_BINS_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lidar_parser.h"
+#include "lidar_triple.h"
+
+// The most bins in one revolution. Sets the smallest bin width (the default
+// is 1 degree), and the size of struct lidar_bins.
+#ifndef LIDAR_BINS_MAX
+#define LIDAR_BINS_MAX 360
+#endif
+
+// LIDAR_BINS_MEDIAN keeps up to this many samples per bin, and ignores any
+// more. At 10 Hz there are ~1.25 samples per degree.
+#ifndef LIDAR_BINS_MEDIAN_MAX
+#define LIDAR_BINS_MEDIAN_MAX 8
+#endif
+
+#define LIDAR_BINS_NUM_BUFS LIDAR_TRIPLE_NUM_BUFS
+
+enum lidar_bins_mode {
+	// Nearest return, for obstacle avoidance
+	LIDAR_BINS_MIN,
+	// Median, rounding down for an even number of samples
+	LIDAR_BINS_MEDIAN,
+	// Mean, rounded to the nearest mm
+	LIDAR_BINS_MEAN,
+};
+
+struct lidar_bins_cfg {
+	// Centi-degrees. Clamped so there are at most LIDAR_BINS_MAX bins. If
+	// it doesn't divide 360 degrees, the last bin is narrower.
+	uint16_t bin_width;
+	enum lidar_bins_mode mode;
+};
+
+struct lidar_bins {
+	// Increments by one for each completed revolution
+	uint32_t seq;
+	// Rotation speed in degrees/s, from the last frame in the revolution
+	uint16_t speed;
+	// Sensor timestamp (ms) of the first frame in the revolution
+	uint16_t timestamp;
+	// Number of samples which went into the revolution
+	uint16_t nsamples;
+	uint16_t bin_width;
+	uint16_t nbins;
+	uint8_t mode;
+	// Bin i covers angles from i * bin_width. Samples with distance 0 (no
+	// return) are ignored, and bins with no samples are 0.
+	uint16_t distance_mm[LIDAR_BINS_MAX];
+};
+
+// Accumulated samples for one bin
+struct lidar_bins_acc {
+	// Min, or sum for the mean
+	uint32_t acc;
+	uint16_t count;
+	uint16_t samples[LIDAR_BINS_MEDIAN_MAX];
+};
+
+// This structure stores the internal state of the binning.
+// You should NOT directly access anything in this structure!
+// The definition is only provided so that the library can be used with zero
+// dynamic allocations.
+struct lidar_bins_reducer {
+	struct lidar_bins bufs[LIDAR_BINS_NUM_BUFS];
+	struct lidar_bins_acc acc[LIDAR_BINS_MAX];
+
+	uint16_t bin_width;
+	uint16_t nbins;
+	enum lidar_bins_mode mode;
+
+	// Which of bufs is being filled, and which is being read
+	struct lidar_triple bufs_idx;
+
+	uint32_t last_angle;
+	bool started;
+	uint32_t seq;
+	uint16_t timestamp;
+	uint16_t nsamples;
+};
+
+void lidar_bins_init(struct lidar_bins_reducer *br, const struct lidar_bins_cfg *cfg);
+
+// Add the samples from a frame. Frames must be added in the order they were
+// received.
+// This is normally called from a frame_cb_t.
+void lidar_bins_add_frame(struct lidar_bins_reducer *br, const struct lidar_frame *frame);
+
+// Get the most recently completed revolution, if there has been a new one
+// since the last call. Otherwise returns NULL. The same rules apply as for
+// lidar_scan_acquire().
+const struct lidar_bins *lidar_bins_acquire(struct lidar_bins_reducer *br);
+
+#endif /* __LIDAR_BINS_H__ */
@@ -0,0 +1,59 @@
+// Raw capture format for the OKDO LIDAR_LD06
+//
+// A capture is the sensor's UART byte stream exactly as the DMA delivered it
+// to the parser, one record per completed DMA transfer, each tagged with the
+// time the transfer completed. Replaying it through the parser in the same
+// chunks reproduces what the parser saw, including any junk, resyncs and
+// CRC errors.
+//
+// A capture file is a lidar_capture_file_header, followed by records:
+// a lidar_capture_record, then 'len' bytes of data. Everything is
+// little-endian and packed, with no padding, so a file can be memory-mapped
+// and walked in place. Files are only ever appended to, so a file which was
+// cut off part-way through a record is still valid up to that record.
+//
+// The device sends the same records (without the file header) over the CDC
+// serial port in capture mode, so the host just has to append them to the
+// file.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+#ifndef __LIDAR_CAPTURE_H__
+#define __LIDAR_CAPTURE_H__
+
+#include <stdint.h>
+
+#include "lidar_parser.h"
+
+#define LIDAR_CAPTURE_MAGIC "LIDARCAP"
+#define LIDAR_CAPTURE_VERSION 1
+
+struct __attribute__((packed)) lidar_capture_file_header {
+	// LIDAR_CAPTURE_MAGIC, without the terminator
+	char magic[8];
+	uint16_t version;
+	// Size of this header, so it can grow
+	uint16_t header_size;
+	// LIDAR_SENSOR of the device which made the capture
+	uint8_t sensor;
+	uint8_t reserved[3];
+	uint32_t baud_rate;
+};
+
+#define LIDAR_CAPTURE_SYNC 0xa55c
+
+// The most data one record can hold: a whole parser buffer
+#define LIDAR_CAPTURE_MAX_LEN LIDAR_HW_BUF_SIZE
+
+struct __attribute__((packed)) lidar_capture_record {
+	// LIDAR_CAPTURE_SYNC, so the stream can be picked up part-way through
+	uint16_t sync;
+	// Increments by one for each record, so lost records can be spotted
+	uint8_t seq;
+	uint8_t sensor_id;
+	// Bytes of data following the record
+	uint16_t len;
+	// Low 32 bits of time_us_64() when the DMA transfer completed
+	uint32_t time_us;
+};
+
+#endif /* __LIDAR_CAPTURE_H__ */
@@ -0,0 +1,80 @@
+// Motion de-skew for the OKDO LIDAR_LD06
+//
+// At 10 Hz a revolution takes 100 ms, so on a moving robot each sample is
+// seen from a slightly different place. Given the sensor's velocity, this
+// converts frames to points as they would have been seen from where the
+// sensor was at one reference time.
+//
+// Each sample's time comes from how far the sensor has turned since the
+// reference, and its rotation speed, rather than straight from the frame's
+// timestamp, which is only to the nearest ms (which would be several mm at
+// the sensor's range, when turning). The timestamp is only used to count
+// whole revolutions.
+//
+// The rotation is applied by adding it to each sample's angle before it's
+// converted to x and y, so the per-sample cost is the same as
+// lidar_points_to_xy() plus the translation. It's all integer maths.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+#ifndef __LIDAR_DESKEW_H__
+#define __LIDAR_DESKEW_H__
+
+#include <stdint.h>
+
+#include "lidar_parser.h"
+#include "lidar_points.h"
+
+// Frames further than this from the reference time are treated as being
+// this far away. De-skewing is only meaningful for a revolution or so.
+#define LIDAR_DESKEW_MAX_DT_MS 1000
+
+// How the sensor is moving, assumed constant
+struct lidar_deskew_motion {
+	// Velocity, in the sensor's own frame at the reference time, using
+	// the same axes as lidar_points_to_xy(): x towards 0 degrees, y
+	// towards 90 degrees
+	int32_t vx_mm_s;
+	int32_t vy_mm_s;
+	// Rotation rate, in centi-degrees/s, in the same direction as the
+	// sample angles
+	int32_t omega_cdeg_s;
+};
+
+// This structure stores the internal state of the de-skew.
+// You should NOT directly access anything in this structure!
+// The definition is only provided so that the library can be used with zero
+// dynamic allocations.
+struct lidar_deskew {
+	// The motion, per us, in 32.32 fixed point, so that lidar_deskew_frame()
+	// doesn't need to divide
+	int64_t vx_q32;
+	int64_t vy_q32;
+	int64_t omega_q32;
+	uint16_t ref_timestamp;
+	uint16_t ref_angle;
+};
+
+// Starts with no motion, and the reference at timestamp 0, angle 0
+void lidar_deskew_init(struct lidar_deskew *d);
+
+void lidar_deskew_set_motion(struct lidar_deskew *d, const struct lidar_deskew_motion *motion);
+
+// The reference time is when the sensor was pointing at 'angle'
+// (centi-degrees), within half a revolution of sensor time 'timestamp' (ms).
+// To de-skew a revolution to its start, use the timestamp and start angle
+// of its first frame.
+void lidar_deskew_set_reference(struct lidar_deskew *d, uint16_t timestamp, uint16_t angle);
+
+// Work out the velocity from how far the sensor moved in 'dt_us': the pose
+// at the end relative to the start (e.g. the transform for a revolution from
+// lidar_match_add_scan(), and the time the revolution took).
+void lidar_deskew_motion_from_delta(struct lidar_deskew_motion *motion, int32_t x_mm, int32_t y_mm,
+                                    int32_t theta_cdeg, uint32_t dt_us);
+
+// Convert a frame into LIDAR_SAMPLES_PER_FRAME points, as seen from the
+// sensor's pose at the reference time. Like lidar_points_to_xy(), samples
+// with no return (distance 0) come out as (0, 0).
+void lidar_deskew_frame(const struct lidar_deskew *d, const struct lidar_frame *frame,
+                        struct lidar_point_xy *xy);
+
+#endif /* __LIDAR_DESKEW_H__ */
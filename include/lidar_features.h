@@ -0,0 +1,152 @@
+// Line feature extraction for the OKDO LIDAR_LD06
+//
+// Indoors, most of a revolution is walls. This reduces each revolution to the
+// straight line segments in it, the corners where they meet, and whatever
+// points are left over, which is a small fraction of the data in a
+// structured environment.
+//
+// The points are split into runs wherever neighbouring points are too far
+// apart to be on the same surface. Each run is then split (split-and-merge)
+// at the point furthest from the line between its ends, until every piece is
+// close enough to straight. Each piece gets a least-squares line fit, and
+// neighbouring pieces which turn out to be on the same line are merged back
+// together. Where two segments of the same run meet at an angle, their ends
+// are moved to where the lines cross, which is a corner. Pieces too short to
+// be a segment are sent as points.
+//
+// It's all integer maths, and the work is bounded: each split looks at the
+// points in the piece being split, and there are at most max_segments
+// splits, so a revolution of n points takes at most (max_segments + 4) * n
+// point operations. lidar_features.work counts them.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+#ifndef __LIDAR_FEATURES_H__
+#define __LIDAR_FEATURES_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lidar_points.h"
+#include "lidar_scan.h"
+
+// The most segments from one revolution. Sets the size of struct
+// lidar_features, and the most work per revolution (see above).
+#ifndef LIDAR_FEATURES_MAX_SEGMENTS
+#define LIDAR_FEATURES_MAX_SEGMENTS 64
+#endif
+
+// The most left over points from one revolution. Any more are counted in
+// lidar_features.dropped.
+#ifndef LIDAR_FEATURES_MAX_POINTS
+#define LIDAR_FEATURES_MAX_POINTS 128
+#endif
+
+struct lidar_features_cfg {
+	// Only samples in this range are used. 0 disables the minimum. The
+	// maximum is at most 16000 mm (and 0 means that), to keep the maths
+	// in 32 bits.
+	uint16_t min_distance_mm;
+	uint16_t max_distance_mm;
+
+	// Neighbouring points further apart than this start a new run. It's
+	// increased with distance, to allow for surfaces seen at up to ~80
+	// degrees, where the samples are spread out.
+	uint16_t break_mm;
+	// A piece is split if any point is further than this from the line
+	// between its ends. Also how far a neighbouring segment's ends can
+	// be from a line, to be merged into it.
+	uint16_t split_mm;
+	// Neighbouring segments within this angle (centi-degrees) of each
+	// other are merged
+	uint16_t merge_angle;
+	// Neighbouring segments at more than this angle (centi-degrees) to
+	// each other, whose lines cross within corner_mm of both their ends,
+	// make a corner
+	uint16_t corner_angle;
+	uint16_t corner_mm;
+
+	// Pieces with fewer points, or shorter than this, are left as points.
+	// min_points below 3 means 3.
+	uint8_t min_points;
+	uint16_t min_length_mm;
+	// The most segments per revolution, to bound the work. 0, or more
+	// than LIDAR_FEATURES_MAX_SEGMENTS, means LIDAR_FEATURES_MAX_SEGMENTS.
+	uint16_t max_segments;
+};
+
+// Ends in mm, in the same frame as lidar_points_to_xy(). Segments go round
+// in the same direction as the sample angles, and so do their ends.
+struct lidar_feature_segment {
+	int16_t x0_mm;
+	int16_t y0_mm;
+	int16_t x1_mm;
+	int16_t y1_mm;
+};
+
+// The end of one segment, and the start of the next, are both moved to the
+// corner where they meet
+struct lidar_feature_corner {
+	int16_t x_mm;
+	int16_t y_mm;
+};
+
+struct lidar_features {
+	// From the revolution
+	uint32_t seq;
+	uint16_t speed;
+	uint16_t timestamp;
+
+	uint16_t nsegments;
+	uint16_t ncorners;
+	uint16_t npoints;
+	// Left over points which didn't fit in 'points'
+	uint16_t dropped;
+	// max_segments was reached, so some pieces weren't split or fitted,
+	// and were sent as points instead
+	bool truncated;
+	// Point operations used, for the bound above
+	uint32_t work;
+
+	struct lidar_feature_segment segments[LIDAR_FEATURES_MAX_SEGMENTS];
+	struct lidar_feature_corner corners[LIDAR_FEATURES_MAX_SEGMENTS];
+	struct lidar_point_xy points[LIDAR_FEATURES_MAX_POINTS];
+};
+
+// A segment while it's being worked on: its range of points, and the fitted
+// line through (cx, cy) in direction (ux, uy), in Q15
+struct lidar_features_line {
+	uint16_t first;
+	uint16_t last;
+	int16_t cx;
+	int16_t cy;
+	int16_t ux;
+	int16_t uy;
+};
+
+// This structure stores the internal state of the extractor.
+// You should NOT directly access anything in this structure!
+// The definition is only provided so that the library can be used with zero
+// dynamic allocations.
+struct lidar_features_extractor {
+	struct lidar_features_cfg cfg;
+
+	// The revolution's points, in angle order, starting at the start of
+	// a run. run_start[i] is set if point i starts a new run.
+	int16_t x[LIDAR_SCAN_BINS];
+	int16_t y[LIDAR_SCAN_BINS];
+	uint8_t run_start[LIDAR_SCAN_BINS];
+	uint16_t npoints;
+
+	struct lidar_features_line lines[LIDAR_FEATURES_MAX_SEGMENTS];
+	// Pieces still to be split, as (first, last)
+	uint16_t stack[LIDAR_FEATURES_MAX_SEGMENTS][2];
+};
+
+// 'cfg' is copied
+void lidar_features_init(struct lidar_features_extractor *ex, const struct lidar_features_cfg *cfg);
+
+// Extract the features from a revolution into 'out'
+void lidar_features_extract(struct lidar_features_extractor *ex, const struct lidar_scan *scan,
+                            struct lidar_features *out);
+
+#endif /* __LIDAR_FEATURES_H__ */
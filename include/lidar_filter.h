@@ -0,0 +1,70 @@
+// Streaming sample filter for the OKDO LIDAR_LD06
+//
+// Removes samples which aren't worth passing on: weak returns, returns
+// outside a range gate, and single-sample spikes (common near edges). Works
+// on whole frames, in the order they were received, and the output is still
+// a valid frame (with a new CRC), so it can be used anywhere the original
+// could.
+//
+// Removed samples get distance 0, the same as the sensor uses for "no
+// return". Their intensity is left alone.
+//
+// The median looks at neighbouring samples, including across frame
+// boundaries, so each frame is only output once the next one has arrived.
+// If a frame is missing, the frames either side are treated as separate.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+#ifndef __LIDAR_FILTER_H__
+#define __LIDAR_FILTER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lidar_parser.h"
+
+// The widest median supported
+#define LIDAR_FILTER_MEDIAN_MAX 5
+#define LIDAR_FILTER_MEDIAN_RADIUS (LIDAR_FILTER_MEDIAN_MAX / 2)
+
+struct lidar_filter_cfg {
+	// Samples with a lower intensity are removed. 0 disables.
+	uint8_t min_intensity;
+	// Samples outside this range are removed. 0 disables either limit.
+	uint16_t min_distance_mm;
+	uint16_t max_distance_mm;
+	// Replace each sample with the median of it and its neighbours: 3 or
+	// 5. 0 or 1 disables, and then frames are output straight away.
+	// Removed samples stay removed, and don't count towards the median.
+	// With an even number left, the lower of the middle two is used.
+	uint8_t median;
+};
+
+// This structure stores the internal state of the filter.
+// You should NOT directly access anything in this structure!
+// The definition is only provided so that the library can be used with zero
+// dynamic allocations.
+struct lidar_filter {
+	struct lidar_filter_cfg cfg;
+
+	// Frame waiting for the next one, with the gating already applied
+	bool have_held;
+	struct lidar_frame held;
+
+	// The end of the frame before 'held', if it was contiguous
+	bool have_prev;
+	uint16_t prev_tail[LIDAR_FILTER_MEDIAN_RADIUS];
+};
+
+// 'cfg' is copied. A median other than 3 or 5 disables it.
+void lidar_filter_init(struct lidar_filter *f, const struct lidar_filter_cfg *cfg);
+
+// Add a frame. Returns true if a filtered frame was written to 'out', which
+// may be the same as 'in'. With a median, that's the previous frame, so the
+// first call returns false.
+bool lidar_filter_frame(struct lidar_filter *f, const struct lidar_frame *in, struct lidar_frame *out);
+
+// Get the last frame out, without waiting for the next one. Returns false
+// if there isn't one.
+bool lidar_filter_flush(struct lidar_filter *f, struct lidar_frame *out);
+
+#endif /* __LIDAR_FILTER_H__ */
@@ -0,0 +1,150 @@
+// 2D occupancy grid for the OKDO LIDAR_LD06
+//
+// Builds a log-odds occupancy grid as frames arrive: each sample lowers the
+// cells its ray passed through, and raises the cell it hit. It's updated one
+// frame at a time, so the cost is spread evenly over the revolution instead of
+// arriving all at once when it completes. Everything is fixed-size integer
+// maths, so it's cheap enough to run on the RP2040.
+//
+// The grid is split into square tiles, and a tile is marked dirty whenever
+// one of its cells changes, so only the parts which changed need to be sent
+// anywhere else.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+#ifndef __LIDAR_GRID_H__
+#define __LIDAR_GRID_H__
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lidar_parser.h"
+
+// The largest grid, in cells along each side. Sets the size of struct
+// lidar_grid: one byte per cell, so 16 kB by default.
+#ifndef LIDAR_GRID_MAX_DIM
+#define LIDAR_GRID_MAX_DIM 128
+#endif
+
+// Cells along each side of a tile. 256 cells per tile.
+#define LIDAR_GRID_TILE_DIM 16
+#define LIDAR_GRID_TILE_CELLS (LIDAR_GRID_TILE_DIM * LIDAR_GRID_TILE_DIM)
+#define LIDAR_GRID_MAX_TILES ((LIDAR_GRID_MAX_DIM / LIDAR_GRID_TILE_DIM) * \
+                              (LIDAR_GRID_MAX_DIM / LIDAR_GRID_TILE_DIM))
+static_assert(LIDAR_GRID_MAX_DIM % LIDAR_GRID_TILE_DIM == 0,
+              "LIDAR_GRID_MAX_DIM must be a whole number of tiles");
+
+struct lidar_grid_cfg {
+	// Size of each (square) cell, in mm
+	uint16_t cell_mm;
+	// Size of the grid, in cells. Rounded up to a whole number of tiles,
+	// and clamped to LIDAR_GRID_MAX_DIM.
+	uint16_t width;
+	uint16_t height;
+
+	// Log-odds added to the cell a sample hit (positive), and to each
+	// cell its ray passed through on the way (negative). Cells saturate
+	// at min and max. Positive cells are probably occupied, negative ones
+	// probably free, and 0 is unknown.
+	int8_t hit;
+	int8_t miss;
+	int8_t min;
+	int8_t max;
+
+	// Samples further away than this only clear cells, up to this
+	// distance. 0 means no limit.
+	uint16_t max_range_mm;
+	// Weaker samples are ignored. 0 disables.
+	uint8_t min_intensity;
+};
+
+// Where the sensor is on the grid, in mm from the corner of cell (0, 0),
+// with x along the rows and y along the columns. 'heading' (centi-degrees) is
+// added to each sample's angle before it's converted to x and y the same way
+// as lidar_points_to_xy().
+struct lidar_grid_pose {
+	int32_t x_mm;
+	int32_t y_mm;
+	uint16_t heading;
+};
+
+// A copy of one tile, from lidar_grid_take_dirty()
+struct lidar_grid_tile {
+	// Which tile this is: it covers cells from (tile_x, tile_y) *
+	// LIDAR_GRID_TILE_DIM
+	uint16_t tile_x;
+	uint16_t tile_y;
+	// The size of the whole grid, in tiles, and of a cell
+	uint16_t tiles_w;
+	uint16_t tiles_h;
+	uint16_t cell_mm;
+	// Log-odds, row by row
+	int8_t cells[LIDAR_GRID_TILE_CELLS];
+};
+
+// Counters, which start at zero and wrap
+struct lidar_grid_stats {
+	uint32_t frames;
+	// Samples which were traced into the grid
+	uint32_t rays;
+	// Cell updates, including ones which were already saturated
+	uint32_t cells;
+	// Tiles taken by lidar_grid_take_dirty()
+	uint32_t tiles_taken;
+};
+
+// This structure stores the internal state of the grid.
+// You should NOT directly access anything in this structure!
+// The definition is only provided so that the library can be used with zero
+// dynamic allocations.
+struct lidar_grid {
+	// Stored a tile at a time, so a tile is contiguous
+	int8_t cells[LIDAR_GRID_MAX_DIM * LIDAR_GRID_MAX_DIM];
+	// Set by the writer, cleared by whoever takes the tile
+	uint8_t dirty[LIDAR_GRID_MAX_TILES];
+
+	struct lidar_grid_cfg cfg;
+	uint16_t tiles_w;
+	uint16_t tiles_h;
+	struct lidar_grid_pose pose;
+
+	// Only used by lidar_grid_take_dirty()
+	uint32_t next_tile;
+
+	struct lidar_grid_stats stats;
+};
+
+// 'cfg' is copied. The grid starts out unknown (all 0), with the sensor in
+// the middle, heading 0.
+void lidar_grid_init(struct lidar_grid *grid, const struct lidar_grid_cfg *cfg);
+
+// Move the sensor. Applies to frames added after this.
+void lidar_grid_set_pose(struct lidar_grid *grid, const struct lidar_grid_pose *pose);
+
+// Trace each sample in a frame into the grid. Frames are ignored while the
+// sensor is off the grid. Samples with no return (distance 0) carry no
+// information, and are ignored too.
+// This is normally called from a frame_cb_t.
+void lidar_grid_add_frame(struct lidar_grid *grid, const struct lidar_frame *frame);
+
+// Log-odds of a cell. 0 (unknown) if it's off the grid.
+int8_t lidar_grid_get(const struct lidar_grid *grid, int32_t x, int32_t y);
+
+// Copy out the next dirty tile, and mark it clean. Tiles are visited round
+// robin, so a busy area can't starve the rest. Returns false if nothing is
+// dirty.
+//
+// This, and lidar_grid_mark_all_dirty(), may be called from a different
+// context to lidar_grid_add_frame() (e.g. the main loop, or the other core).
+// The copy may then catch a frame part-way through, but in that case the tile
+// will be dirty again afterwards, so the latest version always follows.
+bool lidar_grid_take_dirty(struct lidar_grid *grid, struct lidar_grid_tile *tile);
+
+// Mark every tile dirty, e.g. when a new consumer needs the whole grid
+void lidar_grid_mark_all_dirty(struct lidar_grid *grid);
+
+// Copy out the counters. Only consistent if it can't run concurrently with
+// lidar_grid_add_frame().
+void lidar_grid_get_stats(struct lidar_grid *grid, struct lidar_grid_stats *stats);
+
+#endif /* __LIDAR_GRID_H__ */
@@ -0,0 +1,143 @@
+// Scan matching odometry for the OKDO LIDAR_LD06
+//
+// Estimates how the sensor moved between two revolutions, by aligning their
+// points with ICP (iterative closest point): pair each point with the nearest
+// one in the reference revolution, solve for the rigid transform which best
+// lines the pairs up, and repeat from there until it stops moving.
+//
+// The two revolutions sample a surface at different places, so rather than
+// the nearest reference point itself, each point is paired with the nearest
+// place on the surface through it (from its neighbours on either side).
+// Otherwise, the pairs pull the estimate back towards no motion at all.
+//
+// The reference points are sorted into a coarse grid of cells, so finding
+// the nearest one only needs to look at the 3x3 cells around the query.
+// Points are kept as separate x and y arrays of int16_t, in cell order, so
+// each search reads a few short contiguous runs. It's all integer maths, so
+// the same code runs on the host and on the RP2040 (with a lighter
+// configuration, see lidar_match_cfg).
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+#ifndef __LIDAR_MATCH_H__
+#define __LIDAR_MATCH_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lidar_scan.h"
+
+// The most points used from one revolution. One per scan bin.
+#define LIDAR_MATCH_MAX_POINTS LIDAR_SCAN_BINS
+
+// Cells along each side of the reference grid. With cell_mm that sets the
+// area covered (points outside it are ignored), and the size of
+// struct lidar_match: two bytes per cell.
+#ifndef LIDAR_MATCH_GRID_DIM
+#define LIDAR_MATCH_GRID_DIM 64
+#endif
+#define LIDAR_MATCH_GRID_CELLS (LIDAR_MATCH_GRID_DIM * LIDAR_MATCH_GRID_DIM)
+
+// A 2D rigid transform: rotate by theta, then move by (x, y). The same
+// conventions as lidar_points_to_xy() (and lidar_grid_pose), so theta is in
+// centi-degrees, in the same direction as the sample angles. From -18000 to
+// 17999.
+struct lidar_match_transform {
+	int32_t x_mm;
+	int32_t y_mm;
+	int32_t theta;
+};
+
+struct lidar_match_cfg {
+	// Size of the reference grid's cells. Also the furthest apart two
+	// points can be and still be paired. The grid covers
+	// LIDAR_MATCH_GRID_DIM * cell_mm, centred on the sensor, so this
+	// should be a little more than the expected motion between
+	// revolutions, but small enough for the grid to cover the room.
+	uint16_t cell_mm;
+	// Pairs further apart than this are ignored. 0, or anything more
+	// than cell_mm, means cell_mm. At most 16383.
+	uint16_t max_pair_mm;
+
+	// Only samples in this range are used. 0 disables either limit.
+	uint16_t min_distance_mm;
+	uint16_t max_distance_mm;
+
+	// Use every n'th point of the revolution being matched (the
+	// reference always uses them all). 0 or 1 uses every point.
+	uint8_t decimate;
+	// Stop after this many iterations, even if it's still moving
+	uint8_t max_iterations;
+	// Give up if fewer points than this could be paired
+	uint16_t min_pairs;
+};
+
+struct lidar_match_result {
+	// Maps points from the matched revolution into the reference one,
+	// i.e. where the sensor is now, relative to where it was.
+	struct lidar_match_transform transform;
+	// Usable points in the matched revolution, and how many were paired
+	// in the last iteration
+	uint16_t points;
+	uint16_t pairs;
+	// RMS distance between the pairs, in mm, after the last iteration
+	uint16_t rms_mm;
+	uint8_t iterations;
+	// False if it stopped because of max_iterations
+	bool converged;
+};
+
+// This structure stores the internal state of the matcher.
+// You should NOT directly access anything in this structure!
+// The definition is only provided so that the library can be used with zero
+// dynamic allocations.
+struct lidar_match {
+	struct lidar_match_cfg cfg;
+
+	// The reference revolution, sorted by cell. Cell c's points are from
+	// cell_start[c] up to cell_start[c + 1].
+	int16_t ref_x[LIDAR_MATCH_MAX_POINTS];
+	int16_t ref_y[LIDAR_MATCH_MAX_POINTS];
+	// The normal of the surface each reference point is on, in Q14
+	int16_t ref_nx[LIDAR_MATCH_MAX_POINTS];
+	int16_t ref_ny[LIDAR_MATCH_MAX_POINTS];
+	uint16_t cell_start[LIDAR_MATCH_GRID_CELLS + 1];
+	uint16_t nref;
+
+	// The revolution being matched
+	int16_t cur_x[LIDAR_MATCH_MAX_POINTS];
+	int16_t cur_y[LIDAR_MATCH_MAX_POINTS];
+	uint16_t ncur;
+
+	// Used by lidar_match_add_scan()
+	bool have_ref;
+	struct lidar_match_transform last;
+};
+
+// 'cfg' is copied
+void lidar_match_init(struct lidar_match *m, const struct lidar_match_cfg *cfg);
+
+// Use 'scan' as the reference for lidar_match_scan()
+void lidar_match_set_reference(struct lidar_match *m, const struct lidar_scan *scan);
+
+// Find the transform from 'scan' to the reference, starting from 'guess'
+// (NULL for none). Returns false if too few points could be paired, and the
+// result can't be trusted.
+bool lidar_match_scan(struct lidar_match *m, const struct lidar_scan *scan,
+                      const struct lidar_match_transform *guess, struct lidar_match_result *result);
+
+// Odometry: match each revolution against the previous one, guessing that the
+// sensor keeps moving the same way as last time, then make it the reference
+// for the next. Returns false for the first revolution, or if the match
+// failed (and then the motion is assumed to be zero, rather than carrying on
+// from a bad guess).
+bool lidar_match_add_scan(struct lidar_match *m, const struct lidar_scan *scan,
+                          struct lidar_match_result *result);
+
+// out = a * b: moving a point by 'out' is the same as moving it by 'b' and
+// then by 'a'. So with a running pose as 'a', and the transform from
+// lidar_match_add_scan() as 'b', 'out' is the new pose.
+// 'out' may be the same as 'a' or 'b'.
+void lidar_match_compose(const struct lidar_match_transform *a, const struct lidar_match_transform *b,
+                         struct lidar_match_transform *out);
+
+#endif /* __LIDAR_MATCH_H__ */
@@ -0,0 +1,73 @@
+// Merging frames from several sensors into one stream
+//
+// Every sensor pushes references to its frames into one SPSC ring, tagged
+// with the sensor ID and the time they were received. The consumer pops them
+// back out in the order they were pushed, across all the sensors.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+#ifndef __LIDAR_MERGE_H__
+#define __LIDAR_MERGE_H__
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lidar_parser.h"
+#include "lidar_spsc.h"
+#include "lidar_time.h"
+
+#ifndef LIDAR_MERGE_MAX_SENSORS
+#define LIDAR_MERGE_MAX_SENSORS 2
+#endif
+
+// Queue length, shared by all the sensors. Must be a power of two, and big
+// enough to hold every frame the parsers will let the consumer hold.
+#ifndef LIDAR_MERGE_QUEUE_LEN
+#define LIDAR_MERGE_QUEUE_LEN 16
+#endif
+static_assert((LIDAR_MERGE_QUEUE_LEN & (LIDAR_MERGE_QUEUE_LEN - 1)) == 0,
+              "LIDAR_MERGE_QUEUE_LEN must be a power of two");
+static_assert(LIDAR_MERGE_QUEUE_LEN >= LIDAR_MERGE_MAX_SENSORS * (LIDAR_HW_NUM_SLOTS - 1),
+              "LIDAR_MERGE_QUEUE_LEN too small for the held frames");
+
+struct lidar_frame_ref {
+	// A held frame (see hold_frames), which the consumer must release
+	struct lidar_frame *frame;
+	// When the frame was received, in any monotonic unit which wraps at
+	// 2^32 (e.g. time_us_32())
+	uint32_t rx_time;
+	uint8_t sensor_id;
+	// The frame's timestamps on the Pico's clock, if the producer has them
+	struct lidar_frame_time time;
+};
+
+// This structure stores the internal state of the merger.
+// You should NOT directly access anything in this structure!
+// The definition is only provided so that the library can be used with zero
+// dynamic allocations.
+struct lidar_merge {
+	uint32_t nsensors;
+	struct lidar_spsc queue;
+	struct lidar_frame_ref storage[LIDAR_MERGE_QUEUE_LEN];
+};
+
+// 'nsensors' is at most LIDAR_MERGE_MAX_SENSORS. Sensor IDs go from 0 to
+// nsensors - 1.
+void lidar_merge_init(struct lidar_merge *merge, uint32_t nsensors);
+
+// Add a frame from sensor ref->sensor_id. All the sensors must be pushed
+// from the same context (lidar_init() pushes them all from the DMA IRQ).
+// Returns false (and drops the frame) if the queue is full, or the sensor ID
+// is out of range.
+bool lidar_merge_push(struct lidar_merge *merge, const struct lidar_frame_ref *ref);
+
+// Get the oldest frame from any sensor, or return false if there's nothing
+// queued. Must only be called from one context, which can be on the other
+// core.
+//
+// Frames come out in the order they were pushed, so the output is in rx_time
+// order as long as the rx_times were taken in the order the frames are
+// pushed, which is true for lidar_init().
+bool lidar_merge_pop(struct lidar_merge *merge, struct lidar_frame_ref *ref);
+
+#endif /* __LIDAR_MERGE_H__ */
@@ -0,0 +1,186 @@
+// Byte-stream parser for the OKDO LIDAR_LD06
+//
+// This is the hardware-independent part of the driver: it finds, validates
+// and delivers frames from the stream of bytes received from the sensor.
+// It doesn't depend on the Pico SDK, so it can also be built and
+// benchmarked on a host machine.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+#ifndef __LIDAR_PARSER_H__
+#define __LIDAR_PARSER_H__
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lidar_profile.h"
+
+// Structure definitions based on:
+// https://www.elecrow.com/download/product/SLD06360F/LD19_Development%20Manual_V2.3.pdf
+// No copyright attribution mentioned.
+// The sample count, header values and CRC come from lidar_profile.h.
+
+// Angles are in units of 0.01 degrees
+#define LIDAR_ANGLE_MAX 36000
+// Frames claiming a speed (degrees/s) above this are assumed to be junk.
+// The sensor's maximum rotation rate is well under 30 Hz.
+#define LIDAR_MAX_SPEED (30 * 360)
+
+struct __attribute__((packed)) lidar_sample {
+	uint16_t distance_mm;
+	uint8_t intensity;
+};
+
+struct __attribute__((packed)) lidar_frame {
+	uint8_t header;
+	uint8_t ver_len;
+	uint16_t speed;
+	uint16_t start_angle;
+	struct lidar_sample samples[LIDAR_SAMPLES_PER_FRAME];
+	uint16_t end_angle;
+	uint16_t timestamp;
+	uint8_t crc8;
+};
+
+// 'frame' points directly into the parser's receive buffer. Unless the parser
+// was configured with hold_frames, it's only valid until the callback returns.
+typedef void (*frame_cb_t)(void *cb_data, struct lidar_frame *frame);
+
+// A lidar_frame is 47 bytes with 12 samples.
+//
+// The receive buffer is split into frame-sized slots. Once the parser is in
+// sync with the sensor, it asks for whole frames, starting at the beginning
+// of a slot, so every frame lands whole in its own slot and can be handed to
+// the callback without copying it anywhere.
+//
+// Frames are never split across the end of the buffer, so the DMA doesn't use
+// its ring mode and the slot count doesn't need to be a power of two.
+#define LIDAR_FRAME_SIZE sizeof(struct lidar_frame)
+#ifndef LIDAR_HW_NUM_SLOTS
+#define LIDAR_HW_NUM_SLOTS 8
+#endif
+#define LIDAR_HW_BUF_SIZE (LIDAR_HW_NUM_SLOTS * LIDAR_FRAME_SIZE)
+static_assert(LIDAR_HW_NUM_SLOTS >= 2, "need at least two slots");
+
+struct lidar_parser_cfg {
+	// Callback function which will be called for each valid frame.
+	// It will receive frame_cb_data as its cb_data argument.
+	frame_cb_t frame_cb;
+	void *frame_cb_data;
+
+	// If false, each frame is only valid during the callback.
+	//
+	// If true, the frame stays valid (and unmodified) until it is passed to
+	// lidar_parser_release(). Frames must be released in the order they
+	// were received. Up to LIDAR_HW_NUM_SLOTS - 1 frames can be held at
+	// once; if the consumer holds that many, new frames are dropped.
+	bool hold_frames;
+
+	// How many frames to ask for in one go, once in sync. 0 or 1 means
+	// one frame at a time, which gives the lowest latency. Larger values
+	// mean fewer, larger requests (i.e. fewer DMA interrupts), but frames
+	// are delivered up to batch_frames at a time unless something calls
+	// lidar_parser_rx_progress() in between.
+	// Clamped to LIDAR_HW_NUM_SLOTS - 1.
+	uint32_t batch_frames;
+};
+
+// Counters, which start at zero and wrap. Cheap enough to always be kept.
+struct lidar_parser_stats {
+	// Bytes received
+	uint32_t bytes_rx;
+	// Valid frames passed to the frame callback
+	uint32_t frames;
+	// Complete frame candidates which passed the structural checks, but
+	// not the CRC
+	uint32_t crc_errors;
+	// Bytes thrown away looking for the start of a frame
+	uint32_t bytes_skipped;
+	// Receive requests, and how many of those weren't for a whole number
+	// of frames, because the stream was out of sync
+	uint32_t requests;
+	uint32_t short_requests;
+	// Valid frames which were dropped because no slot was free (the
+	// consumer is holding them all)
+	uint32_t frames_dropped;
+};
+
+// This structure stores the internal state of the parser.
+// You should NOT directly access anything in this structure!
+//
+// The parser owns the receive buffer. Whoever is supplying the data (the DMA
+// on the Pico, or a file/generator on a host) must write exactly
+// lidar_parser_rx_len() bytes to lidar_parser_rx_buf(), and then call
+// lidar_parser_rx_done().
+struct lidar_parser {
+	uint8_t __attribute__((aligned(4))) buf[LIDAR_HW_BUF_SIZE];
+
+	// Slot counters. These only ever increase, and are used modulo
+	// LIDAR_HW_NUM_SLOTS.
+	// Data is received into the slot(s) starting at 'head'. Slots from
+	// 'released' up to 'head' are held by the consumer.
+	uint32_t head;
+	uint32_t released;
+	// Bytes received into the slot at 'head' which haven't been consumed
+	uint32_t fill;
+
+	uint32_t req_nbytes;
+	// Bytes of the current request already accounted for in 'fill', by
+	// lidar_parser_rx_progress()
+	uint32_t req_progress;
+	// Only used by lidar_parser_feed(), for requests split across calls
+	uint32_t req_filled;
+
+	struct lidar_parser_stats stats;
+
+	bool hold_frames;
+	uint32_t batch_frames;
+	frame_cb_t frame_cb;
+	void *frame_cb_data;
+};
+
+// Reset the parser state and apply the configuration.
+void lidar_parser_init(struct lidar_parser *parser, const struct lidar_parser_cfg *cfg);
+
+// Where the next chunk of received data should be written.
+uint8_t *lidar_parser_rx_buf(struct lidar_parser *parser);
+
+// How many bytes the parser wants next. Never more than
+// batch_frames * LIDAR_FRAME_SIZE.
+uint32_t lidar_parser_rx_len(struct lidar_parser *parser);
+
+// Notify the parser that the requested lidar_parser_rx_len() bytes have been
+// written. Any valid frames are passed to the frame callback before this
+// returns. Returns the number of bytes wanted next.
+uint32_t lidar_parser_rx_done(struct lidar_parser *parser);
+
+// Notify the parser that the first 'written' bytes of the current request
+// have arrived, while the rest is still being written. Any complete, in-sync
+// frames among them are delivered straight away. Anything that needs
+// resynchronising is left until lidar_parser_rx_done(), so that nothing is
+// moved around underneath the writer.
+//
+// This bounds the latency when using batch_frames. It must not run
+// concurrently with lidar_parser_rx_done().
+void lidar_parser_rx_progress(struct lidar_parser *parser, uint32_t written);
+
+// Give a frame back to the parser, when using hold_frames.
+// May be called from a different context to the one calling
+// lidar_parser_rx_done() (e.g. the main loop, when frames arrive in an IRQ).
+void lidar_parser_release(struct lidar_parser *parser, struct lidar_frame *frame);
+
+// Copy out the counters. Only consistent if it can't run concurrently with
+// the receive functions.
+void lidar_parser_get_stats(struct lidar_parser *parser, struct lidar_parser_stats *stats);
+
+// Zero the counters.
+void lidar_parser_reset_stats(struct lidar_parser *parser);
+
+// Convenience for feeding the parser from memory (e.g. on a host), behaving
+// the same as the DMA would - data is copied in chunks of exactly the
+// requested size. If 'len' ends part-way through a request, the partial data is
+// kept and completed by the next call. Returns the number of bytes consumed,
+// which is always 'len'.
+uint32_t lidar_parser_feed(struct lidar_parser *parser, const uint8_t *data, uint32_t len);
+
+#endif /* __LIDAR_PARSER_H__ */
@@ -0,0 +1,49 @@
+// Per-sample point generation for the OKDO LIDAR_LD06
+//
+// Expands frames into individual (angle, distance, intensity) points, and
+// optionally Cartesian coordinates, using only integer maths so it's cheap
+// on the RP2040 (which has no FPU).
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+#ifndef __LIDAR_POINTS_H__
+#define __LIDAR_POINTS_H__
+
+#include <stdint.h>
+
+#include "lidar_parser.h"
+
+struct lidar_point {
+	// Centi-degrees, 0 to LIDAR_ANGLE_MAX - 1, in the sensor's convention
+	// (clockwise, looking down on the sensor)
+	uint16_t angle;
+	uint16_t distance_mm;
+	uint8_t intensity;
+};
+
+struct lidar_point_xy {
+	// x = distance * cos(angle), y = distance * sin(angle)
+	int16_t x_mm;
+	int16_t y_mm;
+};
+
+// Expand a frame into LIDAR_SAMPLES_PER_FRAME points.
+// The frame's start and end angles are the angles of the first and last
+// samples, and the samples in between are evenly spaced. A frame which
+// crosses 0 degrees (end_angle < start_angle) is handled, and the angles
+// wrap back to 0.
+void lidar_frame_to_points(const struct lidar_frame *frame, struct lidar_point *points);
+
+// sin/cos of an angle in centi-degrees, in Q15 format (i.e. scaled by 32768,
+// and saturated at 32767). Accurate to better than 1e-4.
+int16_t lidar_sin_q15(uint32_t angle);
+int16_t lidar_cos_q15(uint32_t angle);
+
+// The angle of (x, y), in centi-degrees from 0 to LIDAR_ANGLE_MAX - 1, the
+// inverse of the above. Accurate to better than 0.01 degrees. 0 for (0, 0).
+uint32_t lidar_atan2(int32_t y, int32_t x);
+
+// Convert 'n' points to Cartesian coordinates in mm. Distances must be below
+// 32768 mm, which is well beyond the sensor's range.
+void lidar_points_to_xy(const struct lidar_point *points, struct lidar_point_xy *xy, uint32_t n);
+
+#endif /* __LIDAR_POINTS_H__ */
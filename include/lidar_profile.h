@@ -0,0 +1,64 @@
+// Compile-time sensor profiles
+//
+// The LDROBOT sensors all use the same frame layout, but differ in baud
+// rate, sample rate and how their speed is controlled. Select one with
+// LIDAR_SENSOR (e.g. -DLIDAR_SENSOR=LIDAR_SENSOR_LD19, or the LIDAR_SENSOR
+// CMake variable), and everything else is built for that sensor, with no
+// runtime checks. The default is the LD06.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+#ifndef __LIDAR_PROFILE_H__
+#define __LIDAR_PROFILE_H__
+
+#define LIDAR_SENSOR_LD06   1
+#define LIDAR_SENSOR_LD19   2
+#define LIDAR_SENSOR_STL27L 3
+
+#ifndef LIDAR_SENSOR
+#define LIDAR_SENSOR LIDAR_SENSOR_LD06
+#endif
+
+// Each profile defines:
+//  LIDAR_SENSOR_NAME:        For printing
+//  LIDAR_SAMPLES_PER_FRAME:  Samples in each frame
+//  LIDAR_BAUD_RATE:          UART baud rate (8N1)
+//  LIDAR_SAMPLE_RATE_HZ:     Samples per second, whatever the scan rate
+//  LIDAR_PWM_HZ:             Speed control PWM frequency, 0 if the sensor
+//                            has no PWM input
+//  LIDAR_CRC8_POLY:          Frame CRC polynomial
+#if LIDAR_SENSOR == LIDAR_SENSOR_LD06
+#define LIDAR_SENSOR_NAME "LD06"
+#define LIDAR_SAMPLES_PER_FRAME 12
+#define LIDAR_BAUD_RATE 230400
+#define LIDAR_SAMPLE_RATE_HZ 4500
+#define LIDAR_PWM_HZ 30000
+#define LIDAR_CRC8_POLY 0x4d
+#elif LIDAR_SENSOR == LIDAR_SENSOR_LD19
+// Same protocol as the LD06
+#define LIDAR_SENSOR_NAME "LD19"
+#define LIDAR_SAMPLES_PER_FRAME 12
+#define LIDAR_BAUD_RATE 230400
+#define LIDAR_SAMPLE_RATE_HZ 4500
+#define LIDAR_PWM_HZ 30000
+#define LIDAR_CRC8_POLY 0x4d
+#elif LIDAR_SENSOR == LIDAR_SENSOR_STL27L
+// Same frame layout, but much faster
+#define LIDAR_SENSOR_NAME "STL-27L"
+#define LIDAR_SAMPLES_PER_FRAME 12
+#define LIDAR_BAUD_RATE 921600
+#define LIDAR_SAMPLE_RATE_HZ 21600
+#define LIDAR_PWM_HZ 0
+#define LIDAR_CRC8_POLY 0x4d
+#else
+#error "Unknown LIDAR_SENSOR"
+#endif
+
+#define LIDAR_FRAME_HEADER 0x54
+// Version 1 in the top 3 bits, samples per frame in the bottom 5
+#define LIDAR_FRAME_VER_LEN ((1 << 5) | LIDAR_SAMPLES_PER_FRAME)
+
+// Time for one sample, and for one byte on the wire (10 bits, with 8N1)
+#define LIDAR_SAMPLE_PERIOD_NS (1000000000 / LIDAR_SAMPLE_RATE_HZ)
+#define LIDAR_BYTE_TIME_NS (10 * 1000000000ull / LIDAR_BAUD_RATE)
+
+#endif /* __LIDAR_PROFILE_H__ */
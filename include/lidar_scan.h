@@ -0,0 +1,81 @@
+// Full-revolution scan assembly for the OKDO LIDAR_LD06
+//
+// Collects the samples from each frame into an angle-indexed buffer holding
+// one complete 360 degree sweep. Completed sweeps are triple-buffered, so a
+// consumer can read the latest one while the next is being filled.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+#ifndef __LIDAR_SCAN_H__
+#define __LIDAR_SCAN_H__
+
+#include <stdint.h>
+
+#include "lidar_parser.h"
+#include "lidar_triple.h"
+
+// Number of angular bins in one revolution. The default gives 0.5 degree
+// bins, which is finer than the sensor's resolution at its default 10 Hz.
+#ifndef LIDAR_SCAN_BINS
+#define LIDAR_SCAN_BINS 720
+#endif
+
+#define LIDAR_SCAN_NUM_BUFS LIDAR_TRIPLE_NUM_BUFS
+
+struct lidar_scan {
+	// Increments by one for each completed revolution
+	uint32_t seq;
+	// Rotation speed in degrees/s, from the last frame in the revolution
+	uint16_t speed;
+	// Sensor timestamp (ms) of the first frame in the revolution
+	uint16_t timestamp;
+	// Number of samples which went into the revolution
+	uint16_t nsamples;
+	// Bin i covers angles from i * 360 / LIDAR_SCAN_BINS degrees.
+	// Bins which didn't receive a sample have distance_mm == 0. If more
+	// than one sample falls in the same bin, the last one wins.
+	struct lidar_sample bins[LIDAR_SCAN_BINS];
+};
+
+// Called for each completed revolution, in the same context as
+// lidar_scan_add_frame() (i.e. normally the DMA IRQ).
+// 'scan' stays valid until the next revolution completes.
+typedef void (*lidar_scan_cb_t)(void *cb_data, const struct lidar_scan *scan);
+
+// This structure stores the internal state of the assembler.
+// You should NOT directly access anything in this structure!
+// The definition is only provided so that the library can be used with zero
+// dynamic allocations.
+struct lidar_scan_assembler {
+	struct lidar_scan bufs[LIDAR_SCAN_NUM_BUFS];
+
+	// Which of bufs is being filled, and which is being read
+	struct lidar_triple bufs_idx;
+
+	// Angle (centi-degrees) of the previous sample, to detect the wrap
+	// from 359.99 to 0 degrees.
+	uint32_t last_angle;
+	// The first revolution started part-way round, so it isn't published
+	bool started;
+	uint32_t seq;
+
+	lidar_scan_cb_t scan_cb;
+	void *scan_cb_data;
+};
+
+// Reset the assembler. 'scan_cb' may be NULL.
+void lidar_scan_init(struct lidar_scan_assembler *as, lidar_scan_cb_t scan_cb, void *cb_data);
+
+// Add the samples from a frame. Frames must be added in the order they were
+// received.
+// This is normally called from a frame_cb_t.
+void lidar_scan_add_frame(struct lidar_scan_assembler *as, const struct lidar_frame *frame);
+
+// Get the most recently completed revolution, if there has been a new one
+// since the last call. Otherwise returns NULL.
+//
+// The returned scan won't be modified until the next call to
+// lidar_scan_acquire() that returns non-NULL. This may be called from a
+// different context (or core) to lidar_scan_add_frame(), but only from one.
+const struct lidar_scan *lidar_scan_acquire(struct lidar_scan_assembler *as);
+
+#endif /* __LIDAR_SCAN_H__ */
@@ -0,0 +1,87 @@
+// Closed-loop scan rate control for the OKDO LIDAR_LD06
+//
+// A PI controller which sets the motor PWM duty from the speed reported in
+// each frame, to hold a target scan rate. Integer maths only, and it only
+// does any real work a few times a second.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+#ifndef __LIDAR_SPEED_H__
+#define __LIDAR_SPEED_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// PWM duty is in 1/LIDAR_SPEED_DUTY_MAX of the period.
+#define LIDAR_SPEED_DUTY_MAX 1000
+// "Scan rate around 10Hz at PWM 40%"
+#define LIDAR_SPEED_DUTY_DEFAULT 400
+
+// How often the controller updates, averaging the speeds from all the frames
+// in between.
+#define LIDAR_SPEED_PERIOD_US 100000
+
+// Locked when the average speed is within 1/LIDAR_SPEED_LOCK_TOLERANCE of
+// the target for LIDAR_SPEED_LOCK_PERIODS updates in a row. Lock is lost
+// if the error goes beyond twice that.
+#define LIDAR_SPEED_LOCK_TOLERANCE 50
+#define LIDAR_SPEED_LOCK_PERIODS 5
+
+// Convert a scan rate in centi-Hz to the frames' speed units (degrees/s),
+// and back.
+#define LIDAR_SPEED_FROM_CENTI_HZ(_chz) (((_chz) * 18) / 5)
+#define LIDAR_SPEED_TO_CENTI_HZ(_dps) (((_dps) * 5) / 18)
+
+struct lidar_speed_status {
+	// 0 when the controller is off
+	uint32_t target_centi_hz;
+	// Average over the last update period
+	uint32_t measured_centi_hz;
+	uint16_t duty;
+	bool locked;
+	// Time from setting the target to first getting lock. Zero until
+	// then.
+	uint32_t settle_time_us;
+};
+
+// This structure stores the internal state of the controller.
+// You should NOT directly access anything in this structure!
+// The definition is only provided so that the library can be used with zero
+// dynamic allocations.
+struct lidar_speed_ctl {
+	// Degrees/s, 0 when off
+	uint32_t target;
+	uint32_t target_set_us;
+
+	// Speeds accumulated since the last update
+	uint32_t period_start_us;
+	uint32_t sum;
+	uint32_t count;
+	uint32_t measured;
+
+	// Duty and integrator, in Q16 duty units
+	int32_t integral;
+	uint16_t duty;
+
+	uint32_t in_tolerance;
+	bool locked;
+	uint32_t settle_time_us;
+};
+
+// Start with the motor at LIDAR_SPEED_DUTY_DEFAULT, and the controller off.
+void lidar_speed_init(struct lidar_speed_ctl *ctl);
+
+// Set the target scan rate, in centi-Hz (the sensor is rated for 5-13 Hz).
+// 0 turns the controller off, leaving the duty where it is.
+// 'now_us' is the current time, in the same clock as lidar_speed_add_frame().
+void lidar_speed_set_target(struct lidar_speed_ctl *ctl, uint32_t centi_hz, uint32_t now_us);
+
+// Feed in the speed (degrees/s) from a frame, received at 'now_us'.
+// Returns true if the duty has changed, and should be applied.
+bool lidar_speed_add_frame(struct lidar_speed_ctl *ctl, uint16_t speed, uint32_t now_us);
+
+// The duty to apply, from 0 to LIDAR_SPEED_DUTY_MAX.
+uint16_t lidar_speed_duty(const struct lidar_speed_ctl *ctl);
+
+void lidar_speed_get_status(const struct lidar_speed_ctl *ctl, struct lidar_speed_status *status);
+
+#endif /* __LIDAR_SPEED_H__ */
@@ -0,0 +1,70 @@
+// Lock-free single-producer, single-consumer ring
+//
+// For handing data from an IRQ to the main loop, or from one core to the
+// other, without locks or spinlocks. Exactly one context may produce, and
+// exactly one context may consume.
+//
+// Elements are fixed size, and the storage is provided by the caller, so
+// there's no dynamic allocation. Both sides can work in place: the producer
+// reserves a slot, fills it and commits it, and the consumer can look at
+// several elements at once before releasing them.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+#ifndef __LIDAR_SPSC_H__
+#define __LIDAR_SPSC_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// This structure stores the internal state of the ring.
+// You should NOT directly access anything in this structure!
+struct lidar_spsc {
+	uint8_t *storage;
+	uint32_t elem_size;
+	uint32_t mask;
+
+	// Free-running counters, used modulo the capacity.
+	// 'head' is only written by the producer, 'tail' only by the consumer.
+	uint32_t head;
+	uint32_t tail;
+};
+
+// 'storage' must be at least elem_size * capacity bytes, and 'capacity' must
+// be a power of two.
+void lidar_spsc_init(struct lidar_spsc *q, void *storage, uint32_t elem_size, uint32_t capacity);
+
+// Producer side
+
+// Get a pointer to the next free element, or NULL if the ring is full.
+// Nothing is visible to the consumer until lidar_spsc_commit() is called.
+void *lidar_spsc_reserve(struct lidar_spsc *q);
+
+// Publish the element returned by lidar_spsc_reserve().
+void lidar_spsc_commit(struct lidar_spsc *q);
+
+// Copy one element in. Returns false if the ring is full.
+bool lidar_spsc_push(struct lidar_spsc *q, const void *elem);
+
+// Consumer side
+
+// Get a pointer to the oldest element, and return how many elements are
+// available contiguously from there (which may be fewer than are in the
+// ring, if they wrap around the end of the storage).
+// Returns 0 if the ring is empty.
+// The elements stay valid until they are passed to lidar_spsc_release().
+uint32_t lidar_spsc_peek(struct lidar_spsc *q, void **elems);
+
+// Release the 'n' oldest elements, making the space available to the
+// producer again.
+void lidar_spsc_release(struct lidar_spsc *q, uint32_t n);
+
+// Copy out up to 'max' elements into 'dst', and release them.
+// Returns the number copied.
+uint32_t lidar_spsc_pop(struct lidar_spsc *q, void *dst, uint32_t max);
+
+// Number of elements currently in the ring. The other side may change it at
+// any time, so for the consumer it's a lower bound, and for the producer it's
+// an upper bound.
+uint32_t lidar_spsc_count(struct lidar_spsc *q);
+
+#endif /* __LIDAR_SPSC_H__ */
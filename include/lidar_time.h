@@ -0,0 +1,132 @@
+// Timestamp reconstruction for the OKDO LIDAR_LD06
+//
+// The sensor's timestamp is in milliseconds, wraps every 30 s, and runs on
+// the sensor's own clock. This maps it on to the Pico's clock, giving each
+// sample a 64-bit microsecond timestamp.
+//
+// Each frame is tagged with the Pico time when its DMA transfer completed.
+// That's always *after* the frame was sent, by a fixed latency plus however
+// long the interrupt was held off. So the smallest (receive time - sensor
+// time) over a window is the best estimate of the offset between the two
+// clocks. The minimum of each window is kept, and the drift between the
+// clocks is the slope from the oldest to the newest.
+//
+// The lower envelope of the windows is worked out when each window closes,
+// so each frame only costs one multiply and shift to apply the drift.
+//
+// The resolution is limited by the sensor's 1 ms timestamp, so expect
+// individual samples to be within ~0.5 ms.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+#ifndef __LIDAR_TIME_H__
+#define __LIDAR_TIME_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lidar_profile.h"
+
+// The sensor's timestamp counts up to this, then starts again from 0
+#define LIDAR_TIME_SENSOR_WRAP_MS 30000
+
+// The sensor samples at a fixed rate, whatever the scan rate
+#define LIDAR_TIME_SAMPLE_PERIOD_NS LIDAR_SAMPLE_PERIOD_NS
+
+// Time from the frame's first sample to the end of its DMA transfer, with no
+// interrupt latency: the rest of the samples, plus sending the frame (47
+// bytes at 230400 baud for the LD06). This assumes the timestamp is for the
+// first sample, and the frame is sent as soon as the last sample is taken.
+#ifndef LIDAR_TIME_FRAME_LATENCY_US
+#define LIDAR_TIME_FRAME_LATENCY_US \
+	(((LIDAR_SAMPLES_PER_FRAME - 1) * LIDAR_SAMPLE_PERIOD_NS + \
+	  (11 + 3 * LIDAR_SAMPLES_PER_FRAME) * LIDAR_BYTE_TIME_NS) / 1000)
+#endif
+
+// Length of each window the minimum offset is taken over (in sensor time),
+// and how many windows are kept for the drift estimate.
+#define LIDAR_TIME_WINDOW_US 4000000
+#define LIDAR_TIME_NUM_WINDOWS 8
+
+// If a frame is this far from the estimate, the sensor has been reset (or
+// lost for a long time), so start again.
+#define LIDAR_TIME_RESYNC_US 500000
+
+// Fractional bits of the fixed-point drift (Pico us per sensor us)
+#define LIDAR_TIME_DRIFT_SHIFT 32
+
+struct lidar_frame_time {
+	// Pico time (time_us_64()) when the frame's DMA transfer completed
+	uint64_t rx_us;
+	// Estimated Pico time of the first sample
+	uint64_t time_us;
+	// The sensor's timestamp, unwrapped
+	uint64_t sensor_ms;
+};
+
+// Estimated Pico time of sample 'i' in the frame
+static inline uint64_t lidar_frame_time_sample_us(const struct lidar_frame_time *t, int i)
+{
+	return t->time_us + ((uint32_t)i * LIDAR_TIME_SAMPLE_PERIOD_NS) / 1000;
+}
+
+struct lidar_time_status {
+	// Set once the first full window has been seen
+	bool synced;
+	// Pico time minus sensor time (us), now
+	int64_t offset_us;
+	// How fast the Pico's clock runs relative to the sensor's, in parts
+	// per billion. Positive if the Pico is faster.
+	int32_t drift_ppb;
+	// Number of times the estimate was thrown away (see
+	// LIDAR_TIME_RESYNC_US)
+	uint32_t resyncs;
+};
+
+struct lidar_time_point {
+	// Sensor time (us)
+	int64_t sensor_us;
+	// Smallest receive time - sensor time (us)
+	int64_t offset_us;
+};
+
+// This structure stores the internal state of the timestamp reconstruction.
+// You should NOT directly access anything in this structure!
+// The definition is only provided so that the library can be used with zero
+// dynamic allocations.
+struct lidar_time_sync {
+	bool started;
+	uint16_t last_timestamp;
+	uint64_t last_rx_us;
+	uint64_t sensor_ms;
+
+	// Minimum from each complete window, oldest first
+	struct lidar_time_point points[LIDAR_TIME_NUM_WINDOWS];
+	uint32_t npoints;
+
+	// The window in progress
+	int64_t window_start_us;
+	struct lidar_time_point window;
+
+	// Everything is projected to sensor time anchor_us with the drift:
+	// the lowest of the complete windows, and the window in progress
+	int64_t anchor_us;
+	int64_t anchor_offset_us;
+	int64_t window_offset_us;
+
+	// Fixed point, with LIDAR_TIME_DRIFT_SHIFT fractional bits
+	int64_t drift;
+	int32_t drift_ppb;
+	uint32_t resyncs;
+};
+
+void lidar_time_init(struct lidar_time_sync *sync);
+
+// Add a frame with sensor timestamp 'timestamp', whose DMA transfer
+// completed at Pico time 'rx_us', and fill in its timestamps.
+// Frames must be added in order.
+void lidar_time_add_frame(struct lidar_time_sync *sync, uint16_t timestamp,
+                          uint64_t rx_us, struct lidar_frame_time *out);
+
+void lidar_time_get_status(const struct lidar_time_sync *sync, struct lidar_time_status *status);
+
+#endif /* __LIDAR_TIME_H__ */
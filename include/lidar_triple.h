@@ -0,0 +1,57 @@
+// Lock-free triple-buffer handoff
+//
+// For handing the latest of a series of results (e.g. complete revolutions)
+// from an IRQ to the main loop, or from one core to the other. The producer
+// always has a buffer to fill, and the consumer always gets the most recent
+// one that was published, without either side waiting for the other.
+//
+// This only tracks which of the three buffers is which: the buffers
+// themselves are provided by the user, and indexed by what these functions
+// return.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+#ifndef __LIDAR_TRIPLE_H__
+#define __LIDAR_TRIPLE_H__
+
+#include <stdint.h>
+
+#define LIDAR_TRIPLE_NUM_BUFS 3
+
+// Buffer index meaning "none"
+#define LIDAR_TRIPLE_NONE LIDAR_TRIPLE_NUM_BUFS
+
+// This structure stores the internal state of the handoff.
+// You should NOT directly access anything in this structure!
+struct lidar_triple {
+	// 'fill' is only touched by the producer. 'ready' is written by the
+	// producer and 'reading' by the consumer. 'acquired' is the consumer's
+	// own record of what it last returned.
+	uint32_t fill;
+	uint32_t ready;
+	uint32_t reading;
+	uint32_t acquired;
+};
+
+void lidar_triple_init(struct lidar_triple *t);
+
+// Producer side
+
+// The buffer to fill next. It's never one the consumer can see.
+static inline uint32_t lidar_triple_fill(const struct lidar_triple *t)
+{
+	return t->fill;
+}
+
+// Publish the buffer being filled, and move on to another one. Returns the
+// index of the published buffer.
+uint32_t lidar_triple_publish(struct lidar_triple *t);
+
+// Consumer side
+
+// Get the most recently published buffer, if there has been a new one since
+// the last call. Otherwise returns LIDAR_TRIPLE_NONE.
+// The buffer won't be touched by the producer until the next call to
+// lidar_triple_acquire() which doesn't return LIDAR_TRIPLE_NONE.
+uint32_t lidar_triple_acquire(struct lidar_triple *t);
+
+#endif /* __LIDAR_TRIPLE_H__ */
@@ -1,3 +1,5 @@
+#include <stdbool.h>
+
 #include "crc8.h"
 
 // From: https://www.elecrow.com/download/product/SLD06360F/LD19_Development%20Manual_V2.3.pdf
@@ -38,3 +40,64 @@ uint8_t CalCRC8(uint8_t *p, uint8_t len){
 
 	return crc;
 }
+
+// CrcSlice[k][x] is the CRC of byte x followed by k zero bytes. The CRC is
+// linear, so the CRC of 4 bytes can be calculated with 4 independent
+// lookups instead of a chain of 4 dependent ones.
+//
+// These are generated at init from the sensor profile's polynomial
+// (CrcTable above is the LD06/LD19 one), instead of being const, which also
+// means they end up in RAM rather than flash, which is faster to access on
+// the RP2040.
+static uint8_t CrcSlice[4][256];
+static bool CrcSliceReady;
+
+void lidar_crc8_init(void)
+{
+	uint8_t table[256];
+
+	// Only the first time: later calls (e.g. from a second sensor's
+	// lidar_init()) mustn't write to the tables while an earlier
+	// instance's DMA IRQ is reading them.
+	if (CrcSliceReady) {
+		return;
+	}
+
+	for (int i = 0; i < 256; i++) {
+		uint8_t crc = i;
+		for (int b = 0; b < 8; b++) {
+			crc = (crc & 0x80) ? (crc << 1) ^ LIDAR_CRC8_POLY : crc << 1;
+		}
+		table[i] = crc;
+	}
+
+	for (int i = 0; i < 256; i++) {
+		uint8_t crc = table[i];
+
+		CrcSlice[0][i] = crc;
+		for (int k = 1; k < 4; k++) {
+			crc = table[crc];
+			CrcSlice[k][i] = crc;
+		}
+	}
+
+	CrcSliceReady = true;
+}
+
+uint8_t lidar_crc8_update(uint8_t crc, const uint8_t *p, uint32_t len)
+{
+	while (len >= 4) {
+		crc = CrcSlice[3][crc ^ p[0]] ^
+		      CrcSlice[2][p[1]] ^
+		      CrcSlice[1][p[2]] ^
+		      CrcSlice[0][p[3]];
+		p += 4;
+		len -= 4;
+	}
+
+	while (len--) {
+		crc = CrcSlice[0][crc ^ *p++];
+	}
+
+	return crc;
+}
@@ -2,6 +2,22 @@
 #define __CRC8_H__
 #include <stdint.h>
 
+#include "lidar_profile.h"
+
+// Reference implementation from the LD19 manual, one byte at a time.
 uint8_t CalCRC8(uint8_t *p, uint8_t len);
 
+// Build the tables used by lidar_crc8_update(). Must be called before using
+// it. Only the first call does anything, so it's safe to call again while
+// lidar_crc8_update() is in use (but not from two cores at once).
+void lidar_crc8_init(void);
+
+// Faster CRC using the sensor profile's polynomial (LIDAR_CRC8_POLY),
+// processing 4 bytes per step ("slicing-by-4"). Gives bit-for-bit the same
+// result as CalCRC8 when the polynomial is the manual's (0x4d).
+//
+// 'crc' is the CRC of any data already processed (start with 0), so a
+// buffer can be processed in pieces, e.g. either side of a ring buffer wrap.
+uint8_t lidar_crc8_update(uint8_t crc, const uint8_t *p, uint32_t len);
+
 #endif /* __CRC8_H__ */
@@ -1,6 +1,7 @@
 // Interface for the OKDO LIDAR_LD06
-// Uses DMA to capture the frame data, validates it, and then passes the
-// validated frames to a user-provided callback.
+// Uses DMA to capture the frame data, and hands it to the parser (see
+// lidar_parser.c) which validates it and passes the validated frames to a
+// user-provided callback.
 //
 // Copyright 2024 Brian Starkey <stark3y@gmail.com>
 
@@ -10,13 +11,13 @@
 #include "hardware/clocks.h"
 #include "hardware/dma.h"
 #include "hardware/pwm.h"
+#include "hardware/structs/systick.h"
+#include "hardware/sync.h"
 #include "pico/stdlib.h"
 #include "pico/util/queue.h"
 
-#include "crc8.h"
 #include "lidar.h"
 
-#define BAUD_RATE 230400
 
 void dump_frame(struct lidar_frame *frame)
 {
@@ -40,158 +41,198 @@ void dump_frame(struct lidar_frame *frame)
 	printf("crc8: %u\n", frame->crc8);
 }
 
-static bool frame_valid(struct lidar_frame *frame)
+// SysTick counts down from its reload value, and is only 24 bits. That's
+// ~130 ms at 125 MHz, far longer than anything we time.
+static inline uint32_t lidar_cycles(void)
 {
-	uint8_t crc = CalCRC8((uint8_t *)frame, sizeof(*frame) - 1);
-
-	return crc == frame->crc8;
+	return systick_hw->cvr;
 }
 
-static void lidar_hw_request_bytes(struct lidar_hw *hw, uint32_t nbytes)
+static inline uint32_t lidar_cycles_since(uint32_t start)
 {
-	uint8_t *dst = &hw->buf[hw->insert % LIDAR_HW_BUF_SIZE];
-	hw->last_nbytes = nbytes;
-	dma_channel_configure(hw->dma_chan, &hw->dma_cfg,
-	                      dst, hw->dma_read_addr,
-	                      nbytes, true);
+	return (start - systick_hw->cvr) & M0PLUS_SYST_CVR_BITS;
 }
 
-static inline uint32_t min_u32(uint32_t a, uint32_t b)
+static void lidar_timing_add(struct lidar_timing *timing, uint32_t cycles)
 {
-	return a < b ? a : b;
+	if (!timing->count || cycles < timing->min) {
+		timing->min = cycles;
+	}
+	if (cycles > timing->max) {
+		timing->max = cycles;
+	}
+	timing->total += cycles;
+	timing->count++;
 }
 
-static void ring_buffer_memcpy(uint8_t *dst, uint8_t *src_base,
-                        uint32_t start_offs, uint32_t buf_size,
-                        uint32_t size)
+static void lidar_hw_speed_update(struct lidar_hw *hw, struct lidar_frame *frame)
 {
-	uint32_t space = buf_size - start_offs;
-	if (space >= size) {
-		memcpy(dst, &src_base[start_offs], size);
-	} else {
-		memcpy(dst, &src_base[start_offs], space);
-		memcpy(dst + space, &src_base[0], size - space);
+	const uint32_t now = time_us_32();
+
+	// Pick up a new target, if there is one. The request is written
+	// before its sequence number.
+	const uint32_t seq = hw->scan_rate_req_seq;
+	if (seq != hw->scan_rate_seq) {
+		__dmb();
+		hw->scan_rate_seq = seq;
+		lidar_speed_set_target(&hw->speed, hw->scan_rate_req, now);
+	}
+
+	if (lidar_speed_add_frame(&hw->speed, frame->speed, now)) {
+		pwm_set_chan_level(hw->pwm_slice, hw->pwm_chan, lidar_speed_duty(&hw->speed));
 	}
 }
 
-static uint32_t lidar_hw_scan(struct lidar_hw *hw)
+static void lidar_hw_frame_cb(void *cb_data, struct lidar_frame *frame)
 {
-	for (;;) {
-		const uint32_t start_offset = hw->extract % LIDAR_HW_BUF_SIZE;
-		const uint32_t available = hw->insert - hw->extract;
-		const uint32_t before_wrap = min_u32(available, LIDAR_HW_BUF_SIZE - start_offset);
+	struct lidar_hw *hw = (struct lidar_hw *)cb_data;
 
-		if (available == 0) {
-			return LIDAR_FRAME_SIZE;
-		}
+	lidar_time_add_frame(&hw->time_sync, frame->timestamp, hw->rx_time_us, &hw->frame_time);
 
-		uint8_t *p = &hw->buf[start_offset];
-		const uint8_t *end = p + before_wrap;
-		uint32_t consumed = 0;
-
-		while (p < end) {
-			if (*p != LIDAR_FRAME_HEADER) {
-				// Not a header, just advance
-				p++;
-				consumed += 1;
-				continue;
-			}
-
-			uint32_t remainder = available - consumed;
-			if (remainder < LIDAR_FRAME_SIZE) {
-				// Not enough data to copy a full packet
-				// Request more.
-				hw->extract += consumed;
-				return LIDAR_FRAME_SIZE - remainder;
-			}
-
-			// Full packet available
-			struct lidar_frame frame;
-
-			ring_buffer_memcpy((uint8_t *)&frame, hw->buf, p - hw->buf,
-					   LIDAR_HW_BUF_SIZE, sizeof(frame));
-
-			if (frame_valid(&frame)) {
-				hw->frame_cb(hw->frame_cb_data, &frame);
-
-				p += sizeof(frame);
-				consumed += sizeof(frame);
-			} else {
-				p += 1;
-				consumed += 1;
-			}
-		}
+	if (hw->pwm_pin >= 0) {
+		lidar_hw_speed_update(hw, frame);
+	}
 
-		hw->extract += consumed;
+	const uint32_t start = lidar_cycles();
+
+	if (hw->frame_cb) {
+		hw->frame_cb(hw->frame_cb_data, frame);
 	}
+
+	lidar_timing_add(&hw->frame_cb_cycles, lidar_cycles_since(start));
+
+	if (hw->merge) {
+		const struct lidar_frame_ref ref = {
+			.frame = frame,
+			.rx_time = (uint32_t)hw->rx_time_us,
+			.sensor_id = hw->sensor_id,
+			.time = hw->frame_time,
+		};
+
+		// Can't fail: the queue has room for every frame the parser
+		// lets us hold.
+		lidar_merge_push(hw->merge, &ref);
+	}
+}
+
+static void lidar_hw_request_bytes(struct lidar_hw *hw)
+{
+	hw->rx_req_buf = lidar_parser_rx_buf(&hw->parser);
+	hw->rx_req_len = lidar_parser_rx_len(&hw->parser);
+
+	dma_channel_configure(hw->dma_chan, &hw->dma_cfg,
+	                      hw->rx_req_buf, hw->dma_read_addr,
+	                      hw->rx_req_len, true);
 }
 
-// We only support HW UARTs, so there can be at most NUM_UARTS instances
-// of the lidar.
-// We store pointers to the HW structures here, then try and find the matching
-// one in the DMA ISR
-struct lidar_hw *hw_ctxs[NUM_UARTS];
+// Direct lookup from DMA channel to lidar instance, for the IRQ handler.
+// Only channels in lidar_dma_chans have an entry.
+static struct lidar_hw *lidar_dma_chan_hw[NUM_DMA_CHANNELS];
+static uint32_t lidar_dma_chans;
 
-static struct lidar_hw *__find_lidar_hw(uint32_t ints)
+void lidar_dma_irq_handler(void)
 {
-	struct lidar_hw *hw = NULL;
+	// Only our channels, in case the IRQ is shared. Several sensors can
+	// finish at once, so handle all of them now rather than taking the
+	// interrupt again for each.
+	uint32_t ints = dma_hw->ints1 & lidar_dma_chans;
 
 	while (ints) {
-		int chan = __builtin_ffs(ints);
-		if (chan == 0) {
-#if LIDAR_EXCLUSIVE_DMA_IRQ_1
-			panic("No interrupts left! Something went wrong.");
-#endif
-			return NULL;
-		}
+		const uint32_t start = lidar_cycles();
+		const uint chan = __builtin_ctz(ints);
+		struct lidar_hw *hw = lidar_dma_chan_hw[chan];
+
+		ints &= ints - 1;
 
-		chan = chan - 1;
-		ints &= ~(1 << chan);
-
-		for (int i = 0; i < NUM_UARTS; i++) {
-			struct lidar_hw *tmp = hw_ctxs[i];
-			if (!tmp) {
-				continue;
-			}
-
-			// TODO: Could also check the DMA pointer(s) as an
-			// extra check, but this is probably fine.
-			if (tmp->dma_chan == chan) {
-				hw = tmp;
-				break;
-			}
+		hw->rx_time_us = time_us_64();
+		if (hw->rx_cb) {
+			hw->rx_cb(hw->rx_cb_data, hw->rx_req_buf, hw->rx_req_len, hw->rx_time_us);
 		}
-	}
+		lidar_parser_rx_done(&hw->parser);
+
+		// Clear the interrupt request, *before* requesting more
+		dma_hw->ints1 = 1u << chan;
+
+		lidar_hw_request_bytes(hw);
 
-	return hw;
+		lidar_timing_add(&hw->irq_cycles, lidar_cycles_since(start));
+	}
 }
 
-void lidar_dma_irq_handler(void)
+// Deliver any whole frames which have arrived so far in a batched transfer.
+// This runs in the timer IRQ, on the same core and at the same priority as
+// the DMA IRQ (see lidar_alarm_pool()), so the two can't interrupt each
+// other, or run at the same time.
+static bool lidar_hw_flush_timer_cb(repeating_timer_t *rt)
 {
-	uint32_t ints = dma_hw->ints1;
-	struct lidar_hw *hw = __find_lidar_hw(ints);
-	if (!hw) {
-#if LIDAR_EXCLUSIVE_DMA_IRQ_1
-		panic("Couldn't match interrupt with lidar_hw instance.");
-#endif
-		return;
-	}
+	struct lidar_hw *hw = (struct lidar_hw *)rt->user_data;
+	const uint32_t start = lidar_cycles();
+
+	const uint32_t remaining = dma_channel_hw_addr(hw->dma_chan)->transfer_count;
+	const uint32_t written = lidar_parser_rx_len(&hw->parser) - remaining;
+
+	hw->rx_time_us = time_us_64();
+	lidar_parser_rx_progress(&hw->parser, written);
+
+	lidar_timing_add(&hw->irq_cycles, lidar_cycles_since(start));
+
+	return true;
+}
 
-	hw->insert += hw->last_nbytes;
+// Alarm pools for the flush timers, on cores other than the default pool's
+static alarm_pool_t *lidar_alarm_pools[NUM_CORES];
 
-	uint32_t next_req = lidar_hw_scan(hw);
+// The flush timers run on the core which takes the DMA IRQ (the one calling
+// lidar_init()), or the parser could be fed from both cores at once. That's
+// the default pool if it's on this core, or else a pool of this core's own,
+// with one timer for each UART, shared by all the instances on it.
+static alarm_pool_t *lidar_alarm_pool(void)
+{
+	const uint core = get_core_num();
+	alarm_pool_t *pool = alarm_pool_get_default();
 
-	// Clear the interrupt request, *before* requesting more
-	dma_hw->ints1 = 1u << hw->dma_chan;
+	if (alarm_pool_core_num(pool) == core) {
+		return pool;
+	}
+
+	if (!lidar_alarm_pools[core]) {
+		lidar_alarm_pools[core] = alarm_pool_create_with_unused_hardware_alarm(NUM_UARTS);
+	}
 
-	lidar_hw_request_bytes(hw, next_req);
+	return lidar_alarm_pools[core];
 }
 
-static void lidar_hw_init(struct lidar_hw *hw, uart_inst_t *uart, frame_cb_t frame_cb, void *cb_data)
+static void lidar_hw_init(struct lidar_hw *hw, uart_inst_t *uart, struct lidar_cfg *cfg)
 {
 	memset(hw, 0, sizeof(*hw));
-	hw->frame_cb = frame_cb;
-	hw->frame_cb_data = cb_data;
+
+	hw->frame_cb = cfg->frame_cb;
+	hw->frame_cb_data = cfg->frame_cb_data;
+	hw->sensor_id = cfg->sensor_id;
+	hw->merge = cfg->merge;
+	hw->rx_cb = cfg->rx_cb;
+	hw->rx_cb_data = cfg->rx_cb_data;
+
+#if LIDAR_PWM_HZ
+	hw->pwm_pin = cfg->pwm_pin;
+#else
+	hw->pwm_pin = -1;
+#endif
+	if (hw->pwm_pin >= 0) {
+		hw->pwm_slice = pwm_gpio_to_slice_num(cfg->pwm_pin);
+		hw->pwm_chan = pwm_gpio_to_channel(cfg->pwm_pin);
+	}
+	lidar_time_init(&hw->time_sync);
+	lidar_speed_init(&hw->speed);
+	lidar_speed_set_target(&hw->speed, cfg->scan_rate_centi_hz, time_us_32());
+
+	struct lidar_parser_cfg parser_cfg = {
+		.frame_cb = lidar_hw_frame_cb,
+		.frame_cb_data = hw,
+		.hold_frames = cfg->hold_frames || cfg->merge,
+		.batch_frames = cfg->batch_frames,
+	};
+	lidar_parser_init(&hw->parser, &parser_cfg);
 
 	uart_hw_t *uart_hw = uart_get_hw(uart);
 	uint dreq = uart_get_dreq(uart, false);
@@ -200,31 +241,49 @@ static void lidar_hw_init(struct lidar_hw *hw, uart_inst_t *uart, frame_cb_t fra
 	// Set FIFO watermark to 50% (16)
 	uart_hw->ifls = (2 << UART_UARTIFLS_RXIFLSEL_LSB);
 
-	// Set up DMA to transfer from UART to ring-buffer
+	// Set up DMA to transfer from UART to the parser's buffer
 	hw->dma_chan = dma_claim_unused_channel(true);
 	hw->dma_cfg = dma_channel_get_default_config(hw->dma_chan);
 	hw->dma_read_addr = (uint8_t *)&uart_hw->dr;
 
 	// Store our context so the ISR can get at it
-	hw_ctxs[uart_get_index(uart)] = hw;
+	lidar_dma_chan_hw[hw->dma_chan] = hw;
+	lidar_dma_chans |= 1u << hw->dma_chan;
 
 	channel_config_set_read_increment(&hw->dma_cfg, false);
 	channel_config_set_write_increment(&hw->dma_cfg, true);
 	channel_config_set_dreq(&hw->dma_cfg, dreq);
 	channel_config_set_transfer_data_size(&hw->dma_cfg, DMA_SIZE_8);
-	channel_config_set_ring(&hw->dma_cfg, true, LIDAR_HW_BUF_BITS);
 	channel_config_set_enable(&hw->dma_cfg, true);
 
 	dma_channel_set_irq1_enabled(hw->dma_chan, true);
 
+	// For the timing. SysTick is per-core, and this is the core which
+	// will take the interrupts.
+	if (!(systick_hw->csr & M0PLUS_SYST_CSR_ENABLE_BITS)) {
+		systick_hw->rvr = M0PLUS_SYST_RVR_BITS;
+		systick_hw->cvr = 0;
+		systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+	}
+
 #if LIDAR_EXCLUSIVE_DMA_IRQ_1
-	irq_set_exclusive_handler(DMA_IRQ_1, lidar_dma_irq_handler);
-	irq_set_enabled(DMA_IRQ_1, true);
+	// Shared by all instances, so only install it for the first one
+	if (irq_get_exclusive_handler(DMA_IRQ_1) != lidar_dma_irq_handler) {
+		irq_set_exclusive_handler(DMA_IRQ_1, lidar_dma_irq_handler);
+		irq_set_enabled(DMA_IRQ_1, true);
+	}
 #endif
 
-	// Initially request a full packet, and we will adjust when we
-	// see the first header.
-	lidar_hw_request_bytes(hw, LIDAR_FRAME_SIZE);
+	// The parser initially requests a full packet, and will adjust when
+	// it sees the first header.
+	lidar_hw_request_bytes(hw);
+
+	if (cfg->batch_frames > 1 && cfg->max_latency_us) {
+		// Negative period means "between starts", so the period
+		// doesn't drift with the time spent flushing.
+		alarm_pool_add_repeating_timer_us(lidar_alarm_pool(), -(int64_t)cfg->max_latency_us,
+		                                  lidar_hw_flush_timer_cb, hw, &hw->flush_timer);
+	}
 }
 
 static uart_inst_t *__find_uart_for_pin(uint uart_pin)
@@ -245,36 +304,98 @@ static uart_inst_t *__find_uart_for_pin(uint uart_pin)
 
 void lidar_init(struct lidar_hw *hw, struct lidar_cfg *cfg)
 {
+#if LIDAR_PWM_HZ
 	if (cfg->pwm_pin >= 0) {
-		// LD1 wants 30 kHz PWM
 		// "Scan rate around 10Hz at PWM 40%"
 		const uint pwm_slice = pwm_gpio_to_slice_num(cfg->pwm_pin);
 		const uint32_t sys_clk_rate = clock_get_hz(clk_sys);
 
-		// 30 kHz PWM, with 1000 ticks a cycle
-		const float clock_div = sys_clk_rate / (30000.0 * 1000);
+		// LIDAR_PWM_HZ (30 kHz for the LD06), with 1000 ticks a cycle
+		const float clock_div = sys_clk_rate / ((float)LIDAR_PWM_HZ * LIDAR_SPEED_DUTY_MAX);
 
 		pwm_config pwm_cfg = pwm_get_default_config();
 		pwm_config_set_clkdiv(&pwm_cfg, clock_div);
-		pwm_config_set_wrap(&pwm_cfg, 1000);
+		pwm_config_set_wrap(&pwm_cfg, LIDAR_SPEED_DUTY_MAX);
 
 		pwm_init(pwm_slice, &pwm_cfg, false);
 
-		const uint pwm_chan = cfg->pwm_pin & 1 ? PWM_CHAN_B : PWM_CHAN_A;
-		pwm_set_chan_level(pwm_slice, pwm_chan, 400);
+		const uint pwm_chan = pwm_gpio_to_channel(cfg->pwm_pin);
+		pwm_set_chan_level(pwm_slice, pwm_chan, LIDAR_SPEED_DUTY_DEFAULT);
 		pwm_set_enabled(pwm_slice, true);
 
 		gpio_set_function(cfg->pwm_pin, GPIO_FUNC_PWM);
 	}
+#endif
 
 	uart_inst_t *uart = __find_uart_for_pin(cfg->uart_pin);
 	if (!uart) {
 		panic("Invalid uart_pin - couldn't match with a UART instance");
 	}
 
-	uart_init(uart, BAUD_RATE);
+	uart_init(uart, LIDAR_BAUD_RATE);
 	gpio_set_function(cfg->uart_pin, GPIO_FUNC_UART);
-	uart_set_baudrate(uart, BAUD_RATE);
+	uart_set_baudrate(uart, LIDAR_BAUD_RATE);
+
+	lidar_hw_init(hw, uart, cfg);
+}
+
+void lidar_release_frame(struct lidar_hw *hw, struct lidar_frame *frame)
+{
+	lidar_parser_release(&hw->parser, frame);
+}
+
+const struct lidar_frame_time *lidar_frame_time(struct lidar_hw *hw)
+{
+	return &hw->frame_time;
+}
+
+void lidar_get_time_status(struct lidar_hw *hw, struct lidar_time_status *status)
+{
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	lidar_time_get_status(&hw->time_sync, status);
+
+	restore_interrupts(irq_state);
+}
+
+void lidar_set_scan_rate(struct lidar_hw *hw, uint32_t centi_hz)
+{
+	if (hw->pwm_pin < 0) {
+		return;
+	}
+
+	hw->scan_rate_req = centi_hz;
+	__dmb();
+	hw->scan_rate_req_seq++;
+}
+
+void lidar_get_scan_rate_status(struct lidar_hw *hw, struct lidar_speed_status *status)
+{
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	lidar_speed_get_status(&hw->speed, status);
+
+	restore_interrupts(irq_state);
+}
+
+void lidar_get_stats(struct lidar_hw *hw, struct lidar_stats *stats)
+{
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	lidar_parser_get_stats(&hw->parser, &stats->parser);
+	stats->irq_cycles = hw->irq_cycles;
+	stats->frame_cb_cycles = hw->frame_cb_cycles;
+
+	restore_interrupts(irq_state);
+}
+
+void lidar_reset_stats(struct lidar_hw *hw)
+{
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	lidar_parser_reset_stats(&hw->parser);
+	memset(&hw->irq_cycles, 0, sizeof(hw->irq_cycles));
+	memset(&hw->frame_cb_cycles, 0, sizeof(hw->frame_cb_cycles));
 
-	lidar_hw_init(hw, uart, cfg->frame_cb, cfg->frame_cb_data);
+	restore_interrupts(irq_state);
 }
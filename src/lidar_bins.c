@@ -0,0 +1,131 @@
+// Angular binning for the OKDO LIDAR_LD06
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <string.h>
+
+#include "lidar_bins.h"
+#include "lidar_points.h"
+
+#define MIN_BIN_WIDTH ((LIDAR_ANGLE_MAX + LIDAR_BINS_MAX - 1) / LIDAR_BINS_MAX)
+
+static void lidar_bins_start(struct lidar_bins_reducer *br, uint16_t timestamp)
+{
+	for (uint32_t i = 0; i < br->nbins; i++) {
+		br->acc[i].acc = br->mode == LIDAR_BINS_MIN ? UINT32_MAX : 0;
+		br->acc[i].count = 0;
+	}
+
+	br->timestamp = timestamp;
+	br->nsamples = 0;
+}
+
+static void lidar_bins_add_sample(struct lidar_bins_acc *acc, enum lidar_bins_mode mode,
+                                  uint16_t distance)
+{
+	switch (mode) {
+	case LIDAR_BINS_MIN:
+		if (distance < acc->acc) {
+			acc->acc = distance;
+		}
+		acc->count++;
+		break;
+	case LIDAR_BINS_MEDIAN:
+		if (acc->count < LIDAR_BINS_MEDIAN_MAX) {
+			// Insertion sort, there are only a few
+			uint32_t i = acc->count++;
+			while (i > 0 && acc->samples[i - 1] > distance) {
+				acc->samples[i] = acc->samples[i - 1];
+				i--;
+			}
+			acc->samples[i] = distance;
+		}
+		break;
+	case LIDAR_BINS_MEAN:
+		acc->acc += distance;
+		acc->count++;
+		break;
+	}
+}
+
+static uint16_t lidar_bins_result(const struct lidar_bins_acc *acc, enum lidar_bins_mode mode)
+{
+	if (!acc->count) {
+		return 0;
+	}
+
+	switch (mode) {
+	case LIDAR_BINS_MIN:
+		return acc->acc;
+	case LIDAR_BINS_MEDIAN:
+		return acc->samples[(acc->count - 1) / 2];
+	case LIDAR_BINS_MEAN:
+		return (acc->acc + acc->count / 2) / acc->count;
+	}
+
+	return 0;
+}
+
+static void lidar_bins_publish(struct lidar_bins_reducer *br, uint16_t speed)
+{
+	struct lidar_bins *bins = &br->bufs[lidar_triple_fill(&br->bufs_idx)];
+
+	bins->seq = br->seq++;
+	bins->speed = speed;
+	bins->timestamp = br->timestamp;
+	bins->nsamples = br->nsamples;
+	bins->bin_width = br->bin_width;
+	bins->nbins = br->nbins;
+	bins->mode = br->mode;
+	for (uint32_t i = 0; i < br->nbins; i++) {
+		bins->distance_mm[i] = lidar_bins_result(&br->acc[i], br->mode);
+	}
+
+	lidar_triple_publish(&br->bufs_idx);
+}
+
+void lidar_bins_init(struct lidar_bins_reducer *br, const struct lidar_bins_cfg *cfg)
+{
+	memset(br, 0, sizeof(*br));
+
+	br->bin_width = cfg->bin_width < MIN_BIN_WIDTH ? MIN_BIN_WIDTH : cfg->bin_width;
+	br->nbins = (LIDAR_ANGLE_MAX + br->bin_width - 1) / br->bin_width;
+	br->mode = cfg->mode;
+
+	lidar_triple_init(&br->bufs_idx);
+}
+
+void lidar_bins_add_frame(struct lidar_bins_reducer *br, const struct lidar_frame *frame)
+{
+	struct lidar_point points[LIDAR_SAMPLES_PER_FRAME];
+
+	lidar_frame_to_points(frame, points);
+
+	for (int i = 0; i < LIDAR_SAMPLES_PER_FRAME; i++) {
+		const uint32_t angle = points[i].angle;
+
+		// Went past 0 degrees, so the revolution is complete.
+		if (angle < br->last_angle && (br->last_angle - angle) > LIDAR_ANGLE_MAX / 2) {
+			if (br->started) {
+				lidar_bins_publish(br, frame->speed);
+			}
+			br->started = true;
+			lidar_bins_start(br, frame->timestamp);
+		}
+		br->last_angle = angle;
+
+		if (!br->started || !points[i].distance_mm) {
+			continue;
+		}
+
+		lidar_bins_add_sample(&br->acc[angle / br->bin_width], br->mode, points[i].distance_mm);
+		br->nsamples++;
+	}
+}
+
+const struct lidar_bins *lidar_bins_acquire(struct lidar_bins_reducer *br)
+{
+	const uint32_t idx = lidar_triple_acquire(&br->bufs_idx);
+
+	return idx == LIDAR_TRIPLE_NONE ? NULL : &br->bufs[idx];
+}
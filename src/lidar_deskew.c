@@ -0,0 +1,184 @@
+// Motion de-skew for the OKDO LIDAR_LD06
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include "lidar_deskew.h"
+#include "lidar_time.h"
+
+void lidar_deskew_init(struct lidar_deskew *d)
+{
+	d->vx_q32 = 0;
+	d->vy_q32 = 0;
+	d->omega_q32 = 0;
+	d->ref_timestamp = 0;
+	d->ref_angle = 0;
+}
+
+// Per second to per us, in 32.32 fixed point: * 2^32 / 10^6, which is
+// * 2^26 / 5^6 so that it can't overflow
+static int64_t per_us_q32(int32_t per_s)
+{
+	return (int64_t)per_s * (1 << 26) / 15625;
+}
+
+void lidar_deskew_set_motion(struct lidar_deskew *d, const struct lidar_deskew_motion *motion)
+{
+	d->vx_q32 = per_us_q32(motion->vx_mm_s);
+	d->vy_q32 = per_us_q32(motion->vy_mm_s);
+	d->omega_q32 = per_us_q32(motion->omega_cdeg_s);
+}
+
+void lidar_deskew_set_reference(struct lidar_deskew *d, uint16_t timestamp, uint16_t angle)
+{
+	d->ref_timestamp = timestamp;
+	d->ref_angle = angle;
+}
+
+static uint32_t wrap_angle(int32_t angle)
+{
+	angle %= LIDAR_ANGLE_MAX;
+	if (angle < 0) {
+		angle += LIDAR_ANGLE_MAX;
+	}
+
+	return angle;
+}
+
+void lidar_deskew_motion_from_delta(struct lidar_deskew_motion *motion, int32_t x_mm, int32_t y_mm,
+                                    int32_t theta_cdeg, uint32_t dt_us)
+{
+	if (!dt_us) {
+		motion->vx_mm_s = 0;
+		motion->vy_mm_s = 0;
+		motion->omega_cdeg_s = 0;
+		return;
+	}
+
+	// Undo the half-turn that lidar_deskew_frame() applies to the
+	// translation (see translation_q8())
+	const uint32_t back = wrap_angle(-(theta_cdeg / 2));
+	const int64_t c = lidar_cos_q15(back);
+	const int64_t s = lidar_sin_q15(back);
+	const int64_t rx = x_mm * c - y_mm * s;
+	const int64_t ry = x_mm * s + y_mm * c;
+
+	motion->vx_mm_s = ((rx * 1000000) / dt_us) >> 15;
+	motion->vy_mm_s = ((ry * 1000000) / dt_us) >> 15;
+	motion->omega_cdeg_s = ((int64_t)theta_cdeg * 1000000) / dt_us;
+}
+
+// Rotation after t_us, in centi-degrees, 16.16 fixed point
+static int64_t rotation_q16(const struct lidar_deskew *d, int32_t t_us)
+{
+	return (d->omega_q32 * t_us) >> 16;
+}
+
+// Translation after t_us, in mm, 24.8 fixed point.
+// Moving at a constant velocity while turning traces an arc, and the chord
+// of that arc points half-way through the turn. The chord is a little
+// shorter than the arc (by 0.1% for 9 degrees, a quarter-turn per second
+// over a revolution), which is ignored.
+static void translation_q8(const struct lidar_deskew *d, int32_t t_us, int32_t *x, int32_t *y)
+{
+	const uint32_t half = wrap_angle(rotation_q16(d, t_us) >> 17);
+	const int64_t c = lidar_cos_q15(half);
+	const int64_t s = lidar_sin_q15(half);
+	const int64_t dx = (d->vx_q32 * t_us) >> 24;
+	const int64_t dy = (d->vy_q32 * t_us) >> 24;
+
+	*x = (dx * c - dy * s) >> 15;
+	*y = (dx * s + dy * c) >> 15;
+}
+
+void lidar_deskew_frame(const struct lidar_deskew *d, const struct lidar_frame *frame,
+                        struct lidar_point_xy *xy)
+{
+	const uint32_t start = frame->start_angle;
+	uint32_t end = frame->end_angle;
+	if (end < start) {
+		end += LIDAR_ANGLE_MAX;
+	}
+	const uint32_t span = end - start;
+
+	int32_t dt_ms = (int32_t)frame->timestamp - d->ref_timestamp;
+	if (dt_ms >= LIDAR_TIME_SENSOR_WRAP_MS / 2) {
+		dt_ms -= LIDAR_TIME_SENSOR_WRAP_MS;
+	} else if (dt_ms < -(LIDAR_TIME_SENSOR_WRAP_MS / 2)) {
+		dt_ms += LIDAR_TIME_SENSOR_WRAP_MS;
+	}
+	if (dt_ms > LIDAR_DESKEW_MAX_DT_MS) {
+		dt_ms = LIDAR_DESKEW_MAX_DT_MS;
+	} else if (dt_ms < -LIDAR_DESKEW_MAX_DT_MS) {
+		dt_ms = -LIDAR_DESKEW_MAX_DT_MS;
+	}
+
+	// Between samples, in centi-degrees, 16.16 fixed point
+	const uint32_t span_step = (span << 16) / (LIDAR_SAMPLES_PER_FRAME - 1);
+
+	// Time of the first sample relative to the reference, and between
+	// samples (16.16 fixed point), in us. There are no 64-bit divisions
+	// here: they're slow on the M0+.
+	int32_t t0_us, step_us_q16;
+	if (frame->speed) {
+		// The timestamp says roughly how far the sensor has turned
+		// since the reference. The angles say exactly, give or take
+		// whole revolutions.
+		const int32_t turned = (int32_t)frame->speed * dt_ms / 10;
+		int32_t error = wrap_angle((int32_t)start - d->ref_angle - turned);
+		if (error >= LIDAR_ANGLE_MAX / 2) {
+			error -= LIDAR_ANGLE_MAX;
+		}
+
+		// speed is in degrees/s, so 10000 / speed us per centi-degree
+		const uint32_t us_per_cdeg_q16 = (10000u << 16) / frame->speed;
+		t0_us = ((int64_t)(turned + error) * us_per_cdeg_q16) >> 16;
+		step_us_q16 = ((uint64_t)span_step * us_per_cdeg_q16) >> 16;
+	} else {
+		t0_us = dt_ms * 1000;
+		step_us_q16 = ((int64_t)LIDAR_SAMPLE_PERIOD_NS << 16) / 1000;
+	}
+	const int32_t t1_us = t0_us + (((int64_t)(LIDAR_SAMPLES_PER_FRAME - 1) * step_us_q16) >> 16);
+
+	// The sensor's rotation is added to each sample's angle, stepping in
+	// 16.16 fixed point like lidar_frame_to_points().
+	const int64_t rot0 = rotation_q16(d, t0_us);
+	const int64_t rot_step = (d->omega_q32 * step_us_q16) >> 32;
+	const uint32_t full = (uint32_t)LIDAR_ANGLE_MAX << 16;
+	// Both parts are less than a full turn, so the sum is less than two
+	uint64_t base = ((uint64_t)(start + wrap_angle(rot0 >> 16)) << 16) + (1 << 15) + (rot0 & 0xffff);
+	while (base >= full) {
+		base -= full;
+	}
+	int64_t step = (int64_t)span_step + rot_step;
+	if (step < 0) {
+		step = 0;
+	}
+	uint32_t angle = base;
+
+	// The translation is close enough to linear over one frame
+	int32_t tx, ty, tx1, ty1;
+	translation_q8(d, t0_us, &tx, &ty);
+	translation_q8(d, t1_us, &tx1, &ty1);
+	const int32_t tx_step = (tx1 - tx) / (LIDAR_SAMPLES_PER_FRAME - 1);
+	const int32_t ty_step = (ty1 - ty) / (LIDAR_SAMPLES_PER_FRAME - 1);
+
+	for (int i = 0; i < LIDAR_SAMPLES_PER_FRAME; i++) {
+		uint32_t a = angle >> 16;
+		if (a >= LIDAR_ANGLE_MAX) {
+			a -= LIDAR_ANGLE_MAX;
+		}
+
+		const int32_t dist = frame->samples[i].distance_mm;
+		if (dist) {
+			xy[i].x_mm = ((dist * lidar_cos_q15(a) + (1 << 14)) >> 15) + ((tx + (1 << 7)) >> 8);
+			xy[i].y_mm = ((dist * lidar_sin_q15(a) + (1 << 14)) >> 15) + ((ty + (1 << 7)) >> 8);
+		} else {
+			xy[i].x_mm = 0;
+			xy[i].y_mm = 0;
+		}
+
+		angle += step;
+		tx += tx_step;
+		ty += ty_step;
+	}
+}
@@ -0,0 +1,469 @@
+// Line feature extraction for the OKDO LIDAR_LD06
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <string.h>
+
+#include "lidar_features.h"
+
+// How far apart neighbouring points on the same surface can be, as a
+// multiple of the spacing of the samples across the beam. 8 allows for
+// surfaces at up to ~80 degrees to the beam, like walls far down a corridor.
+#define BREAK_SPREAD 8
+
+// Per mm of distance and per bin of gap, in Q16: the spacing between the
+// samples across the beam (2 * pi * 65536 / LIDAR_SCAN_BINS), times
+// BREAK_SPREAD
+#define BREAK_PER_BIN_Q16 ((411775 * BREAK_SPREAD) / LIDAR_SCAN_BINS)
+
+// Keeps the differences between points below 32768 mm, so the cross
+// products in split_run() fit in 32 bits
+#define MAX_DISTANCE_MM 16000
+
+// Sums over the points in a piece, for the least squares line fit
+struct moments {
+	int64_t sx, sy;
+	int64_t sxx, syy, sxy;
+	int32_t n;
+};
+
+static inline int32_t round_q15(int64_t v)
+{
+	return (v + (1 << 14)) >> 15;
+}
+
+static inline int64_t abs64(int64_t v)
+{
+	return v < 0 ? -v : v;
+}
+
+static inline int64_t dist_sq(int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+	const int64_t dx = x1 - x0;
+	const int64_t dy = y1 - y0;
+
+	return dx * dx + dy * dy;
+}
+
+static bool is_break(const struct lidar_features_cfg *cfg, int32_t x0, int32_t y0,
+                     int32_t x1, int32_t y1, int32_t d, uint32_t gap_bins)
+{
+	const int64_t limit = cfg->break_mm + (((int64_t)d * gap_bins * BREAK_PER_BIN_Q16) >> 16);
+
+	return dist_sq(x0, y0, x1, y1) > limit * limit;
+}
+
+static void reverse16(int16_t *v, uint32_t first, uint32_t last)
+{
+	while (first < last) {
+		const int16_t tmp = v[first];
+		v[first++] = v[last];
+		v[last--] = tmp;
+	}
+}
+
+static void reverse8(uint8_t *v, uint32_t first, uint32_t last)
+{
+	while (first < last) {
+		const uint8_t tmp = v[first];
+		v[first++] = v[last];
+		v[last--] = tmp;
+	}
+}
+
+// Rotate the points so that point k is first
+static void rotate_points(struct lidar_features_extractor *ex, uint32_t k)
+{
+	const uint32_t n = ex->npoints;
+
+	if (!k) {
+		return;
+	}
+
+	reverse16(ex->x, 0, k - 1);
+	reverse16(ex->x, k, n - 1);
+	reverse16(ex->x, 0, n - 1);
+	reverse16(ex->y, 0, k - 1);
+	reverse16(ex->y, k, n - 1);
+	reverse16(ex->y, 0, n - 1);
+	reverse8(ex->run_start, 0, k - 1);
+	reverse8(ex->run_start, k, n - 1);
+	reverse8(ex->run_start, 0, n - 1);
+}
+
+// Convert the usable samples in 'scan' to points, using the middle of each
+// bin as its angle, and mark where each run starts. Then rotate them so that
+// the first point starts a run, so no run wraps around the end.
+static void load_points(struct lidar_features_extractor *ex, const struct lidar_scan *scan)
+{
+	const struct lidar_features_cfg *cfg = &ex->cfg;
+	const int32_t min_d = cfg->min_distance_mm ? cfg->min_distance_mm : 1;
+	const int32_t max_d = cfg->max_distance_mm && cfg->max_distance_mm < MAX_DISTANCE_MM ?
+	                      cfg->max_distance_mm : MAX_DISTANCE_MM;
+	int32_t first_bin = 0, prev_bin = 0, prev_d = 0;
+	uint32_t n = 0;
+
+	for (uint32_t i = 0; i < LIDAR_SCAN_BINS; i++) {
+		const int32_t d = scan->bins[i].distance_mm;
+		if (d < min_d || d > max_d) {
+			continue;
+		}
+
+		const uint32_t angle = (2 * i + 1) * (LIDAR_ANGLE_MAX / 2) / LIDAR_SCAN_BINS;
+		ex->x[n] = round_q15(d * lidar_cos_q15(angle));
+		ex->y[n] = round_q15(d * lidar_sin_q15(angle));
+
+		if (n) {
+			ex->run_start[n] = is_break(cfg, ex->x[n - 1], ex->y[n - 1], ex->x[n], ex->y[n],
+			                            d > prev_d ? d : prev_d, i - prev_bin);
+		} else {
+			first_bin = i;
+		}
+
+		prev_bin = i;
+		prev_d = d;
+		n++;
+	}
+
+	ex->npoints = n;
+	if (!n) {
+		return;
+	}
+
+	// Across 0 degrees, from the last point to the first
+	const int32_t first_d = scan->bins[first_bin].distance_mm;
+	ex->run_start[0] = is_break(cfg, ex->x[n - 1], ex->y[n - 1], ex->x[0], ex->y[0],
+	                            first_d > prev_d ? first_d : prev_d,
+	                            first_bin + LIDAR_SCAN_BINS - prev_bin);
+
+	uint32_t k = 0;
+	while (k < n && !ex->run_start[k]) {
+		k++;
+	}
+
+	if (k == n) {
+		// One closed loop, all the way round. Start anywhere.
+		ex->run_start[0] = 1;
+		k = 0;
+	}
+
+	rotate_points(ex, k);
+}
+
+static void moments_add(struct moments *m, const struct lidar_features_extractor *ex,
+                        uint32_t first, uint32_t last)
+{
+	for (uint32_t i = first; i <= last; i++) {
+		// Points are int16_t, so the products fit in 32 bits
+		const int32_t x = ex->x[i];
+		const int32_t y = ex->y[i];
+
+		m->sx += x;
+		m->sy += y;
+		m->sxx += x * x;
+		m->syy += y * y;
+		m->sxy += x * y;
+	}
+	m->n += last - first + 1;
+}
+
+// Fit a line to points 'first' to 'last', given their moments. The line
+// points from the first towards the last.
+static void fit_line(const struct lidar_features_extractor *ex, const struct moments *m,
+                     uint32_t first, uint32_t last, struct lidar_features_line *line)
+{
+	// Central moments, times n
+	const int64_t cxx = m->n * m->sxx - m->sx * m->sx;
+	const int64_t cyy = m->n * m->syy - m->sy * m->sy;
+	const int64_t cxy = m->n * m->sxy - m->sx * m->sy;
+
+	// The direction of least squares (perpendicular) error is at half the
+	// angle of (cxx - cyy, 2 * cxy). Scale them down to fit lidar_atan2().
+	int64_t ax = cxx - cyy, ay = 2 * cxy;
+	while (abs64(ax) >= (1 << 30) || abs64(ay) >= (1 << 30)) {
+		ax >>= 1;
+		ay >>= 1;
+	}
+
+	const int32_t dx = ex->x[last] - ex->x[first];
+	const int32_t dy = ex->y[last] - ex->y[first];
+	uint32_t angle;
+	if (ax || ay) {
+		angle = lidar_atan2(ay, ax) / 2;
+	} else {
+		// No spread at all, so use the ends
+		angle = lidar_atan2(dy, dx);
+	}
+
+	line->first = first;
+	line->last = last;
+	line->cx = (m->sx + m->n / 2) / m->n;
+	line->cy = (m->sy + m->n / 2) / m->n;
+	line->ux = lidar_cos_q15(angle);
+	line->uy = lidar_sin_q15(angle);
+
+	if ((int64_t)dx * line->ux + (int64_t)dy * line->uy < 0) {
+		line->ux = -line->ux;
+		line->uy = -line->uy;
+	}
+}
+
+// The nearest point on 'line' to (x, y)
+static void project(const struct lidar_features_line *line, int32_t x, int32_t y,
+                    int16_t *px, int16_t *py)
+{
+	const int32_t t = round_q15((int64_t)(x - line->cx) * line->ux + (int64_t)(y - line->cy) * line->uy);
+
+	*px = line->cx + round_q15((int64_t)t * line->ux);
+	*py = line->cy + round_q15((int64_t)t * line->uy);
+}
+
+// Distance from (x, y) to 'line', in Q15 mm
+static int64_t line_dist_q15(const struct lidar_features_line *line, int32_t x, int32_t y)
+{
+	return abs64((int64_t)(x - line->cx) * line->uy - (int64_t)(y - line->cy) * line->ux);
+}
+
+static void add_points(const struct lidar_features_extractor *ex, struct lidar_features *out,
+                       uint32_t first, uint32_t last)
+{
+	for (uint32_t i = first; i <= last; i++) {
+		if (out->npoints < LIDAR_FEATURES_MAX_POINTS) {
+			out->points[out->npoints].x_mm = ex->x[i];
+			out->points[out->npoints].y_mm = ex->y[i];
+			out->npoints++;
+		} else {
+			out->dropped++;
+		}
+	}
+	out->work += last - first + 1;
+}
+
+// Split one run into straight pieces, adding them to ex->lines, and anything
+// left over to out->points. Pieces are handled in order, so everything stays
+// in angle order.
+static uint32_t split_run(struct lidar_features_extractor *ex, struct lidar_features *out,
+                          uint32_t first, uint32_t last, uint32_t nlines, uint32_t max_lines)
+{
+	const struct lidar_features_cfg *cfg = &ex->cfg;
+	const int64_t split_sq = (int64_t)cfg->split_mm * cfg->split_mm;
+	const int64_t min_len_sq = (int64_t)cfg->min_length_mm * cfg->min_length_mm;
+	const uint32_t min_points = cfg->min_points < 3 ? 3 : cfg->min_points;
+	uint32_t sp = 0;
+
+	ex->stack[sp][0] = first;
+	ex->stack[sp][1] = last;
+	sp++;
+
+	while (sp) {
+		sp--;
+		const uint32_t a = ex->stack[sp][0];
+		const uint32_t b = ex->stack[sp][1];
+
+		if (b - a + 1 < min_points) {
+			add_points(ex, out, a, b);
+			continue;
+		}
+
+		// Find the point furthest from the line between the ends. The
+		// points are int16_t, so the cross products fit in 32 bits.
+		const int32_t dx = ex->x[b] - ex->x[a];
+		const int32_t dy = ex->y[b] - ex->y[a];
+		int32_t furthest = 0;
+		uint32_t k = a;
+		for (uint32_t i = a + 1; i < b; i++) {
+			int32_t c = (ex->x[i] - ex->x[a]) * dy - (ex->y[i] - ex->y[a]) * dx;
+			c = c < 0 ? -c : c;
+			if (c > furthest) {
+				furthest = c;
+				k = i;
+			}
+		}
+		out->work += b - a + 1;
+
+		if ((int64_t)furthest * furthest > split_sq * dist_sq(0, 0, dx, dy)) {
+			// Both halves might become lines, as might everything
+			// still on the stack
+			if (nlines + sp + 2 <= max_lines) {
+				ex->stack[sp][0] = k + 1;
+				ex->stack[sp][1] = b;
+				ex->stack[sp + 1][0] = a;
+				ex->stack[sp + 1][1] = k;
+				sp += 2;
+			} else {
+				out->truncated = true;
+				add_points(ex, out, a, b);
+			}
+			continue;
+		}
+
+		// The first piece of each run isn't covered by the check above
+		if (nlines >= max_lines) {
+			out->truncated = true;
+			add_points(ex, out, a, b);
+			continue;
+		}
+
+		struct moments m = { 0 };
+		struct lidar_features_line *line = &ex->lines[nlines];
+		int16_t x0, y0, x1, y1;
+
+		moments_add(&m, ex, a, b);
+		out->work += b - a + 1;
+		fit_line(ex, &m, a, b, line);
+		project(line, ex->x[a], ex->y[a], &x0, &y0);
+		project(line, ex->x[b], ex->y[b], &x1, &y1);
+
+		if (dist_sq(x0, y0, x1, y1) < min_len_sq) {
+			add_points(ex, out, a, b);
+		} else {
+			nlines++;
+		}
+	}
+
+	return nlines;
+}
+
+// Whether 'next' carries straight on from 'line', in the same run
+static bool joined(const struct lidar_features_extractor *ex, const struct lidar_features_line *line,
+                   const struct lidar_features_line *next)
+{
+	return next->first == line->last + 1 && !ex->run_start[next->first];
+}
+
+// Merge neighbouring lines which are really the same line. Each line's points
+// are summed again, once, as it's merged. Returns the new number of lines.
+static uint32_t merge_lines(struct lidar_features_extractor *ex, struct lidar_features *out, uint32_t nlines)
+{
+	const struct lidar_features_cfg *cfg = &ex->cfg;
+	const int64_t max_sin = lidar_sin_q15(cfg->merge_angle);
+	const int64_t max_dist = (int64_t)cfg->split_mm << 15;
+	struct moments m = { 0 };
+	bool have_moments = false;
+	uint32_t nmerged = 0;
+
+	for (uint32_t i = 0; i < nlines; i++) {
+		const struct lidar_features_line *line = &ex->lines[i];
+
+		if (nmerged) {
+			struct lidar_features_line *prev = &ex->lines[nmerged - 1];
+			const int64_t sin = ((int64_t)prev->ux * line->uy - (int64_t)prev->uy * line->ux) >> 15;
+			const int64_t cos = ((int64_t)prev->ux * line->ux + (int64_t)prev->uy * line->uy) >> 15;
+
+			if (joined(ex, prev, line) && cos > 0 && abs64(sin) <= max_sin &&
+			    line_dist_q15(prev, ex->x[line->first], ex->y[line->first]) <= max_dist &&
+			    line_dist_q15(prev, ex->x[line->last], ex->y[line->last]) <= max_dist) {
+				if (!have_moments) {
+					memset(&m, 0, sizeof(m));
+					moments_add(&m, ex, prev->first, prev->last);
+					out->work += prev->last - prev->first + 1;
+					have_moments = true;
+				}
+				moments_add(&m, ex, line->first, line->last);
+				out->work += line->last - line->first + 1;
+				fit_line(ex, &m, prev->first, line->last, prev);
+				continue;
+			}
+		}
+
+		ex->lines[nmerged++] = *line;
+		have_moments = false;
+	}
+
+	return nmerged;
+}
+
+void lidar_features_init(struct lidar_features_extractor *ex, const struct lidar_features_cfg *cfg)
+{
+	ex->cfg = *cfg;
+	ex->npoints = 0;
+}
+
+void lidar_features_extract(struct lidar_features_extractor *ex, const struct lidar_scan *scan,
+                            struct lidar_features *out)
+{
+	const struct lidar_features_cfg *cfg = &ex->cfg;
+	const uint32_t max_lines = cfg->max_segments && cfg->max_segments < LIDAR_FEATURES_MAX_SEGMENTS ?
+	                           cfg->max_segments : LIDAR_FEATURES_MAX_SEGMENTS;
+
+	out->seq = scan->seq;
+	out->speed = scan->speed;
+	out->timestamp = scan->timestamp;
+	out->nsegments = 0;
+	out->ncorners = 0;
+	out->npoints = 0;
+	out->dropped = 0;
+	out->truncated = false;
+
+	load_points(ex, scan);
+	out->work = ex->npoints;
+
+	// Split each run
+	const uint32_t n = ex->npoints;
+	uint32_t nlines = 0;
+	uint32_t first = 0;
+	while (first < n) {
+		uint32_t last = first;
+		while (last + 1 < n && !ex->run_start[last + 1]) {
+			last++;
+		}
+
+		nlines = split_run(ex, out, first, last, nlines, max_lines);
+		first = last + 1;
+	}
+
+	nlines = merge_lines(ex, out, nlines);
+
+	for (uint32_t i = 0; i < nlines; i++) {
+		const struct lidar_features_line *line = &ex->lines[i];
+		struct lidar_feature_segment *seg = &out->segments[i];
+
+		project(line, ex->x[line->first], ex->y[line->first], &seg->x0_mm, &seg->y0_mm);
+		project(line, ex->x[line->last], ex->y[line->last], &seg->x1_mm, &seg->y1_mm);
+	}
+	out->nsegments = nlines;
+
+	// Corners, where the lines cross close to both their ends
+	const int64_t min_sin = lidar_sin_q15(cfg->corner_angle);
+	const int64_t corner_sq = (int64_t)cfg->corner_mm * cfg->corner_mm;
+	for (uint32_t i = 0; i + 1 < nlines; i++) {
+		const struct lidar_features_line *a = &ex->lines[i];
+		const struct lidar_features_line *b = &ex->lines[i + 1];
+		struct lidar_feature_segment *sa = &out->segments[i];
+		struct lidar_feature_segment *sb = &out->segments[i + 1];
+
+		if (!joined(ex, a, b)) {
+			continue;
+		}
+
+		// In Q30
+		const int64_t sin = (int64_t)a->ux * b->uy - (int64_t)a->uy * b->ux;
+		const int64_t cos = (int64_t)a->ux * b->ux + (int64_t)a->uy * b->uy;
+		if (abs64(sin) < min_sin * (1 << 15) && cos > 0) {
+			continue;
+		}
+		// Antiparallel lines get past that, but never cross
+		if (!sin) {
+			continue;
+		}
+
+		// Along line a from its centre to where it crosses line b, in mm.
+		// The cross product is often negative, so scale it with a
+		// multiply rather than a shift.
+		const int64_t along = (((int64_t)(b->cx - a->cx) * b->uy - (int64_t)(b->cy - a->cy) * b->ux) * (1 << 15)) / sin;
+		const int32_t x = a->cx + round_q15(along * a->ux);
+		const int32_t y = a->cy + round_q15(along * a->uy);
+
+		if (x < INT16_MIN || x > INT16_MAX || y < INT16_MIN || y > INT16_MAX ||
+		    dist_sq(x, y, sa->x1_mm, sa->y1_mm) > corner_sq ||
+		    dist_sq(x, y, sb->x0_mm, sb->y0_mm) > corner_sq) {
+			continue;
+		}
+
+		sa->x1_mm = sb->x0_mm = x;
+		sa->y1_mm = sb->y0_mm = y;
+		out->corners[out->ncorners].x_mm = x;
+		out->corners[out->ncorners].y_mm = y;
+		out->ncorners++;
+	}
+}
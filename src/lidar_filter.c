@@ -0,0 +1,155 @@
+// Streaming sample filter for the OKDO LIDAR_LD06
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <string.h>
+
+#include "crc8.h"
+#include "lidar_filter.h"
+
+#define RADIUS LIDAR_FILTER_MEDIAN_RADIUS
+
+void lidar_filter_init(struct lidar_filter *f, const struct lidar_filter_cfg *cfg)
+{
+	memset(f, 0, sizeof(*f));
+
+	f->cfg = *cfg;
+	if (f->cfg.median != 3 && f->cfg.median != 5) {
+		f->cfg.median = 0;
+	}
+
+	lidar_crc8_init();
+}
+
+static void lidar_filter_gate(const struct lidar_filter_cfg *cfg, struct lidar_frame *frame)
+{
+	for (int i = 0; i < LIDAR_SAMPLES_PER_FRAME; i++) {
+		struct lidar_sample *s = &frame->samples[i];
+
+		if (s->intensity < cfg->min_intensity ||
+		    s->distance_mm < cfg->min_distance_mm ||
+		    (cfg->max_distance_mm && s->distance_mm > cfg->max_distance_mm)) {
+			s->distance_mm = 0;
+		}
+	}
+}
+
+static void lidar_filter_seal(struct lidar_frame *frame)
+{
+	frame->crc8 = lidar_crc8_update(0, (const uint8_t *)frame, LIDAR_FRAME_SIZE - 1);
+}
+
+// Does 'next' follow straight on from 'frame'? Frames overlap a bit, or
+// leave a gap of about one sample's angle, depending on the speed.
+static bool lidar_filter_contiguous(const struct lidar_frame *frame, const struct lidar_frame *next)
+{
+	const uint32_t span = (frame->end_angle + LIDAR_ANGLE_MAX - frame->start_angle) % LIDAR_ANGLE_MAX;
+	const uint32_t step = span / (LIDAR_SAMPLES_PER_FRAME - 1);
+	// Signed, so that an overlap is a small negative gap
+	int32_t gap = ((int32_t)next->start_angle - frame->end_angle) % LIDAR_ANGLE_MAX;
+	if (gap >= LIDAR_ANGLE_MAX / 2) {
+		gap -= LIDAR_ANGLE_MAX;
+	} else if (gap < -(LIDAR_ANGLE_MAX / 2)) {
+		gap += LIDAR_ANGLE_MAX;
+	}
+
+	return step && gap >= -2 * (int32_t)step && gap <= 2 * (int32_t)step;
+}
+
+// Median-filter the held frame into 'out', using 'next' for the samples
+// after it, if it's contiguous.
+static void lidar_filter_median(struct lidar_filter *f, const struct lidar_frame *next,
+                                bool next_contiguous, struct lidar_frame *out)
+{
+	const int radius = f->cfg.median / 2;
+	// The held frame's distances, with up to RADIUS either side. Missing
+	// neighbours are 0, the same as a removed sample.
+	uint16_t d[RADIUS + LIDAR_SAMPLES_PER_FRAME + RADIUS] = { 0 };
+
+	for (int i = 0; i < RADIUS; i++) {
+		if (f->have_prev) {
+			d[i] = f->prev_tail[i];
+		}
+		if (next_contiguous) {
+			d[RADIUS + LIDAR_SAMPLES_PER_FRAME + i] = next->samples[i].distance_mm;
+		}
+	}
+	for (int i = 0; i < LIDAR_SAMPLES_PER_FRAME; i++) {
+		d[RADIUS + i] = f->held.samples[i].distance_mm;
+	}
+
+	*out = f->held;
+
+	for (int i = 0; i < LIDAR_SAMPLES_PER_FRAME; i++) {
+		const int centre = RADIUS + i;
+		if (!d[centre]) {
+			continue;
+		}
+
+		// Insertion sort of the valid samples in the window, starting
+		// with the centre one.
+		uint16_t w[LIDAR_FILTER_MEDIAN_MAX] = { d[centre] };
+		int n = 1;
+		for (int j = centre - radius; j <= centre + radius; j++) {
+			const uint16_t v = d[j];
+			if (!v || j == centre) {
+				continue;
+			}
+
+			int k = n++;
+			while (k > 0 && w[k - 1] > v) {
+				w[k] = w[k - 1];
+				k--;
+			}
+			w[k] = v;
+		}
+
+		out->samples[i].distance_mm = w[(n - 1) / 2];
+	}
+
+	for (int i = 0; i < RADIUS; i++) {
+		f->prev_tail[i] = d[LIDAR_SAMPLES_PER_FRAME + i];
+	}
+	f->have_prev = next_contiguous;
+}
+
+bool lidar_filter_frame(struct lidar_filter *f, const struct lidar_frame *in, struct lidar_frame *out)
+{
+	struct lidar_frame frame = *in;
+
+	lidar_filter_gate(&f->cfg, &frame);
+
+	if (!f->cfg.median) {
+		*out = frame;
+		lidar_filter_seal(out);
+		return true;
+	}
+
+	if (!f->have_held) {
+		f->held = frame;
+		f->have_held = true;
+		f->have_prev = false;
+		return false;
+	}
+
+	lidar_filter_median(f, &frame, lidar_filter_contiguous(&f->held, &frame), out);
+	lidar_filter_seal(out);
+
+	f->held = frame;
+
+	return true;
+}
+
+bool lidar_filter_flush(struct lidar_filter *f, struct lidar_frame *out)
+{
+	if (!f->have_held) {
+		return false;
+	}
+
+	lidar_filter_median(f, NULL, false, out);
+	lidar_filter_seal(out);
+
+	f->have_held = false;
+
+	return true;
+}
@@ -0,0 +1,243 @@
+// 2D occupancy grid for the OKDO LIDAR_LD06
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <string.h>
+
+#include "lidar_grid.h"
+#include "lidar_points.h"
+
+#define TILE_SHIFT 4
+static_assert((1 << TILE_SHIFT) == LIDAR_GRID_TILE_DIM, "TILE_SHIFT doesn't match");
+
+#define TILE_MASK (LIDAR_GRID_TILE_DIM - 1)
+
+// One bit per tile, for the tiles changed by the current frame
+#define TOUCHED_WORDS ((LIDAR_GRID_MAX_TILES + 31) / 32)
+
+static uint16_t tiles_for(uint16_t cells)
+{
+	uint32_t tiles = (cells + LIDAR_GRID_TILE_DIM - 1) / LIDAR_GRID_TILE_DIM;
+
+	if (tiles < 1) {
+		tiles = 1;
+	} else if (tiles > LIDAR_GRID_MAX_DIM / LIDAR_GRID_TILE_DIM) {
+		tiles = LIDAR_GRID_MAX_DIM / LIDAR_GRID_TILE_DIM;
+	}
+
+	return tiles;
+}
+
+static inline uint32_t tile_of(const struct lidar_grid *grid, uint32_t x, uint32_t y)
+{
+	return (y >> TILE_SHIFT) * grid->tiles_w + (x >> TILE_SHIFT);
+}
+
+static inline uint32_t cell_index(uint32_t tile, uint32_t x, uint32_t y)
+{
+	return tile * LIDAR_GRID_TILE_CELLS + ((y & TILE_MASK) << TILE_SHIFT) + (x & TILE_MASK);
+}
+
+static inline bool on_grid(const struct lidar_grid *grid, int32_t x, int32_t y)
+{
+	return x >= 0 && y >= 0 &&
+	       x < grid->tiles_w * LIDAR_GRID_TILE_DIM &&
+	       y < grid->tiles_h * LIDAR_GRID_TILE_DIM;
+}
+
+// Rounds towards minus infinity, unlike '/'
+static inline int32_t to_cell(int32_t mm, int32_t cell_mm)
+{
+	return mm >= 0 ? mm / cell_mm : -((cell_mm - 1 - mm) / cell_mm);
+}
+
+static void lidar_grid_update(struct lidar_grid *grid, int32_t x, int32_t y, int32_t delta,
+                              uint32_t *touched)
+{
+	const uint32_t tile = tile_of(grid, x, y);
+	int8_t *cell = &grid->cells[cell_index(tile, x, y)];
+
+	int32_t v = *cell + delta;
+	if (v > grid->cfg.max) {
+		v = grid->cfg.max;
+	} else if (v < grid->cfg.min) {
+		v = grid->cfg.min;
+	}
+
+	// Saturated cells don't change, and don't make their tile dirty
+	if (v != *cell) {
+		*cell = v;
+		touched[tile / 32] |= 1u << (tile % 32);
+	}
+
+	grid->stats.cells++;
+}
+
+// Bresenham's line, from the sensor's cell (which must be on the grid) to the
+// end of the ray. The ray stops where it leaves the grid.
+static void lidar_grid_trace(struct lidar_grid *grid, int32_t x0, int32_t y0,
+                             int32_t x1, int32_t y1, bool hit, uint32_t *touched)
+{
+	const int32_t dx = x1 > x0 ? x1 - x0 : x0 - x1;
+	const int32_t dy = y1 > y0 ? y0 - y1 : y1 - y0;
+	const int32_t sx = x1 > x0 ? 1 : -1;
+	const int32_t sy = y1 > y0 ? 1 : -1;
+	int32_t err = dx + dy;
+
+	for (;;) {
+		if (!on_grid(grid, x0, y0)) {
+			return;
+		}
+
+		if (x0 == x1 && y0 == y1) {
+			lidar_grid_update(grid, x0, y0, hit ? grid->cfg.hit : grid->cfg.miss, touched);
+			return;
+		}
+
+		lidar_grid_update(grid, x0, y0, grid->cfg.miss, touched);
+
+		const int32_t e2 = 2 * err;
+		if (e2 >= dy) {
+			err += dy;
+			x0 += sx;
+		}
+		if (e2 <= dx) {
+			err += dx;
+			y0 += sy;
+		}
+	}
+}
+
+void lidar_grid_init(struct lidar_grid *grid, const struct lidar_grid_cfg *cfg)
+{
+	memset(grid, 0, sizeof(*grid));
+
+	grid->cfg = *cfg;
+	if (!grid->cfg.cell_mm) {
+		grid->cfg.cell_mm = 1;
+	}
+	grid->tiles_w = tiles_for(cfg->width);
+	grid->tiles_h = tiles_for(cfg->height);
+
+	grid->pose.x_mm = grid->tiles_w * LIDAR_GRID_TILE_DIM * grid->cfg.cell_mm / 2;
+	grid->pose.y_mm = grid->tiles_h * LIDAR_GRID_TILE_DIM * grid->cfg.cell_mm / 2;
+}
+
+void lidar_grid_set_pose(struct lidar_grid *grid, const struct lidar_grid_pose *pose)
+{
+	grid->pose = *pose;
+	grid->pose.heading %= LIDAR_ANGLE_MAX;
+}
+
+void lidar_grid_add_frame(struct lidar_grid *grid, const struct lidar_frame *frame)
+{
+	const int32_t cell_mm = grid->cfg.cell_mm;
+	const struct lidar_grid_pose *pose = &grid->pose;
+	const int32_t x0 = to_cell(pose->x_mm, cell_mm);
+	const int32_t y0 = to_cell(pose->y_mm, cell_mm);
+	uint32_t touched[TOUCHED_WORDS] = { 0 };
+	struct lidar_point points[LIDAR_SAMPLES_PER_FRAME];
+
+	grid->stats.frames++;
+
+	if (!on_grid(grid, x0, y0)) {
+		return;
+	}
+
+	lidar_frame_to_points(frame, points);
+
+	for (int i = 0; i < LIDAR_SAMPLES_PER_FRAME; i++) {
+		int32_t d = points[i].distance_mm;
+		bool hit = true;
+
+		if (!d || points[i].intensity < grid->cfg.min_intensity) {
+			continue;
+		}
+
+		if (grid->cfg.max_range_mm && d > grid->cfg.max_range_mm) {
+			d = grid->cfg.max_range_mm;
+			hit = false;
+		}
+
+		uint32_t angle = points[i].angle + pose->heading;
+		if (angle >= LIDAR_ANGLE_MAX) {
+			angle -= LIDAR_ANGLE_MAX;
+		}
+
+		// Same rounding as lidar_points_to_xy()
+		const int32_t x = pose->x_mm + ((d * lidar_cos_q15(angle) + (1 << 14)) >> 15);
+		const int32_t y = pose->y_mm + ((d * lidar_sin_q15(angle) + (1 << 14)) >> 15);
+
+		lidar_grid_trace(grid, x0, y0, to_cell(x, cell_mm), to_cell(y, cell_mm), hit, touched);
+		grid->stats.rays++;
+	}
+
+	// Pairs with the fence in lidar_grid_take_dirty(). Whichever side's
+	// fence comes second, either the copy sees these cells, or the dirty
+	// flag set here lands after the flag was cleared.
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	for (uint32_t w = 0; w < TOUCHED_WORDS; w++) {
+		uint32_t bits = touched[w];
+
+		while (bits) {
+			const uint32_t bit = __builtin_ctz(bits);
+			bits &= bits - 1;
+
+			__atomic_store_n(&grid->dirty[w * 32 + bit], 1, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+int8_t lidar_grid_get(const struct lidar_grid *grid, int32_t x, int32_t y)
+{
+	if (!on_grid(grid, x, y)) {
+		return 0;
+	}
+
+	return grid->cells[cell_index(tile_of(grid, x, y), x, y)];
+}
+
+bool lidar_grid_take_dirty(struct lidar_grid *grid, struct lidar_grid_tile *tile)
+{
+	const uint32_t ntiles = grid->tiles_w * grid->tiles_h;
+
+	for (uint32_t i = 0; i < ntiles; i++) {
+		const uint32_t t = (grid->next_tile + i) % ntiles;
+
+		if (!__atomic_load_n(&grid->dirty[t], __ATOMIC_RELAXED)) {
+			continue;
+		}
+
+		__atomic_store_n(&grid->dirty[t], 0, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		tile->tile_x = t % grid->tiles_w;
+		tile->tile_y = t / grid->tiles_w;
+		tile->tiles_w = grid->tiles_w;
+		tile->tiles_h = grid->tiles_h;
+		tile->cell_mm = grid->cfg.cell_mm;
+		memcpy(tile->cells, &grid->cells[t * LIDAR_GRID_TILE_CELLS], sizeof(tile->cells));
+
+		grid->next_tile = t + 1;
+		grid->stats.tiles_taken++;
+
+		return true;
+	}
+
+	return false;
+}
+
+void lidar_grid_mark_all_dirty(struct lidar_grid *grid)
+{
+	const uint32_t ntiles = grid->tiles_w * grid->tiles_h;
+
+	for (uint32_t t = 0; t < ntiles; t++) {
+		__atomic_store_n(&grid->dirty[t], 1, __ATOMIC_RELAXED);
+	}
+}
+
+void lidar_grid_get_stats(struct lidar_grid *grid, struct lidar_grid_stats *stats)
+{
+	*stats = grid->stats;
+}
@@ -0,0 +1,523 @@
+// Scan matching odometry for the OKDO LIDAR_LD06
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <string.h>
+
+#include "lidar_match.h"
+#include "lidar_points.h"
+
+// Stop iterating once an iteration moves the estimate by no more than this
+#define CONVERGED_MM 1
+#define CONVERGED_CDEG 1
+
+#define GRID_HALF (LIDAR_MATCH_GRID_DIM / 2)
+
+// Normals are unit vectors in Q14
+#define NORMAL_SHIFT 14
+
+// The rotation is solved for as the distance it moves a point this far
+// (1024 mm) from the sensor, so that all three unknowns are in mm, and the
+// sums are of similar sizes.
+#define LEVER_SHIFT 10
+
+// Centi-degrees per radian, divided by the lever, in Q16:
+// 36000 / (2 * pi) / 1024 * 65536
+#define LEVER_TO_CDEG_Q16 366690
+
+// The sums are cut down to this many bits before solving, so the
+// determinants fit in int64_t with room for some fraction bits.
+#define SOLVE_BITS 15
+#define SOLVE_FRAC_SHIFT 12
+// Fraction bits in the solution
+#define STEP_SHIFT 8
+
+// So that the sums of squares in surface_normal(), of up to twice this in
+// each direction, fit in int32_t
+#define MAX_PAIR_LIMIT_MM 16383
+
+// Sums over the pairs from one iteration, for the least squares fit of a
+// small change to the estimate: (rotation, x, y), with the rotation as
+// described for LEVER_SHIFT. 'a' is the upper triangle of the symmetric
+// matrix, in Q28; 'b' the right hand side, in Q28 mm.
+struct pair_sums {
+	int64_t a00, a01, a02, a11, a12, a22;
+	int64_t b0, b1, b2;
+	// In (Q7 mm)^2
+	uint64_t dist_sq;
+	uint32_t n;
+};
+
+static inline int32_t normalise_cdeg(int32_t theta)
+{
+	theta %= LIDAR_ANGLE_MAX;
+	if (theta >= LIDAR_ANGLE_MAX / 2) {
+		theta -= LIDAR_ANGLE_MAX;
+	} else if (theta < -LIDAR_ANGLE_MAX / 2) {
+		theta += LIDAR_ANGLE_MAX;
+	}
+
+	return theta;
+}
+
+static inline uint32_t unsigned_cdeg(int32_t theta)
+{
+	return theta < 0 ? theta + LIDAR_ANGLE_MAX : theta;
+}
+
+static inline int32_t round_q15(int64_t v)
+{
+	return (v + (1 << 14)) >> 15;
+}
+
+static inline int32_t abs32(int32_t v)
+{
+	return v < 0 ? -v : v;
+}
+
+static inline int64_t abs64(int64_t v)
+{
+	return v < 0 ? -v : v;
+}
+
+static inline int64_t max64(int64_t a, int64_t b)
+{
+	return a > b ? a : b;
+}
+
+static uint32_t isqrt(uint32_t v)
+{
+	uint32_t res = 0;
+	uint32_t bit = 1u << 30;
+
+	while (bit > v) {
+		bit >>= 2;
+	}
+
+	while (bit) {
+		if (v >= res + bit) {
+			v -= res + bit;
+			res = (res >> 1) + bit;
+		} else {
+			res >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return res;
+}
+
+// Rounds towards minus infinity, unlike '/'. Returns -1 for anything off the
+// grid.
+static inline int32_t cell_of(int32_t mm, int32_t cell_mm)
+{
+	const int32_t c = (mm >= 0 ? mm / cell_mm : -((cell_mm - 1 - mm) / cell_mm)) + GRID_HALF;
+
+	return c >= 0 && c < LIDAR_MATCH_GRID_DIM ? c : -1;
+}
+
+// Convert the usable samples in 'scan' to points, using the middle of each
+// bin as its angle. Returns the number of points.
+static uint32_t load_points(const struct lidar_match_cfg *cfg, const struct lidar_scan *scan,
+                            uint32_t step, int16_t *xs, int16_t *ys)
+{
+	const int32_t min_d = cfg->min_distance_mm ? cfg->min_distance_mm : 1;
+	const int32_t max_d = cfg->max_distance_mm ? cfg->max_distance_mm : INT16_MAX;
+	uint32_t n = 0;
+
+	for (uint32_t i = 0; i < LIDAR_SCAN_BINS; i += step) {
+		const int32_t d = scan->bins[i].distance_mm;
+		if (d < min_d || d > max_d || d > INT16_MAX) {
+			continue;
+		}
+
+		const uint32_t angle = (2 * i + 1) * (LIDAR_ANGLE_MAX / 2) / LIDAR_SCAN_BINS;
+		xs[n] = round_q15(d * lidar_cos_q15(angle));
+		ys[n] = round_q15(d * lidar_sin_q15(angle));
+		n++;
+	}
+
+	return n;
+}
+
+// Which way the surface through point i of 'n' (in cur_x/y, in angle order)
+// faces, from its neighbours. If either is too far away, the point is on an
+// edge, or on its own, and there's no telling, so returns false. 'nx' and
+// 'ny' may be NULL to only check.
+static bool surface_normal(const struct lidar_match *m, uint32_t n, uint32_t i, int16_t *nx, int16_t *ny)
+{
+	const uint32_t max_sq = (uint32_t)m->cfg.max_pair_mm * m->cfg.max_pair_mm;
+	const uint32_t prev = i ? i - 1 : n - 1;
+	const uint32_t next = i + 1 < n ? i + 1 : 0;
+	const int32_t x = m->cur_x[i];
+	const int32_t y = m->cur_y[i];
+
+	if (n < 3) {
+		return false;
+	}
+
+	const int32_t px = m->cur_x[prev] - x, py = m->cur_y[prev] - y;
+	const int32_t qx = m->cur_x[next] - x, qy = m->cur_y[next] - y;
+	// Each one first, so that the squares below can't overflow (see
+	// MAX_PAIR_LIMIT_MM)
+	const int32_t lim = m->cfg.max_pair_mm;
+	if (abs32(px) > lim || abs32(py) > lim || abs32(qx) > lim || abs32(qy) > lim) {
+		return false;
+	}
+	if ((uint32_t)(px * px + py * py) > max_sq || (uint32_t)(qx * qx + qy * qy) > max_sq) {
+		return false;
+	}
+
+	// Along the surface
+	const int32_t hx = qx - px;
+	const int32_t hy = qy - py;
+	const int32_t len = isqrt(hx * hx + hy * hy);
+	if (!len) {
+		return false;
+	}
+
+	if (nx) {
+		*nx = -hy * (1 << NORMAL_SHIFT) / len;
+		*ny = hx * (1 << NORMAL_SHIFT) / len;
+	}
+
+	return true;
+}
+
+// Index of the cell point i of 'n' (in cur_x/y) belongs in, or
+// LIDAR_MATCH_GRID_CELLS if it's off the grid, or has no normal
+static inline uint32_t ref_cell(const struct lidar_match *m, uint32_t n, uint32_t i)
+{
+	const int32_t cx = cell_of(m->cur_x[i], m->cfg.cell_mm);
+	const int32_t cy = cell_of(m->cur_y[i], m->cfg.cell_mm);
+
+	if (cx < 0 || cy < 0 || !surface_normal(m, n, i, NULL, NULL)) {
+		return LIDAR_MATCH_GRID_CELLS;
+	}
+
+	return cy * LIDAR_MATCH_GRID_DIM + cx;
+}
+
+// Find the nearest reference point to (x, y), within max_sq (squared mm).
+// Returns its index, or -1 if there's nothing close enough.
+static int32_t nearest(const struct lidar_match *m, int32_t x, int32_t y, uint32_t max_sq)
+{
+	const int32_t cx = cell_of(x, m->cfg.cell_mm);
+	const int32_t cy = cell_of(y, m->cfg.cell_mm);
+	uint32_t best_sq = max_sq + 1;
+	int32_t best = -1;
+
+	if (cx < 0 || cy < 0) {
+		return -1;
+	}
+
+	const int32_t x0 = cx > 0 ? cx - 1 : 0;
+	const int32_t x1 = cx < LIDAR_MATCH_GRID_DIM - 1 ? cx + 1 : cx;
+	const int32_t y0 = cy > 0 ? cy - 1 : 0;
+	const int32_t y1 = cy < LIDAR_MATCH_GRID_DIM - 1 ? cy + 1 : cy;
+
+	for (int32_t row = y0; row <= y1; row++) {
+		// The cells in a row are next to each other, so that's one run
+		const uint32_t c = row * LIDAR_MATCH_GRID_DIM;
+		const uint32_t end = m->cell_start[c + x1 + 1];
+
+		for (uint32_t i = m->cell_start[c + x0]; i < end; i++) {
+			const int32_t dx = m->ref_x[i] - x;
+			const int32_t dy = m->ref_y[i] - y;
+			const uint32_t d_sq = dx * dx + dy * dy;
+
+			if (d_sq < best_sq) {
+				best_sq = d_sq;
+				best = i;
+			}
+		}
+	}
+
+	return best;
+}
+
+// Pair each point in the current revolution, moved by 't', with the nearest
+// reference point, and add up how far each is from the surface through its
+// pair.
+static void find_pairs(const struct lidar_match *m, const struct lidar_match_transform *t,
+                       uint32_t max_sq, struct pair_sums *sums)
+{
+	const uint32_t theta = unsigned_cdeg(t->theta);
+	const int32_t c = lidar_cos_q15(theta);
+	const int32_t s = lidar_sin_q15(theta);
+
+	memset(sums, 0, sizeof(*sums));
+
+	for (uint32_t i = 0; i < m->ncur; i++) {
+		const int32_t px = m->cur_x[i];
+		const int32_t py = m->cur_y[i];
+		const int32_t x = round_q15(px * c - py * s) + t->x_mm;
+		const int32_t y = round_q15(px * s + py * c) + t->y_mm;
+
+		const int32_t j = nearest(m, x, y, max_sq);
+		if (j < 0) {
+			continue;
+		}
+
+		const int32_t nx = m->ref_nx[j];
+		const int32_t ny = m->ref_ny[j];
+
+		// Distance from the surface, and how much a change to each
+		// unknown would change it
+		const int32_t r = nx * (x - m->ref_x[j]) + ny * (y - m->ref_y[j]);
+		const int32_t a0 = (ny * x - nx * y) >> LEVER_SHIFT;
+
+		sums->a00 += (int64_t)a0 * a0;
+		sums->a01 += (int64_t)a0 * nx;
+		sums->a02 += (int64_t)a0 * ny;
+		sums->a11 += (int64_t)nx * nx;
+		sums->a12 += (int64_t)nx * ny;
+		sums->a22 += (int64_t)ny * ny;
+		sums->b0 += (int64_t)a0 * r;
+		sums->b1 += (int64_t)nx * r;
+		sums->b2 += (int64_t)ny * r;
+
+		const int32_t r_q7 = r >> (NORMAL_SHIFT - 7);
+		sums->dist_sq += (int64_t)r_q7 * r_q7;
+		sums->n++;
+	}
+}
+
+// How far right 'v' (positive) needs shifting to fit in SOLVE_BITS
+static uint32_t fit_shift(int64_t v)
+{
+	uint32_t shift = 0;
+
+	while ((v >> shift) >= (1 << SOLVE_BITS)) {
+		shift++;
+	}
+
+	return shift;
+}
+
+static inline int64_t det3(int64_t a00, int64_t a01, int64_t a02,
+                           int64_t a10, int64_t a11, int64_t a12,
+                           int64_t a20, int64_t a21, int64_t a22)
+{
+	return a00 * (a11 * a22 - a12 * a21) -
+	       a01 * (a10 * a22 - a12 * a20) +
+	       a02 * (a10 * a21 - a11 * a20);
+}
+
+// Solve the sums for the change to make to 't' (Gauss-Newton), and put the
+// result in 'next'. Returns false if there's no solution.
+//
+// The sums are scaled down to SOLVE_BITS first, which costs some precision,
+// but each iteration starts again from the new estimate, so at worst that
+// costs an extra iteration. A little is added to the diagonal, so that any
+// direction which the surfaces don't pin down (e.g. along a corridor) stays
+// where it was, rather than jumping somewhere arbitrary.
+static bool solve(const struct pair_sums *sums, const struct lidar_match_transform *t,
+                  int32_t max_step_mm, struct lidar_match_transform *next)
+{
+	const int64_t damping = max64(max64(sums->a00, sums->a11), sums->a22) >> 12;
+	const int64_t a00 = sums->a00 + damping;
+	const int64_t a11 = sums->a11 + damping;
+	const int64_t a22 = sums->a22 + damping;
+
+	// Off-diagonal entries can't be bigger than the diagonal
+	const uint32_t sa = fit_shift(max64(max64(a00, a11), a22));
+	const uint32_t sb = fit_shift(max64(max64(abs64(sums->b0), abs64(sums->b1)), abs64(sums->b2)));
+
+	const int64_t m00 = a00 >> sa, m01 = sums->a01 >> sa, m02 = sums->a02 >> sa;
+	const int64_t m11 = a11 >> sa, m12 = sums->a12 >> sa, m22 = a22 >> sa;
+	const int64_t v0 = -(sums->b0 >> sb), v1 = -(sums->b1 >> sb), v2 = -(sums->b2 >> sb);
+
+	const int64_t det = det3(m00, m01, m02, m01, m11, m12, m02, m12, m22);
+	if (det <= 0) {
+		return false;
+	}
+
+	// Cramer's rule
+	const int64_t dets[3] = {
+		det3(v0, m01, m02, v1, m11, m12, v2, m12, m22),
+		det3(m00, v0, m02, m01, v1, m12, m02, v2, m22),
+		det3(m00, m01, v0, m01, m11, v1, m02, m12, v2),
+	};
+
+	// Back to mm, in Q8 (1 mm at the lever is over 5 centi-degrees), and
+	// no bigger than max_step_mm
+	const int32_t shift = (int32_t)sb - (int32_t)sa - SOLVE_FRAC_SHIFT + STEP_SHIFT;
+	const int32_t max_step = max_step_mm << STEP_SHIFT;
+	int32_t u[3];
+	for (int i = 0; i < 3; i++) {
+		int64_t v = dets[i] * (1 << SOLVE_FRAC_SHIFT) / det;
+
+		if (shift < 0) {
+			v = (v + (1ll << (-shift - 1))) >> -shift;
+		} else if (abs64(v) > ((int64_t)max_step >> shift)) {
+			v = v < 0 ? -max_step : max_step;
+		} else {
+			v *= 1ll << shift;
+		}
+
+		u[i] = v > max_step ? max_step : v < -max_step ? -max_step : v;
+	}
+
+	const int32_t d_theta = ((int64_t)u[0] * LEVER_TO_CDEG_Q16 + (1 << (15 + STEP_SHIFT))) >> (16 + STEP_SHIFT);
+	const int32_t dx = (u[1] + (1 << (STEP_SHIFT - 1))) >> STEP_SHIFT;
+	const int32_t dy = (u[2] + (1 << (STEP_SHIFT - 1))) >> STEP_SHIFT;
+
+	// The change is applied after 't', so it rotates the existing
+	// translation too
+	const uint32_t dt = unsigned_cdeg(d_theta);
+	const int64_t c = lidar_cos_q15(dt);
+	const int64_t s = lidar_sin_q15(dt);
+
+	next->x_mm = round_q15(t->x_mm * c - t->y_mm * s) + dx;
+	next->y_mm = round_q15(t->x_mm * s + t->y_mm * c) + dy;
+	next->theta = normalise_cdeg(t->theta + d_theta);
+
+	return true;
+}
+
+void lidar_match_init(struct lidar_match *m, const struct lidar_match_cfg *cfg)
+{
+	memset(m, 0, sizeof(*m));
+
+	m->cfg = *cfg;
+	if (!m->cfg.cell_mm) {
+		m->cfg.cell_mm = 1;
+	}
+	if (!m->cfg.max_pair_mm || m->cfg.max_pair_mm > m->cfg.cell_mm) {
+		m->cfg.max_pair_mm = m->cfg.cell_mm;
+	}
+	if (m->cfg.max_pair_mm > MAX_PAIR_LIMIT_MM) {
+		m->cfg.max_pair_mm = MAX_PAIR_LIMIT_MM;
+	}
+	if (!m->cfg.decimate) {
+		m->cfg.decimate = 1;
+	}
+	if (!m->cfg.max_iterations) {
+		m->cfg.max_iterations = 1;
+	}
+}
+
+void lidar_match_set_reference(struct lidar_match *m, const struct lidar_scan *scan)
+{
+	// Load into cur_x/y first, then sort into ref_x/y by cell
+	const uint32_t n = load_points(&m->cfg, scan, 1, m->cur_x, m->cur_y);
+	uint16_t *start = m->cell_start;
+
+	memset(start, 0, sizeof(m->cell_start));
+
+	// Counting sort: count the points in each cell, make start[c] the end
+	// of cell c, then count back down to its start as the points are
+	// placed. The cell is cheap enough to work out twice, rather than
+	// keep a copy. Points which can never be paired are dropped.
+	for (uint32_t i = 0; i < n; i++) {
+		start[ref_cell(m, n, i)]++;
+	}
+
+	uint32_t total = 0;
+	for (uint32_t c = 0; c < LIDAR_MATCH_GRID_CELLS; c++) {
+		total += start[c];
+		start[c] = total;
+	}
+	start[LIDAR_MATCH_GRID_CELLS] = total;
+
+	for (uint32_t i = n; i-- > 0;) {
+		const uint32_t c = ref_cell(m, n, i);
+		if (c == LIDAR_MATCH_GRID_CELLS) {
+			continue;
+		}
+
+		const uint32_t j = --start[c];
+		m->ref_x[j] = m->cur_x[i];
+		m->ref_y[j] = m->cur_y[i];
+		surface_normal(m, n, i, &m->ref_nx[j], &m->ref_ny[j]);
+	}
+
+	m->nref = total;
+	m->ncur = 0;
+}
+
+bool lidar_match_scan(struct lidar_match *m, const struct lidar_scan *scan,
+                      const struct lidar_match_transform *guess, struct lidar_match_result *result)
+{
+	const uint32_t max_sq = (uint32_t)m->cfg.max_pair_mm * m->cfg.max_pair_mm;
+	struct lidar_match_transform t = { 0 };
+	struct pair_sums sums = { 0 };
+	bool ok = false;
+
+	if (guess) {
+		t = *guess;
+		t.theta = normalise_cdeg(t.theta);
+	}
+
+	m->ncur = load_points(&m->cfg, scan, m->cfg.decimate, m->cur_x, m->cur_y);
+
+	memset(result, 0, sizeof(*result));
+	result->points = m->ncur;
+
+	while (result->iterations < m->cfg.max_iterations) {
+		find_pairs(m, &t, max_sq, &sums);
+		result->iterations++;
+
+		struct lidar_match_transform next;
+		ok = sums.n && sums.n >= m->cfg.min_pairs &&
+		     solve(&sums, &t, m->cfg.max_pair_mm, &next);
+		if (!ok) {
+			break;
+		}
+
+		const bool done = abs32(normalise_cdeg(next.theta - t.theta)) <= CONVERGED_CDEG &&
+		                  abs32(next.x_mm - t.x_mm) <= CONVERGED_MM &&
+		                  abs32(next.y_mm - t.y_mm) <= CONVERGED_MM;
+		t = next;
+
+		if (done) {
+			result->converged = true;
+			break;
+		}
+	}
+
+	result->transform = t;
+	result->pairs = sums.n;
+	result->rms_mm = sums.n ? isqrt(sums.dist_sq / sums.n) >> 7 : 0;
+
+	return ok;
+}
+
+bool lidar_match_add_scan(struct lidar_match *m, const struct lidar_scan *scan,
+                          struct lidar_match_result *result)
+{
+	bool ok = false;
+
+	if (m->have_ref) {
+		ok = lidar_match_scan(m, scan, &m->last, result);
+		if (ok) {
+			m->last = result->transform;
+		} else {
+			memset(&m->last, 0, sizeof(m->last));
+			memset(&result->transform, 0, sizeof(result->transform));
+		}
+	} else {
+		memset(result, 0, sizeof(*result));
+	}
+
+	lidar_match_set_reference(m, scan);
+	m->have_ref = true;
+
+	return ok;
+}
+
+void lidar_match_compose(const struct lidar_match_transform *a, const struct lidar_match_transform *b,
+                         struct lidar_match_transform *out)
+{
+	const uint32_t theta = unsigned_cdeg(normalise_cdeg(a->theta));
+	const int64_t c = lidar_cos_q15(theta);
+	const int64_t s = lidar_sin_q15(theta);
+	const struct lidar_match_transform res = {
+		.x_mm = a->x_mm + round_q15(b->x_mm * c - b->y_mm * s),
+		.y_mm = a->y_mm + round_q15(b->x_mm * s + b->y_mm * c),
+		.theta = normalise_cdeg(a->theta + b->theta),
+	};
+
+	*out = res;
+}
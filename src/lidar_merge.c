@@ -0,0 +1,35 @@
+// Merging frames from several sensors into one stream
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <string.h>
+
+#include "lidar_merge.h"
+
+// There's only one producer, so a single ring keeps the frames in the order
+// they were pushed. One ring per sensor would need the consumer to pick the
+// oldest head, and a push landing in the middle of that (from the other
+// core) could make it pick a later frame over an earlier one.
+
+void lidar_merge_init(struct lidar_merge *merge, uint32_t nsensors)
+{
+	memset(merge, 0, sizeof(*merge));
+
+	merge->nsensors = nsensors;
+	lidar_spsc_init(&merge->queue, merge->storage,
+	                sizeof(merge->storage[0]), LIDAR_MERGE_QUEUE_LEN);
+}
+
+bool lidar_merge_push(struct lidar_merge *merge, const struct lidar_frame_ref *ref)
+{
+	if (ref->sensor_id >= merge->nsensors) {
+		return false;
+	}
+
+	return lidar_spsc_push(&merge->queue, ref);
+}
+
+bool lidar_merge_pop(struct lidar_merge *merge, struct lidar_frame_ref *ref)
+{
+	return lidar_spsc_pop(&merge->queue, ref, 1) == 1;
+}
@@ -0,0 +1,325 @@
+// Byte-stream parser for the OKDO LIDAR_LD06
+// Finds frame headers in the receive buffer, validates the frames with their
+// CRC, and passes the valid ones to a callback.
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <stddef.h>
+#include <string.h>
+
+#include "crc8.h"
+#include "lidar_parser.h"
+
+static inline uint32_t min_u32(uint32_t a, uint32_t b)
+{
+	return a < b ? a : b;
+}
+
+static inline uint8_t *slot_ptr(struct lidar_parser *parser, uint32_t slot)
+{
+	return &parser->buf[(slot % LIDAR_HW_NUM_SLOTS) * LIDAR_FRAME_SIZE];
+}
+
+static inline uint32_t load_released(struct lidar_parser *parser)
+{
+	// Pairs with the store in lidar_parser_release(), which may run on
+	// the other core.
+	return __atomic_load_n(&parser->released, __ATOMIC_ACQUIRE);
+}
+
+static bool frame_valid(const uint8_t *p)
+{
+	uint8_t crc = lidar_crc8_update(0, p, LIDAR_FRAME_SIZE - 1);
+
+	return crc == p[LIDAR_FRAME_SIZE - 1];
+}
+
+static inline uint16_t get_u16(const uint8_t *p, uint32_t offs)
+{
+	return p[offs] | (p[offs + 1] << 8);
+}
+
+// Cheap structural checks on a frame candidate, before spending time on the
+// CRC. Only the fields within the first 'len' bytes are checked, so this can
+// also reject a candidate before the rest of it has arrived.
+//
+// A 0x54 in sample data is common, but is very unlikely to also be followed
+// by a valid ver_len, speed and angles.
+static bool frame_plausible(const uint8_t *p, uint32_t len)
+{
+	if (len > offsetof(struct lidar_frame, ver_len) &&
+	    p[offsetof(struct lidar_frame, ver_len)] != LIDAR_FRAME_VER_LEN) {
+		return false;
+	}
+
+	if (len >= offsetof(struct lidar_frame, speed) + 2 &&
+	    get_u16(p, offsetof(struct lidar_frame, speed)) > LIDAR_MAX_SPEED) {
+		return false;
+	}
+
+	if (len >= offsetof(struct lidar_frame, start_angle) + 2 &&
+	    get_u16(p, offsetof(struct lidar_frame, start_angle)) >= LIDAR_ANGLE_MAX) {
+		return false;
+	}
+
+	if (len >= offsetof(struct lidar_frame, end_angle) + 2 &&
+	    get_u16(p, offsetof(struct lidar_frame, end_angle)) >= LIDAR_ANGLE_MAX) {
+		return false;
+	}
+
+	return true;
+}
+
+// Find the next LIDAR_FRAME_HEADER byte in buf, at or after 'offs'.
+// Returns 'len' if there isn't one.
+//
+// This checks a word at a time, using the usual trick for finding a zero
+// byte in a word, after XORing every byte with the header value.
+static uint32_t find_header(const uint8_t *buf, uint32_t offs, uint32_t len)
+{
+	const uint32_t ones = 0x01010101;
+	const uint32_t highs = 0x80808080;
+	const uint32_t pattern = ones * LIDAR_FRAME_HEADER;
+
+	// Byte at a time up to a word boundary
+	while (offs < len && ((uintptr_t)&buf[offs] & 3)) {
+		if (buf[offs] == LIDAR_FRAME_HEADER) {
+			return offs;
+		}
+		offs++;
+	}
+
+	while (len - offs >= 4) {
+		uint32_t word;
+		memcpy(&word, __builtin_assume_aligned(&buf[offs], 4), sizeof(word));
+
+		const uint32_t x = word ^ pattern;
+
+		if ((x - ones) & ~x & highs) {
+			// One of these bytes matches
+			break;
+		}
+
+		offs += 4;
+	}
+
+	while (offs < len && buf[offs] != LIDAR_FRAME_HEADER) {
+		offs++;
+	}
+
+	return offs;
+}
+
+// Find the offset of the first thing in buf which could be a valid frame:
+// either a complete frame which passes all the checks, or a partial one at
+// the end which passes the checks so far. Returns 'len' if there isn't one.
+//
+// Each byte is looked at once by the header search, and most false headers
+// are rejected by frame_plausible() after a couple of bytes, so this is
+// roughly linear in 'len', rather than needing a CRC for every 0x54.
+static uint32_t find_frame(struct lidar_parser *parser, const uint8_t *buf, uint32_t len)
+{
+	uint32_t offs = 0;
+
+	for (;;) {
+		offs = find_header(buf, offs, len);
+		if (offs == len) {
+			return len;
+		}
+
+		const uint8_t *p = &buf[offs];
+		const uint32_t avail = len - offs;
+
+		if (frame_plausible(p, avail)) {
+			if (avail < LIDAR_FRAME_SIZE || frame_valid(p)) {
+				return offs;
+			}
+			parser->stats.crc_errors++;
+		}
+
+		offs++;
+	}
+}
+
+static void lidar_parser_deliver(struct lidar_parser *parser, uint8_t *base)
+{
+	parser->fill -= LIDAR_FRAME_SIZE;
+
+	// Moving on to the next slot must leave it free to receive into
+	if (parser->head + 1 - load_released(parser) >= LIDAR_HW_NUM_SLOTS) {
+		// The consumer is holding every other slot, so we have to
+		// drop this frame and re-use its slot.
+		// Slots are only requested if they're free, so this can only
+		// happen at the end of a request, and there's normally nothing
+		// to move.
+		memmove(base, base + LIDAR_FRAME_SIZE, parser->fill);
+		parser->stats.frames_dropped++;
+		return;
+	}
+
+	parser->frame_cb(parser->frame_cb_data, (struct lidar_frame *)base);
+	parser->head++;
+	parser->stats.frames++;
+
+	if (!parser->hold_frames) {
+		// Single writer in this mode, so no need for anything atomic
+		parser->released = parser->head;
+	}
+}
+
+// Whatever is left in the head slot starts with a header, so ask for the rest
+// of that frame, plus enough whole frames to make up the batch. If we're in
+// sync, they will all land aligned to slots.
+static uint32_t lidar_parser_next_request(struct lidar_parser *parser)
+{
+	const uint32_t slot = parser->head % LIDAR_HW_NUM_SLOTS;
+	const uint32_t nfree = LIDAR_HW_NUM_SLOTS - (parser->head - load_released(parser));
+
+	// Don't run off the end of the buffer, or into held slots
+	uint32_t nslots = min_u32(parser->batch_frames, LIDAR_HW_NUM_SLOTS - slot);
+	nslots = min_u32(nslots, nfree);
+
+	parser->stats.requests++;
+	if (parser->fill) {
+		parser->stats.short_requests++;
+	}
+
+	return nslots * LIDAR_FRAME_SIZE - parser->fill;
+}
+
+static uint32_t lidar_parser_scan(struct lidar_parser *parser)
+{
+	while (parser->fill > 0) {
+		uint8_t *base = slot_ptr(parser, parser->head);
+
+		// When in sync this is always zero. Otherwise, we skip the
+		// junk with a single move.
+		const uint32_t offs = find_frame(parser, base, parser->fill);
+		if (offs) {
+			memmove(base, base + offs, parser->fill - offs);
+			parser->fill -= offs;
+			parser->stats.bytes_skipped += offs;
+		}
+
+		if (parser->fill < LIDAR_FRAME_SIZE) {
+			// Not enough data for a full packet yet
+			break;
+		}
+
+		// find_frame() already checked it
+		lidar_parser_deliver(parser, base);
+	}
+
+	return lidar_parser_next_request(parser);
+}
+
+void lidar_parser_init(struct lidar_parser *parser, const struct lidar_parser_cfg *cfg)
+{
+	lidar_crc8_init();
+
+	memset(parser, 0, sizeof(*parser));
+	parser->frame_cb = cfg->frame_cb;
+	parser->frame_cb_data = cfg->frame_cb_data;
+	parser->hold_frames = cfg->hold_frames;
+	parser->batch_frames = cfg->batch_frames ? cfg->batch_frames : 1;
+	if (parser->batch_frames > LIDAR_HW_NUM_SLOTS - 1) {
+		parser->batch_frames = LIDAR_HW_NUM_SLOTS - 1;
+	}
+
+	// Initially request a full packet, and we will adjust when we
+	// see the first header.
+	parser->req_nbytes = LIDAR_FRAME_SIZE;
+}
+
+uint8_t *lidar_parser_rx_buf(struct lidar_parser *parser)
+{
+	return slot_ptr(parser, parser->head) + parser->fill;
+}
+
+uint32_t lidar_parser_rx_len(struct lidar_parser *parser)
+{
+	return parser->req_nbytes;
+}
+
+uint32_t lidar_parser_rx_done(struct lidar_parser *parser)
+{
+	parser->fill += parser->req_nbytes - parser->req_progress;
+	parser->stats.bytes_rx += parser->req_nbytes - parser->req_progress;
+	parser->req_progress = 0;
+	parser->req_nbytes = lidar_parser_scan(parser);
+
+	return parser->req_nbytes;
+}
+
+void lidar_parser_rx_progress(struct lidar_parser *parser, uint32_t written)
+{
+	if (written <= parser->req_progress) {
+		return;
+	}
+
+	parser->fill += written - parser->req_progress;
+	parser->stats.bytes_rx += written - parser->req_progress;
+	parser->req_progress = written;
+
+	// The slots from 'head' onwards are contiguous and the writer fills
+	// them in order, so the write position stays at head + fill as
+	// frames are delivered.
+	while (parser->fill >= LIDAR_FRAME_SIZE) {
+		uint8_t *base = slot_ptr(parser, parser->head);
+
+		if (base[0] != LIDAR_FRAME_HEADER ||
+		    !frame_plausible(base, LIDAR_FRAME_SIZE) ||
+		    !frame_valid(base)) {
+			// Out of sync. Leave it for rx_done, when it's safe
+			// to move data around.
+			break;
+		}
+
+		lidar_parser_deliver(parser, base);
+	}
+}
+
+void lidar_parser_release(struct lidar_parser *parser, struct lidar_frame *frame)
+{
+	(void)frame;
+
+	__atomic_store_n(&parser->released, parser->released + 1, __ATOMIC_RELEASE);
+}
+
+void lidar_parser_get_stats(struct lidar_parser *parser, struct lidar_parser_stats *stats)
+{
+	*stats = parser->stats;
+}
+
+void lidar_parser_reset_stats(struct lidar_parser *parser)
+{
+	memset(&parser->stats, 0, sizeof(parser->stats));
+}
+
+uint32_t lidar_parser_feed(struct lidar_parser *parser, const uint8_t *data, uint32_t len)
+{
+	uint32_t done = 0;
+
+	while (done < len) {
+		// Part of the request may already have been written by a
+		// previous call.
+		const uint32_t want = parser->req_nbytes - parser->req_filled;
+		const uint32_t nbytes = min_u32(want, len - done);
+
+		// Write into the buffer the same way the DMA would. Anything
+		// accounted for by lidar_parser_rx_progress() has already
+		// moved the write position along.
+		uint8_t *dst = lidar_parser_rx_buf(parser) + parser->req_filled - parser->req_progress;
+		memcpy(dst, data + done, nbytes);
+
+		done += nbytes;
+		parser->req_filled += nbytes;
+
+		if (parser->req_filled == parser->req_nbytes) {
+			parser->req_filled = 0;
+			lidar_parser_rx_done(parser);
+		}
+	}
+
+	return done;
+}
@@ -0,0 +1,184 @@
+// Per-sample point generation for the OKDO LIDAR_LD06
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include "lidar_points.h"
+
+// Quarter sine wave in Q15, in 128 steps from 0 to 90 degrees. Linear
+// interpolation between entries keeps the error below 2e-5.
+static const int16_t sin_table[129] = {
+	0, 402, 804, 1206, 1608, 2009, 2411, 2811,
+	3212, 3612, 4011, 4410, 4808, 5205, 5602, 5998,
+	6393, 6787, 7180, 7571, 7962, 8351, 8740, 9127,
+	9512, 9896, 10279, 10660, 11039, 11417, 11793, 12167,
+	12540, 12910, 13279, 13646, 14010, 14373, 14733, 15091,
+	15447, 15800, 16151, 16500, 16846, 17190, 17531, 17869,
+	18205, 18538, 18868, 19195, 19520, 19841, 20160, 20475,
+	20788, 21097, 21403, 21706, 22006, 22302, 22595, 22884,
+	23170, 23453, 23732, 24008, 24279, 24548, 24812, 25073,
+	25330, 25583, 25833, 26078, 26320, 26557, 26791, 27020,
+	27246, 27467, 27684, 27897, 28106, 28311, 28511, 28707,
+	28899, 29086, 29269, 29448, 29622, 29792, 29957, 30118,
+	30274, 30425, 30572, 30715, 30853, 30986, 31114, 31238,
+	31357, 31471, 31581, 31686, 31786, 31881, 31972, 32058,
+	32138, 32214, 32286, 32352, 32413, 32470, 32522, 32568,
+	32610, 32647, 32679, 32706, 32729, 32746, 32758, 32766,
+	32767,
+};
+
+// atan(2^-i), in centi-degrees scaled by 65536, for CORDIC
+#define CORDIC_ITERATIONS 20
+static const int32_t cordic_atan[CORDIC_ITERATIONS] = {
+	294912000, 174096719, 91987925, 46694507, 23437865, 11730358, 5866610, 2933484,
+	1466764, 733385, 366693, 183346, 91673, 45837, 22918, 11459,
+	5730, 2865, 1432, 716,
+};
+
+void lidar_frame_to_points(const struct lidar_frame *frame, struct lidar_point *points)
+{
+	// A frame can pass the CRC with angles of up to 65535 (less than two
+	// turns), so wrap both into one turn first. Otherwise the 16.16 angle
+	// below could overflow.
+	const uint32_t full = (uint32_t)LIDAR_ANGLE_MAX << 16;
+	uint32_t start = frame->start_angle;
+	uint32_t end = frame->end_angle;
+	if (start >= LIDAR_ANGLE_MAX) {
+		start -= LIDAR_ANGLE_MAX;
+	}
+	if (end >= LIDAR_ANGLE_MAX) {
+		end -= LIDAR_ANGLE_MAX;
+	}
+	if (end < start) {
+		end += LIDAR_ANGLE_MAX;
+	}
+	const uint32_t span = end - start;
+
+	// There are N - 1 gaps between N samples. Step in 16.16 fixed point,
+	// so there's only one division per frame.
+	const uint32_t step = (span << 16) / (LIDAR_SAMPLES_PER_FRAME - 1);
+	uint32_t angle = (start << 16) + (1 << 15);
+
+	for (int i = 0; i < LIDAR_SAMPLES_PER_FRAME; i++) {
+		if (angle >= full) {
+			angle -= full;
+		}
+
+		points[i].angle = angle >> 16;
+		points[i].distance_mm = frame->samples[i].distance_mm;
+		points[i].intensity = frame->samples[i].intensity;
+
+		// Both are less than a turn, so this can't overflow
+		angle += step;
+	}
+}
+
+int16_t lidar_sin_q15(uint32_t angle)
+{
+	// Convert to a 16-bit binary angle (65536 per revolution).
+	// 65536 / 36000 ~= 119305 / 65536, and doesn't overflow for angles
+	// below 36000.
+	const uint32_t bangle = (angle * 119305) >> 16;
+	const uint32_t quadrant = bangle >> 14;
+	uint32_t x = bangle & 0x3fff;
+
+	// sin(90 + t) == sin(90 - t)
+	if (quadrant & 1) {
+		x = 0x4000 - x;
+	}
+
+	const uint32_t idx = x >> 7;
+	const int32_t frac = x & 0x7f;
+	int32_t v = sin_table[idx];
+	if (frac) {
+		v += ((sin_table[idx + 1] - v) * frac) >> 7;
+	}
+
+	// sin(180 + t) == -sin(t)
+	return (quadrant & 2) ? -v : v;
+}
+
+int16_t lidar_cos_q15(uint32_t angle)
+{
+	angle += LIDAR_ANGLE_MAX / 4;
+	if (angle >= LIDAR_ANGLE_MAX) {
+		angle -= LIDAR_ANGLE_MAX;
+	}
+
+	return lidar_sin_q15(angle);
+}
+
+void lidar_points_to_xy(const struct lidar_point *points, struct lidar_point_xy *xy, uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++) {
+		const int32_t d = points[i].distance_mm;
+
+		// Round to nearest mm
+		xy[i].x_mm = (d * lidar_cos_q15(points[i].angle) + (1 << 14)) >> 15;
+		xy[i].y_mm = (d * lidar_sin_q15(points[i].angle) + (1 << 14)) >> 15;
+	}
+}
+
+uint32_t lidar_atan2(int32_t y, int32_t x)
+{
+	int64_t x64 = x, y64 = y;
+	int32_t angle = 0;
+
+	// CORDIC only converges within about +/- 90 degrees
+	if (x64 < 0) {
+		x64 = -x64;
+		y64 = -y64;
+		angle = (LIDAR_ANGLE_MAX / 2) << 16;
+	}
+
+	if (!x64 && !y64) {
+		return 0;
+	}
+
+	// Scale so the larger component is just under 2^29: big enough for
+	// the shifts below to keep their precision, and small enough to leave
+	// room for the vector to grow by ~1.65 times.
+	const int64_t ay = y64 < 0 ? -y64 : y64;
+	const int64_t big = x64 > ay ? x64 : ay;
+	int32_t vx, vy;
+
+	if (big >= (1 << 29)) {
+		int shift = 1;
+		while ((big >> shift) >= (1 << 29)) {
+			shift++;
+		}
+		vx = x64 >> shift;
+		vy = y64 >> shift;
+	} else {
+		int64_t scale = 1;
+		while (big * scale * 2 < (1 << 29)) {
+			scale *= 2;
+		}
+		vx = x64 * scale;
+		vy = y64 * scale;
+	}
+
+	// Rotate the vector onto the x axis, adding up the rotations
+	for (int i = 0; i < CORDIC_ITERATIONS; i++) {
+		const int32_t dx = vy >> i;
+		const int32_t dy = vx >> i;
+
+		if (vy > 0) {
+			vx += dx;
+			vy -= dy;
+			angle += cordic_atan[i];
+		} else {
+			vx -= dx;
+			vy += dy;
+			angle -= cordic_atan[i];
+		}
+	}
+
+	int32_t result = (angle + (1 << 15)) >> 16;
+	if (result < 0) {
+		result += LIDAR_ANGLE_MAX;
+	} else if (result >= LIDAR_ANGLE_MAX) {
+		result -= LIDAR_ANGLE_MAX;
+	}
+
+	return result;
+}
@@ -0,0 +1,72 @@
+// Full-revolution scan assembly for the OKDO LIDAR_LD06
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <string.h>
+
+#include "lidar_points.h"
+#include "lidar_scan.h"
+
+static void lidar_scan_start(struct lidar_scan_assembler *as, uint16_t timestamp)
+{
+	struct lidar_scan *scan = &as->bufs[lidar_triple_fill(&as->bufs_idx)];
+
+	memset(scan, 0, sizeof(*scan));
+	scan->timestamp = timestamp;
+}
+
+static void lidar_scan_publish(struct lidar_scan_assembler *as)
+{
+	struct lidar_scan *scan = &as->bufs[lidar_triple_fill(&as->bufs_idx)];
+	scan->seq = as->seq++;
+
+	lidar_triple_publish(&as->bufs_idx);
+
+	if (as->scan_cb) {
+		as->scan_cb(as->scan_cb_data, scan);
+	}
+}
+
+void lidar_scan_init(struct lidar_scan_assembler *as, lidar_scan_cb_t scan_cb, void *cb_data)
+{
+	memset(as, 0, sizeof(*as));
+
+	lidar_triple_init(&as->bufs_idx);
+	as->scan_cb = scan_cb;
+	as->scan_cb_data = cb_data;
+}
+
+void lidar_scan_add_frame(struct lidar_scan_assembler *as, const struct lidar_frame *frame)
+{
+	struct lidar_point points[LIDAR_SAMPLES_PER_FRAME];
+
+	lidar_frame_to_points(frame, points);
+
+	for (int i = 0; i < LIDAR_SAMPLES_PER_FRAME; i++) {
+		const uint32_t angle = points[i].angle;
+
+		// Went past 0 degrees, so the revolution is complete.
+		if (angle < as->last_angle && (as->last_angle - angle) > LIDAR_ANGLE_MAX / 2) {
+			if (as->started) {
+				lidar_scan_publish(as);
+			}
+			as->started = true;
+			lidar_scan_start(as, frame->timestamp);
+		}
+		as->last_angle = angle;
+
+		struct lidar_scan *scan = &as->bufs[lidar_triple_fill(&as->bufs_idx)];
+		const uint32_t bin = (angle * LIDAR_SCAN_BINS) / LIDAR_ANGLE_MAX;
+
+		scan->bins[bin] = frame->samples[i];
+		scan->speed = frame->speed;
+		scan->nsamples++;
+	}
+}
+
+const struct lidar_scan *lidar_scan_acquire(struct lidar_scan_assembler *as)
+{
+	const uint32_t idx = lidar_triple_acquire(&as->bufs_idx);
+
+	return idx == LIDAR_TRIPLE_NONE ? NULL : &as->bufs[idx];
+}
@@ -0,0 +1,127 @@
+// Closed-loop scan rate control for the OKDO LIDAR_LD06
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <string.h>
+
+#include "lidar_speed.h"
+
+// Gains, in Q16 duty units per degree/s of error. The integral gain is per
+// update period. Tuned against the motor model in host/bench_speed.c, which
+// has ~12 degrees/s per duty unit and a ~0.3 s time constant, for lock
+// in under 2 s.
+#define KP_Q16 ((int32_t)(0.05 * 65536))
+#define KI_Q16 ((int32_t)(0.03 * 65536))
+
+// Keep the output where the motor actually turns
+#define DUTY_MIN 100
+#define DUTY_MAX 900
+
+static inline int32_t clamp_i32(int32_t v, int32_t lo, int32_t hi)
+{
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static inline uint32_t abs_diff(uint32_t a, uint32_t b)
+{
+	return a > b ? a - b : b - a;
+}
+
+void lidar_speed_init(struct lidar_speed_ctl *ctl)
+{
+	memset(ctl, 0, sizeof(*ctl));
+
+	ctl->duty = LIDAR_SPEED_DUTY_DEFAULT;
+}
+
+void lidar_speed_set_target(struct lidar_speed_ctl *ctl, uint32_t centi_hz, uint32_t now_us)
+{
+	ctl->target = LIDAR_SPEED_FROM_CENTI_HZ(centi_hz);
+	ctl->target_set_us = now_us;
+
+	// Start integrating from the current duty, so there's no jump
+	ctl->integral = (int32_t)ctl->duty << 16;
+
+	ctl->in_tolerance = 0;
+	ctl->locked = false;
+	ctl->settle_time_us = 0;
+}
+
+static bool lidar_speed_update(struct lidar_speed_ctl *ctl, uint32_t now_us)
+{
+	const uint32_t measured = ctl->measured;
+	const uint32_t tolerance = ctl->target / LIDAR_SPEED_LOCK_TOLERANCE;
+	const uint32_t err_abs = abs_diff(measured, ctl->target);
+
+	if (err_abs <= tolerance) {
+		if (++ctl->in_tolerance >= LIDAR_SPEED_LOCK_PERIODS && !ctl->locked) {
+			ctl->locked = true;
+			if (!ctl->settle_time_us) {
+				ctl->settle_time_us = now_us - ctl->target_set_us;
+			}
+		}
+	} else {
+		ctl->in_tolerance = 0;
+		if (err_abs > 2 * tolerance) {
+			ctl->locked = false;
+		}
+	}
+
+	const int32_t err = (int32_t)ctl->target - (int32_t)measured;
+
+	// The integrator is clamped to the output range, so it can't wind up
+	// while the output is saturated.
+	ctl->integral = clamp_i32(ctl->integral + KI_Q16 * err,
+	                          DUTY_MIN << 16, DUTY_MAX << 16);
+
+	const int32_t out = ctl->integral + KP_Q16 * err;
+	const uint16_t duty = clamp_i32((out + (1 << 15)) >> 16, DUTY_MIN, DUTY_MAX);
+
+	if (duty == ctl->duty) {
+		return false;
+	}
+
+	ctl->duty = duty;
+
+	return true;
+}
+
+bool lidar_speed_add_frame(struct lidar_speed_ctl *ctl, uint16_t speed, uint32_t now_us)
+{
+	if (!ctl->count) {
+		ctl->period_start_us = now_us;
+	}
+
+	ctl->sum += speed;
+	ctl->count++;
+
+	if (now_us - ctl->period_start_us < LIDAR_SPEED_PERIOD_US) {
+		return false;
+	}
+
+	ctl->measured = ctl->sum / ctl->count;
+	ctl->sum = 0;
+	ctl->count = 0;
+
+	if (!ctl->target) {
+		return false;
+	}
+
+	return lidar_speed_update(ctl, now_us);
+}
+
+uint16_t lidar_speed_duty(const struct lidar_speed_ctl *ctl)
+{
+	return ctl->duty;
+}
+
+void lidar_speed_get_status(const struct lidar_speed_ctl *ctl, struct lidar_speed_status *status)
+{
+	*status = (struct lidar_speed_status){
+		.target_centi_hz = LIDAR_SPEED_TO_CENTI_HZ(ctl->target),
+		.measured_centi_hz = LIDAR_SPEED_TO_CENTI_HZ(ctl->measured),
+		.duty = ctl->duty,
+		.locked = ctl->locked,
+		.settle_time_us = ctl->settle_time_us,
+	};
+}
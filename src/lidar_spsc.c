@@ -0,0 +1,105 @@
+// Lock-free single-producer, single-consumer ring
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <string.h>
+
+#include "lidar_spsc.h"
+
+// Each side reads its own counter plainly, and the other side's with acquire
+// ordering, pairing with the release store when the other side updates it.
+// That's all that's needed for one producer and one consumer, and on the
+// RP2040 it compiles to plain loads/stores plus barriers, so it's safe
+// between an IRQ and the main loop as well as between the two cores.
+
+void lidar_spsc_init(struct lidar_spsc *q, void *storage, uint32_t elem_size, uint32_t capacity)
+{
+	q->storage = storage;
+	q->elem_size = elem_size;
+	q->mask = capacity - 1;
+	q->head = 0;
+	q->tail = 0;
+}
+
+void *lidar_spsc_reserve(struct lidar_spsc *q)
+{
+	const uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+
+	if (q->head - tail > q->mask) {
+		return NULL;
+	}
+
+	return &q->storage[(q->head & q->mask) * q->elem_size];
+}
+
+void lidar_spsc_commit(struct lidar_spsc *q)
+{
+	__atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+}
+
+bool lidar_spsc_push(struct lidar_spsc *q, const void *elem)
+{
+	void *dst = lidar_spsc_reserve(q);
+	if (!dst) {
+		return false;
+	}
+
+	memcpy(dst, elem, q->elem_size);
+	lidar_spsc_commit(q);
+
+	return true;
+}
+
+uint32_t lidar_spsc_peek(struct lidar_spsc *q, void **elems)
+{
+	const uint32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	const uint32_t idx = q->tail & q->mask;
+	uint32_t n = head - q->tail;
+
+	// Only up to the end of the storage
+	if (n > q->mask + 1 - idx) {
+		n = q->mask + 1 - idx;
+	}
+
+	*elems = &q->storage[idx * q->elem_size];
+
+	return n;
+}
+
+void lidar_spsc_release(struct lidar_spsc *q, uint32_t n)
+{
+	__atomic_store_n(&q->tail, q->tail + n, __ATOMIC_RELEASE);
+}
+
+uint32_t lidar_spsc_pop(struct lidar_spsc *q, void *dst, uint32_t max)
+{
+	uint8_t *out = dst;
+	uint32_t total = 0;
+
+	// At most two pieces, either side of the wrap
+	while (total < max) {
+		void *elems;
+		uint32_t n = lidar_spsc_peek(q, &elems);
+		if (!n) {
+			break;
+		}
+
+		if (n > max - total) {
+			n = max - total;
+		}
+
+		memcpy(out, elems, n * q->elem_size);
+		lidar_spsc_release(q, n);
+
+		out += n * q->elem_size;
+		total += n;
+	}
+
+	return total;
+}
+
+uint32_t lidar_spsc_count(struct lidar_spsc *q)
+{
+	return __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) -
+	       __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,161 @@
+// Timestamp reconstruction for the OKDO LIDAR_LD06
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lidar_time.h"
+
+// The sensor's timestamp is truncated to the millisecond, so on average the
+// real time is half a millisecond later.
+#define SENSOR_ROUNDING_US 500
+
+void lidar_time_init(struct lidar_time_sync *sync)
+{
+	memset(sync, 0, sizeof(*sync));
+}
+
+// Throw away the estimate, but keep counting
+static void lidar_time_restart(struct lidar_time_sync *sync)
+{
+	const uint32_t resyncs = sync->resyncs + 1;
+
+	lidar_time_init(sync);
+	sync->resyncs = resyncs;
+}
+
+// The drift between anchor_us and sensor time 't'. Relies on >> of a
+// negative value being an arithmetic shift, as it is with GCC.
+static inline int64_t lidar_time_drift_us(const struct lidar_time_sync *sync, int64_t t)
+{
+	return (sync->drift * (t - sync->anchor_us)) >> LIDAR_TIME_DRIFT_SHIFT;
+}
+
+// Smallest receive offset at anchor_us, from all the windows
+static inline int64_t lidar_time_anchor_offset(const struct lidar_time_sync *sync)
+{
+	if (sync->npoints && sync->anchor_offset_us < sync->window_offset_us) {
+		return sync->anchor_offset_us;
+	}
+
+	return sync->window_offset_us;
+}
+
+// Close the window in progress, and start a new one at 'sensor_us'. This
+// only happens every LIDAR_TIME_WINDOW_US, so it does the divisions.
+static void lidar_time_close_window(struct lidar_time_sync *sync, int64_t sensor_us, int64_t offset)
+{
+	if (sync->npoints == LIDAR_TIME_NUM_WINDOWS) {
+		memmove(&sync->points[0], &sync->points[1],
+		        sizeof(sync->points[0]) * (LIDAR_TIME_NUM_WINDOWS - 1));
+		sync->npoints--;
+	}
+	sync->points[sync->npoints++] = sync->window;
+
+	if (sync->npoints >= 2) {
+		const struct lidar_time_point *first = &sync->points[0];
+		const struct lidar_time_point *last = &sync->points[sync->npoints - 1];
+		const int64_t doffset = last->offset_us - first->offset_us;
+		const int64_t dsensor = last->sensor_us - first->sensor_us;
+
+		sync->drift = (doffset * ((int64_t)1 << LIDAR_TIME_DRIFT_SHIFT)) / dsensor;
+		sync->drift_ppb = (doffset * 1000000000) / dsensor;
+	}
+
+	// Re-anchor on the new window, so frames in it start from no drift
+	sync->anchor_us = sensor_us;
+	sync->anchor_offset_us = INT64_MAX;
+	for (uint32_t i = 0; i < sync->npoints; i++) {
+		const struct lidar_time_point *p = &sync->points[i];
+		const int64_t o = p->offset_us - lidar_time_drift_us(sync, p->sensor_us);
+
+		if (o < sync->anchor_offset_us) {
+			sync->anchor_offset_us = o;
+		}
+	}
+
+	sync->window_start_us = sensor_us;
+	sync->window = (struct lidar_time_point){ sensor_us, offset };
+	sync->window_offset_us = offset;
+}
+
+// Returns the unwrapped sensor time in ms
+static uint64_t lidar_time_unwrap(struct lidar_time_sync *sync, uint16_t timestamp, uint64_t rx_us)
+{
+	uint32_t delta = (timestamp + LIDAR_TIME_SENSOR_WRAP_MS - sync->last_timestamp) %
+	                 LIDAR_TIME_SENSOR_WRAP_MS;
+
+	// The sensor's timestamp can't say how many times it wrapped if we
+	// haven't heard from it for a while, but the Pico's clock can.
+	const uint64_t elapsed_ms = rx_us > sync->last_rx_us ? (rx_us - sync->last_rx_us) / 1000 : 0;
+	if (elapsed_ms > delta + LIDAR_TIME_SENSOR_WRAP_MS / 2) {
+		delta += ((elapsed_ms - delta + LIDAR_TIME_SENSOR_WRAP_MS / 2) /
+		          LIDAR_TIME_SENSOR_WRAP_MS) * LIDAR_TIME_SENSOR_WRAP_MS;
+	}
+
+	return sync->sensor_ms + delta;
+}
+
+void lidar_time_add_frame(struct lidar_time_sync *sync, uint16_t timestamp,
+                          uint64_t rx_us, struct lidar_frame_time *out)
+{
+	int64_t sensor_us, offset, drift_us;
+
+	if (sync->started) {
+		sync->sensor_ms = lidar_time_unwrap(sync, timestamp, rx_us);
+		sensor_us = sync->sensor_ms * 1000;
+		offset = (int64_t)rx_us - sensor_us;
+		drift_us = lidar_time_drift_us(sync, sensor_us);
+
+		const int64_t err = offset - (lidar_time_anchor_offset(sync) + drift_us);
+		if (err > LIDAR_TIME_RESYNC_US || err < -LIDAR_TIME_RESYNC_US) {
+			lidar_time_restart(sync);
+		}
+	}
+
+	if (!sync->started) {
+		sync->started = true;
+		sync->sensor_ms = timestamp;
+		sensor_us = sync->sensor_ms * 1000;
+		offset = (int64_t)rx_us - sensor_us;
+		drift_us = 0;
+
+		sync->window_start_us = sensor_us;
+		sync->window = (struct lidar_time_point){ sensor_us, offset };
+		sync->anchor_us = sensor_us;
+		sync->window_offset_us = offset;
+	}
+
+	sync->last_timestamp = timestamp;
+	sync->last_rx_us = rx_us;
+
+	if (sensor_us - sync->window_start_us >= LIDAR_TIME_WINDOW_US) {
+		lidar_time_close_window(sync, sensor_us, offset);
+		drift_us = 0;
+	} else if (offset < sync->window.offset_us) {
+		sync->window = (struct lidar_time_point){ sensor_us, offset };
+		sync->window_offset_us = offset - drift_us;
+	}
+
+	*out = (struct lidar_frame_time){
+		.rx_us = rx_us,
+		.time_us = sensor_us + SENSOR_ROUNDING_US - LIDAR_TIME_FRAME_LATENCY_US +
+		           lidar_time_anchor_offset(sync) + drift_us,
+		.sensor_ms = sync->sensor_ms,
+	};
+}
+
+void lidar_time_get_status(const struct lidar_time_sync *sync, struct lidar_time_status *status)
+{
+	const int64_t sensor_us = sync->sensor_ms * 1000;
+
+	*status = (struct lidar_time_status){
+		.synced = sync->npoints > 0,
+		.offset_us = sync->started ?
+			SENSOR_ROUNDING_US - LIDAR_TIME_FRAME_LATENCY_US +
+			lidar_time_anchor_offset(sync) + lidar_time_drift_us(sync, sensor_us) : 0,
+		.drift_ppb = sync->drift_ppb,
+		.resyncs = sync->resyncs,
+	};
+}
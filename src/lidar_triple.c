@@ -0,0 +1,55 @@
+// Lock-free triple-buffer handoff
+//
+// Copyright 2024 Brian Starkey <stark3y@gmail.com>
+
+#include "lidar_triple.h"
+
+// The consumer marks the buffer it's reading, and the producer never picks
+// that one (or the one which was just published) to fill next. There's no
+// atomic swap on the Cortex-M0+, so the consumer instead checks that the
+// buffer it marked is still the published one after marking it. The
+// seq_cst ordering makes sure that at least one side sees the other's store.
+
+void lidar_triple_init(struct lidar_triple *t)
+{
+	t->fill = 0;
+	t->ready = LIDAR_TRIPLE_NONE;
+	t->reading = LIDAR_TRIPLE_NONE;
+	t->acquired = LIDAR_TRIPLE_NONE;
+}
+
+uint32_t lidar_triple_publish(struct lidar_triple *t)
+{
+	const uint32_t published = t->fill;
+
+	__atomic_store_n(&t->ready, published, __ATOMIC_SEQ_CST);
+	const uint32_t reading = __atomic_load_n(&t->reading, __ATOMIC_SEQ_CST);
+
+	for (uint32_t i = 0; i < LIDAR_TRIPLE_NUM_BUFS; i++) {
+		if (i != published && i != reading) {
+			t->fill = i;
+			break;
+		}
+	}
+
+	return published;
+}
+
+uint32_t lidar_triple_acquire(struct lidar_triple *t)
+{
+	for (;;) {
+		const uint32_t ready = __atomic_load_n(&t->ready, __ATOMIC_SEQ_CST);
+		if (ready == LIDAR_TRIPLE_NONE || ready == t->acquired) {
+			return LIDAR_TRIPLE_NONE;
+		}
+
+		__atomic_store_n(&t->reading, ready, __ATOMIC_SEQ_CST);
+
+		// If it's still the published buffer, the producer must have
+		// seen our mark before choosing the next one to fill.
+		if (__atomic_load_n(&t->ready, __ATOMIC_SEQ_CST) == ready) {
+			t->acquired = ready;
+			return ready;
+		}
+	}
+}
@@ -0,0 +1,163 @@
+# Line feature viewer, for the example's CDC features mode (LIDAR_EXAMPLE_FEATURES)
+# Copyright 2024 Brian Starkey <stark3y@gmail.com>
+# SPDX-License-Identifier: BSD-3-Clause
+
+import argparse
+import pygame
+import serial
+import struct
+
+# See example/usb.h
+CDC_CMD_TEXT = b"t"
+CDC_CMD_FEATURES = b"f"
+FEATURES_SYNC = b"\x5e\xa5"
+FEATURES_HEADER = struct.Struct("<HBBHHBBH")
+# x0, y0, x1, y1
+SEGMENT = struct.Struct("<hhhh")
+# x, y, for corners and points
+POINT = struct.Struct("<hh")
+
+# No revolution has more than this many points (see lidar_scan.h)
+MAX_POINTS = 720
+
+class Features:
+    """Features holds one revolution's features, in mm"""
+
+    def __init__(self, sensor_id, timestamp, speed, segments, corners, points):
+        self.sensor_id = sensor_id
+        self.timestamp = timestamp
+        self.speed = speed
+        # [((x0, y0), (x1, y1)), ...]
+        self.segments = segments
+        # [(x, y), ...]
+        self.corners = corners
+        self.points = points
+
+class FeaturesDecoder:
+    """FeaturesDecoder turns the byte stream into Features"""
+
+    def __init__(self):
+        self.buf = bytearray()
+        self.next_seq = None
+        self.dropped = 0
+        self.skipped = 0
+        self.bytes = 0
+
+    def decode(self, data):
+        """decode returns a list of the Features which arrived"""
+        self.buf += data
+        self.bytes += len(data)
+        result = []
+
+        while True:
+            idx = self.buf.find(FEATURES_SYNC)
+            if idx < 0:
+                self.skipped += max(len(self.buf) - 1, 0)
+                del self.buf[:-1]
+                break
+
+            self.skipped += idx
+            del self.buf[:idx]
+            if len(self.buf) < FEATURES_HEADER.size:
+                break
+
+            (_, seq, sensor_id, timestamp, speed,
+             nsegments, ncorners, npoints) = FEATURES_HEADER.unpack_from(self.buf)
+            if ncorners > nsegments or npoints > MAX_POINTS:
+                # Not really a sync word
+                self.skipped += 1
+                del self.buf[:1]
+                continue
+
+            size = (FEATURES_HEADER.size + nsegments * SEGMENT.size +
+                    (ncorners + npoints) * POINT.size)
+            if len(self.buf) < size:
+                break
+
+            if self.next_seq is not None:
+                self.dropped += (seq - self.next_seq) & 0xff
+            self.next_seq = (seq + 1) & 0xff
+
+            offset = FEATURES_HEADER.size
+            segments = []
+            for _ in range(nsegments):
+                x0, y0, x1, y1 = SEGMENT.unpack_from(self.buf, offset)
+                segments.append(((x0, y0), (x1, y1)))
+                offset += SEGMENT.size
+
+            corners = [POINT.unpack_from(self.buf, offset + i * POINT.size) for i in range(ncorners)]
+            offset += ncorners * POINT.size
+            points = [POINT.unpack_from(self.buf, offset + i * POINT.size) for i in range(npoints)]
+
+            result.append(Features(sensor_id, timestamp, speed, segments, corners, points))
+            del self.buf[:size]
+
+        return result
+
+def parse_args():
+    parser = argparse.ArgumentParser(prog="usb_features", description="Line feature viewer")
+    parser.add_argument("--port", "-p", help="Serial port for the Pico", required=True)
+    parser.add_argument("--sensor", "-s", help="Which sensor's features to show", type=int, default=0)
+    parser.add_argument("--range", "-r", help="Range to show, in mm", type=int, default=6000)
+    parser.add_argument("--size", "-x", help="Window size, in pixels", type=int, default=800)
+
+    return parser.parse_args()
+
+def main():
+    args = parse_args()
+
+    port = serial.Serial(args.port)
+    port.write(CDC_CMD_FEATURES)
+    decoder = FeaturesDecoder()
+
+    pygame.init()
+    screen = pygame.display.set_mode((args.size, args.size))
+    pygame.display.set_caption("Line features")
+    clock = pygame.time.Clock()
+    scale = args.size / (2 * args.range)
+
+    def to_screen(p):
+        # The sensor is in the middle, with y up
+        return (args.size / 2 + p[0] * scale, args.size / 2 - p[1] * scale)
+
+    revolutions = 0
+    running = True
+    while running:
+        for event in pygame.event.get():
+            if event.type == pygame.QUIT:
+                running = False
+            if event.type == pygame.KEYDOWN:
+                if chr(event.key) == 'q':
+                    running = False
+
+        latest = [f for f in decoder.decode(port.read(port.in_waiting or 1))
+                  if f.sensor_id == args.sensor]
+        if not latest:
+            continue
+
+        features = latest[-1]
+        revolutions += len(latest)
+
+        screen.fill((255, 255, 255))
+        for p in features.points:
+            pygame.draw.circle(screen, (160, 160, 160), to_screen(p), 2)
+        for a, b in features.segments:
+            pygame.draw.line(screen, (0, 0, 0), to_screen(a), to_screen(b), 2)
+        for c in features.corners:
+            pygame.draw.circle(screen, (200, 0, 0), to_screen(c), 4)
+        pygame.draw.circle(screen, (0, 0, 200), to_screen((0, 0)), 4)
+        pygame.display.flip()
+
+        pygame.display.set_caption(
+            f"Line features: {len(features.segments)} segments, "
+            f"{len(features.corners)} corners, {len(features.points)} points, "
+            f"{decoder.bytes / max(revolutions, 1):.0f} bytes/revolution, "
+            f"{decoder.dropped} dropped")
+
+        clock.tick(10)
+
+    port.write(CDC_CMD_TEXT)
+    pygame.quit()
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,146 @@
+# Occupancy grid viewer, for the example's CDC grid mode (LIDAR_EXAMPLE_GRID)
+# Copyright 2024 Brian Starkey <stark3y@gmail.com>
+# SPDX-License-Identifier: BSD-3-Clause
+
+import argparse
+import pygame
+import serial
+import struct
+
+# See example/usb.h
+CDC_CMD_TEXT = b"t"
+CDC_CMD_GRID = b"g"
+GRID_SYNC = b"\x5d\xa5"
+GRID_HEADER = struct.Struct("<HBBHBBBBB")
+
+class GridDecoder:
+    """GridDecoder turns a stream of grid tile packets into whole grids
+
+    Each sensor's grid is kept as a bytearray of signed log-odds, row by row,
+    and updated as tiles arrive.
+    """
+
+    def __init__(self):
+        self.buf = bytearray()
+        self.next_seq = None
+        self.dropped = 0
+        self.skipped = 0
+        # sensor_id: (width, height, cell_mm, cells)
+        self.grids = {}
+
+    def decode(self, data):
+        """decode returns the number of tiles which arrived"""
+        self.buf += data
+        ntiles = 0
+
+        while True:
+            idx = self.buf.find(GRID_SYNC)
+            if idx < 0:
+                self.skipped += max(len(self.buf) - 1, 0)
+                del self.buf[:-1]
+                break
+
+            self.skipped += idx
+            del self.buf[:idx]
+            if len(self.buf) < GRID_HEADER.size:
+                break
+
+            (_, seq, sensor_id, cell_mm, tile_dim,
+             tiles_w, tiles_h, tile_x, tile_y) = GRID_HEADER.unpack_from(self.buf)
+            if (tile_dim == 0 or cell_mm == 0 or
+                tile_x >= tiles_w or tile_y >= tiles_h):
+                # Not really a sync word
+                self.skipped += 1
+                del self.buf[:1]
+                continue
+
+            size = GRID_HEADER.size + tile_dim * tile_dim
+            if len(self.buf) < size:
+                break
+
+            if self.next_seq is not None:
+                self.dropped += (seq - self.next_seq) & 0xff
+            self.next_seq = (seq + 1) & 0xff
+
+            width = tiles_w * tile_dim
+            height = tiles_h * tile_dim
+            grid = self.grids.get(sensor_id)
+            if grid is None or grid[:3] != (width, height, cell_mm):
+                grid = (width, height, cell_mm, bytearray(width * height))
+                self.grids[sensor_id] = grid
+
+            cells = grid[3]
+            for y in range(tile_dim):
+                src = GRID_HEADER.size + y * tile_dim
+                dst = (tile_y * tile_dim + y) * width + tile_x * tile_dim
+                cells[dst:dst + tile_dim] = self.buf[src:src + tile_dim]
+
+            del self.buf[:size]
+            ntiles += 1
+
+        return ntiles
+
+def grid_surface(width, height, cells):
+    """grid_surface draws a grid: occupied black, free white, unknown grey"""
+
+    surface = pygame.Surface((width, height))
+    for y in range(height):
+        for x in range(width):
+            v = cells[y * width + x]
+            v = v - 256 if v > 127 else v
+            shade = max(0, min(255, 128 - v * 2))
+            surface.set_at((x, y), (shade, shade, shade))
+
+    return surface
+
+def parse_args():
+    parser = argparse.ArgumentParser(prog="usb_grid", description="Occupancy grid viewer")
+    parser.add_argument("--port", "-p", help="Serial port for the Pico", required=True)
+    parser.add_argument("--sensor", "-s", help="Which sensor's grid to show", type=int, default=0)
+    parser.add_argument("--scale", "-x", help="Pixels per cell", type=int, default=4)
+
+    return parser.parse_args()
+
+def main():
+    args = parse_args()
+
+    port = serial.Serial(args.port)
+    port.write(CDC_CMD_GRID)
+    decoder = GridDecoder()
+
+    pygame.init()
+    screen = None
+    clock = pygame.time.Clock()
+
+    running = True
+    while running:
+        for event in pygame.event.get():
+            if event.type == pygame.QUIT:
+                running = False
+            if event.type == pygame.KEYDOWN:
+                if chr(event.key) == 'q':
+                    running = False
+
+        if not decoder.decode(port.read(port.in_waiting or 1)):
+            continue
+
+        grid = decoder.grids.get(args.sensor)
+        if grid is None:
+            continue
+
+        width, height, cell_mm, cells = grid
+        if screen is None:
+            screen = pygame.display.set_mode((width * args.scale, height * args.scale))
+            pygame.display.set_caption(f"Occupancy grid, {cell_mm} mm cells")
+
+        surface = grid_surface(width, height, cells)
+        screen.blit(pygame.transform.scale(surface, screen.get_size()), (0, 0))
+        pygame.display.flip()
+
+        clock.tick(10)
+
+    port.write(CDC_CMD_TEXT)
+    pygame.quit()
+
+if __name__ == "__main__":
+    main()
@@ -1,7 +1,14 @@
+import struct
 import time
 import usb.core
 import usb.util
 
+# See example/usb.h
+RAW_XFER_HEADER = struct.Struct("<IIHHH")
+FRAME_SIZE = 47
+# Always a whole number of packets, so a transfer is never split across reads
+RAW_XFER_READ_SIZE = 1024
+
 dev = usb.core.find(idVendor=0x1209, idProduct=0x0001)
 if dev is None:
     raise ValueError('device not found')
@@ -23,8 +30,46 @@ ep_in = usb.util.find_descriptor(intf,
 
 assert (ep_in is not None)
 
-try:
+def read_interrupt():
+    while True:
+        print(ep_in.read(FRAME_SIZE))
+
+def read_bulk():
+    next_seq = None
+    missed_xfers = 0
+    frames = [0, 0]
+    xfers = 0
+    dropped = 0
+    last_print = time.monotonic()
+
     while True:
-        print(ep_in.read(57))
+        data = ep_in.read(RAW_XFER_READ_SIZE)
+
+        seq, dropped, nframes, frame_size, sensor_ids = RAW_XFER_HEADER.unpack_from(data)
+        assert frame_size == FRAME_SIZE
+        assert len(data) >= RAW_XFER_HEADER.size + nframes * frame_size
+
+        # Transfers we never saw, e.g. because a read timed out
+        if next_seq is not None and seq != next_seq:
+            missed_xfers += (seq - next_seq) & 0xffffffff
+        next_seq = (seq + 1) & 0xffffffff
+
+        for i in range(nframes):
+            frames[(sensor_ids >> i) & 1] += 1
+        xfers += 1
+
+        now = time.monotonic()
+        if now - last_print >= 1:
+            print(f"{frames[0]} + {frames[1]} frames in {xfers} transfers, "
+                  f"{dropped} dropped by device, {missed_xfers} transfers missed")
+            frames = [0, 0]
+            xfers = 0
+            last_print = now
+
+try:
+    if usb.util.endpoint_type(ep_in.bmAttributes) == usb.util.ENDPOINT_TYPE_BULK:
+        read_bulk()
+    else:
+        read_interrupt()
 finally:
     usb.util.dispose_resources(dev)
@@ -0,0 +1,77 @@
+# Set and monitor the scan rate of the sensors on the example firmware
+# Copyright 2024 Brian Starkey <stark3y@gmail.com>
+# SPDX-License-Identifier: BSD-3-Clause
+
+import argparse
+import struct
+import time
+import usb.core
+import usb.util
+
+# See example/usb.h
+LIDAR_REQ_SET_SCAN_RATE = 0x03
+LIDAR_REQ_GET_SCAN_RATE = 0x04
+
+USB_SCAN_RATE = struct.Struct("<IIIHB")
+USB_SCAN_RATE_FIELDS = [
+    "target_centi_hz", "measured_centi_hz", "settle_time_us", "duty", "locked",
+]
+
+def get_scan_rate(dev, intf, sensor):
+    req_type = usb.util.build_request_type(usb.util.CTRL_IN,
+            usb.util.CTRL_TYPE_VENDOR, usb.util.CTRL_RECIPIENT_INTERFACE)
+    data = dev.ctrl_transfer(req_type, LIDAR_REQ_GET_SCAN_RATE, sensor,
+            intf.bInterfaceNumber, USB_SCAN_RATE.size)
+
+    return dict(zip(USB_SCAN_RATE_FIELDS, USB_SCAN_RATE.unpack(bytes(data))))
+
+def set_scan_rate(dev, intf, sensor, centi_hz):
+    req_type = usb.util.build_request_type(usb.util.CTRL_OUT,
+            usb.util.CTRL_TYPE_VENDOR, usb.util.CTRL_RECIPIENT_INTERFACE)
+    dev.ctrl_transfer(req_type, LIDAR_REQ_SET_SCAN_RATE, sensor,
+            intf.bInterfaceNumber, struct.pack("<I", centi_hz))
+
+def print_scan_rate(status):
+    target = status["target_centi_hz"]
+    settle = status["settle_time_us"]
+
+    print(f"measured {status['measured_centi_hz'] / 100:.2f} Hz, "
+          f"target {target / 100:.2f} Hz, " if target else "target off, ", end="")
+    print(f"duty {status['duty'] / 10:.1f}%, "
+          f"{'locked' if status['locked'] else 'unlocked'}", end="")
+    print(f", settled in {settle / 1e6:.2f} s" if settle else "")
+
+def parse_args():
+    parser = argparse.ArgumentParser(prog="usb_scan_rate", description="Lidar scan rate control")
+    parser.add_argument("--set", "-r", help="Target scan rate in Hz (0 to stop adjusting)", type=float)
+    parser.add_argument("--sensor", "-s", help="Sensor ID", type=int, default=0)
+    parser.add_argument("--interval", "-i", help="Keep reading every N seconds", type=float)
+
+    return parser.parse_args()
+
+def main():
+    args = parse_args()
+
+    dev = usb.core.find(idVendor=0x1209, idProduct=0x0001)
+    if dev is None:
+        raise ValueError('device not found')
+
+    cfg = dev.get_active_configuration()
+    intf = usb.util.find_descriptor(cfg, bInterfaceClass=0xff)
+
+    try:
+        if args.set is not None:
+            set_scan_rate(dev, intf, args.sensor, round(args.set * 100))
+
+        while True:
+            print_scan_rate(get_scan_rate(dev, intf, args.sensor))
+
+            if not args.interval:
+                break
+
+            time.sleep(args.interval)
+    finally:
+        usb.util.dispose_resources(dev)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,92 @@
+# Read (and optionally reset) the driver statistics from the example firmware
+# Copyright 2024 Brian Starkey <stark3y@gmail.com>
+# SPDX-License-Identifier: BSD-3-Clause
+
+import argparse
+import struct
+import time
+import usb.core
+import usb.util
+
+# See example/usb.h
+LIDAR_REQ_GET_STATS = 0x01
+LIDAR_REQ_RESET_STATS = 0x02
+
+USB_STATS = struct.Struct("<I" "7I" "3IQ" "3IQ" "2I")
+USB_STATS_FIELDS = [
+    "sys_clk_hz",
+    "bytes_rx", "frames", "crc_errors", "bytes_skipped",
+    "requests", "short_requests", "frames_dropped",
+    "irq_count", "irq_min", "irq_max", "irq_total",
+    "frame_cb_count", "frame_cb_min", "frame_cb_max", "frame_cb_total",
+    "raw_dropped", "cdc_dropped",
+]
+
+def get_stats(dev, intf, sensor):
+    req_type = usb.util.build_request_type(usb.util.CTRL_IN,
+            usb.util.CTRL_TYPE_VENDOR, usb.util.CTRL_RECIPIENT_INTERFACE)
+    data = dev.ctrl_transfer(req_type, LIDAR_REQ_GET_STATS, sensor,
+            intf.bInterfaceNumber, USB_STATS.size)
+
+    return dict(zip(USB_STATS_FIELDS, USB_STATS.unpack(bytes(data))))
+
+def reset_stats(dev, intf, sensor):
+    req_type = usb.util.build_request_type(usb.util.CTRL_OUT,
+            usb.util.CTRL_TYPE_VENDOR, usb.util.CTRL_RECIPIENT_INTERFACE)
+    dev.ctrl_transfer(req_type, LIDAR_REQ_RESET_STATS, sensor, intf.bInterfaceNumber)
+
+def print_timing(stats, name):
+    count = stats[f"{name}_count"]
+    if not count:
+        print(f"{name}: none")
+        return
+
+    us = 1e6 / stats["sys_clk_hz"]
+    avg = stats[f"{name}_total"] / count
+    print(f"{name}: {count} calls, "
+          f"min {stats[f'{name}_min'] * us:.1f} us, "
+          f"avg {avg * us:.1f} us, "
+          f"max {stats[f'{name}_max'] * us:.1f} us")
+
+def print_stats(stats):
+    for field in USB_STATS_FIELDS[1:8]:
+        print(f"{field}: {stats[field]}")
+    print_timing(stats, "irq")
+    print_timing(stats, "frame_cb")
+    for field in USB_STATS_FIELDS[16:]:
+        print(f"{field}: {stats[field]}")
+
+def parse_args():
+    parser = argparse.ArgumentParser(prog="usb_stats", description="Lidar driver statistics")
+    parser.add_argument("--reset", "-r", help="Reset the statistics after reading them", action="store_true")
+    parser.add_argument("--sensor", "-s", help="Sensor ID", type=int, default=0)
+    parser.add_argument("--interval", "-i", help="Keep reading every N seconds", type=float)
+
+    return parser.parse_args()
+
+def main():
+    args = parse_args()
+
+    dev = usb.core.find(idVendor=0x1209, idProduct=0x0001)
+    if dev is None:
+        raise ValueError('device not found')
+
+    cfg = dev.get_active_configuration()
+    intf = usb.util.find_descriptor(cfg, bInterfaceClass=0xff)
+
+    try:
+        while True:
+            print_stats(get_stats(dev, intf, args.sensor))
+            if args.reset:
+                reset_stats(dev, intf, args.sensor)
+
+            if not args.interval:
+                break
+
+            print()
+            time.sleep(args.interval)
+    finally:
+        usb.util.dispose_resources(dev)
+
+if __name__ == "__main__":
+    main()
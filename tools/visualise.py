@@ -6,6 +6,7 @@ import argparse
 import math
 import pygame
 import serial
+import struct
 
 from collections import deque
 
@@ -34,6 +35,167 @@ def read_points(port, point_queue, max_points=250):
 
         max_points -= 1
 
+# Binary CDC packets, see example/usb.h
+CDC_CMD_TEXT = b"t"
+CDC_CMD_BINARY = b"b"
+CDC_CMD_FILTERED = b"F"
+CDC_CMD_BINS = b"r"
+PACKET_SYNC = b"\x5a\xa5"
+PACKET_HEADER = struct.Struct("<HBBBHH")
+SAMPLE = struct.Struct("<HB")
+SAMPLES_PER_PACKET = 12
+PACKET_SIZE = PACKET_HEADER.size + SAMPLE.size * SAMPLES_PER_PACKET
+
+class PacketDecoder:
+    """PacketDecoder turns a stream of binary CDC packets into samples
+
+    It resynchronises on the sync word, and counts the packets which were
+    dropped (gaps in the sequence number) and the bytes which were skipped.
+    """
+
+    def __init__(self):
+        self.buf = bytearray()
+        self.next_seq = None
+        self.dropped = 0
+        self.skipped = 0
+
+    def decode(self, data):
+        """decode returns a list of (sensor_id, angle, distance_mm, intensity)
+
+        Angles are in degrees.
+        """
+        self.buf += data
+        samples = []
+
+        while True:
+            idx = self.buf.find(PACKET_SYNC)
+            if idx < 0:
+                # Keep the last byte, it might be half a sync word
+                self.skipped += max(len(self.buf) - 1, 0)
+                del self.buf[:-1]
+                break
+
+            self.skipped += idx
+            del self.buf[:idx]
+            if len(self.buf) < PACKET_SIZE:
+                break
+
+            _, seq, count, sensor_id, start, end = PACKET_HEADER.unpack_from(self.buf)
+            if count != SAMPLES_PER_PACKET or start >= 36000 or end >= 36000:
+                # Not really a sync word
+                self.skipped += 1
+                del self.buf[:1]
+                continue
+
+            if self.next_seq is not None:
+                self.dropped += (seq - self.next_seq) & 0xff
+            self.next_seq = (seq + 1) & 0xff
+
+            if end < start:
+                end += 36000
+            step = (end - start) / (count - 1)
+
+            for i in range(count):
+                distance, intensity = SAMPLE.unpack_from(self.buf, PACKET_HEADER.size + i * SAMPLE.size)
+                angle = ((start + step * i) % 36000) / 100
+                samples.append((sensor_id, angle, distance, intensity))
+
+            del self.buf[:PACKET_SIZE]
+
+        return samples
+
+# Binned CDC packets (one per revolution), see example/usb.h
+BINS_SYNC = b"\x5b\xa5"
+BINS_HEADER = struct.Struct("<HBBBHHH")
+BINS_MODES = ["min", "median", "mean"]
+
+class BinsDecoder:
+    """BinsDecoder turns a stream of binned CDC packets into revolutions"""
+
+    def __init__(self):
+        self.buf = bytearray()
+        self.next_seq = None
+        self.dropped = 0
+        self.skipped = 0
+
+    def decode(self, data):
+        """decode returns a list of (sensor_id, bin_width, distances)
+
+        bin_width is in degrees, and distances (mm) has one entry per bin,
+        0 where there was no return.
+        """
+        self.buf += data
+        revolutions = []
+
+        while True:
+            idx = self.buf.find(BINS_SYNC)
+            if idx < 0:
+                self.skipped += max(len(self.buf) - 1, 0)
+                del self.buf[:-1]
+                break
+
+            self.skipped += idx
+            del self.buf[:idx]
+            if len(self.buf) < BINS_HEADER.size:
+                break
+
+            _, seq, sensor_id, mode, bin_width, nbins, _ = BINS_HEADER.unpack_from(self.buf)
+            if (mode >= len(BINS_MODES) or bin_width == 0 or
+                nbins != (36000 + bin_width - 1) // bin_width):
+                self.skipped += 1
+                del self.buf[:1]
+                continue
+
+            size = BINS_HEADER.size + 2 * nbins
+            if len(self.buf) < size:
+                break
+
+            if self.next_seq is not None:
+                self.dropped += (seq - self.next_seq) & 0xff
+            self.next_seq = (seq + 1) & 0xff
+
+            distances = struct.unpack_from(f"<{nbins}H", self.buf, BINS_HEADER.size)
+            revolutions.append((sensor_id, bin_width / 100, distances))
+
+            del self.buf[:size]
+
+        return revolutions
+
+def read_points_bins(port, decoder, point_queue):
+    """read_points_bins is read_points, for one revolution of binned data
+
+    Each bin is drawn at its centre angle.
+    """
+
+    while True:
+        revolutions = decoder.decode(port.read(port.in_waiting or 1))
+        for _, bin_width, distances in revolutions:
+            for i, distance in enumerate(distances):
+                if not distance:
+                    continue
+
+                rads = math.radians((i + 0.5) * bin_width - 90)
+                point_queue.appendleft((
+                    distance * math.cos(rads),
+                    distance * math.sin(rads),
+                ))
+
+        if revolutions:
+            return
+
+def read_points_binary(port, decoder, point_queue, max_points=250):
+    """read_points_binary is read_points, for the binary packet format"""
+
+    while max_points > 0:
+        for _, angle, distance, _ in decoder.decode(port.read(PACKET_SIZE)):
+            rads = math.radians(angle - 90)
+            point_queue.appendleft((
+                distance * math.cos(rads),
+                distance * math.sin(rads),
+            ))
+
+            max_points -= 1
+
 def get_max_xy(point_queue):
     return abs(max(max(point_queue, key=lambda t: abs(max(t, key=abs))), key=abs))
 
@@ -58,6 +220,9 @@ def parse_args():
     parser = argparse.ArgumentParser(prog="visualise", description="Simple Lidar visualisation")
     parser.add_argument("--port", "-p", help="Serial port for Lidar")
     parser.add_argument("--npoints", "-n", help="Number of points of history", type=int, default=1000)
+    parser.add_argument("--binary", "-b", help="Use the binary packet format", action="store_true")
+    parser.add_argument("--filtered", "-F", help="Use the binary packet format, with the frames filtered", action="store_true")
+    parser.add_argument("--bins", "-r", help="Use the binned format, one packet per revolution", action="store_true")
 
     return parser.parse_args()
 
@@ -65,6 +230,16 @@ def main():
     args = parse_args()
 
     port = serial.Serial(args.port)
+    if args.bins:
+        port.write(CDC_CMD_BINS)
+        decoder = BinsDecoder()
+    else:
+        if args.filtered:
+            port.write(CDC_CMD_FILTERED)
+        else:
+            port.write(CDC_CMD_BINARY if args.binary else CDC_CMD_TEXT)
+        decoder = PacketDecoder()
+
     point_queue = deque([], maxlen=args.npoints)
 
     pygame.init()
@@ -91,7 +266,12 @@ def main():
                     running = False
 
         # Get points from sensor
-        read_points(port, point_queue)
+        if args.bins:
+            read_points_bins(port, decoder, point_queue)
+        elif args.binary or args.filtered:
+            read_points_binary(port, decoder, point_queue)
+        else:
+            read_points(port, point_queue)
 
         max_xy = get_max_xy(point_queue)
 